@@ -237,6 +237,14 @@ typedef enum _CControlType {
  */
 typedef enum _CEventId {
 	CE_CONTROL_INVALID		= 0,
+	/// The value of a control changed
+	CE_CONTROL_VALUE_CHANGED,
+	/// The range, default value, or flags of a control changed
+	CE_CONTROL_INFO_CHANGED,
+	/// A video device was connected (subscribe with a handle of 0)
+	CE_DEVICE_ADDED,
+	/// A video device was disconnected (subscribe with a handle of 0)
+	CE_DEVICE_REMOVED,
 
 } CEventId;
 
@@ -288,6 +296,8 @@ typedef enum _CDynctrlFlags {
 	CD_REPORT_ERRORS		= 1 << 1,
 	/// Return meta data during the XML parsing process
 	CD_RETRIEVE_META_INFO	= 1 << 2,
+	/// Return the names of the files that the messages concern in CDynctrlInfo.message_files
+	CD_REPORT_FILE_NAMES	= 1 << 3,
 
 } CDynctrlFlags;
 
@@ -303,6 +313,42 @@ typedef enum _CDynctrlMessageSeverity {
 } CDynctrlMessageSeverity;
 
 
+/**
+ * Types of device requests that are counted in the device statistics.
+ */
+typedef enum _CRequestType {
+	CR_QUERYCAP				= 0,	///< VIDIOC_QUERYCAP
+	CR_QUERYCTRL,					///< VIDIOC_QUERYCTRL
+	CR_QUERYMENU,					///< VIDIOC_QUERYMENU
+	CR_G_CTRL,						///< VIDIOC_G_CTRL
+	CR_S_CTRL,						///< VIDIOC_S_CTRL
+	CR_G_EXT_CTRLS,					///< VIDIOC_G_EXT_CTRLS
+	CR_S_EXT_CTRLS,					///< VIDIOC_S_EXT_CTRLS
+	CR_ENUM_FMT,					///< VIDIOC_ENUM_FMT
+	CR_ENUM_FRAMESIZES,				///< VIDIOC_ENUM_FRAMESIZES
+	CR_ENUM_FRAMEINTERVALS,			///< VIDIOC_ENUM_FRAMEINTERVALS
+	CR_SUBSCRIBE_EVENT,				///< VIDIOC_SUBSCRIBE_EVENT
+	CR_UNSUBSCRIBE_EVENT,			///< VIDIOC_UNSUBSCRIBE_EVENT
+	CR_DQEVENT,						///< VIDIOC_DQEVENT
+	CR_CTRL_MAP,					///< UVCIOC_CTRL_MAP
+	CR_OTHER,						///< Any other request
+	CR_COUNT,						///< Number of request types
+
+} CRequestType;
+
+
+/**
+ * Severity levels of the messages that libwebcam logs.
+ */
+typedef enum _CLogLevel {
+	CL_ERROR				= 2,		///< Error
+	CL_WARNING				= 3,		///< Warning
+	CL_INFO					= 4,		///< Informational
+	CL_DEBUG				= 5,		///< Debugging
+
+} CLogLevel;
+
+
 
 /*
  * Structs
@@ -571,6 +617,22 @@ typedef struct _CEvent {
 } CEvent;
 
 
+/**
+ * Details of an event that are passed to the event handler.
+ */
+typedef struct _CEventData {
+	/// Short name of the device that the event concerns (e.g. 'video0')
+	const char		* device_name;
+
+	/// Control that changed. 0 for device events.
+	CControlId		control_id;
+
+	/// New value of the control. Only valid for #CE_CONTROL_VALUE_CHANGED.
+	CControlValue	value;
+
+} CEventData;
+
+
 /**
  * Message returned by the dynamic control configuration parser.
  */
@@ -661,18 +723,158 @@ typedef struct _CDynctrlInfo {
 	/// Pointer to the array with the messages concerning the operation
 	CDynctrlMessage	* messages;
 
+	/// Pointer to an array with @a message_count entries that contains the name of the
+	/// file that each message concerns, or NULL if a message does not concern a particular
+	/// file. The field is only set if #CD_REPORT_FILE_NAMES is given, so that callers built
+	/// before it was added are not affected. The array is part of the @a messages buffer
+	/// and must not be freed separately.
+	char			** message_files;
+
 } CDynctrlInfo;
 
 
+/// Number of buckets in the latency histogram of a request type
+#define C_STATS_LATENCY_BUCKETS		20
+/// Number of error codes that are counted separately
+#define C_STATS_ERROR_CODES			128
+
+/**
+ * Statistics on the requests of one type sent to a device.
+ */
+typedef struct _CRequestStats {
+	/// Number of requests
+	unsigned int		count;
+
+	/// Number of requests that failed
+	unsigned int		errors;
+
+	/// Total time spent in the requests in nanoseconds
+	unsigned long long	total_time;
+
+	/// Duration of the longest request in nanoseconds
+	unsigned long long	max_time;
+
+	/// Latency histogram. Element 0 counts the requests that took less than 1 µs,
+	/// element i > 0 the ones that took at least 2^(i-1) µs but less than 2^i µs.
+	/// The last element also counts all longer requests.
+	unsigned int		latency[C_STATS_LATENCY_BUCKETS];
+
+	/// Number of failed requests by error code (errno). The last element also counts
+	/// all larger error codes.
+	unsigned int		error_codes[C_STATS_ERROR_CODES];
+
+} CRequestStats;
+
+
+/**
+ * Statistics on the requests sent to a device since the library was loaded.
+ */
+typedef struct _CDeviceStats {
+	/// Number of control queries that were retried after an I/O error
+	unsigned int	retries;
+
+	/// Statistics for each request type, indexed by #CRequestType
+	CRequestStats	requests[CR_COUNT];
+
+} CDeviceStats;
+
+
+/**
+ * A message logged by libwebcam.
+ */
+typedef struct _CLogMessage {
+	/// Severity level
+	CLogLevel			level;
+
+	/// Time at which the message was logged in nanoseconds since the epoch
+	unsigned long long	timestamp;
+
+	/// Short name of the device that the message concerns (e.g. 'video0') or NULL
+	const char			* device;
+
+	/// Message text. It has no trailing newline but may consist of several lines.
+	const char			* text;
+
+	/// Number of similar messages that were suppressed since the last one was logged
+	unsigned int		suppressed;
+
+} CLogMessage;
+
+
+/// Number of recent requests that are kept in the trace of a device
+#define C_TRACE_ENTRIES				256
+
+/**
+ * A request in the trace of recent requests sent to a device.
+ */
+typedef struct _CTraceEntry {
+	/// Sequence number of the request. The numbers of consecutive requests to the
+	/// same device are consecutive.
+	unsigned int		sequence;
+
+	/// Type of the request
+	CRequestType		type;
+
+	/// ioctl request code
+	unsigned int		request;
+
+	/// V4L2 control ID the request refers to (0 if none)
+	unsigned int		control_id;
+
+	/// Control value after the request, the menu index for #CR_QUERYMENU requests
+	int					value;
+
+	/// 0 if the request succeeded, its error code (errno) otherwise
+	int					error;
+
+	/// Time at which the request was sent in nanoseconds (CLOCK_MONOTONIC)
+	unsigned long long	timestamp;
+
+	/// Duration of the request in nanoseconds
+	unsigned long long	duration;
+
+} CTraceEntry;
+
+
+/**
+ * Cache of parsed dynamic controls configurations.
+ *
+ * The cache is bound to a configuration directory and keeps one parsed configuration per
+ * USB vendor and product ID, so that devices can be configured without parsing the
+ * files again. The structure is opaque to applications.
+ */
+typedef struct _CDynctrlCache CDynctrlCache;
+
+
 
 /*
  * Type definitions
  */
 
 /**
- * Prototype for event handlers
+ * Prototype for event handlers.
+ *
+ * The handler is called on the event thread of the library, so it should return quickly.
+ * The event data is only valid during the call. For device events, @a hDevice is 0.
+ */
+typedef void (*CEventHandler)(CHandle hDevice, CEventId event_id, const CEventData *data,
+		void *context);
+
+/**
+ * Prototype for functions that receive control value changes from #c_watch_controls.
+ *
+ * @return 0 to continue watching or any other value to stop
  */
-typedef void (*CEventHandler)(CHandle hDevice, CEventId event_id, void *context);
+typedef int (*CControlChangeHandler)(CHandle hDevice, CControlId control_id,
+		const CControlValue *value, void *context);
+
+/**
+ * Prototype for functions that receive the messages logged by libwebcam.
+ *
+ * The function is called in the thread that logs the message, so it should return
+ * quickly. The message is only valid during the call.
+ */
+typedef void (*CLogHandler)(const CLogMessage *message, void *context);
 
 
 
@@ -687,11 +889,16 @@ extern "C" {
 extern CResult		c_init (void);
 extern void			c_cleanup (void);
 
+extern void			c_set_log_handler (CLogHandler handler, void *context);
+extern void			c_set_log_level (CLogLevel level);
+
 extern CHandle		c_open_device (const char *device_name);
 extern void			c_close_device (CHandle hDevice);
 
 extern CResult		c_enum_devices (CDevice *devices, unsigned int *size, unsigned int *count);
 extern CResult		c_get_device_info (CHandle hDevice, const char *device_name, CDevice *info, unsigned int *size);
+extern CResult		c_get_device_stats (const char *device_name, CDeviceStats *stats);
+extern CResult		c_get_device_trace (const char *device_name, CTraceEntry *entries, unsigned int *size, unsigned int *count);
 
 extern CResult		c_enum_pixel_formats (CHandle hDevice, CPixelFormat *formats, unsigned int *size, unsigned int *count);
 extern CResult		c_enum_frame_sizes (CHandle hDevice, const CPixelFormat *pixelformat, CFrameSize *sizes, unsigned int *size, unsigned int *count);
@@ -701,12 +908,27 @@ extern CResult		c_enum_controls (CHandle hDevice, CControl *controls, unsigned i
 extern CResult		c_set_control (CHandle hDevice, CControlId control_id, const CControlValue *value);
 extern CResult		c_get_control (CHandle hDevice, CControlId control_id, CControlValue *value);
 
+extern CResult		c_save_profile (CHandle hDevice, const char *file_name);
+extern CResult		c_load_profile (CHandle hDevice, const char *file_name);
+extern CResult		c_watch_controls (CHandle hDevice, const CControlId *control_ids, unsigned int count,
+								CControlChangeHandler handler, void *context);
+
 extern CResult		c_enum_events (CHandle hDevice, CEvent *events, unsigned int *size, unsigned int *count);
 extern CResult		c_subscribe_event (CHandle hDevice, CEventId event_id, CEventHandler handler, void *context);
 extern CResult		c_unsubscribe_event (CHandle hDevice, CEventId event_id);
+extern CResult		c_get_event_fd (int *fd);
+extern CResult		c_dispatch_events (void);
 
 #ifndef DISABLE_UVCVIDEO_DYNCTRL
 extern CResult		c_add_control_mappings_from_file (const char *file_name, CDynctrlInfo *info);
+extern CResult		c_add_control_mappings_to_device (const char *device_name, const char *file_name,
+						CDynctrlInfo *info);
+extern CResult		c_add_control_mappings_from_dir (const char *device_name, const char *dir_name,
+						CDynctrlInfo *info);
+extern CResult		c_create_dynctrl_cache (const char *dir_name, CDynctrlCache **cache);
+extern CResult		c_add_control_mappings_from_cache (CDynctrlCache *cache, const char *device_name,
+						CDynctrlInfo *info);
+extern void			c_destroy_dynctrl_cache (CDynctrlCache *cache);
 #endif
 
 extern char			*c_get_error_text (CResult error);
@@ -0,0 +1,637 @@
+/*
+ * Benchmark program for libwebcam.
+ *
+ *
+ * Copyright (c) 2006-2007 Logitech.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the hot paths of libwebcam against simulated devices, so that the results do
+ * not depend on the cameras and drivers of the machine. The program writes a fake device
+ * script and two synthetic dynamic controls files to a temporary directory and points
+ * LIBWEBCAM_FAKE to the script. Usage:
+ *
+ *   webcam-bench [-n devices] [-i iterations]
+ *
+ * For each operation it prints the latency distribution and the number of heap
+ * allocations as tab-separated values:
+ *
+ *   # operation	samples	errors	p50_us	p99_us	max_us	allocs	bytes
+ *   init	100	0	412.3	530.1	611.8	1203.0	98304.0
+ *
+ * The allocs and bytes columns are averages per operation. They are counted by replacing
+ * malloc(), calloc(), and realloc() in this program, which also catches the allocations
+ * made by libwebcam and libxml2.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include <webcam.h>
+
+
+/// Default number of simulated devices
+#define DEFAULT_DEVICE_COUNT		4
+/// Default number of times each operation is run
+#define DEFAULT_ITERATIONS			100
+
+/// Number of controls in the large dynamic controls file
+#define LARGE_XML_CONTROLS			2000
+/// Number of mappings in the large dynamic controls file. The fake backend supports
+/// a limited number of controls per device, so most controls are not mapped.
+#define LARGE_XML_MAPPINGS			32
+/// V4L2 ID of the first control mapped by the dynamic controls files
+#define XML_MAPPING_BASE_ID			0x0A046D00
+
+
+/*
+ * Allocation counting
+ */
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t count, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+/// Number of allocations since the program started
+static unsigned long alloc_count;
+/// Number of bytes allocated since the program started
+static unsigned long alloc_bytes;
+
+static void count_allocation (size_t size)
+{
+	__sync_fetch_and_add(&alloc_count, 1);
+	__sync_fetch_and_add(&alloc_bytes, size);
+}
+
+void *malloc (size_t size)
+{
+	count_allocation(size);
+	return __libc_malloc(size);
+}
+
+void *calloc (size_t count, size_t size)
+{
+	count_allocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+	count_allocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+
+
+/*
+ * Measurements
+ */
+
+/**
+ * Latency samples and allocations of a single operation.
+ */
+typedef struct _BenchResult {
+	/// Durations of the successful operations in microseconds
+	double				* samples;
+	/// Number of elements in @a samples
+	unsigned int		count;
+	/// Number of failed operations
+	unsigned int		errors;
+	/// Number of allocations made by all operations
+	unsigned long		allocs;
+	/// Number of bytes allocated by all operations
+	unsigned long		bytes;
+
+} BenchResult;
+
+/// An operation to measure. Returns C_SUCCESS if the operation succeeded.
+typedef CResult (*BenchOperation) (void);
+
+/// Handle of the device the per-device operations run on
+static CHandle handle;
+/// First pixel format of the device
+static CPixelFormat pixel_format;
+/// First frame size of the first pixel format
+static CFrameSize frame_size;
+/// Temporary directory that contains the generated files. Leaves room for the file names.
+static char temp_dir[PATH_MAX - 32];
+/// Names of the generated dynamic controls files
+static char small_xml[PATH_MAX], large_xml[PATH_MAX];
+
+
+static double get_time_us (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+
+static int compare_samples (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Returns the given percentile of the sorted samples using the nearest rank method.
+ */
+static double get_percentile (BenchResult *result, unsigned int percent)
+{
+	unsigned int rank = (result->count * percent + 99) / 100;
+	return result->samples[rank ? rank - 1 : 0];
+}
+
+
+/**
+ * Runs an operation the given number of times and prints its latency distribution and
+ * the number of allocations per operation.
+ */
+static CResult measure (const char *name, BenchOperation operation, int iterations)
+{
+	BenchResult result = { NULL, 0, 0, 0, 0 };
+	int i;
+
+	result.samples = (double *)malloc(iterations * sizeof(double));
+	if(!result.samples)
+		return C_NO_MEMORY;
+
+	for(i = 0; i < iterations; i++) {
+		unsigned long allocs = alloc_count, bytes = alloc_bytes;
+		double start = get_time_us();
+		CResult res = operation();
+		double duration = get_time_us() - start;
+		result.allocs += alloc_count - allocs;
+		result.bytes += alloc_bytes - bytes;
+		if(res)
+			result.errors++;
+		else
+			result.samples[result.count++] = duration;
+	}
+
+	printf("%s\t%u\t%u", name, iterations, result.errors);
+	if(result.count) {
+		qsort(result.samples, result.count, sizeof(double), compare_samples);
+		printf("\t%.1f\t%.1f\t%.1f", get_percentile(&result, 50), get_percentile(&result, 99),
+				result.samples[result.count - 1]);
+	}
+	else {
+		printf("\t-\t-\t-");
+	}
+	printf("\t%.1f\t%.1f\n", (double)result.allocs / iterations, (double)result.bytes / iterations);
+
+	free(result.samples);
+	return C_SUCCESS;
+}
+
+
+
+/*
+ * Operations
+ */
+
+static CResult init (void)
+{
+	CResult res = c_init();
+	c_cleanup();
+	return res;
+}
+
+
+static CResult enum_devices (void)
+{
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_devices(NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res ? res : C_NOT_FOUND;
+
+	CDevice *devices = (CDevice *)malloc(size);
+	res = devices ? c_enum_devices(devices, &size, &count) : C_NO_MEMORY;
+	free(devices);
+	return res;
+}
+
+
+static CResult enum_controls (void)
+{
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_controls(handle, NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res ? res : C_NOT_FOUND;
+
+	CControl *controls = (CControl *)malloc(size);
+	res = controls ? c_enum_controls(handle, controls, &size, &count) : C_NO_MEMORY;
+	free(controls);
+	return res;
+}
+
+
+/**
+ * Looks up a control that does not exist, which walks the whole control list of the
+ * device without sending a request to it.
+ */
+static CResult find_control (void)
+{
+	CControlValue value;
+	CResult res = c_get_control(handle, CC_V4L2_CUSTOM_BASE + 0xffff, &value);
+	return res == C_NOT_FOUND ? C_SUCCESS : res;
+}
+
+
+static CResult get_control (void)
+{
+	CControlValue value;
+	return c_get_control(handle, CC_BRIGHTNESS, &value);
+}
+
+
+static CResult set_control (void)
+{
+	CControlValue value = { .type = CC_TYPE_DWORD, .value = 128 };
+	return c_set_control(handle, CC_BRIGHTNESS, &value);
+}
+
+
+static CResult enum_pixel_formats (void)
+{
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_pixel_formats(handle, NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res ? res : C_NOT_FOUND;
+
+	CPixelFormat *formats = (CPixelFormat *)malloc(size);
+	res = formats ? c_enum_pixel_formats(handle, formats, &size, &count) : C_NO_MEMORY;
+	free(formats);
+	return res;
+}
+
+
+static CResult enum_frame_sizes (void)
+{
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_frame_sizes(handle, &pixel_format, NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res ? res : C_NOT_FOUND;
+
+	CFrameSize *sizes = (CFrameSize *)malloc(size);
+	res = sizes ? c_enum_frame_sizes(handle, &pixel_format, sizes, &size, &count) : C_NO_MEMORY;
+	free(sizes);
+	return res;
+}
+
+
+static CResult enum_frame_intervals (void)
+{
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_frame_intervals(handle, &pixel_format, &frame_size, NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res ? res : C_NOT_FOUND;
+
+	CFrameInterval *intervals = (CFrameInterval *)malloc(size);
+	res = intervals
+		? c_enum_frame_intervals(handle, &pixel_format, &frame_size, intervals, &size, &count)
+		: C_NO_MEMORY;
+	free(intervals);
+	return res;
+}
+
+
+static CResult import_file (const char *file_name)
+{
+	CDynctrlInfo info;
+	memset(&info, 0, sizeof(info));
+	CResult res = c_add_control_mappings_from_file(file_name, &info);
+	free(info.messages);
+	return res;
+}
+
+
+static CResult import_small (void)
+{
+	return import_file(small_xml);
+}
+
+
+static CResult import_large (void)
+{
+	return import_file(large_xml);
+}
+
+
+
+/*
+ * Test data
+ */
+
+/**
+ * Writes the fake device script with the given number of identical devices. Each
+ * device has the controls and formats of a typical UVC camera.
+ */
+static int write_device_script (const char *file_name, int device_count)
+{
+	static const char *controls =
+		"control 0x00980900 integer Brightness 0 255 1 128\n"
+		"control 0x00980901 integer Contrast 0 255 1 32\n"
+		"control 0x00980902 integer Saturation 0 255 1 32\n"
+		"control 0x00980903 integer Hue -180 180 1 0\n"
+		"control 0x0098090c boolean \"White Balance Temperature, Auto\" 0 1 1 1\n"
+		"control 0x00980910 integer Gamma 100 300 1 220\n"
+		"control 0x00980913 integer Gain 0 255 1 0\n"
+		"control 0x00980918 menu \"Power Line Frequency\" 0 2 1 2\n"
+		"menu 0x00980918 0 Disabled\n"
+		"menu 0x00980918 1 \"50 Hz\"\n"
+		"menu 0x00980918 2 \"60 Hz\"\n"
+		"control 0x0098091a integer \"White Balance Temperature\" 2800 6500 10 4000\n"
+		"control 0x0098091b integer Sharpness 0 255 1 128\n"
+		"control 0x0098091c integer \"Backlight Compensation\" 0 2 1 1\n"
+		"control 0x009a0901 menu \"Exposure, Auto\" 0 3 1 3\n"
+		"menu 0x009a0901 0 \"Auto Mode\"\n"
+		"menu 0x009a0901 1 \"Manual Mode\"\n"
+		"menu 0x009a0901 2 \"Shutter Priority Mode\"\n"
+		"menu 0x009a0901 3 \"Aperture Priority Mode\"\n"
+		"control 0x009a0902 integer \"Exposure (Absolute)\" 3 2047 1 250\n"
+		"control 0x009a0903 boolean \"Exposure, Auto Priority\" 0 1 1 0\n"
+		"control 0x009a0908 integer \"Pan (Absolute)\" -36000 36000 3600 0\n"
+		"control 0x009a0909 integer \"Tilt (Absolute)\" -36000 36000 3600 0\n"
+		"control 0x009a090a integer \"Focus (absolute)\" 0 250 5 0\n"
+		"control 0x009a090c boolean \"Focus, Auto\" 0 1 1 1\n"
+		"control 0x009a090d integer \"Zoom, Absolute\" 100 500 1 100\n";
+	static const char *formats =
+		"format YUYV \"YUYV 4:2:2\"\n"
+		"size 160x120 30 25 20 15 10 5\n"
+		"size 320x240 30 25 20 15 10 5\n"
+		"size 640x480 30 25 20 15 10 5\n"
+		"size 800x600 24 20 15 10 5\n"
+		"size 1280x720 10 5\n"
+		"size 1920x1080 5\n"
+		"format MJPG Motion-JPEG\n"
+		"size 640x480 30 25 20 15 10 5\n"
+		"size 1280x720 30 25 20 15 10 5\n"
+		"size 1920x1080 30 25 20 15 10 5\n";
+	int i;
+
+	FILE *file = fopen(file_name, "w");
+	if(!file)
+		return -1;
+	for(i = 0; i < device_count; i++) {
+		fprintf(file, "device video%d\ncard \"Bench Camera %d\"\nusb 046d:0825 0010\n", i, i);
+		fputs(controls, file);
+		fputs(formats, file);
+	}
+	return fclose(file);
+}
+
+
+/**
+ * Writes a dynamic controls file with the given number of extension unit controls of
+ * which the first @a mapping_count are mapped to V4L2 controls.
+ */
+static int write_dynctrl_file (const char *file_name, int control_count, int mapping_count)
+{
+	int i;
+
+	FILE *file = fopen(file_name, "w");
+	if(!file)
+		return -1;
+
+	fprintf(file,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<config version=\"1.0\">\n"
+		"\t<meta>\n"
+		"\t\t<version>1.0</version>\n"
+		"\t\t<author>webcam-bench</author>\n"
+		"\t\t<contact>-</contact>\n"
+		"\t\t<revision>1.0</revision>\n"
+		"\t\t<copyright>-</copyright>\n"
+		"\t</meta>\n"
+		"\t<constants>\n"
+		"\t\t<constant type=\"guid\">\n"
+		"\t\t\t<id>UVC_GUID_BENCH</id>\n"
+		"\t\t\t<value>63610682-5070-49ab-b8cc-b3855e8d2256</value>\n"
+		"\t\t</constant>\n");
+	for(i = 0; i < control_count; i++)
+		fprintf(file,
+			"\t\t<constant type=\"integer\">\n"
+			"\t\t\t<id>XU_BENCH_CONTROL_%d</id>\n"
+			"\t\t\t<value>%d</value>\n"
+			"\t\t</constant>\n",
+			i, i % 255 + 1);
+	fprintf(file,
+		"\t</constants>\n"
+		"\t<devices>\n"
+		"\t\t<device>\n"
+		"\t\t\t<match>\n"
+		"\t\t\t\t<vendor_id>0x046d</vendor_id>\n"
+		"\t\t\t</match>\n"
+		"\t\t\t<controls>\n");
+	for(i = 0; i < control_count; i++)
+		fprintf(file,
+			"\t\t\t\t<control id=\"bench_control_%d\">\n"
+			"\t\t\t\t\t<entity>UVC_GUID_BENCH</entity>\n"
+			"\t\t\t\t\t<selector>XU_BENCH_CONTROL_%d</selector>\n"
+			"\t\t\t\t\t<size>4</size>\n"
+			"\t\t\t\t\t<description>Synthetic control number %d.</description>\n"
+			"\t\t\t\t</control>\n",
+			i, i, i);
+	fprintf(file,
+		"\t\t\t</controls>\n"
+		"\t\t</device>\n"
+		"\t</devices>\n"
+		"\t<mappings>\n");
+	for(i = 0; i < mapping_count; i++)
+		fprintf(file,
+			"\t\t<mapping>\n"
+			"\t\t\t<name>Bench Control %d</name>\n"
+			"\t\t\t<uvc>\n"
+			"\t\t\t\t<control_ref idref=\"bench_control_%d\"/>\n"
+			"\t\t\t\t<size>16</size>\n"
+			"\t\t\t\t<offset>0</offset>\n"
+			"\t\t\t\t<uvc_type>UVC_CTRL_DATA_TYPE_UNSIGNED</uvc_type>\n"
+			"\t\t\t</uvc>\n"
+			"\t\t\t<v4l2>\n"
+			"\t\t\t\t<id>%d</id>\n"
+			"\t\t\t\t<v4l2_type>V4L2_CTRL_TYPE_INTEGER</v4l2_type>\n"
+			"\t\t\t</v4l2>\n"
+			"\t\t</mapping>\n",
+			i, i, XML_MAPPING_BASE_ID + i);
+	fprintf(file,
+		"\t</mappings>\n"
+		"</config>\n");
+
+	return fclose(file);
+}
+
+
+/**
+ * Creates the temporary directory with the fake device script and the dynamic controls
+ * files and selects the fake backend.
+ */
+static int create_test_data (int device_count)
+{
+	char script[PATH_MAX];
+
+	snprintf(temp_dir, sizeof(temp_dir), "%s/webcam-bench.XXXXXX",
+			getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if(!mkdtemp(temp_dir)) {
+		temp_dir[0] = '\0';
+		return -1;
+	}
+	snprintf(script, sizeof(script), "%s/devices.txt", temp_dir);
+	snprintf(small_xml, sizeof(small_xml), "%s/small.xml", temp_dir);
+	snprintf(large_xml, sizeof(large_xml), "%s/large.xml", temp_dir);
+
+	if(write_device_script(script, device_count) ||
+	   write_dynctrl_file(small_xml, 1, 1) ||
+	   write_dynctrl_file(large_xml, LARGE_XML_CONTROLS, LARGE_XML_MAPPINGS))
+		return -1;
+
+	return setenv("LIBWEBCAM_FAKE", script, 1);
+}
+
+
+static void remove_test_data (void)
+{
+	char file_name[PATH_MAX];
+	if(!temp_dir[0])
+		return;
+
+	snprintf(file_name, sizeof(file_name), "%s/devices.txt", temp_dir);
+	unlink(file_name);
+	unlink(small_xml);
+	unlink(large_xml);
+	rmdir(temp_dir);
+}
+
+
+/**
+ * Opens the first device and looks up the format and frame size used by the frame
+ * enumeration operations.
+ */
+static CResult open_bench_device (void)
+{
+	unsigned int size = 0, count = 0;
+
+	handle = c_open_device("video0");
+	if(!handle)
+		return C_INVALID_DEVICE;
+
+	CResult res = c_enum_pixel_formats(handle, NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		CPixelFormat *formats = (CPixelFormat *)malloc(size);
+		res = formats ? c_enum_pixel_formats(handle, formats, &size, &count) : C_NO_MEMORY;
+		// Keep only the FourCC code so that the format does not point into the buffer
+		if(!res)
+			memcpy(pixel_format.fourcc, formats[0].fourcc, sizeof(pixel_format.fourcc));
+		free(formats);
+	}
+	if(res)
+		return res;
+
+	size = 0;
+	res = c_enum_frame_sizes(handle, &pixel_format, NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		CFrameSize *sizes = (CFrameSize *)malloc(size);
+		res = sizes ? c_enum_frame_sizes(handle, &pixel_format, sizes, &size, &count) : C_NO_MEMORY;
+		if(!res)
+			frame_size = sizes[0];
+		free(sizes);
+	}
+	return res;
+}
+
+
+static void print_usage (const char *program)
+{
+	fprintf(stderr, "Usage: %s [-n devices] [-i iterations]\n", program);
+}
+
+
+int main (int argc, char **argv)
+{
+	int device_count = DEFAULT_DEVICE_COUNT, iterations = DEFAULT_ITERATIONS;
+	CResult res = C_SUCCESS;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:i:h")) != -1) {
+		switch(opt) {
+			case 'n':	device_count = atoi(optarg);	break;
+			case 'i':	iterations = atoi(optarg);		break;
+			default:
+				print_usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(device_count <= 0 || device_count > 16 || iterations <= 0 || optind < argc) {
+		print_usage(argv[0]);
+		fprintf(stderr, "The number of devices must be between 1 and 16.\n");
+		return 1;
+	}
+
+	if(create_test_data(device_count)) {
+		fprintf(stderr, "Unable to create the test data in %s.\n", temp_dir);
+		remove_test_data();
+		return 1;
+	}
+
+	printf("# libwebcam benchmark: %d simulated devices, %d iterations\n", device_count, iterations);
+	printf("# operation\tsamples\terrors\tp50_us\tp99_us\tmax_us\tallocs\tbytes\n");
+
+	if((res = measure("init", init, iterations))) goto done;
+
+	res = c_init();
+	if(res) {
+		fprintf(stderr, "Unable to initialize libwebcam (%d).\n", res);
+		goto done;
+	}
+	res = open_bench_device();
+	if(res) {
+		fprintf(stderr, "Unable to open the simulated device (%d).\n", res);
+		goto done;
+	}
+
+	static const struct {
+		const char		* name;
+		BenchOperation	operation;
+	} operations[] = {
+		{ "enum_devices",			enum_devices },
+		{ "enum_controls",			enum_controls },
+		{ "find_control",			find_control },
+		{ "get_control",			get_control },
+		{ "set_control",			set_control },
+		{ "enum_pixel_formats",		enum_pixel_formats },
+		{ "enum_frame_sizes",		enum_frame_sizes },
+		{ "enum_frame_intervals",	enum_frame_intervals },
+		{ "import_small_xml",		import_small },
+		{ "import_large_xml",		import_large },
+	};
+	unsigned int i;
+	for(i = 0; i < sizeof(operations) / sizeof(operations[0]) && !res; i++)
+		res = measure(operations[i].name, operations[i].operation, iterations);
+
+done:
+	if(handle)
+		c_close_device(handle);
+	c_cleanup();
+	remove_test_data();
+	if(res == C_NO_MEMORY)
+		fprintf(stderr, "Out of memory.\n");
+	return res ? 1 : 0;
+}
@@ -37,6 +37,8 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <iconv.h>
+#include <pthread.h>
+#include <dirent.h>
 #include <linux/videodev2.h>
 #include <linux/uvcvideo.h>
 
@@ -47,6 +49,7 @@
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 
 
 /*
@@ -62,6 +65,19 @@
 /// Helper macro to convert the UTF-8 strings used by libxml2 into whitespace normalized ASCII
 #define UNICODE_TO_NORM_ASCII(s)	(unicode_to_normalized_ascii(s, ctx))
 
+/// Initial number of buckets of a hash table (must be a power of two)
+#define HASH_TABLE_INITIAL_SIZE		64
+/// Maximum average chain length before a hash table is enlarged
+#define HASH_TABLE_MAX_LOAD			2
+
+/// Number of messages stored in one chunk of the message log
+#define MESSAGE_CHUNK_SIZE			64
+
+/// Maximum length of an element path tracked by the streaming parser
+#define ELEMENT_PATH_MAX_LENGTH		128
+/// Maximum nesting depth of an element path tracked by the streaming parser
+#define ELEMENT_PATH_MAX_DEPTH		16
+
 
 
 /*
@@ -108,6 +124,101 @@ typedef enum _ConstantType {
  * Types
  */
 
+/**
+ * Entry of a hash table that maps a name to an arbitrary object.
+ */
+typedef struct _HashEntry {
+	/// Name under which the object is stored. Owned by the object, not by the entry.
+	const char			* key;
+	/// Cached hash value of @a key
+	unsigned int		hash;
+	/// Pointer to the object
+	void				* value;
+	/// Pointer to the next entry in the same bucket
+	struct _HashEntry	* next;
+
+} HashEntry;
+
+/**
+ * Chained hash table used to look up parsed objects by their name.
+ */
+typedef struct _HashTable {
+	/// Array of buckets. NULL as long as the table is empty.
+	HashEntry			** buckets;
+	/// Number of buckets (always a power of two)
+	unsigned int		size;
+	/// Number of entries contained in the table
+	unsigned int		count;
+
+} HashTable;
+
+/**
+ * Chunk of the append-only log that collects messages during parsing.
+ *
+ * The text pointers of the messages point to individually allocated strings. The log is
+ * converted into the self-contained CDynctrlInfo.messages buffer once parsing is done.
+ */
+typedef struct _MessageChunk {
+	/// Number of used entries in @a messages
+	unsigned int		count;
+	/// Message entries
+	CDynctrlMessage		messages[MESSAGE_CHUNK_SIZE];
+	/// Names of the files that the messages concern (not copied, can be NULL)
+	const char			* file_names[MESSAGE_CHUNK_SIZE];
+	/// Pointer to the next chunk in the log
+	struct _MessageChunk	* next;
+
+} MessageChunk;
+
+/**
+ * Append-only log of the messages generated during parsing.
+ */
+typedef struct _MessageLog {
+	/// The first chunk of the log
+	MessageChunk		* first;
+	/// The last chunk of the log (the one new messages are appended to)
+	MessageChunk		* last;
+	/// Total number of messages in the log
+	unsigned int		count;
+	/// Total length of all message strings including their terminating null characters
+	unsigned int		text_size;
+
+} MessageLog;
+
+/**
+ * Path of the current element relative to an ancestor element (e.g. "uvc/control_ref").
+ *
+ * Used by the streaming parser to find out where in the document it is located.
+ */
+typedef struct _ElementPath {
+	/// Element names separated by slashes
+	char				buffer[ELEMENT_PATH_MAX_LENGTH];
+	/// Length of @a buffer before each of the contained elements was appended
+	unsigned int		lengths[ELEMENT_PATH_MAX_DEPTH];
+	/// Number of elements contained in @a buffer
+	unsigned int		depth;
+	/// Number of elements that did not fit into @a buffer. No path comparisons succeed
+	/// as long as this is non-zero.
+	unsigned int		overflow;
+
+} ElementPath;
+
+/**
+ * Child element or attribute of an XML element that is collected by read_record().
+ */
+typedef struct _RecordField {
+	/// Path of the field relative to the record element (e.g. "uvc/size"). Attributes are
+	/// denoted by an '@' followed by the attribute name (e.g. "uvc/control_ref@idref").
+	const char			* path;
+	/// Text content of the field or NULL if the field has no text
+	xmlChar				* text;
+	/// Boolean whether the field element or attribute was encountered
+	int					present;
+	/// Line number of the field element
+	int					line;
+
+} RecordField;
+
 /**
  * Constant read from the XML configuration file.
  */
@@ -116,6 +227,8 @@ typedef struct _Constant {
 	ConstantType		type;
 	/// Name of the constant
 	char				* name;
+	/// Number of the file that defined the constant (1 for the first file)
+	unsigned int		file;
 
 	union {
 		/// Integer value (only valid if type == CT_INTEGER)
@@ -129,6 +242,37 @@ typedef struct _Constant {
 
 } Constant;
 
+/**
+ * USB device match rule read from a @c match element.
+ */
+typedef struct _DeviceMatch {
+	/// USB vendor ID that a device must have
+	unsigned short				vendor;
+	/// List of USB product IDs of which a device must have one
+	unsigned short				* products;
+	/// Number of elements in @a products. If zero, all products of the vendor match.
+	unsigned int				product_count;
+	/// List of USB release numbers of which a device must have one
+	unsigned short				* releases;
+	/// Number of elements in @a releases. If zero, all releases match.
+	unsigned int				release_count;
+	/// Pointer to the next match rule of the same @c device element
+	struct _DeviceMatch			* next;
+
+} DeviceMatch;
+
+/**
+ * Set of match rules read from a @c device element that applies to the contained controls.
+ */
+typedef struct _DeviceFilter {
+	/// List of match rules of which a device must satisfy one.
+	/// If the list is empty, the filter matches all devices.
+	DeviceMatch					* matches;
+	/// Pointer to the next filter in the list
+	struct _DeviceFilter		* next;
+
+} DeviceFilter;
+
 /**
  * UVC extension unit control for use with UVCIOC_CTRL_MAP.
  */
@@ -137,35 +281,167 @@ typedef struct _UVCXUControl {
 	xmlChar						* id;
 	/// UVC data required to identify an extension unit control
 	struct uvc_xu_control_mapping info;
+	/// Filter that determines which devices the control is added to
+	const DeviceFilter			* filter;
+	/// Key made up of the entity and the selector that identifies the control in the driver
+	char						key[2 * GUID_SIZE + 4];
+	/// Previously parsed definition of the same driver control (NULL if there is none)
+	const struct _UVCXUControl	* duplicate_of;
 	/// Pointer to the next extension unit control definition in the list
 	struct _UVCXUControl		* next;
 
 } UVCXUControl;
 
+/**
+ * UVC extension unit control mapping for use with UVCIOC_CTRL_MAP.
+ */
+typedef struct _UVCXUMapping {
+	/// UVC and V4L2 data describing the mapping
+	struct uvc_xu_control_mapping info;
+	/// The extension unit control that the mapping refers to
+	const UVCXUControl			* control;
+	/// Key made up of the V4L2 ID that identifies the mapping in the driver
+	char						key[9];
+	/// Previously parsed mapping for the same V4L2 ID (NULL if there is none)
+	const struct _UVCXUMapping	* duplicate_of;
+	/// Pointer to the next mapping in the list
+	struct _UVCXUMapping		* next;
+
+} UVCXUMapping;
+
 /**
  * Helper structure that contains handles and information useful during the XML parsing process.
  */
 typedef struct _ParseContext {
 	/// Structure used to pass information between the application and libwebcam. Can be NULL.
 	CDynctrlInfo	* info;
-	/// Size of the info->messages buffer (which contains the CDynctrlMessage structures
-	/// and the strings pointed to).
-	unsigned int	messages_size;
+	/// Messages collected during parsing. They are copied to info->messages when done.
+	MessageLog		log;
 	/// Conversion descriptor for iconv
 	iconv_t			cd;
+	/// Name of the file that is currently being parsed (NULL when not parsing)
+	const char		* file_name;
+	/// Number of files parsed so far including the current one
+	unsigned int	file_count;
+	/// Boolean whether the meta information has been retrieved from a file
+	int				have_meta;
 	/// List of constants parsed from the @c constants node
 	Constant		* constants;
-	/// Handle to the libwebcam device
-	CHandle			handle;
+	/// Index of the @a constants list by constant name
+	HashTable		constants_index;
+	/// Short V4L2 name of the current device (e.g. 'video0')
+	const char		* device_name;
 	/// Handle to the V4L2 device that is used to add the dynamic controls
 	int				v4l2_handle;
+	/// Request statistics of the current device (may be NULL)
+	DeviceStats		* stats;
+	/// Ascending list of the IDs of the V4L2 controls that the current device already has
+	__u32			* present_ids;
+	/// Number of elements in @a present_ids
+	unsigned int	present_count;
+	/// Number of mappings added to the current device
+	unsigned int	added_mappings;
 	/// List of controls parsed from the @c devices nodes
 	UVCXUControl	* controls;
+	/// Index of the @a controls list by control ID (only for the current file)
+	HashTable		controls_index;
+	/// Index of the @a controls list by UVCXUControl.key (latest definition)
+	HashTable		control_keys;
+	/// List of mappings parsed from the @c mappings node
+	UVCXUMapping	* mappings;
+	/// Index of the @a mappings list by UVCXUMapping.key (latest definition)
+	HashTable		mapping_keys;
+	/// List of device filters parsed from the @c device nodes
+	DeviceFilter	* filters;
+	/// USB information of the current device (NULL while parsing)
+	const CUSBInfo	* usb;
 	/// The current parsing pass (first device is pass 1, second device pass 2, etc.)
 	int				pass;
 
 } ParseContext;
 
+/**
+ * State of adding the parsed controls and mappings to a single device.
+ */
+typedef struct _DeviceJob {
+	/// The device that the controls and mappings are added to
+	CDevice			* device;
+	/// Parse context of the device. It shares the parsed lists with the main parse
+	/// context but has its own handles, message log, and statistics.
+	ParseContext	ctx;
+	/// Receives the statistics of the device (only used if the caller requested info)
+	CDynctrlInfo	info;
+	/// Result of add_control_mappings() for the device
+	CResult			result;
+	/// Boolean whether the job has been processed
+	int				processed;
+
+} DeviceJob;
+
+/**
+ * Queue of device jobs shared by the worker threads.
+ */
+typedef struct _DeviceJobQueue {
+	/// Array of jobs
+	DeviceJob		* jobs;
+	/// Number of elements in @a jobs
+	unsigned int	count;
+	/// Index of the next job to be picked up by a worker
+	unsigned int	next;
+	/// The mutex used to serialize access to @a next
+	pthread_mutex_t	mutex;
+
+} DeviceJobQueue;
+
+/**
+ * Device that is configured without going through the libwebcam device list.
+ */
+typedef struct _TargetDevice {
+	/// Handle to the V4L2 device (0 once it has been handed over or closed)
+	int						v4l2_handle;
+	/// Short V4L2 device name (e.g. 'video0')
+	char					v4l2_name[NAME_MAX];
+	/// Capabilities of the device. The strings of @a device point into this structure
+	/// and @a v4l2_name.
+	struct v4l2_capability	v4l2_cap;
+	/// Device information for the device job
+	CDevice					device;
+
+} TargetDevice;
+
+/**
+ * Parsed configuration for one USB product stored in a #CDynctrlCache.
+ */
+typedef struct _CacheEntry {
+	/// USB vendor ID that the configuration was loaded for
+	unsigned short			vendor;
+	/// USB product ID that the configuration was loaded for
+	unsigned short			product;
+	/// Parse context that holds the configuration
+	ParseContext			* ctx;
+	/// Result of parsing the configuration files
+	CResult					parse_result;
+	/// Paths of the files that the configuration was loaded from
+	char					** file_names;
+	/// Number of elements in @a file_names
+	unsigned int			file_count;
+	/// Pointer to the next entry in the cache
+	struct _CacheEntry		* next;
+
+} CacheEntry;
+
+/**
+ * Cache of parsed configurations (see CDynctrlCache in webcam.h).
+ */
+struct _CDynctrlCache {
+	/// Directory that contains the configuration files
+	char					* dir_name;
+	/// List of the configurations loaded so far
+	CacheEntry				* entries;
+	/// The mutex used to serialize access to the list of configurations
+	pthread_mutex_t			mutex;
+};
+
 
 
 /*
@@ -292,6 +568,30 @@ static int is_valid_guid (const char *string)
 }
 
 
+/**
+ * Checks whether a given string represents a valid USB ID.
+ *
+ * USB IDs are hexadecimal numbers of up to four digits with an optional '0x' prefix.
+ *
+ * @param string	String containing a USB ID. Can be NULL.
+ * @param value		A pointer in which the converted value will be stored.
+ *
+ * @return			boolean indicating whether the string represents a valid USB ID
+ */
+static int is_valid_usb_id_string (const char *string, unsigned short *value)
+{
+	if(!string) return 0;
+
+	char *end = NULL;
+	long id = strtol(string, &end, 16);
+	if(*string == '\0' || *end != '\0' || id < 0 || id > 0xFFFF)
+		return 0;
+
+	*value = (unsigned short)id;
+	return 1;
+}
+
+
 /**
  * Converts a string to a version consisting of major and minor version.
  *
@@ -493,6 +793,9 @@ static char *normalize_string (const char *input)
  * Converts a UTF-8 string to ASCII.
  *
  * The function may convert some characters in a non-reversible way.
+ * Strings that contain only ASCII characters are copied without going through iconv.
+ * The iconv conversion descriptor is only opened once the first non-ASCII string
+ * is encountered.
  *
  * @param unicode	input string to be converted.
  * @param ctx		current parse context
@@ -505,23 +808,34 @@ static char *normalize_string (const char *input)
 static char *unicode_to_ascii (const xmlChar *unicode, ParseContext *ctx)
 {
 	if(!unicode) return NULL;
-	assert(ctx && ctx->cd && ctx->cd != (iconv_t)-1);
+
+	// Pure ASCII strings need no conversion
+	const xmlChar *p = unicode;
+	while(*p && *p < 0x80) p++;
+	if(!*p) return strdup((char *)unicode);
+
+	// Allocate a conversion descriptor if this is the first string that needs one
+	assert(ctx);
+	if(!ctx->cd)
+		ctx->cd = iconv_open("ASCII//TRANSLIT", "UTF-8");
 
 	// If there is no conversion descriptor return a copy of the input string
-	if(!ctx || !ctx->cd || ctx->cd == (iconv_t)-1) return strdup((char *)unicode);
+	if(ctx->cd == (iconv_t)-1) return strdup((char *)unicode);
 
-	// Allocate a new buffer as big as the input string
+	// Allocate a new buffer. Transliteration can make the output longer than the input
+	// so leave some room for that.
 	char *inbuf, *outbuf, *ascii;
 	size_t unicode_bytes, ascii_bytes;
 	inbuf = (char *)unicode;
-	ascii_bytes = unicode_bytes = strlen(inbuf) + 1;
+	unicode_bytes = strlen(inbuf) + 1;
+	ascii_bytes = 2 * unicode_bytes;
 	ascii = (char *)malloc(ascii_bytes);
-	memset(ascii, 0, sizeof(*ascii));
+	if(!ascii) return NULL;
 	outbuf = ascii;
 
 	// Do the conversion
-	if(iconv(ctx->cd, &inbuf, &unicode_bytes, &outbuf, &ascii_bytes) == -1) {
-		assert(0);
+	iconv(ctx->cd, NULL, NULL, NULL, NULL);
+	if(iconv(ctx->cd, &inbuf, &unicode_bytes, &outbuf, &ascii_bytes) == (size_t)-1) {
 		free(ascii);
 		return NULL;
 	}
@@ -550,74 +864,314 @@ static char *unicode_to_normalized_ascii (const xmlChar *unicode, ParseContext *
  */
 
 /**
- * Returns the text content of the given node.
+ * Appends an element name to an element path.
+ *
+ * Elements that do not fit into the path buffer are only counted, so that the path
+ * can be restored correctly when they are removed again.
+ */
+static void element_path_push (ElementPath *path, const char *name)
+{
+	unsigned int length = strlen(path->buffer);
+	unsigned int name_length = strlen(name);
+
+	if(path->overflow || path->depth == ELEMENT_PATH_MAX_DEPTH
+			|| length + name_length + 2 > sizeof(path->buffer)) {
+		path->overflow++;
+		return;
+	}
+
+	path->lengths[path->depth++] = length;
+	if(length)
+		path->buffer[length++] = '/';
+	memcpy(path->buffer + length, name, name_length + 1);
+}
+
+
+/**
+ * Removes the last element name from an element path.
+ */
+static void element_path_pop (ElementPath *path)
+{
+	if(path->overflow) {
+		path->overflow--;
+		return;
+	}
+	if(path->depth)
+		path->buffer[path->lengths[--path->depth]] = '\0';
+}
+
+
+/**
+ * Checks whether an element path is equal to the given string.
+ */
+static int element_path_is (const ElementPath *path, const char *string)
+{
+	return !path->overflow && strcmp(path->buffer, string) == 0;
+}
+
+
+/**
+ * Returns the line number of the node that the XML reader is currently positioned on.
+ */
+static int xml_reader_get_line (xmlTextReader *reader)
+{
+	xmlNode *node = xmlTextReaderCurrentNode(reader);
+	return node ? (int)xmlGetLineNo(node) : xmlTextReaderGetParserLineNumber(reader);
+}
+
+
+/**
+ * Fills in the record fields that correspond to the element the XML reader is currently
+ * positioned on or to one of its attributes.
+ */
+static void read_record_element (xmlTextReader *reader, const ElementPath *path,
+		RecordField *fields, unsigned int count)
+{
+	if(path->overflow)
+		return;
+
+	unsigned int i, length = strlen(path->buffer);
+	for(i = 0; i < count; i++) {
+		RecordField *field = &fields[i];
+		if(field->present || strncmp(field->path, path->buffer, length) != 0)
+			continue;
+
+		if(field->path[length] == '\0') {
+			// The field is the element itself
+			field->present = 1;
+			field->line = xml_reader_get_line(reader);
+		}
+		else if(field->path[length] == '@') {
+			// The field is an attribute of the element
+			field->text = xmlTextReaderGetAttribute(reader, BAD_CAST(field->path + length + 1));
+			if(field->text) {
+				field->present = 1;
+				field->line = xml_reader_get_line(reader);
+			}
+		}
+	}
+}
+
+
+/**
+ * Reads an XML element and collects the contents of the given child elements and attributes.
  *
- * @param node	Pointer to a node. May be NULL.
+ * The XML reader must be positioned on the start of the record element. When the
+ * function returns successfully, the reader is positioned on the end of the record
+ * element, so only the memory required for the requested fields is ever allocated.
+ * Only the first text node of each field element is retrieved.
  *
- * @return
- * 		- the content of the first text child node if it exists
- * 		- NULL if a node in the path does not exist or does not contain text
+ * Note that the field texts must be freed with free_record() in any case.
  *
+ * @param reader	XML reader positioned on the start of the record element
+ * @param fields	array of fields whose @a path members are filled in
+ * @param count		number of elements in @a fields
+ *
+ * @return
+ * 		- C_NO_MEMORY if a field text could not be copied
+ * 		- C_PARSE_ERROR if the XML file is malformed
+ * 		- C_SUCCESS if the element was read successfully
  */
-static const xmlChar *xml_get_node_text (const xmlNode *node)
+static CResult read_record (xmlTextReader *reader, RecordField *fields, unsigned int count)
 {
-	if(node && node->children && xmlNodeIsText(node->children)) {
-		return node->children->content;
+	ElementPath path;
+	unsigned int i;
+	memset(&path, 0, sizeof(path));
+
+	int depth = xmlTextReaderDepth(reader);
+	read_record_element(reader, &path, fields, count);
+	if(xmlTextReaderIsEmptyElement(reader))
+		return C_SUCCESS;
+
+	while(xmlTextReaderRead(reader) == 1) {
+		switch(xmlTextReaderNodeType(reader)) {
+			case XML_READER_TYPE_ELEMENT:
+				element_path_push(&path, (const char *)xmlTextReaderConstLocalName(reader));
+				read_record_element(reader, &path, fields, count);
+				if(xmlTextReaderIsEmptyElement(reader))
+					element_path_pop(&path);
+				break;
+
+			case XML_READER_TYPE_END_ELEMENT:
+				if(xmlTextReaderDepth(reader) == depth)
+					return C_SUCCESS;
+				element_path_pop(&path);
+				break;
+
+			case XML_READER_TYPE_TEXT:
+			case XML_READER_TYPE_CDATA:
+				if(path.overflow)
+					break;
+				for(i = 0; i < count; i++) {
+					if(!fields[i].text && strcmp(fields[i].path, path.buffer) == 0) {
+						fields[i].text = xmlStrdup(xmlTextReaderConstValue(reader));
+						if(!fields[i].text) return C_NO_MEMORY;
+					}
+				}
+				break;
+		}
 	}
-	else {
-		return NULL;
+
+	// We ran into the end of the file or a syntax error before the end of the record
+	return C_PARSE_ERROR;
+}
+
+
+/**
+ * Frees the field texts collected by read_record().
+ */
+static void free_record (RecordField *fields, unsigned int count)
+{
+	unsigned int i;
+	for(i = 0; i < count; i++) {
+		if(fields[i].text)
+			xmlFree(fields[i].text);
+		fields[i].text = NULL;
 	}
 }
 
 
+
+/*
+ * Data management and lookup functions
+ */
+
 /**
- * Returns the first child node with a given name.
- *
- * @param node	pointer to the parent node whose children are to be searched
- * @param name	the name of the child node to be searched for
+ * Calculates the hash value of a string (FNV-1a).
+ */
+static unsigned int hash_string (const char *string)
+{
+	unsigned int hash = 2166136261u;
+	while(*string) {
+		hash ^= (unsigned char)*string++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Doubles the number of buckets of a hash table and redistributes its entries.
  *
  * @return
- * 		- a pointer to the first child node with the given name
- * 		- NULL if no child node has the given name
+ * 		- C_NO_MEMORY if the new bucket array could not be allocated
+ * 		- C_SUCCESS otherwise
  */
-static xmlNode *xml_get_first_child_by_name (const xmlNode *node, const char *name)
+static CResult hash_table_grow (HashTable *table)
 {
-	xmlNode *cnode = node->children;
-	while(cnode) {
-		if(cnode->type == XML_ELEMENT_NODE && xmlStrEqual(cnode->name, BAD_CAST(name)))
-			return cnode;
-		cnode = cnode->next;
+	unsigned int new_size = table->size ? table->size * 2 : HASH_TABLE_INITIAL_SIZE;
+	HashEntry **new_buckets = (HashEntry **)calloc(new_size, sizeof(HashEntry *));
+	if(!new_buckets)
+		return C_NO_MEMORY;
+
+	// Move all entries over to the new buckets. The entries themselves are reused.
+	unsigned int i;
+	for(i = 0; i < table->size; i++) {
+		HashEntry *entry = table->buckets[i];
+		while(entry) {
+			HashEntry *next = entry->next;
+			unsigned int index = entry->hash & (new_size - 1);
+			entry->next = new_buckets[index];
+			new_buckets[index] = entry;
+			entry = next;
+		}
 	}
-	return NULL;
+
+	free(table->buckets);
+	table->buckets = new_buckets;
+	table->size = new_size;
+	return C_SUCCESS;
 }
 
 
 /**
- * Returns the next sibling node with a given name.
+ * Stores an object in a hash table under the given name.
  *
- * @param node	pointer to the node whose siblings are to be searched
- * @param name	the name of the sibling node to be searched for
+ * If an object with the same name already exists, it is replaced. Note that the table
+ * does not copy @a key, so the string must live at least as long as the table entry.
  *
  * @return
- * 		- a pointer to the first sibling node with the given name
- * 		- NULL if no sibling node has the given name
+ * 		- C_NO_MEMORY if the entry could not be allocated
+ * 		- C_SUCCESS otherwise
  */
-static xmlNode *xml_get_next_sibling_by_name (const xmlNode *node, const char *name)
+static CResult hash_table_insert (HashTable *table, const char *key, void *value)
 {
-	xmlNode *cnode = node->next;
-	while(cnode) {
-		if(cnode->type == XML_ELEMENT_NODE && xmlStrEqual(cnode->name, BAD_CAST(name)))
-			return cnode;
-		cnode = cnode->next;
+	unsigned int hash = hash_string(key);
+
+	// Replace the object if the name is already present
+	if(table->size) {
+		HashEntry *entry = table->buckets[hash & (table->size - 1)];
+		while(entry) {
+			if(entry->hash == hash && strcmp(entry->key, key) == 0) {
+				entry->key = key;
+				entry->value = value;
+				return C_SUCCESS;
+			}
+			entry = entry->next;
+		}
 	}
-	return NULL;
+
+	// Enlarge the table if the chains get too long
+	if(table->count >= table->size * HASH_TABLE_MAX_LOAD) {
+		CResult ret = hash_table_grow(table);
+		if(ret) return ret;
+	}
+
+	HashEntry *entry = (HashEntry *)malloc(sizeof(HashEntry));
+	if(!entry)
+		return C_NO_MEMORY;
+	entry->key = key;
+	entry->hash = hash;
+	entry->value = value;
+	entry->next = table->buckets[hash & (table->size - 1)];
+	table->buckets[hash & (table->size - 1)] = entry;
+	table->count++;
+
+	return C_SUCCESS;
 }
 
 
+/**
+ * Looks up the object stored under the given name.
+ *
+ * @return
+ * 		- NULL if no object with the given name exists
+ * 		- a pointer to the object otherwise
+ */
+static void *hash_table_lookup (const HashTable *table, const char *key)
+{
+	if(!table->size || !key)
+		return NULL;
+
+	unsigned int hash = hash_string(key);
+	HashEntry *entry = table->buckets[hash & (table->size - 1)];
+	while(entry) {
+		if(entry->hash == hash && strcmp(entry->key, key) == 0)
+			return entry->value;
+		entry = entry->next;
+	}
+	return NULL;
+}
 
-/*
- * Data management and lookup functions
+
+/**
+ * Frees all entries of a hash table. The stored objects themselves are not freed.
  */
+static void hash_table_clear (HashTable *table)
+{
+	unsigned int i;
+	for(i = 0; i < table->size; i++) {
+		HashEntry *entry = table->buckets[i];
+		while(entry) {
+			HashEntry *next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+	free(table->buckets);
+	memset(table, 0, sizeof(*table));
+}
+
 
 /**
  * Look up a constant by its name.
@@ -633,13 +1187,9 @@ static xmlNode *xml_get_next_sibling_by_name (const xmlNode *node, const char *n
  */
 static Constant *lookup_constant (const char *find_name, ConstantType find_type, ParseContext *ctx)
 {
-	Constant *elem = ctx->constants;
-	while(elem) {
-		if(strcmp(elem->name, find_name) == 0
-				&& (find_type == CT_INVALID ? 1 : elem->type == find_type))
-			return elem;
-		elem = elem->next;
-	}
+	Constant *elem = (Constant *)hash_table_lookup(&ctx->constants_index, find_name);
+	if(elem && (find_type == CT_INVALID || elem->type == find_type))
+		return elem;
 	return NULL;
 }
 
@@ -711,79 +1261,143 @@ static CResult lookup_or_convert_to_guid (const xmlChar *text, __u8 *guid, Parse
  */
 static UVCXUControl * lookup_control (const xmlChar *name, ParseContext *ctx)
 {
-	UVCXUControl *elem = ctx->controls;
-	while(elem) {
-		if(xmlStrEqual(elem->id, name))
-			return elem;
-		elem = elem->next;
-	}
-	return NULL;
+	return (UVCXUControl *)hash_table_lookup(&ctx->controls_index, (const char *)name);
 }
 
 
 /**
- * Reorganize the buffer that is used to store the messages that are logged during parsing.
- *
- * The buffer that is used to store the messages is completely self-contained. It consists
- * of an array of CDynctrlMessage structures and an area for "dynamics" which stores
- * dynamic data like strings. All string pointers in the array point to strings in the
- * dynamics area, so for clean up only a single buffer needs to be freed.
- *
- * Every time a new array element is added, the buffer has to be enlarged, and a new array
- * element has to be inserted between the current last element and the dynamics area.
- * The dynamics area is moved by sizeof(CDynctrlMessage) bytes and all pointers to it
- * are updated to point to the new direction.
+ * Appends a message to the message log of the parse context.
  *
  * @param ctx	current parse context
- * @param msg	pointer to the new message to be added. Note that this is only a temporary
- * 				buffer. Its content (including its strings) is copied into the message
- * 				buffer and the temporary buffer is no longer required after the function
- * 				returns.
+ * @param msg	pointer to the new message to be added. The log takes over ownership
+ * 				of the @a msg->text string which must have been allocated with malloc().
+ * @param file_name	name of the file that the message concerns or NULL. The string is
+ * 				not copied. It must stay valid until the log has been packed.
  *
  * @return
- * 		- C_NO_MEMORY if the buffer could not be enlarged for lack of memory
+ * 		- C_NO_MEMORY if a new log chunk could not be allocated
  * 		- C_SUCCESS otherwise
  */
-static CResult resize_message_buffer (ParseContext *ctx, CDynctrlMessage *msg)
+static CResult append_message (ParseContext *ctx, CDynctrlMessage *msg, const char *file_name)
+{
+	MessageLog *log = &ctx->log;
+
+	// Start a new chunk if the last one is full
+	if(!log->last || log->last->count == MESSAGE_CHUNK_SIZE) {
+		MessageChunk *chunk = (MessageChunk *)malloc(sizeof(MessageChunk));
+		if(!chunk) return C_NO_MEMORY;
+		chunk->count = 0;
+		chunk->next = NULL;
+		if(log->last)
+			log->last->next = chunk;
+		else
+			log->first = chunk;
+		log->last = chunk;
+	}
+
+	log->last->file_names[log->last->count] = file_name;
+	log->last->messages[log->last->count++] = *msg;
+	log->count++;
+	log->text_size += strlen(msg->text) + 1;
+	if(file_name)
+		log->text_size += strlen(file_name) + 1;
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Frees the message log of the parse context including all message strings.
+ */
+static void free_message_log (ParseContext *ctx)
+{
+	MessageChunk *chunk = ctx->log.first;
+	while(chunk) {
+		MessageChunk *next = chunk->next;
+		unsigned int i;
+		for(i = 0; i < chunk->count; i++)
+			free(chunk->messages[i].text);
+		free(chunk);
+		chunk = next;
+	}
+	memset(&ctx->log, 0, sizeof(ctx->log));
+}
+
+
+/**
+ * Moves all messages from one message log to the end of another one.
+ */
+static void merge_message_log (MessageLog *target, MessageLog *source)
 {
-	CDynctrlMessage *new_messages = NULL;
+	if(!source->first)
+		return;
+
+	if(target->last)
+		target->last->next = source->first;
+	else
+		target->first = source->first;
+	target->last = source->last;
+	target->count += source->count;
+	target->text_size += source->text_size;
+
+	memset(source, 0, sizeof(*source));
+}
 
-	// Enlarge the CDynctrlMessage buffer and zero out the newly allocated space
-	unsigned int extra_required = sizeof(CDynctrlMessage) + strlen(msg->text) + 1;
-	new_messages = (CDynctrlMessage *)realloc(ctx->info->messages, ctx->messages_size + extra_required);
-	if(new_messages == NULL) return C_NO_MEMORY;
-	memset((unsigned char *)new_messages + ctx->messages_size, 0, extra_required);
-	ctx->messages_size += extra_required;
 
-	// Move the dynamics area (e.g. all strings) down (imagine ctx->messages as the top)
-	// by sizeof(CDynctrlMessage) to make room for the new array element.
-	// Note that to access the current .text string we already need to refer to the new
-	// buffer (to the old location in the new buffer to be more specific) because the buffer
-	// has been freed above.
-	int i, dynamics_length = 0;
-	for(i = 0; i < ctx->info->message_count; i++) {
-		char *old_text = (char *)new_messages + ctx->info->message_count * sizeof(CDynctrlMessage) + dynamics_length;
-		dynamics_length += strlen(old_text) + 1;
-		// Note that the .text pointers will be invalid until we actually move the data below
-		new_messages[i].text = old_text + sizeof(CDynctrlMessage);
-	}
-	if(i > 0) {
-		memmove((unsigned char *)new_messages + (ctx->info->message_count + 1) * sizeof(CDynctrlMessage),
-				(unsigned char *)new_messages + ctx->info->message_count * sizeof(CDynctrlMessage),
-				dynamics_length);
-	}
+/**
+ * Copies the message log into the buffer returned to the caller in info->messages.
+ *
+ * The buffer that is returned is completely self-contained. It consists of an array of
+ * CDynctrlMessage structures, the info->message_files array if #CD_REPORT_FILE_NAMES is
+ * set, and an area for "dynamics" which stores the strings. All string pointers in the
+ * arrays point to strings in the dynamics area, so for clean up only a single buffer
+ * needs to be freed.
+ *
+ * @return
+ * 		- C_NO_MEMORY if the buffer could not be allocated
+ * 		- C_SUCCESS otherwise
+ */
+static CResult pack_message_log (ParseContext *ctx)
+{
+	MessageLog *log = &ctx->log;
 
-	// Copy the string of the new message to the end of the dynamics area
-	char *new_text = (char *)((unsigned char *)new_messages + (ctx->info->message_count + 1) * sizeof(CDynctrlMessage) + dynamics_length);
-	strcpy(new_text, msg->text);
-	msg->text = new_text;		// Update the message to point to the new text
+	if(!ctx->info || !log->count)
+		return C_SUCCESS;
 
-	// Copy the new message to the end of the array and update the array size
-	ctx->info->message_count++;
-	memcpy(&new_messages[ctx->info->message_count - 1], msg, sizeof(CDynctrlMessage));
+	// Older callers do not have the message_files field, so it is only touched on request
+	int report_files = ctx->info->flags & CD_REPORT_FILE_NAMES;
+	unsigned int array_size = log->count * sizeof(CDynctrlMessage);
+	unsigned int files_size = report_files ? log->count * sizeof(char *) : 0;
+	CDynctrlMessage *messages = (CDynctrlMessage *)malloc(array_size + files_size + log->text_size);
+	if(!messages) return C_NO_MEMORY;
+
+	char **files = report_files ? (char **)((char *)messages + array_size) : NULL;
+	char *text = (char *)messages + array_size + files_size;
+	unsigned int index = 0;
+	MessageChunk *chunk;
+	for(chunk = log->first; chunk; chunk = chunk->next) {
+		unsigned int i;
+		for(i = 0; i < chunk->count; i++) {
+			unsigned int length = strlen(chunk->messages[i].text) + 1;
+			messages[index] = chunk->messages[i];
+			messages[index].text = memcpy(text, chunk->messages[i].text, length);
+			text += length;
+			if(files) {
+				files[index] = NULL;
+				if(chunk->file_names[i]) {
+					length = strlen(chunk->file_names[i]) + 1;
+					files[index] = memcpy(text, chunk->file_names[i], length);
+					text += length;
+				}
+			}
+			index++;
+		}
+	}
 
-	// Finally, update the context to point to the resized messages buffer
-	ctx->info->messages = new_messages;
+	ctx->info->messages = messages;
+	ctx->info->message_count = log->count;
+	if(report_files)
+		ctx->info->message_files = files;
 
 	return C_SUCCESS;
 }
@@ -812,17 +1426,18 @@ static CResult add_message_v (ParseContext *ctx, int line, int col, CDynctrlMess
 		goto done;
 	}
 
-	// Allocate memory for the new message (i.e. CDynctrlMessage and its string)
+	// Append the new message to the log which takes over the string
 	CDynctrlMessage message = { 0 };
 	message.line		= line;
 	message.col			= col;
 	message.severity	= severity;
 	message.text		= text;
-	ret = resize_message_buffer(ctx, &message);
+	ret = append_message(ctx, &message, ctx->file_name);
 	if(ret) {
 		ret = C_NO_MEMORY;
 		goto done;
 	}
+	text = NULL;
 
 done:
 	if(text) free(text);
@@ -896,17 +1511,29 @@ static CResult add_error (ParseContext *ctx, const char *format, ...)
 
 
 /**
- * Adds a new error message concerning a given xmlNode to the message list.
- *
- * The node is used to extract the line number.
+ * Adds a new error message concerning a given line of the XML file to the message list.
+ */
+static CResult add_error_at_line (ParseContext *ctx, int line, const char *format, ...)
+{
+	va_list va;
+
+	va_start(va, format);
+	CResult ret = add_message_v(ctx, line, 0, CD_SEVERITY_ERROR, format, va);
+	va_end(va);
+
+	return ret;
+}
+
+
+/**
+ * Adds a new warning message concerning a given line of the XML file to the message list.
  */
-static CResult add_error_at_node (ParseContext *ctx, const xmlNode *node, const char *format, ...)
+static CResult add_warning_at_line (ParseContext *ctx, int line, const char *format, ...)
 {
-	assert(node);
 	va_list va;
 
 	va_start(va, format);
-	CResult ret = add_message_v(ctx, node->line, 0, CD_SEVERITY_ERROR, format, va);
+	CResult ret = add_message_v(ctx, line, 0, CD_SEVERITY_WARNING, format, va);
 	va_end(va);
 
 	return ret;
@@ -919,252 +1546,397 @@ static CResult add_error_at_node (ParseContext *ctx, const xmlNode *node, const
  */
 
 /**
- * Parse a dynamic controls configuration XML file and return an XML document tree.
- *
- * Note that the pointer stored in @a *xml_doc must be freed using xmlFreeDoc() if
- * the return value of this functino is C_SUCCESS.
- *
- * @param file_name		name (with an optional path) of the file to be parsed
- * @param xml_doc		address of a pointer to store the XML document tree
- * @param ctx		current parse context
- *
- * @return
- * 		- C_NO_MEMORY if a buffer or structure could not be allocated
- * 		- C_PARSE_ERROR if the XML file is malformed
- * 		- C_SUCCESS if parsing was successful
+ * Error handler for the XML reader that adds syntax errors to the message list.
  */
-static CResult parse_dynctrl_file (const char *file_name, xmlDoc **xml_doc, ParseContext *ctx)
+static void parse_error_handler (void *arg, xmlErrorPtr error)
 {
-	CResult ret = C_SUCCESS;
-	xmlParserCtxt *parser = NULL;
-	xmlDoc *doc = NULL;
-	assert(xml_doc);
-
-	parser = xmlNewParserCtxt();
-	if(!parser)
-		return C_NO_MEMORY;
-	
-	// Read and parse the XML file
-	doc = xmlCtxtReadFile(parser, file_name, NULL, XML_PARSE_NOBLANKS);
-	if(!doc) {
-		xmlError *e = &parser->lastError;
-		add_message(ctx, e->line, e->int2, CD_SEVERITY_ERROR,
-				"Malformed control mapping file encountered. Unable to parse: %s",
-				e->message);
-		ret = C_PARSE_ERROR;
-	}
-	assert(parser->valid);
+	ParseContext *ctx = (ParseContext *)arg;
 
-	// Validate the XML file against the schema
-	if(!ctx->info || !(ctx->info->flags & CD_DONT_VALIDATE)) {
-		// TODO implement
-	}
+	if(error->level < XML_ERR_ERROR)
+		return;
+	add_message(ctx, error->line, error->int2, CD_SEVERITY_ERROR,
+			"Malformed control mapping file encountered. Unable to parse: %s",
+			error->message);
+}
 
-	// Free the document tree if there was an error
-	if(ret) {
-		xmlFreeDoc(doc);
-		doc = NULL;
-	}
 
-	// Return the document (or NULL if there was an error)
-	*xml_doc = doc;
-	
-	// Clean up
-	xmlFreeParserCtxt(parser);
+/**
+ * Parse a @c meta element by filling in the corresponding info structure.
+ */
+static CResult parse_meta (xmlTextReader *reader, ParseContext *ctx)
+{
+	RecordField fields[] = {
+		{ .path = "version" },
+		{ .path = "revision" },
+		{ .path = "author" },
+		{ .path = "contact" },
+		{ .path = "copyright" },
+	};
+	const unsigned int count = sizeof(fields) / sizeof(fields[0]);
+
+	// Only collect the fields if the meta information is required and has not been
+	// retrieved from a previous file yet
+	int wanted = ctx->info && ctx->info->flags & CD_RETRIEVE_META_INFO && !ctx->have_meta;
+	CResult ret = read_record(reader, fields, wanted ? count : 0);
+	if(ret || !wanted)
+		goto done;
+	ctx->have_meta = 1;
+
+	// Copy the version and revision numbers
+	if(fields[0].text)
+		string_to_version((char *)fields[0].text,
+				&ctx->info->meta.version.major, &ctx->info->meta.version.minor);
+	if(fields[1].text)
+		string_to_version((char *)fields[1].text,
+				&ctx->info->meta.revision.major, &ctx->info->meta.revision.minor);
+
+	// Copy the strings for author (normalized), contact, and copyright
+	ctx->info->meta.author = unicode_to_normalized_ascii(fields[2].text, ctx);
+	ctx->info->meta.contact = unicode_to_ascii(fields[3].text, ctx);
+	ctx->info->meta.copyright = unicode_to_ascii(fields[4].text, ctx);
 
+done:
+	free_record(fields, count);
 	return ret;
 }
 
 
 /**
- * Process a @c mapping node and add the contained mapping to the UVC driver.
+ * Parse a @c constant element by adding the contained constant to an internal list.
  */
-static CResult process_mapping (const xmlNode *node_mapping, ParseContext *ctx)
+static CResult parse_constant (xmlTextReader *reader, ParseContext *ctx)
 {
-	CResult ret;
-	assert(node_mapping);
+	RecordField fields[] = {
+		{ .path = "@type" },
+		{ .path = "id" },
+		{ .path = "value" },
+	};
+	const unsigned int count = sizeof(fields) / sizeof(fields[0]);
+	const xmlChar *type = NULL, *value = NULL;
+	int line = xml_reader_get_line(reader);
 
-	struct uvc_xu_control_mapping mapping_info = { 0 };
+	// Allocate memory for the constant list element
+	Constant *constant = (Constant *)malloc(sizeof(Constant));
+	if(!constant) return C_NO_MEMORY;
+	memset(constant, 0, sizeof(*constant));
 
-	// At the moment only V4L2 mappings are supported
-	xmlNode *node_v4l2 = xml_get_first_child_by_name(node_mapping, "v4l2");
-	if(!node_v4l2) {
-		// TODO implement
-		return C_NOT_IMPLEMENTED;
-	}
+	CResult ret = read_record(reader, fields, count);
+	if(ret) goto done;
+	type = fields[0].text;
+	value = fields[2].text;
 
-	// Search for the node containing UVC information
-	xmlNode *node_uvc = xml_get_first_child_by_name(node_mapping, "uvc");
-	if(!node_uvc) {
-		add_error_at_node(ctx, node_mapping,
-			"Mapping does not have UVC information. <uvc> is mandatory.");
-		return C_PARSE_ERROR;
+	// Read and convert the name
+	constant->name = UNICODE_TO_ASCII(fields[1].text);
+	if(!constant->name) {
+		add_error_at_line(ctx, line, "Constant has no name. <id> is mandatory.");
+		ret = C_PARSE_ERROR;
+		goto done;
 	}
+	constant->file = ctx->file_count;
 
-	// Look up the referenced control definition and fill in the UVC fields of
-	// the uvc_xu_control_mapping structure.
-	xmlNode *node_control_ref = xml_get_first_child_by_name(node_uvc, "control_ref");
-	if(!node_control_ref) {
-		add_error_at_node(ctx, node_uvc,
-			"Control reference missing. <control_ref> is mandatory.");
-		return C_PARSE_ERROR;
-	}
-	xmlChar *control_ref = xmlGetProp(node_control_ref, BAD_CAST("idref"));
-	if(!control_ref) {
-		add_error_at_node(ctx, node_control_ref,
-			"Invalid control reference. 'idref' attribute referencing a <control> is mandatory.");
-		return C_PARSE_ERROR;
+	// Read the type of the constant
+	if(xmlStrEqual(type, BAD_CAST("integer"))) {
+		constant->type = CT_INTEGER;
 	}
-	UVCXUControl *control = lookup_control(control_ref, ctx);
-	if(!control) {
-		add_error_at_node(ctx, node_control_ref,
-			"Invalid control reference: control with ID '%s' could not be found.", (char *)control_ref);
-		xmlFree(control_ref);
-		return C_PARSE_ERROR;
+	else if(xmlStrEqual(type, BAD_CAST("guid"))) {
+		constant->type = CT_GUID;
 	}
-	xmlFree(control_ref); control_ref = NULL;
-	memcpy(mapping_info.entity, control->info.entity, GUID_SIZE);
-	mapping_info.selector = control->info.selector;
 
-	// Copy the descriptive name (truncate if it's too long for V4L2/uvcvideo)
-	char *name = UNICODE_TO_NORM_ASCII(xml_get_node_text(xml_get_first_child_by_name(node_mapping, "name")));
-	if(!name) {
-		add_error_at_node(ctx, node_mapping,
-			"Control mapping has no name. <name> is mandatory.");
-		return C_PARSE_ERROR;
-	}
-	strncpy((char *)mapping_info.name, name, sizeof(mapping_info.name) - 1);
-	mapping_info.name[sizeof(mapping_info.name) - 1] = '\0';
-	free(name);
-	name = NULL;
+	// Read the value of the constant
+	switch(constant->type) {
+		case CT_INTEGER:
+			if(!is_valid_integer_string((char *)value, &constant->value)) {
+				add_error_at_line(ctx, fields[2].present ? fields[2].line : line,
+					"Integer constant %s has invalid value '%s'.", constant->name,
+					value ? (char *)value : "<empty>");
+				ret = C_PARSE_ERROR;
+				goto done;
+			}
+			break;
 
-	// Fill in the V4L2 fields of the uvc_xu_control_mapping structure
-	int value = 0;
-	const xmlChar *text = xml_get_node_text(xml_get_first_child_by_name(node_v4l2, "id"));
-	ret = lookup_or_convert_to_integer(text, &value, ctx);
-	if(ret) {
-		add_error_at_node(ctx, node_v4l2,
-			"V4L2 ID contains invalid number or references unknown constant: '%s'",
-			text ? (char *)text : "<empty>");
-		return C_PARSE_ERROR;
-	}
-	mapping_info.id = (__u32)value;
-	text = xml_get_node_text(xml_get_first_child_by_name(node_v4l2, "v4l2_type"));
-	enum v4l2_ctrl_type v4l2_type = get_v4l2_ctrl_type_by_name(text);
-	if(v4l2_type == 0) {
-		add_error_at_node(ctx, node_v4l2,
-			"Invalid V4L2 control type specified: '%s'",
-			text ? (char *)text : "<empty>");
-		return C_PARSE_ERROR;
-	}
-	mapping_info.v4l2_type = v4l2_type;
+		case CT_GUID:
+			if(!value || !is_valid_guid((char *)value)) {
+				add_error_at_line(ctx, fields[2].present ? fields[2].line : line,
+					"GUID constant %s has invalid value '%s'.", constant->name,
+					value ? (char *)value : "<empty>");
+				ret = C_PARSE_ERROR;
+				goto done;
+			}
+			guid_to_byte_array((char *)value, constant->guid);
+			break;
 
-	// Fill in the remaining UVC fields of the uvc_xu_control_mappings structure
-	char *string = UNICODE_TO_ASCII(xml_get_node_text(xml_get_first_child_by_name(node_uvc, "size")));
-	if(!is_valid_size_string(string, &value, 0xFF)) {
-		add_error_at_node(ctx, node_v4l2,
-			"Invalid UVC control size specified: '%s'",
-			string ? string : "<empty>");
-		return C_PARSE_ERROR;
+		default:
+			add_error_at_line(ctx, line,
+				"Constant has unknown type '%s' (must be 'integer' or 'guid').",
+				type ? (char *)type : "<empty>");
+			ret = C_PARSE_ERROR;
+			goto done;
+			break;
 	}
-	mapping_info.size = value;
-	free(string);
 
-	string = UNICODE_TO_ASCII(xml_get_node_text(xml_get_first_child_by_name(node_uvc, "offset")));
-	if(!is_valid_size_string(string, &value, 0xFF)) {
-		add_error_at_node(ctx, node_v4l2,
-			"Invalid UVC control offset specified: '%s'",
-			string ? string : "<empty>");
-		return C_PARSE_ERROR;
+	// All files share one namespace for constants. Identical definitions in different
+	// files are merged silently, all other redefinitions are ignored.
+	Constant *existing = lookup_constant(constant->name, CT_INVALID, ctx);
+	if(existing) {
+		if(existing->file != constant->file && existing->type == constant->type
+				&& (constant->type == CT_INTEGER
+					? existing->value == constant->value
+					: memcmp(existing->guid, constant->guid, GUID_SIZE) == 0))
+			goto done;
+		add_error_at_line(ctx, line,
+			"Constant '%s' has already been defined. Ignoring redefinition.", constant->name);
+		ret = C_PARSE_ERROR;
+		goto done;
 	}
-	mapping_info.offset = value;
-	free(string);
 
-	text = xml_get_node_text(xml_get_first_child_by_name(node_uvc, "uvc_type"));
-	enum uvc_control_data_type uvc_type = get_uvc_ctrl_type_by_name(xml_get_node_text(xml_get_first_child_by_name(node_uvc, "uvc_type")));
-	if(uvc_type == -1) {
-		add_error_at_node(ctx, node_v4l2,
-			"Invalid UVC control type specified: '%s'",
-			text ? (char *)text : "<empty>");
-		return C_PARSE_ERROR;
-	}
-	mapping_info.data_type = uvc_type;
+	// Add the constant to the internal list and index for later reference
+	constant->next = ctx->constants;
+	ctx->constants = constant;
+	if(hash_table_insert(&ctx->constants_index, constant->name, constant))
+		ret = C_NO_MEMORY;
 
-	// Add the control to the UVC driver's control list
-	/*
-	printf(
-		"uvc_xu_control_mapping = {\n"
-		"	id        = 0x%08x,\n"
-		"	name      = '%s',\n"
-		"	entity    = {" GUID_FORMAT "},\n"
-		"	selector  = %u,\n"
-		"	size      = %u,\n"
-		"	offset    = %u,\n"
-		"	v4l2_type = %u,\n"
-		"	data_type = %u\n"
-		"}\n",
-		mapping_info.id,
-		mapping_info.name,
-		GUID_ARGS(mapping_info.entity),
-		mapping_info.selector,
-		mapping_info.size,
-		mapping_info.offset,
-		mapping_info.v4l2_type,
-		mapping_info.data_type
-	);
-	*/
-	int v4l2_ret = ioctl(ctx->v4l2_handle, UVCIOC_CTRL_MAP, &mapping_info);
-	if(v4l2_ret != 0
-#ifdef DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
-			&& (ctx->pass == 1 || errno != EEXIST)
-#endif
-		)
-	{
-		add_error(ctx,
-			"%s: unable to map '%s' control. ioctl(UVCIOC_CTRL_MAP) failed with return value %d (error %d: %s)",
-			GET_HANDLE(ctx->handle).device->v4l2_name,
-			mapping_info.name, v4l2_ret, errno, strerror(errno));
-		return C_V4L2_ERROR;
+done:
+	// Clean up
+	free_record(fields, count);
+	if(constant != ctx->constants) {
+		free(constant->name);
+		free(constant);
 	}
 
+	return ret;
+}
+
+
+/**
+ * Parse a @c device element by adding an empty device filter to an internal list.
+ *
+ * The filter is completed by the contained @c match elements and applies to the
+ * contained @c control elements.
+ */
+static CResult parse_device (ParseContext *ctx)
+{
+	DeviceFilter *filter = (DeviceFilter *)malloc(sizeof(DeviceFilter));
+	if(!filter)
+		return C_NO_MEMORY;
+	memset(filter, 0, sizeof(*filter));
+
+	filter->next = ctx->filters;
+	ctx->filters = filter;
 	return C_SUCCESS;
 }
 
 
 /**
- * Process a @c mappings node.
+ * Appends a USB ID to a dynamically allocated array.
  */
-static CResult process_mappings (const xmlNode *node_mappings, ParseContext *ctx)
+static CResult append_usb_id (unsigned short **ids, unsigned int *count, unsigned short id)
 {
-	assert(node_mappings);
+	unsigned short *new_ids = (unsigned short *)realloc(*ids, (*count + 1) * sizeof(**ids));
+	if(!new_ids)
+		return C_NO_MEMORY;
+	new_ids[(*count)++] = id;
+	*ids = new_ids;
+	return C_SUCCESS;
+}
 
-	// Process all <mapping> nodes
-	xmlNode *node_mapping = xml_get_first_child_by_name(node_mappings, "mapping");
-	while(node_mapping) {
-		CResult ret = process_mapping(node_mapping, ctx);
-		if(ctx->info) {
-			if(ret)
-				ctx->info->stats.mappings.successful++;
-			else
-				ctx->info->stats.mappings.failed++;
+
+/**
+ * Parse a @c match element and add the contained match rule to the filter of the
+ * current device.
+ *
+ * The XML reader must be positioned on the start of the @c match element. When the
+ * function returns, it is positioned on its end.
+ */
+static CResult parse_match (xmlTextReader *reader, ParseContext *ctx)
+{
+	CResult ret = C_SUCCESS;
+	int has_vendor = 0;
+	int depth = xmlTextReaderDepth(reader);
+	int line = xml_reader_get_line(reader);
+	assert(ctx->filters);
+
+	DeviceMatch *match = (DeviceMatch *)malloc(sizeof(DeviceMatch));
+	if(!match)
+		return C_NO_MEMORY;
+	memset(match, 0, sizeof(*match));
+
+	// Read the vendor_id, product_id, and release child elements
+	int status = 1;
+	if(!xmlTextReaderIsEmptyElement(reader)) {
+		while((status = xmlTextReaderRead(reader)) == 1) {
+			int type = xmlTextReaderNodeType(reader);
+			if(type == XML_READER_TYPE_END_ELEMENT && xmlTextReaderDepth(reader) == depth)
+				break;
+			if(type != XML_READER_TYPE_ELEMENT || xmlTextReaderDepth(reader) != depth + 1)
+				continue;
+
+			const char *name = (const char *)xmlTextReaderConstLocalName(reader);
+			int is_vendor = strcmp(name, "vendor_id") == 0;
+			int is_product = strcmp(name, "product_id") == 0;
+			int is_release = strcmp(name, "release") == 0;
+			if(!is_vendor && !is_product && !is_release)
+				continue;
+
+			unsigned short id = 0;
+			xmlChar *text = xmlTextReaderReadString(reader);
+			if(!is_valid_usb_id_string((char *)text, &id)) {
+				add_error_at_line(ctx, xml_reader_get_line(reader),
+					"Invalid USB ID specified in <%s>: '%s'", name,
+					text ? (char *)text : "<empty>");
+				if(ret == C_SUCCESS)
+					ret = C_PARSE_ERROR;
+			}
+			else if(is_vendor) {
+				match->vendor = id;
+				has_vendor = 1;
+			}
+			else if(is_product) {
+				if(append_usb_id(&match->products, &match->product_count, id))
+					ret = C_NO_MEMORY;
+			}
+			else {
+				if(append_usb_id(&match->releases, &match->release_count, id))
+					ret = C_NO_MEMORY;
+			}
+			if(text)
+				xmlFree(text);
 		}
-		node_mapping = xml_get_next_sibling_by_name(node_mapping, "mapping");
+	}
+	if(status != 1) {
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	if(ret == C_SUCCESS && !has_vendor) {
+		add_error_at_line(ctx, line,
+			"Device match has no vendor ID. <vendor_id> is mandatory.");
+		ret = C_PARSE_ERROR;
+	}
+	if(ret) {
+		// A broken rule matches no device
+		match->vendor = 0;
+		match->product_count = 0;
+		match->release_count = 0;
 	}
 
-	return C_SUCCESS;
+	// Add the rule to the filter of the current device
+	match->next = ctx->filters->matches;
+	ctx->filters->matches = match;
+	match = NULL;
+
+done:
+	if(match) {
+		free(match->products);
+		free(match->releases);
+		free(match);
+	}
+	return ret;
 }
 
 
 /**
- * Process a @c control node by adding the contained control to the UVC driver.
+ * Checks whether a control applies to the device with the given USB information.
+ *
+ * Controls without match rules apply to all devices. If the USB IDs of a device are
+ * unknown, the rules cannot be evaluated and the device is assumed to match.
  */
-static CResult process_control (xmlNode *node_control, ParseContext *ctx)
+static int control_matches_device (const UVCXUControl *xu_control, const CUSBInfo *usb)
 {
-	CResult ret = C_SUCCESS;
-	assert(node_control);
+	if(!xu_control->filter || !xu_control->filter->matches)
+		return 1;
+	if(!usb || (usb->vendor == 0 && usb->product == 0))
+		return 1;
+
+	const DeviceMatch *match;
+	for(match = xu_control->filter->matches; match; match = match->next) {
+		unsigned int i;
+		if(match->vendor != usb->vendor)
+			continue;
+
+		for(i = 0; i < match->product_count; i++) {
+			if(match->products[i] == usb->product)
+				break;
+		}
+		if(match->product_count && i == match->product_count)
+			continue;
+
+		for(i = 0; i < match->release_count; i++) {
+			if(match->releases[i] == usb->release)
+				break;
+		}
+		if(match->release_count && i == match->release_count)
+			continue;
+
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Checks whether an earlier definition of the same driver control applies to the device
+ * with the given USB information, in which case the control has already been added.
+ */
+static int control_is_duplicate (const UVCXUControl *xu_control, const CUSBInfo *usb)
+{
+	const UVCXUControl *previous;
+	for(previous = xu_control->duplicate_of; previous; previous = previous->duplicate_of) {
+		if(control_matches_device(previous, usb))
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Checks whether an earlier mapping for the same V4L2 ID applies to the device with the
+ * given USB information, in which case the V4L2 control has already been mapped.
+ */
+static int mapping_is_duplicate (const UVCXUMapping *mapping, const CUSBInfo *usb)
+{
+	const UVCXUMapping *previous;
+	for(previous = mapping->duplicate_of; previous; previous = previous->duplicate_of) {
+		if(control_matches_device(previous->control, usb))
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Checks whether at least one of the parsed controls applies to the device with the
+ * given USB information.
+ *
+ * If there are no controls at all, the device is considered a match.
+ */
+static int config_matches_device (const ParseContext *ctx, const CUSBInfo *usb)
+{
+	if(!ctx->controls)
+		return 1;
+
+	const UVCXUControl *xu_control;
+	for(xu_control = ctx->controls; xu_control; xu_control = xu_control->next) {
+		if(control_matches_device(xu_control, usb))
+			return 1;
+	}
+	return 0;
+}
+
 
+/**
+ * Parse a @c control element and add the contained control to an internal list.
+ */
+static CResult parse_control (xmlTextReader *reader, ParseContext *ctx)
+{
+	RecordField fields[] = {
+		{ .path = "@id" },
+		{ .path = "entity" },
+		{ .path = "selector" },
+		{ .path = "size" },
+	};
+	const unsigned int count = sizeof(fields) / sizeof(fields[0]);
 	const xmlChar *text = NULL;
 	int value = 0;
+	int line = xml_reader_get_line(reader);
 
 	// Allocate memory for the extension unit control definition
 	UVCXUControl *xu_control = (UVCXUControl *)malloc(sizeof(UVCXUControl));
@@ -1172,30 +1944,34 @@ static CResult process_control (xmlNode *node_control, ParseContext *ctx)
 		return C_NO_MEMORY;
 	memset(xu_control, 0, sizeof *xu_control);
 
+	CResult ret = read_record(reader, fields, count);
+	if(ret) goto done;
+
 	// Get the ID of the extension unit control definition
-	xu_control->id = xmlGetProp(node_control, BAD_CAST("id"));
+	xu_control->id = fields[0].text;
+	fields[0].text = NULL;
 	if(!xu_control->id) {
-		add_error_at_node(ctx, node_control,
+		add_error_at_line(ctx, line,
 			"Control has no ID. 'id' attribute is mandatory.");
 		ret = C_PARSE_ERROR;
 		goto done;
 	}
 
 	// Retrieve the entity and check whether it's a constant or a GUID
-	text = xml_get_node_text(xml_get_first_child_by_name(node_control, "entity"));
+	text = fields[1].text;
 	ret = lookup_or_convert_to_guid(text, xu_control->info.entity, ctx);
 	if(ret) {
-		add_error_at_node(ctx, node_control,
+		add_error_at_line(ctx, line,
 			"Control entity contains invalid GUID or references unknown constant: '%s'",
 			text ? (char *)text : "<empty>");
 		goto done;
 	}
 
 	// Retrieve the selector and check whether it's a constant or a GUID
-	text = xml_get_node_text(xml_get_first_child_by_name(node_control, "selector"));
+	text = fields[2].text;
 	ret = lookup_or_convert_to_integer(text, &value, ctx);
 	if(ret) {
-		add_error_at_node(ctx, node_control,
+		add_error_at_line(ctx, line,
 			"Control selector contains invalid number or references unknown constant: '%s'",
 			text ? (char *)text : "<empty>");
 		goto done;
@@ -1203,60 +1979,45 @@ static CResult process_control (xmlNode *node_control, ParseContext *ctx)
 	xu_control->info.selector = (__u8)value;
 
 	// Retrieve the size
-	text = xml_get_node_text(xml_get_first_child_by_name(node_control, "size"));
+	text = fields[3].text;
 	ret = lookup_or_convert_to_integer(text, &value, ctx);
 	if(ret || !is_valid_size(value, 0xFFFF)) {
-		add_error_at_node(ctx, node_control,
+		add_error_at_line(ctx, line,
 			"Invalid control size specified: '%s'", text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
 		goto done;
 	}
 	xu_control->info.size = (__u16)value;
 
-	// Map the control to the UVC driver's control list
-	/*
-	printf(
-		"uvc_xu_control_mapping = {\n"
-		"	entity   = {" GUID_FORMAT "},\n"
-		"	index    = %u,\n"
-		"	selector = %u,\n"
-		"	size     = %u,\n"
-		"	flags    = %u\n"
-		"}\n",
-		GUID_ARGS(xu_control->info.entity),
-		xu_control->info.index,
-		xu_control->info.selector,
-		xu_control->info.size,
-		xu_control->info.flags
-	);
-	*/
-	int v4l2_ret = ioctl(ctx->v4l2_handle, UVCIOC_CTRL_MAP, &xu_control->info);
-	if(v4l2_ret != 0
-#ifdef DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
-			&& (ctx->pass == 1 || errno != EEXIST)
-#endif
-		)
-	{
-		add_error(ctx,
-			"%s: unable to add control with GUID {"GUID_FORMAT"} and selector %d. "
-			"ioctl(UVCIOC_CTRL_MAP) failed with return value %d (error %d: %s)",
-			GET_HANDLE(ctx->handle).device->v4l2_name,
-			GUID_ARGS(xu_control->info.entity), xu_control->info.selector,
-			v4l2_ret, errno, strerror(errno));
-		ret = C_V4L2_ERROR;
+	// The match rules of the enclosing device element determine where the control applies
+	xu_control->filter = ctx->filters;
+
+	// Link the control to an earlier definition of the same driver control, if any, so that
+	// it is only added once per device
+	snprintf(xu_control->key, sizeof(xu_control->key), "%02x%02x%02x%02x%02x%02x%02x%02x"
+			"%02x%02x%02x%02x%02x%02x%02x%02x:%02x",
+			GUID_ARGS(xu_control->info.entity), xu_control->info.selector);
+	xu_control->duplicate_of = (UVCXUControl *)hash_table_lookup(&ctx->control_keys, xu_control->key);
+	if(xu_control->duplicate_of && xu_control->duplicate_of->info.size != xu_control->info.size) {
+		add_warning_at_line(ctx, line,
+			"Control '%s' redefines the control with GUID {"GUID_FORMAT"} and selector %d "
+			"with a different size. The first definition takes precedence.",
+			(char *)xu_control->id, GUID_ARGS(xu_control->info.entity), xu_control->info.selector);
 	}
 
-	// Add the extension unit control definition to the internal list for later
-	// reference by mappings.
-	// Note that we add controls to the list whether or not the UVCIOC_CTRL_MAP above
-	// succeeded or not. The control might already exist in the driver but a referencing
-	// mapping might not, but the mapping needs to be able to look up the control.
+	// Add the extension unit control definition to the internal list. The controls are
+	// added to the driver later and are also looked up by the mappings.
 	xu_control->next = ctx->controls;
 	ctx->controls = xu_control;
+	if(hash_table_insert(&ctx->controls_index, (const char *)xu_control->id, xu_control)
+			|| hash_table_insert(&ctx->control_keys, xu_control->key, xu_control))
+		ret = C_NO_MEMORY;
 
 done:
-	if(xu_control && xu_control != ctx->controls) {	// Only free xu_control if it was not added
-		if(xu_control->id)							// to the list.
-			free(xu_control->id);
+	free_record(fields, count);
+	if(xu_control != ctx->controls) {		// Only free xu_control if it was not added
+		if(xu_control->id)					// to the list.
+			xmlFree(xu_control->id);
 		free(xu_control);
 	}
 	return ret;
@@ -1264,500 +2025,1708 @@ done:
 
 
 /**
- * Process a @c controls node.
- */
-static CResult process_controls (const xmlNode *node_controls, ParseContext *ctx)
-{
-	assert(node_controls);
-
-	// Process all <control> nodes
-	xmlNode *node_control = xml_get_first_child_by_name(node_controls, "control");
-	while(node_control) {
-		CResult ret = process_control(node_control, ctx);
-		if(ctx->info) {
-			if(ret)
-				ctx->info->stats.controls.successful++;
-			else
-				ctx->info->stats.controls.failed++;
-		}
-		node_control = xml_get_next_sibling_by_name(node_control, "control");
-	}
-
-	return C_SUCCESS;
-}
-
-
-/**
- * Process a @c device node.
- *
- * Note that the contained @c match sections are currently ignored.
+ * Parse a @c mapping element and add the contained mapping to an internal list.
  */
-static CResult process_device (const xmlNode *node_device, ParseContext *ctx)
+static CResult parse_mapping (xmlTextReader *reader, ParseContext *ctx)
 {
-	assert(node_device);
-
-	// Process the <controls> node
-	xmlNode *node_controls = xml_get_first_child_by_name(node_device, "controls");
-	if(node_controls)
-		process_controls(node_controls, ctx);
-
-	return C_SUCCESS;
-}
+	RecordField fields[] = {
+		{ .path = "name" },
+		{ .path = "uvc" },
+		{ .path = "uvc/control_ref" },
+		{ .path = "uvc/control_ref@idref" },
+		{ .path = "uvc/size" },
+		{ .path = "uvc/offset" },
+		{ .path = "uvc/uvc_type" },
+		{ .path = "v4l2" },
+		{ .path = "v4l2/id" },
+		{ .path = "v4l2/v4l2_type" },
+	};
+	const unsigned int count = sizeof(fields) / sizeof(fields[0]);
+	RecordField *field_uvc = &fields[1], *field_control_ref = &fields[2], *field_v4l2 = &fields[7];
+	const xmlChar *text = NULL;
+	char *name = NULL;
+	int value = 0;
+	int line = xml_reader_get_line(reader);
 
+	// Allocate memory for the mapping
+	UVCXUMapping *mapping = (UVCXUMapping *)malloc(sizeof(UVCXUMapping));
+	if(!mapping)
+		return C_NO_MEMORY;
+	memset(mapping, 0, sizeof(*mapping));
+	struct uvc_xu_control_mapping *mapping_info = &mapping->info;
 
-/**
- * Process a @c devices node.
- */
-static CResult process_devices (const xmlNode *node_devices, ParseContext *ctx)
-{
-	assert(node_devices);
+	CResult ret = read_record(reader, fields, count);
+	if(ret) goto done;
 
-	// Process all <device> nodes
-	xmlNode *node_device = xml_get_first_child_by_name(node_devices, "device");
-	while(node_device) {
-		process_device(node_device, ctx);
-		node_device = xml_get_next_sibling_by_name(node_device, "device");
+	// At the moment only V4L2 mappings are supported
+	if(!field_v4l2->present) {
+		// TODO implement
+		ret = C_NOT_IMPLEMENTED;
+		goto done;
 	}
 
-	return C_SUCCESS;
-}
+	// Search for the node containing UVC information
+	if(!field_uvc->present) {
+		add_error_at_line(ctx, line,
+			"Mapping does not have UVC information. <uvc> is mandatory.");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+
+	// Look up the referenced control definition and fill in the UVC fields of
+	// the uvc_xu_control_mapping structure.
+	if(!field_control_ref->present) {
+		add_error_at_line(ctx, field_uvc->line,
+			"Control reference missing. <control_ref> is mandatory.");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	text = fields[3].text;
+	if(!text) {
+		add_error_at_line(ctx, field_control_ref->line,
+			"Invalid control reference. 'idref' attribute referencing a <control> is mandatory.");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	UVCXUControl *control = lookup_control(text, ctx);
+	if(!control) {
+		add_error_at_line(ctx, field_control_ref->line,
+			"Invalid control reference: control with ID '%s' could not be found.", (char *)text);
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	memcpy(mapping_info->entity, control->info.entity, GUID_SIZE);
+	mapping_info->selector = control->info.selector;
+	mapping->control = control;
+
+	// Copy the descriptive name (truncate if it's too long for V4L2/uvcvideo)
+	name = UNICODE_TO_NORM_ASCII(fields[0].text);
+	if(!name) {
+		add_error_at_line(ctx, line,
+			"Control mapping has no name. <name> is mandatory.");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	strncpy((char *)mapping_info->name, name, sizeof(mapping_info->name) - 1);
+	mapping_info->name[sizeof(mapping_info->name) - 1] = '\0';
+
+	// Fill in the V4L2 fields of the uvc_xu_control_mapping structure
+	text = fields[8].text;
+	ret = lookup_or_convert_to_integer(text, &value, ctx);
+	if(ret) {
+		add_error_at_line(ctx, field_v4l2->line,
+			"V4L2 ID contains invalid number or references unknown constant: '%s'",
+			text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	mapping_info->id = (__u32)value;
+	text = fields[9].text;
+	enum v4l2_ctrl_type v4l2_type = get_v4l2_ctrl_type_by_name(text);
+	if(v4l2_type == 0) {
+		add_error_at_line(ctx, field_v4l2->line,
+			"Invalid V4L2 control type specified: '%s'",
+			text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	mapping_info->v4l2_type = v4l2_type;
+
+	// Fill in the remaining UVC fields of the uvc_xu_control_mappings structure
+	text = fields[4].text;
+	if(!is_valid_size_string((char *)text, &value, 0xFF)) {
+		add_error_at_line(ctx, field_v4l2->line,
+			"Invalid UVC control size specified: '%s'",
+			text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	mapping_info->size = value;
+
+	text = fields[5].text;
+	if(!is_valid_size_string((char *)text, &value, 0xFF)) {
+		add_error_at_line(ctx, field_v4l2->line,
+			"Invalid UVC control offset specified: '%s'",
+			text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	mapping_info->offset = value;
+
+	text = fields[6].text;
+	enum uvc_control_data_type uvc_type = get_uvc_ctrl_type_by_name(text);
+	if(uvc_type == -1) {
+		add_error_at_line(ctx, field_v4l2->line,
+			"Invalid UVC control type specified: '%s'",
+			text ? (char *)text : "<empty>");
+		ret = C_PARSE_ERROR;
+		goto done;
+	}
+	mapping_info->data_type = uvc_type;
+
+	// Link the mapping to an earlier mapping for the same V4L2 ID, if any, so that
+	// the V4L2 control is only mapped once per device
+	snprintf(mapping->key, sizeof(mapping->key), "%08x", mapping_info->id);
+	mapping->duplicate_of = (UVCXUMapping *)hash_table_lookup(&ctx->mapping_keys, mapping->key);
+	if(mapping->duplicate_of && (
+			memcmp(mapping->duplicate_of->info.entity, mapping_info->entity, GUID_SIZE) != 0
+			|| mapping->duplicate_of->info.selector != mapping_info->selector
+			|| mapping->duplicate_of->info.size != mapping_info->size
+			|| mapping->duplicate_of->info.offset != mapping_info->offset)) {
+		add_warning_at_line(ctx, line,
+			"Mapping '%s' redefines the V4L2 control 0x%08x with a different UVC control. "
+			"The first definition takes precedence.",
+			(char *)mapping_info->name, mapping_info->id);
+	}
+
+	// Add the mapping to the internal list. The mappings are added to the driver later.
+	mapping->next = ctx->mappings;
+	ctx->mappings = mapping;
+	if(hash_table_insert(&ctx->mapping_keys, mapping->key, mapping))
+		ret = C_NO_MEMORY;
+
+done:
+	free_record(fields, count);
+	if(name) free(name);
+	if(mapping != ctx->mappings)	// Only free the mapping if it was not added to the list
+		free(mapping);
+	return ret;
+}
+
+
+/**
+ * Counts the result of processing a list element in the given statistics structure.
+ */
+static void count_result (CResult result, CDynctrlInfoListStats *stats)
+{
+	if(result == C_SUCCESS)
+		stats->successful++;
+	else
+		stats->failed++;
+}
+
+
+/**
+ * Parse a dynamic controls configuration XML file and store its contents in the parse context.
+ *
+ * The file is read with a streaming XML reader and the @c constant, @c control, and
+ * @c mapping elements are converted into their compact internal representation as they
+ * arrive. No document tree is built, so memory use does not depend on the size of the
+ * file apart from the resulting lists. Note that constants must be defined before they
+ * are referenced and controls before the mappings that reference them, as is the case in
+ * files that conform to the schema.
+ *
+ * Multiple files can be parsed into the same context. Constants are shared between the
+ * files whereas control IDs are only valid within the file that defines them. The lists
+ * are built in reverse order and must be reversed with reverse_parsed_lists() once all
+ * files have been parsed.
+ *
+ * @param file_name		name (with an optional path) of the file to be parsed
+ * @param ctx			current parse context
+ *
+ * @return
+ * 		- C_NO_MEMORY if a buffer or structure could not be allocated
+ * 		- C_PARSE_ERROR if the XML file is malformed
+ * 		- C_SUCCESS if parsing was successful
+ */
+static CResult parse_dynctrl_file (const char *file_name, ParseContext *ctx)
+{
+	CResult ret = C_SUCCESS;
+	xmlTextReader *reader = NULL;
+	ElementPath path;
+	memset(&path, 0, sizeof(path));
+
+	// Messages concern this file from now on and control IDs are local to it
+	ctx->file_name = file_name;
+	ctx->file_count++;
+	hash_table_clear(&ctx->controls_index);
+
+	reader = xmlReaderForFile(file_name, NULL, XML_PARSE_NOBLANKS);
+	if(!reader) {
+		add_error(ctx, "Unable to open control mapping file '%s'.", file_name);
+		return C_PARSE_ERROR;
+	}
+	xmlTextReaderSetStructuredErrorHandler(reader, parse_error_handler, ctx);
+
+	// Validate the XML file against the schema
+	if(!ctx->info || !(ctx->info->flags & CD_DONT_VALIDATE)) {
+		// TODO implement
+	}
+
+	// Read the file node by node and process the elements we are interested in.
+	// The path is relative to the root element, whatever its name.
+	int status;
+	while((status = xmlTextReaderRead(reader)) == 1) {
+		int type = xmlTextReaderNodeType(reader);
+		if(xmlTextReaderDepth(reader) == 0)
+			continue;
+		if(type == XML_READER_TYPE_END_ELEMENT) {
+			element_path_pop(&path);
+			continue;
+		}
+		if(type != XML_READER_TYPE_ELEMENT)
+			continue;
+
+		element_path_push(&path, (const char *)xmlTextReaderConstLocalName(reader));
+		if(element_path_is(&path, "devices/device")) {
+			// Start a new filter and descend into the element
+			ret = parse_device(ctx);
+			if(ret)
+				break;
+			if(xmlTextReaderIsEmptyElement(reader))
+				element_path_pop(&path);
+			continue;
+		}
+		else if(element_path_is(&path, "meta")) {
+			ret = parse_meta(reader, ctx);
+		}
+		else if(element_path_is(&path, "devices/device/match")) {
+			ret = parse_match(reader, ctx);
+		}
+		else if(element_path_is(&path, "constants/constant")) {
+			ret = parse_constant(reader, ctx);
+			if(ctx->info)
+				count_result(ret, &ctx->info->stats.constants);
+		}
+		else if(element_path_is(&path, "devices/device/controls/control")) {
+			ret = parse_control(reader, ctx);
+			if(ctx->info && ret)
+				ctx->info->stats.controls.failed++;
+		}
+		else if(element_path_is(&path, "mappings/mapping")) {
+			ret = parse_mapping(reader, ctx);
+			if(ctx->info && ret)
+				ctx->info->stats.mappings.failed++;
+		}
+		else {
+			// Descend into all other elements
+			if(xmlTextReaderIsEmptyElement(reader))
+				element_path_pop(&path);
+			continue;
+		}
+
+		// The element was consumed up to and including its end
+		element_path_pop(&path);
+		if(ret == C_NO_MEMORY)
+			break;
+		ret = C_SUCCESS;
+	}
+	if(status == -1)
+		ret = C_PARSE_ERROR;
+
+	xmlFreeTextReader(reader);
+	return ret;
+}
+
+
+/**
+ * Reverses the lists built by parse_dynctrl_file() so that they are in file order.
+ */
+static void reverse_parsed_lists (ParseContext *ctx)
+{
+	UVCXUControl *controls = NULL;
+	while(ctx->controls) {
+		UVCXUControl *next = ctx->controls->next;
+		ctx->controls->next = controls;
+		controls = ctx->controls;
+		ctx->controls = next;
+	}
+	ctx->controls = controls;
+	UVCXUMapping *mappings = NULL;
+	while(ctx->mappings) {
+		UVCXUMapping *next = ctx->mappings->next;
+		ctx->mappings->next = mappings;
+		mappings = ctx->mappings;
+		ctx->mappings = next;
+	}
+	ctx->mappings = mappings;
+}
+
+
+/**
+ * Add a parsed extension unit control to the UVC driver.
+ */
+static CResult add_control (const UVCXUControl *xu_control, ParseContext *ctx)
+{
+	// Map the control to the UVC driver's control list
+	struct uvc_xu_control_mapping info = xu_control->info;
+	int v4l2_ret = device_ioctl(ctx->stats, ctx->v4l2_handle, UVCIOC_CTRL_MAP, &info);
+	PROBE5(mapping, ctx->device_name, info.id, info.selector, v4l2_ret, v4l2_ret ? errno : 0);
+	if(v4l2_ret != 0
+#ifdef DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
+			&& (ctx->pass == 1 || errno != EEXIST)
+#endif
+		)
+	{
+		add_error(ctx,
+			"%s: unable to add control with GUID {"GUID_FORMAT"} and selector %d. "
+			"ioctl(UVCIOC_CTRL_MAP) failed with return value %d (error %d: %s)",
+			ctx->device_name,
+			GUID_ARGS(xu_control->info.entity), xu_control->info.selector,
+			v4l2_ret, errno, strerror(errno));
+		return C_V4L2_ERROR;
+	}
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Add a parsed control mapping to the UVC driver.
+ */
+static CResult add_mapping (const UVCXUMapping *mapping, ParseContext *ctx)
+{
+	// Add the mapping to the UVC driver's control list
+	struct uvc_xu_control_mapping info = mapping->info;
+	int v4l2_ret = device_ioctl(ctx->stats, ctx->v4l2_handle, UVCIOC_CTRL_MAP, &info);
+	PROBE5(mapping, ctx->device_name, info.id, info.selector, v4l2_ret, v4l2_ret ? errno : 0);
+	if(v4l2_ret != 0
+#ifdef DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
+			&& (ctx->pass == 1 || errno != EEXIST)
+#endif
+		)
+	{
+		add_error(ctx,
+			"%s: unable to map '%s' control. ioctl(UVCIOC_CTRL_MAP) failed with return value %d (error %d: %s)",
+			ctx->device_name,
+			mapping->info.name, v4l2_ret, errno, strerror(errno));
+		return C_V4L2_ERROR;
+	}
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Checks whether the driver behind the current device supports dynamic controls.
+ *
+ * The check is done by redefining the brightness control which is hardcoded in the
+ * UVC driver. If the driver supports dynamic controls, it will return EEXIST.
+ * If the driver does not support dynamic controls, the ioctl will fail with EINVAL.
+ *
+ * @param ctx		current parse context
+ *
+ * @return
+ * 		- #C_SUCCESS if the driver supports dynamic controls
+ * 		- #C_NOT_IMPLEMENTED if the driver does not support dynamic controls
+ */
+static CResult device_supports_dynctrl(ParseContext *ctx)
+{
+	CResult ret = C_SUCCESS;
+	struct uvc_xu_control_mapping xu_control = {
+		.entity		= /* UVC_GUID_UVC_PROCESSING */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01 },
+		.selector	= /* PU_BRIGHTNESS_CONTROL */ 0x02,
+		.size		= 0,
+	};
+	
+	assert(ctx->v4l2_handle);
+
+	int v4l2_ret = device_ioctl(ctx->stats, ctx->v4l2_handle, UVCIOC_CTRL_MAP, &xu_control);
+	if(v4l2_ret == -1) {
+		if(errno == EPERM) {
+			/* User is not root (newer drivers require root permissions) */
+			ret = C_CANNOT_WRITE;
+		}
+		else if(errno == EEXIST) {
+			/* Driver supports dynamic controls */
+		}
+		else {
+			/* Unexpected error: Assume not supported */
+			ret = C_NOT_IMPLEMENTED;
+		}
+	}
+	else {
+		/* Success: Assume not supported */
+		ret = C_NOT_IMPLEMENTED;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Retrieves the IDs of the V4L2 controls that the current device already has.
+ *
+ * The controls are enumerated in a single walk using the V4L2_CTRL_FLAG_NEXT_CTRL flag,
+ * which returns them in ascending order. If the driver does not support the flag, the list
+ * stays empty and all controls and mappings are added as usual.
+ *
+ * @return
+ * 		- #C_NO_MEMORY if the list could not be allocated
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult query_present_controls (ParseContext *ctx)
+{
+#ifdef ENABLE_V4L2_ADVANCED_CONTROL_ENUMERATION
+	struct v4l2_queryctrl v4l2_ctrl;
+	unsigned int size = 0;
+
+	memset(&v4l2_ctrl, 0, sizeof(v4l2_ctrl));
+	v4l2_ctrl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+	while(device_ioctl(ctx->stats, ctx->v4l2_handle, VIDIOC_QUERYCTRL, &v4l2_ctrl) == 0) {
+		// Prevent infinite loops for buggy NEXT_CTRL implementations
+		if(ctx->present_count && v4l2_ctrl.id <= ctx->present_ids[ctx->present_count - 1])
+			break;
+
+		if(ctx->present_count == size) {
+			size = size ? size * 2 : 64;
+			__u32 *ids = (__u32 *)realloc(ctx->present_ids, size * sizeof(__u32));
+			if(!ids)
+				return C_NO_MEMORY;
+			ctx->present_ids = ids;
+		}
+		ctx->present_ids[ctx->present_count++] = v4l2_ctrl.id;
+		v4l2_ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+	}
+#endif
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Compares two V4L2 control IDs for bsearch().
+ */
+static int compare_control_ids (const void *a, const void *b)
+{
+	__u32 id1 = *(const __u32 *)a, id2 = *(const __u32 *)b;
+	return id1 < id2 ? -1 : id1 > id2;
+}
+
+
+/**
+ * Checks whether the V4L2 control of a mapping already exists on the current device.
+ */
+static int mapping_is_present (const UVCXUMapping *mapping, const ParseContext *ctx)
+{
+	return ctx->present_count && bsearch(&mapping->info.id, ctx->present_ids,
+			ctx->present_count, sizeof(__u32), compare_control_ids) != NULL;
+}
+
+
+/**
+ * Add all parsed controls and mappings to the UVC driver of the current device.
+ *
+ * Controls whose match rules exclude the device and the mappings referring to them
+ * are skipped. So are mappings whose V4L2 control the device already has and controls
+ * that are only referenced by such mappings. This makes importing the same configuration
+ * again cheap: If nothing is missing, no UVCIOC_CTRL_MAP ioctl is issued at all.
+ *
+ * @return
+ * 		- #C_NO_MEMORY if a buffer could not be allocated
+ * 		- the return value of device_supports_dynctrl() if anything needs to be added
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult process_dynctrl_config (ParseContext *ctx)
+{
+	CResult ret = C_SUCCESS;
+	HashTable referenced, missing;
+	unsigned int present_mappings = 0, missing_mappings = 0, missing_controls = 0;
+	UVCXUControl *xu_control;
+	UVCXUMapping *mapping;
+
+	memset(&referenced, 0, sizeof(referenced));
+	memset(&missing, 0, sizeof(missing));
+	ctx->pass++;	// We start at pass 1 ...
+
+	// Compare the mappings against the V4L2 controls the device has. Controls are tracked
+	// by their key because duplicate definitions of a control are only added once.
+	for(mapping = ctx->mappings; mapping; mapping = mapping->next) {
+		if(!control_matches_device(mapping->control, ctx->usb)
+				|| mapping_is_duplicate(mapping, ctx->usb))
+			continue;
+		const char *key = mapping->control->key;
+		if(hash_table_insert(&referenced, key, (void *)mapping->control)) {
+			ret = C_NO_MEMORY;
+			goto done;
+		}
+		if(mapping_is_present(mapping, ctx)) {
+			present_mappings++;
+		}
+		else {
+			missing_mappings++;
+			if(hash_table_insert(&missing, key, (void *)mapping->control)) {
+				ret = C_NO_MEMORY;
+				goto done;
+			}
+		}
+	}
+
+	// Controls without mappings cannot be checked, so they are always added
+	for(xu_control = ctx->controls; xu_control; xu_control = xu_control->next) {
+		if(!control_matches_device(xu_control, ctx->usb)
+				|| control_is_duplicate(xu_control, ctx->usb))
+			continue;
+		if(!hash_table_lookup(&referenced, xu_control->key)
+				|| hash_table_lookup(&missing, xu_control->key))
+			missing_controls++;
+	}
+
+	if(present_mappings) {
+		add_info(ctx,
+			"%s: %u of %u mappings are already present and were skipped.",
+			ctx->device_name, present_mappings, present_mappings + missing_mappings
+		);
+	}
+
+	// Only check if the driver supports dynamic controls if anything needs to be added
+	if(missing_controls || missing_mappings) {
+		ret = device_supports_dynctrl(ctx);
+		if(ret) goto done;
+	}
+
+	// Add the controls first because the mappings refer to them
+	for(xu_control = ctx->controls; xu_control; xu_control = xu_control->next) {
+		if(!control_matches_device(xu_control, ctx->usb)
+				|| control_is_duplicate(xu_control, ctx->usb))
+			continue;
+		CResult result = C_SUCCESS;
+		if(!hash_table_lookup(&referenced, xu_control->key)
+				|| hash_table_lookup(&missing, xu_control->key))
+			result = add_control(xu_control, ctx);
+		if(ctx->info)
+			count_result(result, &ctx->info->stats.controls);
+	}
+
+	for(mapping = ctx->mappings; mapping; mapping = mapping->next) {
+		if(!control_matches_device(mapping->control, ctx->usb)
+				|| mapping_is_duplicate(mapping, ctx->usb))
+			continue;
+		CResult result = C_SUCCESS;
+		if(!mapping_is_present(mapping, ctx)) {
+			result = add_mapping(mapping, ctx);
+			if(result == C_SUCCESS)
+				ctx->added_mappings++;
+		}
+		if(ctx->info)
+			count_result(result, &ctx->info->stats.mappings);
+	}
+
+done:
+	hash_table_clear(&referenced);
+	hash_table_clear(&missing);
+	return ret;
+}
+
+
+/** 
+ * Adds the controls and control mappings contained in the parse context to the UVC driver.
+ *
+ * If the parse context does not contain an open V4L2 device handle yet, the device
+ * is opened. The device handle is closed in any case.
+ *
+ * @param ctx		current parse context
+ *
+ * @return
+ * 		- #C_INVALID_DEVICE if the device cannot be opened
+ * 		- #C_CANNOT_WRITE if the user does not have permissions to add the mappings
+ * 		- #C_SUCCESS if adding the controls and control mappings was successful
+ */
+static CResult add_control_mappings (ParseContext *ctx)
+{
+	CResult ret = C_SUCCESS;
+
+	assert(ctx->device_name);
+	ctx->stats = get_device_stats(ctx->device_name);
+
+	// Open the V4L2 device
+	if(!ctx->v4l2_handle) {
+		ctx->v4l2_handle = open_v4l2_device((char *)ctx->device_name);
+		if(ctx->v4l2_handle <= 0) {
+			ctx->v4l2_handle = 0;
+			ret = C_INVALID_DEVICE;
+			goto done;
+		}
+	}
+
+	// Find out which V4L2 controls the device already has
+	ret = query_present_controls(ctx);
+	if(ret) goto done;
+
+	// Process the contained control mappings
+	ctx->added_mappings = 0;
+	ret = process_dynctrl_config(ctx);
+
+	// Make the new controls available to open handles right away. This is not part of
+	// the import itself, so it cannot make the import fail.
+	if(ctx->added_mappings)
+		update_device_controls(ctx->device_name, ctx->v4l2_handle);
+
+done:
+	// Close the device handle
+	if(ctx && ctx->v4l2_handle) {
+		backend_close(ctx->v4l2_handle);
+		ctx->v4l2_handle = 0;
+	}
+	free(ctx->present_ids);
+	ctx->present_ids = NULL;
+	ctx->present_count = 0;
+
+	return ret;
+}
 
 
 /**
- * Process a @c constant node by adding the contained constant to an internal list.
+ * Worker thread that processes device jobs until the queue is empty.
  */
-static CResult process_constant (xmlNode *node_constant, ParseContext *ctx)
+static void *device_job_worker (void *arg)
 {
-	CResult ret = C_SUCCESS;
-	xmlChar *type = NULL;
+	DeviceJobQueue *queue = (DeviceJobQueue *)arg;
 
-	assert(node_constant);
+	for(;;) {
+		pthread_mutex_lock(&queue->mutex);
+		unsigned int index = queue->next++;
+		pthread_mutex_unlock(&queue->mutex);
+		if(index >= queue->count)
+			break;
 
-	// Allocate memory for the constant list element
-	Constant *constant = (Constant *)malloc(sizeof(Constant));
-	if(!constant) return C_NO_MEMORY;
-	memset(constant, 0, sizeof(*constant));
+		DeviceJob *job = &queue->jobs[index];
+		if(job->ctx.device_name && !job->processed) {
+			job->result = add_control_mappings(&job->ctx);
+			job->processed = 1;
+		}
+	}
 
-	// Read and convert the name
-	constant->name = UNICODE_TO_ASCII(xml_get_node_text(xml_get_first_child_by_name(node_constant, "id")));
-	if(!constant->name) {
-		add_error_at_node(ctx, node_constant, "Constant has no name. <id> is mandatory.");
-		ret = C_PARSE_ERROR;
-		goto done;
+	return NULL;
+}
+
+
+/**
+ * Adds the parsed controls and mappings to the devices of the given jobs in parallel.
+ *
+ * Up to DYNCTRL_MAX_WORKERS threads (including the calling one) process the jobs.
+ * Jobs without a device and jobs that were already processed are skipped.
+ * The function returns when all jobs are done. If no threads can be created,
+ * the calling thread processes all jobs by itself.
+ */
+static void run_device_jobs (DeviceJob *jobs, unsigned int count)
+{
+	DeviceJobQueue queue = { .jobs = jobs, .count = count, .next = 0 };
+	pthread_t threads[DYNCTRL_MAX_WORKERS - 1];
+	unsigned int i, thread_count = 0;
+
+	if(pthread_mutex_init(&queue.mutex, NULL)) {
+		// Fall back to processing the jobs one after another
+		for(i = 0; i < count; i++) {
+			if(jobs[i].ctx.device_name && !jobs[i].processed) {
+				jobs[i].result = add_control_mappings(&jobs[i].ctx);
+				jobs[i].processed = 1;
+			}
+		}
+		return;
 	}
-	if(lookup_constant(constant->name, CT_INVALID, ctx)) {
-		add_error_at_node(ctx, node_constant,
-			"Constant '%s' has already been defined. Ignoring redefinition.", constant->name);
-		ret = C_PARSE_ERROR;
-		goto done;
+
+	// Start the additional worker threads and then help out
+	for(i = 0; i + 1 < count && i < DYNCTRL_MAX_WORKERS - 1; i++) {
+		if(pthread_create(&threads[thread_count], NULL, device_job_worker, &queue))
+			break;
+		thread_count++;
 	}
+	device_job_worker(&queue);
 
-	// Read the type of the constant
-	type = xmlGetProp(node_constant, BAD_CAST("type"));
-	if(xmlStrEqual(type, BAD_CAST("integer"))) {
-		constant->type = CT_INTEGER;
+	for(i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&queue.mutex);
+}
+
+
+/**
+ * Prepares the job that adds the parsed controls and mappings to the given device.
+ *
+ * The job gets its own copy of the parse context which shares the parsed lists but has
+ * its own device, message log, and statistics. If the device is not a UVC device or
+ * none of the parsed controls apply to it, the job's device name is left empty and
+ * the reason is logged in the job's message log.
+ */
+static void init_device_job (DeviceJob *job, const ParseContext *ctx, CDevice *device,
+		CDynctrlInfo *info)
+{
+	memset(job, 0, sizeof(*job));
+	job->device = device;
+	job->ctx = *ctx;
+	job->ctx.cd = 0;
+	memset(&job->ctx.log, 0, sizeof(job->ctx.log));
+	job->ctx.info = NULL;
+	if(info) {
+		job->info.flags = info->flags;
+		job->ctx.info = &job->info;
+	}
+
+	// Skip non-UVC devices
+	if(strcmp(device->driver, "uvcvideo") != 0) {
+		add_info(&job->ctx,
+			"device '%s' skipped because it is not a UVC device.",
+			device->shortName
+		);
+		return;
+	}
+
+	// Skip devices that none of the controls apply to before touching them
+	job->ctx.usb = &device->usb;
+	if(!config_matches_device(ctx, &device->usb)) {
+		add_info(&job->ctx,
+			"device '%s' skipped because none of the controls apply to it "
+			"(USB ID %04x:%04x).",
+			device->shortName, device->usb.vendor, device->usb.product
+		);
+		return;
+	}
+
+	job->ctx.device_name = device->shortName;
+}
+
+
+/**
+ * Adds the parsed controls and mappings to the devices of the given jobs and collects
+ * the results.
+ *
+ * The messages and statistics of all jobs are merged into the main parse context
+ * in device order.
+ *
+ * @return
+ * 		- #C_INVALID_DEVICE if the controls could not be added to any device
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult process_device_jobs (ParseContext *ctx, DeviceJob *jobs, unsigned int count,
+		CDynctrlInfo *info)
+{
+	int i, successful_devices = 0;
+
+	// The first device is processed in pass 1, all other ones in later passes
+	DeviceJob *first_job = NULL;
+	for(i = 0; i < count; i++) {
+		if(!jobs[i].ctx.device_name)
+			continue;
+		jobs[i].ctx.pass = first_job ? 1 : 0;
+		if(!first_job)
+			first_job = &jobs[i];
 	}
-	else if(xmlStrEqual(type, BAD_CAST("guid"))) {
-		constant->type = CT_GUID;
+
+	// Add the parsed control mappings to all devices.
+	// If EEXIST errors are only reported for the first pass, the first device needs to be
+	// processed before all other ones. This is required if the driver uses global controls.
+#ifdef DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
+	if(first_job) {
+		first_job->result = add_control_mappings(&first_job->ctx);
+		first_job->processed = 1;
 	}
+#endif
+	run_device_jobs(jobs, count);
 
-	// Read the value of the constant
-	const xmlNode *node_value;
-	const xmlChar *value = xml_get_node_text(node_value = xml_get_first_child_by_name(node_constant, "value"));
-	switch(constant->type) {
-		case CT_INTEGER:
-			if(!is_valid_integer_string((char *)value, &constant->value)) {
-				add_error_at_node(ctx, node_value,
-					"Integer constant %s has invalid value '%s'.", constant->name, (char *)value);
-				ret = C_PARSE_ERROR;
-				goto done;
+	// Collect the results in device order
+	for(i = 0; i < count; i++) {
+		DeviceJob *job = &jobs[i];
+		CDevice *device = job->device;
+
+		if(job->processed) {
+			CResult ret = job->result;
+			if(ret == C_SUCCESS) {
+				successful_devices++;
 			}
-			break;
+			else if(ret == C_INVALID_DEVICE) {
+				add_error(&job->ctx,
+					"device '%s' skipped because it could not be opened.",
+					device->shortName
+				);
+			}
+			else if(ret == C_NOT_IMPLEMENTED) {
+				add_error(&job->ctx,
+					"device '%s' skipped because the driver '%s' behind it does not seem "
+					"to support dynamic controls.",
+					device->shortName, device->driver
+				);
+			}
+			else if(ret == C_CANNOT_WRITE) {
+				add_error(&job->ctx,
+					"device '%s' skipped because you do not have the right permissions. "
+					"Newer driver versions require root permissions.",
+					device->shortName
+				);
+			}
+			else {
+				char *error = c_get_error_text(ret);
+				assert(error);
+				add_error(&job->ctx,
+					"device '%s' was not processed successfully: %s. (Code: %d)",
+					device->shortName, error, ret
+				);
+				free(error);
+			}
+		}
 
-		case CT_GUID:
-			guid_to_byte_array((char *)value, constant->guid);
-			break;
+		// Merge the messages and statistics of the device
+		merge_message_log(&ctx->log, &job->ctx.log);
+		if(info) {
+			info->stats.controls.successful	+= job->info.stats.controls.successful;
+			info->stats.controls.failed		+= job->info.stats.controls.failed;
+			info->stats.mappings.successful	+= job->info.stats.mappings.successful;
+			info->stats.mappings.failed		+= job->info.stats.mappings.failed;
+		}
+	}
 
-		default:
-			add_error_at_node(ctx, node_constant,
-				"Constant has unknown type '%s' (must be 'integer' or 'guid').", (char *)type);
-			ret = C_PARSE_ERROR;
-			goto done;
+	return successful_devices ? C_SUCCESS : C_INVALID_DEVICE;
+}
+
+
+/// Makes sure that libxml2 is initialized only once, even if several threads start
+/// parsing at the same time.
+static pthread_once_t libxml_init_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Allocates a parse context and parses dynamic controls configuration files into it.
+ *
+ * The files are parsed in the given order, so definitions from earlier files take
+ * precedence over duplicates in later ones. A file that cannot be parsed does not stop
+ * the remaining files from being processed.
+ *
+ * Note that the parse context is returned in @a *pctx even if parsing fails, so that the
+ * messages can be passed to the caller. It must be freed with free_parse_context().
+ *
+ * @return
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- the return value of parse_dynctrl_file() if none of the files could be parsed
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult create_parse_context (const char * const *file_names, unsigned int file_count,
+		CDynctrlInfo *info, ParseContext **pctx)
+{
+	CResult ret = C_SUCCESS;
+	unsigned int i, parsed_files = 0;
+
+	pthread_once(&libxml_init_once, xmlInitParser);
+
+	ParseContext *ctx = (ParseContext *)malloc(sizeof(ParseContext));
+	*pctx = ctx;
+	if(!ctx)
+		return C_NO_MEMORY;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->info = info;
+
+	for(i = 0; i < file_count; i++) {
+		ret = parse_dynctrl_file(file_names[i], ctx);
+		if(ret == C_NO_MEMORY)
 			break;
+		if(ret == C_SUCCESS)
+			parsed_files++;
 	}
+	ctx->file_name = NULL;
+	reverse_parsed_lists(ctx);
 
-	// Add the constant to the internal list for later reference
-	constant->next = ctx->constants;
-	ctx->constants = constant;
+	if(parsed_files && ret != C_NO_MEMORY)
+		ret = C_SUCCESS;
+	return ret;
+}
+
+
+/**
+ * Hands the collected messages over to the caller and detaches the caller's info structure
+ * from the parse context, so that the context can be used again for another operation.
+ *
+ * @param ret	result of the operation so far
+ *
+ * @return
+ * 		- #C_NO_MEMORY if the messages could not be passed on and @a ret was #C_SUCCESS
+ * 		- @a ret otherwise
+ */
+static CResult flush_message_log (ParseContext *ctx, CResult ret)
+{
+	if(pack_message_log(ctx) != C_SUCCESS && ret == C_SUCCESS)
+		ret = C_NO_MEMORY;
+	free_message_log(ctx);
+	ctx->info = NULL;
+
+	return ret;
+}
+
+
+/**
+ * Hands the collected messages over to the caller and frees a parse context.
+ *
+ * @param ret	result of the operation so far
+ *
+ * @return
+ * 		- #C_NO_MEMORY if the messages could not be passed on and @a ret was #C_SUCCESS
+ * 		- @a ret otherwise
+ */
+static CResult free_parse_context (ParseContext *ctx, CResult ret)
+{
+	if(!ctx)
+		return ret;
+
+	// Close the conversion descriptor
+	if(ctx->cd && ctx->cd != (iconv_t)-1)
+		iconv_close(ctx->cd);
+
+	// Hand the collected messages over to the caller
+	ret = flush_message_log(ctx, ret);
+
+	// Free the lookup indexes (but not the objects they point to)
+	hash_table_clear(&ctx->constants_index);
+	hash_table_clear(&ctx->controls_index);
+	hash_table_clear(&ctx->control_keys);
+	hash_table_clear(&ctx->mapping_keys);
+
+	// Free the ParseContext.constants list
+	Constant *celem = ctx->constants;
+	while(celem) {
+		Constant *next = celem->next;
+		free(celem->name);
+		free(celem);
+		celem = next;
+	}
+
+	// Free the ParseContext.controls list
+	UVCXUControl *elem = ctx->controls;
+	while(elem) {
+		UVCXUControl *next = elem->next;
+		xmlFree(elem->id);
+		free(elem);
+		elem = next;
+	}
+
+	// Free the ParseContext.filters list
+	DeviceFilter *felem = ctx->filters;
+	while(felem) {
+		DeviceFilter *next = felem->next;
+		DeviceMatch *match = felem->matches;
+		while(match) {
+			DeviceMatch *next_match = match->next;
+			free(match->products);
+			free(match->releases);
+			free(match);
+			match = next_match;
+		}
+		free(felem);
+		felem = next;
+	}
+
+	// Free the ParseContext.mappings list
+	UVCXUMapping *melem = ctx->mappings;
+	while(melem) {
+		UVCXUMapping *next = melem->next;
+		free(melem);
+		melem = next;
+	}
+
+	free(ctx);
+	return ret;
+}
+
+
+
+/**
+ * Opens a device by name and retrieves the information required to configure it.
+ *
+ * @param device_name	name of the device. Both device paths (e.g. '/dev/video0') and
+ * 						short names (e.g. 'video0') are accepted.
+ * @param target		structure that receives the device information. If the function
+ * 						succeeds, the device must be closed with close_target_device().
+ *
+ * @return
+ * 		- #C_INVALID_DEVICE if the name is not valid or the device cannot be opened
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult open_target_device (const char *device_name, TargetDevice *target)
+{
+	memset(target, 0, sizeof(*target));
+	init_backend();
+
+	// Accept the same device names as c_open_device()
+	const char *v4l2_name;
+	if(strstr(device_name, "/dev/video") == device_name)
+		v4l2_name = &device_name[5];
+	else if(strstr(device_name, "video") == device_name)
+		v4l2_name = device_name;
+	else
+		return C_INVALID_DEVICE;
+
+	// Open the device and find out which driver is behind it
+	target->v4l2_handle = open_v4l2_device((char *)v4l2_name);
+	if(target->v4l2_handle <= 0) {
+		target->v4l2_handle = 0;
+		return C_INVALID_DEVICE;
+	}
+	if(device_ioctl(get_device_stats(v4l2_name), target->v4l2_handle, VIDIOC_QUERYCAP, &target->v4l2_cap) < 0) {
+		backend_close(target->v4l2_handle);
+		target->v4l2_handle = 0;
+		return C_INVALID_DEVICE;
+	}
+	snprintf(target->v4l2_name, sizeof(target->v4l2_name), "%s", v4l2_name);
+	target->device.shortName	= target->v4l2_name;
+	target->device.name			= (char *)target->v4l2_cap.card;
+	target->device.driver		= (char *)target->v4l2_cap.driver;
+	target->device.location		= (char *)target->v4l2_cap.bus_info;
+	get_v4l2_device_usb_info(v4l2_name, &target->device.usb);
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Selects the sysfs entries of video devices.
+ */
+static int is_video_device_entry (const struct dirent *entry)
+{
+	return strstr(entry->d_name, "video") == entry->d_name;
+}
+
+
+/**
+ * Opens all video devices in the system.
+ *
+ * Unlike c_enum_devices() this function does not use the global device list, so it can
+ * be used from multiple threads at the same time. Devices that cannot be opened are
+ * left out.
+ *
+ * @param targets		pointer that receives the array of devices. The devices must be
+ * 						closed with close_target_device() and the array must be freed
+ * 						by the caller.
+ * @param count			pointer that receives the number of devices in the array
+ *
+ * @return
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult open_all_target_devices (TargetDevice **targets, unsigned int *count)
+{
+	CResult ret = C_SUCCESS;
+	struct dirent **entries = NULL;
+	int i;
+
+	*targets = NULL;
+	*count = 0;
+	init_backend();
+
+	int entry_count = backend_scandir("/sys/class/video4linux", &entries, is_video_device_entry,
+			versionsort);
+	if(entry_count <= 0)
+		goto done;
+
+	*targets = (TargetDevice *)malloc(entry_count * sizeof(TargetDevice));
+	if(!*targets) {
+		ret = C_NO_MEMORY;
+		goto done;
+	}
+	for(i = 0; i < entry_count; i++) {
+		if(open_target_device(entries[i]->d_name, &(*targets)[*count]) == C_SUCCESS)
+			(*count)++;
+	}
 
 done:
-	// Clean up
-	if(type)
-		xmlFree(type);
-	if(constant != ctx->constants)
-		free(constant);
+	for(i = 0; i < entry_count; i++)
+		free(entries[i]);
+	free(entries);
+	return ret;
+}
+
+
+/**
+ * Closes a device opened with open_target_device() unless its handle has been handed over.
+ */
+static void close_target_device (TargetDevice *target)
+{
+	if(target->v4l2_handle)
+		backend_close(target->v4l2_handle);
+	target->v4l2_handle = 0;
+}
+
+
+/**
+ * Adds the parsed controls and mappings to a device opened with open_target_device().
+ *
+ * The device handle is handed over to the device job, so the device is not opened again.
+ */
+static CResult add_config_to_target_device (ParseContext *ctx, TargetDevice *target,
+		CDynctrlInfo *info)
+{
+	DeviceJob job;
+
+	init_device_job(&job, ctx, &target->device, info);
+	if(job.ctx.device_name) {
+		job.ctx.v4l2_handle = target->v4l2_handle;
+		target->v4l2_handle = 0;
+	}
+
+	return process_device_jobs(ctx, &job, 1, info);
+}
+
+
+/*
+ * API
+ */
+
+/**
+ * Parses a dynamic controls configuration file and adds the contained controls and control
+ * mappings to the UVC driver.
+ *
+ * Notes:
+ * - Just because the function returns C_SUCCESS doesn't mean there were no errors.
+ *   The dynamic controls parsing process tries to be very forgiving on syntax errors
+ *   or if processing of a single control/mapping fails. Check the info->messages list
+ *   for details after processing is done.
+ * - If the @a info parameter is not NULL the caller must free the info->messages field
+ *   if it is not NULL.
+ * - The function can be called from multiple threads at the same time, also for the
+ *   same devices. Imports into the same device share its control list, which is
+ *   updated under the device and control list locks. All imports share the request
+ *   statistics of the process, which are looked up under a mutex and counted with
+ *   atomic operations. Only c_init() and c_cleanup() must not run concurrently.
+ * - The file is parsed only once. The controls and mappings are then added to up to
+ *   DYNCTRL_MAX_WORKERS devices in parallel. The messages are reported in device order.
+ *
+ * @param file_name		name of the device to open.
+ * @param info			structure to pass operation flags and retrieve status information.
+ * 						Can be NULL.
+ *
+ * @return
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_DEVICE if no supported devices are available
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS if the parsing was successful and no fatal error occurred
+ * 		- #C_NOT_IMPLEMENTED if libwebcam was compiled with dynctrl support disabled
+ */
+CResult c_add_control_mappings_from_file (const char *file_name, CDynctrlInfo *info)
+{
+	CResult ret = C_SUCCESS;
+	TargetDevice *targets = NULL;
+	unsigned int i, device_count = 0;
+	ParseContext *ctx = NULL;
+	DeviceJob *jobs = NULL;
+
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(!file_name)
+		return C_INVALID_ARG;
 	
+	// Open the devices and abort if there are no devices present
+	ret = open_all_target_devices(&targets, &device_count);
+	if(ret) goto done;
+	if(!device_count) {
+		ret = C_INVALID_DEVICE;
+		goto done;
+	}
+
+	// Parse the dynctrl configuration file
+	ret = create_parse_context(&file_name, 1, info, &ctx);
+	if(ret) goto done;
+
+	// Prepare one job per device and add the controls to the applicable devices reusing
+	// the device handles we already have
+	jobs = (DeviceJob *)malloc(device_count * sizeof(DeviceJob));
+	if(!jobs) {
+		ret = C_NO_MEMORY;
+		goto done;
+	}
+	for(i = 0; i < device_count; i++) {
+		init_device_job(&jobs[i], ctx, &targets[i].device, info);
+		if(jobs[i].ctx.device_name) {
+			jobs[i].ctx.v4l2_handle = targets[i].v4l2_handle;
+			targets[i].v4l2_handle = 0;
+		}
+	}
+	ret = process_device_jobs(ctx, jobs, device_count, info);
+
+done:
+	ret = free_parse_context(ctx, ret);
+	if(jobs) free(jobs);
+	for(i = 0; i < device_count; i++)
+		close_target_device(&targets[i]);
+	if(targets) free(targets);
+
 	return ret;
 }
 
 
 /**
- * Process a @c constants node.
+ * Selects the directory entries that look like dynamic controls configuration files.
  */
-static CResult process_constants (const xmlNode *node_constants, ParseContext *ctx)
+static int is_dynctrl_file_entry (const struct dirent *entry)
 {
-	assert(node_constants);
+	size_t length = strlen(entry->d_name);
+	return entry->d_name[0] != '.' && entry->d_type != DT_DIR
+		&& length > 4 && strcmp(&entry->d_name[length - 4], ".xml") == 0;
+}
 
-	// Process all <constant> nodes
-	xmlNode *node_constant = xml_get_first_child_by_name(node_constants, "constant");
-	while(node_constant) {
-		CResult ret = process_constant(node_constant, ctx);
-		if(ctx->info) {
-			if(ret)
-				ctx->info->stats.constants.successful++;
-			else
-				ctx->info->stats.constants.failed++;
+
+/**
+ * Appends the paths of all dynamic controls configuration files in a directory to a list.
+ *
+ * The files are appended in alphabetical order. Directories that do not exist are ignored.
+ *
+ * @param dir_name		path of the directory to search
+ * @param file_names	pointer to the list of paths. The list is enlarged as necessary and
+ * 						must be freed together with its elements by the caller.
+ * @param file_count	pointer to the number of elements in the list
+ *
+ * @return
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS otherwise
+ */
+static CResult append_dynctrl_files (const char *dir_name, char ***file_names, unsigned int *file_count)
+{
+	CResult ret = C_SUCCESS;
+	struct dirent **entries = NULL;
+	int i;
+
+	int entry_count = scandir(dir_name, &entries, is_dynctrl_file_entry, alphasort);
+	if(entry_count <= 0)
+		goto done;
+
+	char **names = (char **)realloc(*file_names, (*file_count + entry_count) * sizeof(char *));
+	if(!names) {
+		ret = C_NO_MEMORY;
+		goto done;
+	}
+	*file_names = names;
+
+	for(i = 0; i < entry_count; i++) {
+		if(asprintf(&names[*file_count], "%s/%s", dir_name, entries[i]->d_name) < 0) {
+			ret = C_NO_MEMORY;
+			goto done;
 		}
-		node_constant = xml_get_next_sibling_by_name(node_constant, "constant");
+		(*file_count)++;
 	}
 
-	return C_SUCCESS;
+done:
+	for(i = 0; i < entry_count; i++)
+		free(entries[i]);
+	free(entries);
+	return ret;
 }
 
 
 /**
- * Process a @c meta node by filling in the corresponding info structure.
+ * Collects the dynamic controls configuration files for a USB device from a directory.
+ *
+ * The layout of the directory is the one used by the udev helper script: Product specific
+ * files are stored in @c dir_name/VID/PID/ and vendor specific files in @c dir_name/VID/,
+ * where VID and PID are lowercase four digit hexadecimal numbers. The product specific
+ * files come first in the list, so their definitions take precedence.
  */
-static CResult process_meta (const xmlNode *node_meta, ParseContext *ctx)
+static CResult collect_dynctrl_files (const char *dir_name, const CUSBInfo *usb,
+		char ***file_names, unsigned int *file_count)
 {
-	assert(node_meta);
-
-	// Extract meta information if required
-	if(ctx->info && ctx->info->flags & CD_RETRIEVE_META_INFO) {
-		// Copy the version and revision numbers
-		string_to_version(
-				(char *)xml_get_node_text(xml_get_first_child_by_name(node_meta, "version")),
-				&ctx->info->meta.version.major, &ctx->info->meta.version.minor);
-		string_to_version(
-				(char *)xml_get_node_text(xml_get_first_child_by_name(node_meta, "revision")),
-				&ctx->info->meta.revision.major, &ctx->info->meta.revision.minor);
+	CResult ret = C_SUCCESS;
+	char *path = NULL;
 
-		// Copy the strings for author (normalized), contact, and copyright
-		ctx->info->meta.author = unicode_to_normalized_ascii(
-				xml_get_node_text(xml_get_first_child_by_name(node_meta, "author")), ctx);
-		ctx->info->meta.contact = unicode_to_ascii(
-				xml_get_node_text(xml_get_first_child_by_name(node_meta, "contact")), ctx);
-		ctx->info->meta.copyright = unicode_to_ascii(
-				xml_get_node_text(xml_get_first_child_by_name(node_meta, "copyright")), ctx);
-	}
+	if(asprintf(&path, "%s/%04x/%04x", dir_name, usb->vendor, usb->product) < 0)
+		return C_NO_MEMORY;
+	ret = append_dynctrl_files(path, file_names, file_count);
+	free(path);
+	if(ret) return ret;
 
-	return C_SUCCESS;
+	if(asprintf(&path, "%s/%04x", dir_name, usb->vendor) < 0)
+		return C_NO_MEMORY;
+	ret = append_dynctrl_files(path, file_names, file_count);
+	free(path);
+	return ret;
 }
 
 
 /**
- * Process an XML document tree representing a dynamic controls configuration file.
+ * Adds the controls and control mappings from a single file or from all applicable files
+ * in a directory to the UVC driver of a single device.
+ *
+ * This is the common implementation of c_add_control_mappings_to_device() and
+ * c_add_control_mappings_from_dir(). Exactly one of @a file_name and @a dir_name
+ * must be given.
  */
-static CResult process_dynctrl_doc (xmlDoc *xml_doc, ParseContext *ctx)
+static CResult add_config_to_device (const char *device_name, const char *file_name,
+		const char *dir_name, CDynctrlInfo *info)
 {
 	CResult ret = C_SUCCESS;
-	if(!xml_doc)
-		return C_INVALID_ARG;
+	ParseContext *ctx = NULL;
+	TargetDevice target;
+	char **dir_files = NULL;
+	unsigned int i, dir_file_count = 0;
 
-	xmlNode *node_root = xmlDocGetRootElement(xml_doc);
-	assert(node_root);
-	ctx->pass++;	// We start at pass 1 ...
+	if(!device_name || (!file_name == !dir_name))
+		return C_INVALID_ARG;
 
-	// Some processing only needs to be done in the first pass
-	if(ctx->pass == 1) {
-		// Find and process the <meta> node
-		ret = process_meta(xml_get_first_child_by_name(node_root, "meta"), ctx);
-		if(ret) return ret;
+	ret = open_target_device(device_name, &target);
+	if(ret) goto done;
 
-		// Find the <constants> list (if it exists)
-		ret = process_constants(xml_get_first_child_by_name(node_root, "constants"), ctx);
-		if(ret) return ret;
+	// Parse the dynctrl configuration file or all files that apply to the device
+	if(dir_name) {
+		ret = collect_dynctrl_files(dir_name, &target.device.usb, &dir_files, &dir_file_count);
+		if(ret) goto done;
+		ret = create_parse_context((const char * const *)dir_files, dir_file_count, info, &ctx);
+		if(ret) goto done;
+		if(!dir_file_count) {
+			add_info(ctx,
+				"No dynamic controls configuration files found for device '%s' "
+				"(USB ID %04x:%04x) in '%s'.",
+				target.device.shortName, target.device.usb.vendor, target.device.usb.product,
+				dir_name
+			);
+			ret = C_NOT_FOUND;
+			goto done;
+		}
 	}
-
-	// Process all <devices> lists
-	xmlNode *node_devices = xml_get_first_child_by_name(node_root, "devices");
-	while(node_devices) {
-		process_devices(node_devices, ctx);
-		node_devices = xml_get_next_sibling_by_name(node_devices, "devices");
+	else {
+		ret = create_parse_context(&file_name, 1, info, &ctx);
+		if(ret) goto done;
 	}
 
-	// Process the <mappings> node
-	ret = process_mappings(xml_get_first_child_by_name(node_root, "mappings"), ctx);
+	// Add the controls to the device reusing the device handle we already have
+	ret = add_config_to_target_device(ctx, &target, info);
 
+done:
+	// The messages refer to the file names, so free those last
+	ret = free_parse_context(ctx, ret);
+	for(i = 0; i < dir_file_count; i++)
+		free(dir_files[i]);
+	free(dir_files);
+	close_target_device(&target);
+
+	// The library may not be initialized, so c_cleanup() may never flush the log
+	flush_log();
 	return ret;
 }
 
 
 /**
- * Checks whether the driver behind the current device supports dynamic controls.
- *
- * The check is done by redefining the brightness control which is hardcoded in the
- * UVC driver. If the driver supports dynamic controls, it will return EEXIST.
- * If the driver does not support dynamic controls, the ioctl will fail with EINVAL.
+ * Frees a cache entry including the parsed configuration.
+ */
+static void free_cache_entry (CacheEntry *entry)
+{
+	unsigned int i;
+
+	free_parse_context(entry->ctx, C_SUCCESS);
+	for(i = 0; i < entry->file_count; i++)
+		free(entry->file_names[i]);
+	free(entry->file_names);
+	free(entry);
+}
+
+
+/**
+ * Looks up the configuration for a USB product in the cache and loads it if necessary.
  *
- * @param ctx		current parse context
+ * If the configuration is loaded, @a info receives the parse messages.
  *
  * @return
- * 		- #C_SUCCESS if the driver supports dynamic controls
- * 		- #C_NOT_IMPLEMENTED if the driver does not support dynamic controls
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS otherwise (the parse result is stored in the entry)
  */
-static CResult device_supports_dynctrl(ParseContext *ctx)
+static CResult get_cache_entry (CDynctrlCache *cache, const CUSBInfo *usb, CDynctrlInfo *info,
+		CacheEntry **pentry)
 {
 	CResult ret = C_SUCCESS;
-	struct uvc_xu_control_mapping xu_control = {
-		.entity		= /* UVC_GUID_UVC_PROCESSING */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01 },
-		.selector	= /* PU_BRIGHTNESS_CONTROL */ 0x02,
-		.size		= 0,
-	};
-	
-	assert(ctx->v4l2_handle);
+	CacheEntry *entry;
 
-	int v4l2_ret = ioctl(ctx->v4l2_handle, UVCIOC_CTRL_MAP, &xu_control);
-	if(v4l2_ret == -1) {
-		if(errno == EPERM) {
-			/* User is not root (newer drivers require root permissions) */
-			ret = C_CANNOT_WRITE;
-		}
-		else if(errno == EEXIST) {
-			/* Driver supports dynamic controls */
-		}
-		else {
-			/* Unexpected error: Assume not supported */
-			ret = C_NOT_IMPLEMENTED;
+	for(entry = cache->entries; entry; entry = entry->next) {
+		if(entry->vendor == usb->vendor && entry->product == usb->product) {
+			*pentry = entry;
+			return C_SUCCESS;
 		}
 	}
-	else {
-		/* Success: Assume not supported */
-		ret = C_NOT_IMPLEMENTED;
+
+	entry = (CacheEntry *)malloc(sizeof(CacheEntry));
+	if(!entry)
+		return C_NO_MEMORY;
+	memset(entry, 0, sizeof(*entry));
+	entry->vendor = usb->vendor;
+	entry->product = usb->product;
+
+	ret = collect_dynctrl_files(cache->dir_name, usb, &entry->file_names, &entry->file_count);
+	if(ret) goto done;
+	entry->parse_result = create_parse_context((const char * const *)entry->file_names,
+			entry->file_count, info, &entry->ctx);
+	if(entry->parse_result == C_NO_MEMORY) {
+		ret = C_NO_MEMORY;
+		goto done;
 	}
 
+	entry->next = cache->entries;
+	cache->entries = entry;
+	*pentry = entry;
+
+done:
+	if(ret) {
+		if(entry->ctx)
+			ret = flush_message_log(entry->ctx, ret);
+		free_cache_entry(entry);
+	}
 	return ret;
 }
 
 
-/** 
- * Adds controls and control mappings contained in the given XML tree to the UVC driver.
+/**
+ * Parses a dynamic controls configuration file and adds the contained controls and control
+ * mappings to the UVC driver of a single device.
  *
- * @param xml_doc	XML document tree corresponding to the dynctrl format
- * @param ctx		current parse context
+ * Unlike c_add_control_mappings_from_file() this function only touches the given device.
+ * It does not enumerate the other devices in the system and it can be used without
+ * initializing the library first, which makes it suitable for hotplug helpers that are
+ * run once per device.
+ *
+ * The notes of c_add_control_mappings_from_file() apply to this function as well.
+ *
+ * @param device_name	name of the device to add the controls to. Both device paths
+ * 						(e.g. '/dev/video0') and short names (e.g. 'video0') are accepted.
+ * @param file_name		name of the dynamic controls configuration file.
+ * @param info			structure to pass operation flags and retrieve status information.
+ * 						Can be NULL.
  *
  * @return
- * 		- #C_INVALID_DEVICE if no devices are available
- * 		- #C_CANNOT_WRITE if the user does not have permissions to add the mappings
- * 		- #C_SUCCESS if adding the controls and control mappings was successful
+ * 		- #C_INVALID_ARG if a name is NULL
+ * 		- #C_INVALID_DEVICE if the device cannot be opened, is not a UVC device, or
+ * 		  none of the controls apply to it
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS if the parsing was successful and no fatal error occurred
+ * 		- #C_NOT_IMPLEMENTED if libwebcam was compiled with dynctrl support disabled
  */
-static CResult add_control_mappings (xmlDoc *xml_doc, ParseContext *ctx)
+CResult c_add_control_mappings_to_device (const char *device_name, const char *file_name,
+		CDynctrlInfo *info)
 {
-	CResult ret = C_SUCCESS;
+	if(!file_name)
+		return C_INVALID_ARG;
 
-	assert(HANDLE_OPEN(ctx->handle));
-	assert(HANDLE_VALID(ctx->handle));
+	return add_config_to_device(device_name, file_name, NULL, info);
+}
 
-	// Open the V4L2 device
-	ctx->v4l2_handle = open_v4l2_device(GET_HANDLE(ctx->handle).device->v4l2_name);
-	if(!ctx->v4l2_handle) {
-		ret = C_INVALID_DEVICE;
-		goto done;
-	}
 
-	// Check if the driver supports dynamic controls
-	ret = device_supports_dynctrl(ctx);
-	if(ret) goto done;
+/**
+ * Adds the controls and control mappings from all dynamic controls configuration files
+ * that apply to a device to the UVC driver of that device.
+ *
+ * The files are looked up by the USB vendor and product ID of the device. Product specific
+ * files are the .xml files in @c dir_name/VID/PID/ and vendor specific files the ones in
+ * @c dir_name/VID/, which is the layout used by the udev helper script.
+ *
+ * All files are parsed into a single configuration before the device is touched:
+ * - Constants share one namespace. Identical definitions in several files are merged.
+ * - Control IDs (as referenced by @c control_ref) are local to the file that defines them.
+ * - Controls with the same GUID and selector and mappings with the same V4L2 ID are
+ *   only added once. Product specific files take precedence over vendor specific ones
+ *   and files are otherwise processed in alphabetical order.
+ * If #CD_REPORT_FILE_NAMES is set, CDynctrlInfo.message_files tells which file each
+ * message concerns.
+ *
+ * The notes of c_add_control_mappings_from_file() apply to this function as well.
+ *
+ * @param device_name	name of the device to add the controls to. Both device paths
+ * 						(e.g. '/dev/video0') and short names (e.g. 'video0') are accepted.
+ * @param dir_name		name of the directory that contains the configuration files.
+ * @param info			structure to pass operation flags and retrieve status information.
+ * 						Can be NULL.
+ *
+ * @return
+ * 		- #C_INVALID_ARG if a name is NULL
+ * 		- #C_INVALID_DEVICE if the device cannot be opened, is not a UVC device, or
+ * 		  none of the controls apply to it
+ * 		- #C_NOT_FOUND if there are no configuration files for the device
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS if the parsing was successful and no fatal error occurred
+ * 		- #C_NOT_IMPLEMENTED if libwebcam was compiled with dynctrl support disabled
+ */
+CResult c_add_control_mappings_from_dir (const char *device_name, const char *dir_name,
+		CDynctrlInfo *info)
+{
+	if(!dir_name)
+		return C_INVALID_ARG;
 
-	// Process the contained control mappings
-	ret = process_dynctrl_doc(xml_doc, ctx);
+	return add_config_to_device(device_name, NULL, dir_name, info);
+}
 
-done:
-	// Close the device handle
-	if(ctx && ctx->v4l2_handle) {
-		close(ctx->v4l2_handle);
-		ctx->v4l2_handle = 0;
-	}
 
-	return ret;
-}
+/**
+ * Creates a cache of parsed dynamic controls configurations.
+ *
+ * The cache is meant for long-running processes that configure devices as they appear,
+ * e.g. a hotplug daemon. Use c_add_control_mappings_from_cache() to configure a device.
+ * The files for a given USB vendor and product ID are only parsed the first time that a
+ * device with these IDs is configured. To pick up changes to the files, destroy the cache
+ * and create a new one.
+ *
+ * The cache can be used from multiple threads at the same time, e.g. to configure
+ * several devices that were plugged in together.
+ *
+ * @param dir_name		name of the directory that contains the configuration files. The
+ * 						layout is the same as for c_add_control_mappings_from_dir().
+ * @param cache			pointer that receives the new cache. It must be destroyed with
+ * 						c_destroy_dynctrl_cache().
+ *
+ * @return
+ * 		- #C_INVALID_ARG if an argument is NULL
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SUCCESS if the cache was created
+ * 		- #C_NOT_IMPLEMENTED if libwebcam was compiled with dynctrl support disabled
+ */
+CResult c_create_dynctrl_cache (const char *dir_name, CDynctrlCache **cache)
+{
+	if(!dir_name || !cache)
+		return C_INVALID_ARG;
 
+	*cache = (CDynctrlCache *)malloc(sizeof(CDynctrlCache));
+	if(!*cache)
+		return C_NO_MEMORY;
+	(*cache)->entries = NULL;
+	(*cache)->dir_name = strdup(dir_name);
+	if(!(*cache)->dir_name) {
+		free(*cache);
+		*cache = NULL;
+		return C_NO_MEMORY;
+	}
+	if(pthread_mutex_init(&(*cache)->mutex, NULL)) {
+		free((*cache)->dir_name);
+		free(*cache);
+		*cache = NULL;
+		return C_NO_MEMORY;
+	}
 
+	return C_SUCCESS;
+}
 
-/*
- * API
- */
 
 /**
- * Parses a dynamic controls configuration file and adds the contained controls and control
- * mappings to the UVC driver.
+ * Adds the controls and control mappings that apply to a device to its UVC driver using
+ * a cache of parsed configurations.
  *
- * Notes:
- * - Just because the function returns C_SUCCESS doesn't mean there were no errors.
- *   The dynamic controls parsing process tries to be very forgiving on syntax errors
- *   or if processing of a single control/mapping fails. Check the info->messages list
- *   for details after processing is done.
- * - If the @a info parameter is not NULL the caller must free the info->messages field
- *   if it is not NULL.
- * - Note that this function is not thread-safe.
+ * This function works like c_add_control_mappings_from_dir() except that the configuration
+ * files are only parsed when a device with the same USB vendor and product ID is configured
+ * for the first time. Messages about the files are only reported at that point, too.
  *
- * @param file_name		name of the device to open.
+ * @param cache			cache created with c_create_dynctrl_cache()
+ * @param device_name	name of the device to add the controls to. Both device paths
+ * 						(e.g. '/dev/video0') and short names (e.g. 'video0') are accepted.
  * @param info			structure to pass operation flags and retrieve status information.
  * 						Can be NULL.
  *
  * @return
- * 		- #C_INIT_ERROR if the library has not been initialized
- * 		- #C_INVALID_DEVICE if no supported devices are available
+ * 		- #C_INVALID_ARG if an argument is NULL
+ * 		- #C_INVALID_DEVICE if the device cannot be opened, is not a UVC device, or
+ * 		  none of the controls apply to it
+ * 		- #C_NOT_FOUND if there are no configuration files for the device
  * 		- #C_NO_MEMORY if memory could not be allocated
- * 		- #C_SUCCESS if the parsing was successful and no fatal error occurred
+ * 		- #C_SUCCESS if no fatal error occurred
  * 		- #C_NOT_IMPLEMENTED if libwebcam was compiled with dynctrl support disabled
  */
-CResult c_add_control_mappings_from_file (const char *file_name, CDynctrlInfo *info)
+CResult c_add_control_mappings_from_cache (CDynctrlCache *cache, const char *device_name,
+		CDynctrlInfo *info)
 {
 	CResult ret = C_SUCCESS;
-	CDevice *devices = NULL;
-	ParseContext *ctx = NULL;
-	xmlDoc *xml_doc = NULL;
+	CacheEntry *entry = NULL;
+	ParseContext ctx;
+	TargetDevice target;
 
-	if(!initialized)
-		return C_INIT_ERROR;
-	if(!file_name)
+	if(!cache || !device_name)
 		return C_INVALID_ARG;
-	
-	// Enumerate the devices and abort if there are no devices present
-	unsigned int size = 0, device_count = 0;
-	ret = c_enum_devices(NULL, &size, &device_count);
-	if(ret == C_SUCCESS) {
-		// Our zero buffer was large enough, so no devices are present
-		return C_INVALID_DEVICE;
-	}
-	else if(ret != C_BUFFER_TOO_SMALL) {
-		// Something bad has happened, so bail out
+
+	ret = open_target_device(device_name, &target);
+	if(ret) {
+		flush_log();
 		return ret;
 	}
-	assert(device_count > 0);
-	devices = (CDevice *)malloc(size);
-	ret = c_enum_devices(devices, &size, &device_count);
-	if(ret) goto done;
 
-	// Allocate memory for the parsing context
-	ctx = (ParseContext *)malloc(sizeof(ParseContext));
-	if(!ctx) {
-		ret = C_NO_MEMORY;
+	// Look up the configuration and load it if necessary. The parsed lists are not
+	// modified afterwards, so they can be used without holding the lock.
+	pthread_mutex_lock(&cache->mutex);
+	ret = get_cache_entry(cache, &target.device.usb, info, &entry);
+	if(ret) {
+		pthread_mutex_unlock(&cache->mutex);
 		goto done;
 	}
-	memset(ctx, 0, sizeof(*ctx));
-	ctx->info = info;
 
-	// Parse the dynctrl configuration file
-	ret = parse_dynctrl_file(file_name, &xml_doc, ctx);
+	// Work on a copy of the parse context that shares the parsed lists but has its own
+	// message log, so that other threads can use the same entry at the same time.
+	// If the entry was just loaded, the parse messages are passed on to this caller.
+	ctx = *entry->ctx;
+	ctx.cd = 0;
+	ctx.info = info;
+	memset(&ctx.log, 0, sizeof(ctx.log));
+	merge_message_log(&ctx.log, &entry->ctx->log);
+	entry->ctx->info = NULL;
+	pthread_mutex_unlock(&cache->mutex);
+
+	ret = entry->parse_result;
 	if(ret) goto done;
+	if(!entry->file_count) {
+		add_info(&ctx,
+			"No dynamic controls configuration files found for device '%s' "
+			"(USB ID %04x:%04x) in '%s'.",
+			target.device.shortName, target.device.usb.vendor, target.device.usb.product,
+			cache->dir_name
+		);
+		ret = C_NOT_FOUND;
+		goto done;
+	}
 
-	// Allocate a conversion descriptor
-	ctx->cd = iconv_open("ASCII", "UTF-8");
-	assert(ctx->cd != (iconv_t)-1);
+	ret = add_config_to_target_device(&ctx, &target, info);
 
-	// Loop through the devices and check which ones have a supported uvcvideo driver behind them
-	int i, successful_devices = 0;
-	for(i = 0; i < device_count; i++) {
-		CDevice *device = &devices[i];
+done:
+	if(entry)
+		ret = flush_message_log(&ctx, ret);
+	close_target_device(&target);
 
-		// Skip non-UVC devices
-		if(strcmp(device->driver, "uvcvideo") != 0) {
-			add_info(ctx,
-				"device '%s' skipped because it is not a UVC device.",
-				device->shortName
-			);
-			continue;
-		}
+	flush_log();
+	return ret;
+}
 
-		// Create a device handle
-		ctx->handle = c_open_device(device->shortName);
-		if(!ctx->handle) {
-			add_error(ctx,
-				"device '%s' skipped because it could not be opened.",
-				device->shortName
-			);
-			continue;
-		}
 
-		// Add the parsed control mappings to this device
-		ret = add_control_mappings(xml_doc, ctx);
-		if(ret == C_SUCCESS) {
-			successful_devices++;
-		}
-		else if(ret == C_NOT_IMPLEMENTED) {
-			add_error(ctx,
-				"device '%s' skipped because the driver '%s' behind it does not seem "
-				"to support dynamic controls.",
-				device->shortName, device->driver
-			);
-		}
-		else if(ret == C_CANNOT_WRITE) {
-			add_error(ctx,
-				"device '%s' skipped because you do not have the right permissions. "
-				"Newer driver versions require root permissions.",
-				device->shortName
-			);
-		}
-		else {
-			char *error = c_get_handle_error_text(ctx->handle, ret);
-			assert(error);
-			add_error(ctx,
-				"device '%s' was not processed successfully: %s. (Code: %d)",
-				device->shortName, error, ret
-			);
-			free(error);
-		}
+/**
+ * Destroys a cache created with c_create_dynctrl_cache() including all parsed configurations.
+ *
+ * @param cache			cache to destroy. Can be NULL.
+ */
+void c_destroy_dynctrl_cache (CDynctrlCache *cache)
+{
+	if(!cache)
+		return;
+
+	CacheEntry *entry = cache->entries;
+	while(entry) {
+		CacheEntry *next = entry->next;
+		free_cache_entry(entry);
+		entry = next;
+	}
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache->dir_name);
+	free(cache);
+}
 
-		// Close the device handle
-		c_close_device(ctx->handle);
-		ctx->handle = 0;
-	}
-	if(successful_devices == 0)
-		ret = C_INVALID_DEVICE;
 
-done:
-	// Close the conversion descriptor
-	if(ctx && ctx->cd && ctx->cd != (iconv_t)-1)
-		iconv_close(ctx->cd);
+#else
 
-	// Clean up
-	if(xml_doc) xmlFreeDoc(xml_doc);
-	if(ctx) {
-		// Free the ParseContext.constants list
-		Constant *celem = ctx->constants;
-		while(celem) {
-			Constant *next = celem->next;
-			free(celem->name);
-			free(celem);
-			celem = next;
-		}
 
-		// Free the ParseContext.controls list
-		UVCXUControl *elem = ctx->controls;
-		while(elem) {
-			UVCXUControl *next = elem->next;
-			xmlFree(elem->id);
-			free(elem);
-			elem = next;
-		}
+CResult c_add_control_mappings_from_file (const char *file_name, CDynctrlInfo *info)
+{
+	return C_NOT_IMPLEMENTED;
+}
 
-		free(ctx);
-	}
-	if(devices) free(devices);
 
-	return ret;
+CResult c_add_control_mappings_to_device (const char *device_name, const char *file_name,
+		CDynctrlInfo *info)
+{
+	return C_NOT_IMPLEMENTED;
 }
 
 
-#else
+CResult c_add_control_mappings_from_dir (const char *device_name, const char *dir_name,
+		CDynctrlInfo *info)
+{
+	return C_NOT_IMPLEMENTED;
+}
 
 
-CResult c_add_control_mappings_from_file (const char *file_name, CDynctrlInfo *info)
+CResult c_create_dynctrl_cache (const char *dir_name, CDynctrlCache **cache)
+{
+	return C_NOT_IMPLEMENTED;
+}
+
+
+CResult c_add_control_mappings_from_cache (CDynctrlCache *cache, const char *device_name,
+		CDynctrlInfo *info)
 {
 	return C_NOT_IMPLEMENTED;
 }
 
 
+void c_destroy_dynctrl_cache (CDynctrlCache *cache)
+{
+}
+
+
 #endif
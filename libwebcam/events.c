@@ -0,0 +1,1363 @@
+/**
+ * \file
+ * Device events.
+ *
+ * \ingroup libwebcam
+ */
+
+/*
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of libwebcam.
+ *
+ * libwebcam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libwebcam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwebcam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The events of all devices are delivered by one thread that waits on an epoll set:
+ *
+ * - The first subscription for a device opens the device once more and subscribes to
+ *   the V4L2 control events of all controls that support them (CC_CAN_NOTIFY). The
+ *   separate file keeps these subscriptions apart from the ones of c_watch_controls()
+ *   and the requests of the application. It is added to the epoll set and stays open
+ *   as long as the device has subscribers. Controls that a dynctrl import adds later
+ *   are subscribed when the control list is updated.
+ * - When a device has events, the thread dequeues them, translates the V4L2 control
+ *   IDs, and calls the handlers without holding a lock, so that handlers can call
+ *   other libwebcam functions, including c_unsubscribe_event(). Controls whose range
+ *   or flags changed are queried again before, also without holding the lock.
+ *
+ * Hotplug events come from the kernel's uevent netlink socket, which is added to the
+ * same epoll set while there are hotplug subscribers. A uevent is only a hint: the
+ * thread checks sysfs and updates the library's entry of the device before it calls
+ * the handlers, so handles of a removed device are already invalid by then. The entry
+ * of a removed device is only freed by the next c_enum_devices() call, because other
+ * threads may still be using it. Both the kernel's and udev's messages are received,
+ * because a device that was just added may only become accessible once udev has set
+ * its permissions.
+ *
+ * Applications with their own event loop can call c_get_event_fd() instead. From then
+ * on, no thread is started: the application polls the epoll set itself and calls
+ * c_dispatch_events(), which delivers the events on the calling thread exactly like the
+ * event thread would.
+ *
+ * While a thread calls handlers, removed subscriptions are only marked and freed
+ * afterwards, so that the thread can continue walking the list. Functions that remove
+ * subscriptions wait until the thread has returned from the handlers, so that the
+ * context of a handler can be freed as soon as c_unsubscribe_event() returns.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/videodev2.h>
+
+#include "webcam.h"
+#include "libwebcam.h"
+
+
+/// epoll data of the descriptor that stops the thread
+#define STOP_SOURCE				0
+/// epoll data of the uevent socket and source of the hotplug subscriptions
+#define HOTPLUG_SOURCE			1
+
+/// Netlink multicast groups of the kernel's and udev's uevents
+#define UEVENT_GROUP_KERNEL		1
+#define UEVENT_GROUP_UDEV		2
+/// Value of the magic field in the header of udev's messages
+#define UDEV_MONITOR_MAGIC		0xfeedcafe
+
+
+/**
+ * A control whose events a device delivers.
+ */
+typedef struct _EventControl {
+	/// V4L2 control ID
+	unsigned int	v4l2_id;
+	/// libwebcam control ID
+	CControlId		id;
+	/// Control type
+	CControlType	type;
+
+} EventControl;
+
+/**
+ * A device with subscribers.
+ */
+typedef struct _EventSource {
+	/// Short V4L2 device name (e.g. 'video0')
+	char			v4l2_name[NAME_MAX];
+	/// Number that identifies the source in the epoll set (never 0)
+	uint64_t		serial;
+	/// Request statistics of the device
+	DeviceStats		* stats;
+	/// Device file that holds the V4L2 event subscriptions
+	int				fd;
+	/// Descriptor in the epoll set (see backend_event_fd())
+	int				poll_fd;
+	/// Controls with event subscriptions
+	EventControl	* controls;
+	unsigned int	control_count;
+	/// Next source in the list
+	struct _EventSource	* next;
+
+} EventSource;
+
+/**
+ * A handler subscribed to an event of a device handle.
+ */
+typedef struct _EventSubscription {
+	CHandle			hDevice;
+	CEventId		id;
+	CEventHandler	handler;
+	void			* context;
+	/// Serial number of the event source of the device
+	uint64_t		source;
+	/// Boolean whether the subscription was removed while handlers were running
+	int				removed;
+	/// Next subscription in the list
+	struct _EventSubscription	* next;
+
+} EventSubscription;
+
+/**
+ * Header of the messages that udev sends to its netlink group.
+ * Only the fields that are needed to find the properties are declared.
+ */
+typedef struct _UdevMessageHeader {
+	/// "libudev"
+	char			prefix[8];
+	/// #UDEV_MONITOR_MAGIC in network byte order
+	unsigned int	magic;
+	unsigned int	header_size;
+	/// Offset of the properties from the start of the message
+	unsigned int	properties_offset;
+	unsigned int	properties_length;
+
+} UdevMessageHeader;
+
+/**
+ * State of the event thread.
+ */
+static struct {
+	/// Protects all of the state below
+	pthread_mutex_t			mutex;
+	/// Signaled when the thread has returned from the handlers
+	pthread_cond_t			idle;
+	/// epoll set with the event sources, -1 if it has not been created yet
+	int						epoll_fd;
+	/// Descriptor that stops the thread when it becomes readable, -1 if the thread is
+	/// not running
+	int						stop_fd;
+	/// Socket that receives uevents, -1 if there are no hotplug subscribers
+	int						uevent_fd;
+	pthread_t				thread;
+	/// Boolean whether the application dispatches the events (see c_get_event_fd())
+	int						external;
+	/// Boolean whether a thread is calling handlers
+	int						dispatching;
+	/// Thread that is calling handlers
+	pthread_t				dispatching_thread;
+	/// Serial number of the last event source
+	uint64_t				serial;
+	EventSource				* sources;
+	EventSubscription		* subscriptions;
+
+} dispatcher = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, -1, -1, -1, .serial = HOTPLUG_SOURCE };
+
+
+/**
+ * Events that devices with event support deliver.
+ */
+static const struct {
+	CEventId		id;
+	char			* name;
+} supported_events[] = {
+	{ CE_CONTROL_VALUE_CHANGED,		"Control value changed" },
+	{ CE_CONTROL_INFO_CHANGED,		"Control information changed" },
+};
+
+
+/**
+ * Returns true if the given event is a hotplug event, i.e. one that concerns all
+ * devices instead of a device handle.
+ */
+static inline int is_hotplug_event (CEventId id)
+{
+	return id == CE_DEVICE_ADDED || id == CE_DEVICE_REMOVED;
+}
+
+
+
+/*
+ * Event sources
+ */
+
+static EventSource *find_event_source (const char *v4l2_name)
+{
+	EventSource *elem;
+	for(elem = dispatcher.sources; elem; elem = elem->next) {
+		if(strcmp(elem->v4l2_name, v4l2_name) == 0)
+			break;
+	}
+	return elem;
+}
+
+
+static EventSource *find_event_source_by_serial (uint64_t serial)
+{
+	EventSource *elem;
+	for(elem = dispatcher.sources; elem; elem = elem->next) {
+		if(elem->serial == serial)
+			break;
+	}
+	return elem;
+}
+
+
+static EventControl *find_event_control (EventSource *source, unsigned int v4l2_id)
+{
+	unsigned int i;
+	for(i = 0; i < source->control_count; i++) {
+		if(source->controls[i].v4l2_id == v4l2_id)
+			return &source->controls[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * Subscribes to the events of the controls of a device that support them and that the
+ * event source does not know yet.
+ *
+ * Note: The dispatcher mutex must be locked.
+ *
+ * @return
+ * 		- #C_SUCCESS on success, even if no control was added
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SYNC_ERROR if the control list could not be locked
+ */
+static CResult add_event_controls (EventSource *source, Device *device)
+{
+	if(lock_control_list(device))
+		return C_SYNC_ERROR;
+
+	if(device->controls.count) {
+		EventControl *controls = (EventControl *)realloc(source->controls,
+				(source->control_count + device->controls.count) * sizeof(EventControl));
+		if(!controls) {
+			unlock_control_list(device);
+			return C_NO_MEMORY;
+		}
+		source->controls = controls;
+	}
+	Control *elem;
+	for(elem = device->controls.first; elem; elem = elem->next) {
+		if(!(elem->control.flags & CC_CAN_NOTIFY) ||
+		   find_event_control(source, elem->v4l2_control) ||
+		   subscribe_control_event(source->stats, source->fd, elem->v4l2_control, 1, 0))
+			continue;
+		EventControl *control = &source->controls[source->control_count++];
+		control->v4l2_id	= elem->v4l2_control;
+		control->id			= elem->control.id;
+		control->type		= elem->control.type;
+	}
+
+	unlock_control_list(device);
+	return C_SUCCESS;
+}
+
+
+/**
+ * Opens a device for event delivery and adds it to the epoll set.
+ *
+ * Note: The dispatcher mutex must be locked and the thread must be running.
+ *
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INVALID_DEVICE if the device could not be opened
+ * 		- #C_NOT_FOUND if no control of the device supports events
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SYNC_ERROR if the device could not be added to the epoll set
+ */
+static CResult open_event_source (Device *device, EventSource **psource)
+{
+	CResult ret = C_SUCCESS;
+	char path[5 + NAME_MAX + 1];
+	struct epoll_event ev;
+	short events;
+
+	EventSource *source = (EventSource *)calloc(1, sizeof(*source));
+	if(!source)
+		return C_NO_MEMORY;
+	strcpy(source->v4l2_name, device->v4l2_name);
+	source->serial	= ++dispatcher.serial;
+	source->stats	= device->stats;
+
+	snprintf(path, sizeof(path), "/dev/%s", device->v4l2_name);
+	source->fd = backend_open(path, O_RDWR | O_NONBLOCK);
+	if(source->fd < 0) {
+		free(source);
+		return C_INVALID_DEVICE;
+	}
+
+	// Subscribe to the events of all controls that support them
+	ret = add_event_controls(source, device);
+	if(ret)
+		goto done;
+	if(!source->control_count) {
+		ret = C_NOT_FOUND;
+		goto done;
+	}
+
+	source->poll_fd = backend_event_fd(source->fd, &events);
+	memset(&ev, 0, sizeof(ev));
+	ev.events	= (events & POLLPRI ? EPOLLPRI : 0) | (events & POLLIN ? EPOLLIN : 0);
+	ev.data.u64	= source->serial;
+	if(source->poll_fd < 0 ||
+	   epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_ADD, source->poll_fd, &ev)) {
+		ret = C_SYNC_ERROR;
+		goto done;
+	}
+
+	source->next = dispatcher.sources;
+	dispatcher.sources = source;
+	*psource = source;
+
+done:
+	if(ret) {
+		backend_close(source->fd);
+		free(source->controls);
+		free(source);
+	}
+	return ret;
+}
+
+
+/**
+ * Removes an event source from the epoll set and closes its device file.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void close_event_source (EventSource *source)
+{
+	EventSource **link;
+	for(link = &dispatcher.sources; *link; link = &(*link)->next) {
+		if(*link == source) {
+			*link = source->next;
+			break;
+		}
+	}
+
+	epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_DEL, source->poll_fd, NULL);
+	backend_close(source->fd);
+	free(source->controls);
+	free(source);
+}
+
+
+
+
+/*
+ * Hotplug
+ */
+
+/**
+ * Opens the socket that receives the uevents and adds it to the epoll set.
+ *
+ * Note: The dispatcher mutex must be locked and the thread must be running.
+ *
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_SYNC_ERROR if the socket could not be opened or added to the epoll set
+ */
+static CResult open_uevent_socket (void)
+{
+	struct sockaddr_nl addr;
+	struct epoll_event ev;
+
+	if(dispatcher.uevent_fd >= 0)
+		return C_SUCCESS;
+
+	int fd;
+	if(USE_FAKE_BACKEND) {
+		fd = fake_uevent_socket();
+	}
+	else {
+		fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		addr.nl_groups = UEVENT_GROUP_KERNEL | UEVENT_GROUP_UDEV;
+		if(fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if(fd < 0)
+		return C_SYNC_ERROR;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events	= EPOLLIN;
+	ev.data.u64	= HOTPLUG_SOURCE;
+	if(epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		close(fd);
+		return C_SYNC_ERROR;
+	}
+	dispatcher.uevent_fd = fd;
+	return C_SUCCESS;
+}
+
+
+/**
+ * Closes the uevent socket.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void close_uevent_socket (void)
+{
+	if(dispatcher.uevent_fd < 0)
+		return;
+	epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_DEL, dispatcher.uevent_fd, NULL);
+	close(dispatcher.uevent_fd);
+	dispatcher.uevent_fd = -1;
+}
+
+
+/**
+ * Extracts the name of the video device that a uevent concerns.
+ *
+ * @param buffer	the message, terminated by an additional NUL character
+ * @param length	length of the message
+ * @param v4l2_name	receives the short device name (e.g. 'video0')
+ * @return 1 if a video device was added or removed, 0 otherwise
+ */
+static int parse_uevent (char *buffer, unsigned int length, char v4l2_name[NAME_MAX])
+{
+	const char *action = NULL, *subsystem = NULL, *devname = NULL;
+	char *p;
+
+	// Kernel messages start with a text header ("add@/devices/..."), udev messages
+	// with a binary one. Both are followed by NUL-terminated KEY=VALUE pairs.
+	if(strcmp(buffer, "libudev") == 0) {
+		UdevMessageHeader *header = (UdevMessageHeader *)buffer;
+		if(length < sizeof(*header) || ntohl(header->magic) != UDEV_MONITOR_MAGIC ||
+		   header->properties_offset >= length)
+			return 0;
+		p = buffer + header->properties_offset;
+	}
+	else {
+		p = buffer + strlen(buffer) + 1;
+	}
+	while(p < buffer + length) {
+		if(strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if(strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if(strncmp(p, "DEVNAME=", 8) == 0)
+			devname = p + 8;
+		p += strlen(p) + 1;
+	}
+	if(!action || !subsystem || !devname || strcmp(subsystem, "video4linux") != 0 ||
+	   (strcmp(action, "add") != 0 && strcmp(action, "remove") != 0))
+		return 0;
+
+	// DEVNAME is relative to /dev for the kernel and absolute for udev
+	const char *name = strrchr(devname, '/');
+	name = name ? name + 1 : devname;
+	if(strstr(name, "video") != name || strlen(name) >= NAME_MAX)
+		return 0;
+	strcpy(v4l2_name, name);
+	return 1;
+}
+
+
+
+/*
+ * Subscriptions
+ */
+
+/**
+ * Removes a subscription and closes the event source of its device if the device has
+ * no subscribers left.
+ *
+ * If the thread is calling handlers, the subscription is only marked as removed and
+ * freed when the thread has returned from the handlers.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void remove_subscription (EventSubscription *subscription)
+{
+	EventSubscription *elem, **link;
+
+	subscription->removed = 1;
+	for(elem = dispatcher.subscriptions; elem; elem = elem->next) {
+		if(!elem->removed && elem->source == subscription->source)
+			break;
+	}
+	if(!elem) {
+		EventSource *source = find_event_source_by_serial(subscription->source);
+		if(source)
+			close_event_source(source);
+		else if(subscription->source == HOTPLUG_SOURCE)
+			close_uevent_socket();
+	}
+
+	if(dispatcher.dispatching)
+		return;
+	for(link = &dispatcher.subscriptions; *link; link = &(*link)->next) {
+		if(*link == subscription) {
+			*link = subscription->next;
+			break;
+		}
+	}
+	free(subscription);
+}
+
+
+/**
+ * Frees the subscriptions that were removed while the thread was calling handlers.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void free_removed_subscriptions (void)
+{
+	EventSubscription **link = &dispatcher.subscriptions;
+	while(*link) {
+		EventSubscription *elem = *link;
+		if(elem->removed) {
+			*link = elem->next;
+			free(elem);
+		}
+		else {
+			link = &elem->next;
+		}
+	}
+}
+
+
+/**
+ * Returns true if the calling thread is calling handlers, i.e. the caller is a handler.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static int in_handler (void)
+{
+	return dispatcher.dispatching && pthread_equal(pthread_self(), dispatcher.dispatching_thread);
+}
+
+
+/**
+ * Waits until the dispatching thread has returned from the handlers, unless it is the
+ * calling thread, i.e. a handler removes a subscription.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void wait_for_handlers (void)
+{
+	if(in_handler())
+		return;
+	while(dispatcher.dispatching)
+		pthread_cond_wait(&dispatcher.idle, &dispatcher.mutex);
+}
+
+
+
+/*
+ * Dispatching
+ */
+
+/**
+ * Marks the calling thread as the one that calls handlers.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void begin_dispatching (void)
+{
+	dispatcher.dispatching = 1;
+	dispatcher.dispatching_thread = pthread_self();
+}
+
+
+/**
+ * Calls the handlers subscribed to an event of the given source.
+ *
+ * Note: The dispatcher mutex must be locked and the thread must be marked as
+ * dispatching. The mutex is released while handlers run.
+ */
+static void call_handlers (uint64_t source, CEventId id, const CEventData *data)
+{
+	EventSubscription *elem;
+	for(elem = dispatcher.subscriptions; elem; elem = elem->next) {
+		if(elem->removed || elem->source != source || elem->id != id)
+			continue;
+		CEventHandler handler = elem->handler;
+		void *context = elem->context;
+		CHandle hDevice = elem->hDevice;
+
+		pthread_mutex_unlock(&dispatcher.mutex);
+		handler(hDevice, id, data, context);
+		pthread_mutex_lock(&dispatcher.mutex);
+	}
+}
+
+
+/**
+ * Frees the subscriptions that were removed while the thread was dispatching and wakes
+ * up the threads that wait for it.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static void finish_dispatching (void)
+{
+	dispatcher.dispatching = 0;
+	free_removed_subscriptions();
+	pthread_cond_broadcast(&dispatcher.idle);
+}
+
+
+/**
+ * Converts a V4L2 event into libwebcam events.
+ *
+ * @return the number of events added to @a ids and @a data
+ */
+static unsigned int translate_event (EventSource *source, struct v4l2_event *event,
+		CEventId *ids, CEventData *data)
+{
+	unsigned int count = 0;
+#ifdef V4L2_EVENT_CTRL
+	if(event->type != V4L2_EVENT_CTRL)
+		return 0;
+	EventControl *control = find_event_control(source, event->id);
+	if(!control)
+		return 0;
+
+	if(event->u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE) {
+		ids[count] = CE_CONTROL_VALUE_CHANGED;
+		memset(&data[count], 0, sizeof(data[count]));
+		data[count].control_id	= control->id;
+		data[count].value.type	= control->type;
+		data[count].value.value	= event->u.ctrl.value;
+		count++;
+	}
+	if(event->u.ctrl.changes & ~V4L2_EVENT_CTRL_CH_VALUE) {
+		ids[count] = CE_CONTROL_INFO_CHANGED;
+		memset(&data[count], 0, sizeof(data[count]));
+		data[count].control_id	= control->id;
+		count++;
+	}
+#endif
+	return count;
+}
+
+
+/**
+ * Queries the controls whose range or flags changed again, so that c_enum_controls()
+ * returns the new descriptions.
+ *
+ * The device is opened once more, because the event source can be closed meanwhile.
+ */
+static void update_event_controls (const char *v4l2_name, const unsigned int *v4l2_ids,
+		unsigned int count)
+{
+	unsigned int i;
+
+	int v4l2_dev = open_v4l2_device((char *)v4l2_name);
+	if(v4l2_dev <= 0)
+		return;
+	for(i = 0; i < count; i++)
+		update_device_control(v4l2_name, v4l2_dev, v4l2_ids[i]);
+	backend_close(v4l2_dev);
+}
+
+
+/**
+ * Dequeues the pending events of a device and calls the handlers.
+ *
+ * Note: The dispatcher mutex must be locked. It is released while controls are queried
+ * and while handlers run.
+ */
+static void dispatch_source_events (uint64_t serial, uint32_t ready)
+{
+	CEventId ids[EVENT_BATCH_SIZE];
+	CEventData data[EVENT_BATCH_SIZE];
+	unsigned int updates[EVENT_BATCH_SIZE];
+	char v4l2_name[NAME_MAX];
+	struct v4l2_event event;
+	unsigned int count = 0, update_count = 0, i;
+	int gone = ready & (EPOLLERR | EPOLLHUP);
+
+	EventSource *source = find_event_source_by_serial(serial);
+	if(!source)
+		return;
+
+	// Take the events while the lock keeps the source alive. Events that do not fit
+	// into the batch are taken in the next round. An unplugged device reports
+	// EPOLLPRI together with the error, so the error is checked first.
+	if(!gone && (ready & (EPOLLPRI | EPOLLIN))) {
+		while(count + 2 <= EVENT_BATCH_SIZE) {
+			if(device_ioctl(source->stats, source->fd, VIDIOC_DQEVENT, &event)) {
+				// ENOENT means the queue is empty, anything else that the device
+				// cannot deliver events anymore
+				gone = errno != ENOENT && errno != EAGAIN && errno != EINTR;
+				break;
+			}
+			unsigned int added = translate_event(source, &event, ids + count, data + count);
+			if(added && ids[count + added - 1] == CE_CONTROL_INFO_CHANGED)
+				updates[update_count++] = event.id;
+			count += added;
+			if(!event.pending)
+				break;
+		}
+	}
+	if(gone) {
+		// The device is gone. Stop waiting on it, otherwise the level-triggered
+		// epoll set keeps reporting it. The subscriptions stay until they are removed.
+		epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_DEL, source->poll_fd, NULL);
+	}
+	if(!count)
+		return;
+
+	strcpy(v4l2_name, source->v4l2_name);
+	begin_dispatching();
+	if(update_count) {
+		// Update the control descriptions before the handlers look at them. Querying the
+		// device takes a while, so release the lock meanwhile like for hotplug events.
+		pthread_mutex_unlock(&dispatcher.mutex);
+		update_event_controls(v4l2_name, updates, update_count);
+		pthread_mutex_lock(&dispatcher.mutex);
+	}
+	for(i = 0; i < count; i++) {
+		data[i].device_name = v4l2_name;
+		call_handlers(serial, ids[i], &data[i]);
+	}
+	finish_dispatching();
+}
+
+
+/**
+ * Receives a uevent and, if a video device was added or removed, updates the device
+ * list and calls the hotplug handlers.
+ *
+ * Note: The dispatcher mutex must be locked. It is released while the device list is
+ * updated and while handlers run.
+ */
+static void dispatch_hotplug_events (void)
+{
+	char buffer[UEVENT_BUFFER_SIZE];
+	char v4l2_name[NAME_MAX];
+
+	ssize_t length = recv(dispatcher.uevent_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+	if(length <= 0)
+		return;
+	buffer[length] = '\0';
+	if(!parse_uevent(buffer, length, v4l2_name))
+		return;
+
+	// Opening and querying a new device takes a while, so release the lock meanwhile.
+	// Marking the thread as busy makes c_cleanup() wait until the list is updated.
+	begin_dispatching();
+	pthread_mutex_unlock(&dispatcher.mutex);
+	int change = update_device(v4l2_name);
+	pthread_mutex_lock(&dispatcher.mutex);
+
+	if(change) {
+		CEventData data;
+		memset(&data, 0, sizeof(data));
+		data.device_name = v4l2_name;
+		if(change < 0) {
+			// The device file is useless now
+			EventSource *source = find_event_source(v4l2_name);
+			if(source)
+				close_event_source(source);
+		}
+		call_handlers(HOTPLUG_SOURCE, change > 0 ? CE_DEVICE_ADDED : CE_DEVICE_REMOVED, &data);
+	}
+	finish_dispatching();
+}
+
+
+/**
+ * Delivers the events of the descriptors that epoll reported as ready.
+ *
+ * Note: The dispatcher mutex must be locked. It is released while handlers run.
+ *
+ * @return 1 if the thread was asked to stop, 0 otherwise
+ */
+static int dispatch_ready_events (struct epoll_event *ready, int count)
+{
+	int i;
+	for(i = 0; i < count; i++) {
+		if(ready[i].data.u64 == STOP_SOURCE)
+			return 1;
+		if(ready[i].data.u64 == HOTPLUG_SOURCE)
+			dispatch_hotplug_events();
+		else
+			dispatch_source_events(ready[i].data.u64, ready[i].events);
+	}
+	return 0;
+}
+
+
+
+/*
+ * Event thread
+ */
+
+/// Set on the event thread when a handler stopped the dispatcher. The thread then
+/// closes its descriptors itself, because nobody joins it.
+static __thread int close_on_exit;
+
+/**
+ * Waits for events of the devices in the epoll set and delivers them until
+ * the thread is stopped.
+ *
+ * @param arg	the stop descriptor of the thread
+ */
+static void *event_thread (void *arg)
+{
+	struct epoll_event ready[EVENT_READY_SIZE];
+	int epoll_fd = dispatcher.epoll_fd, stop_fd = (int)(intptr_t)arg;
+	int count, stop;
+
+	for(;;) {
+		count = epoll_wait(epoll_fd, ready, ARRAY_SIZE(ready), -1);
+		if(count < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		pthread_mutex_lock(&dispatcher.mutex);
+		stop = dispatch_ready_events(ready, count);
+		pthread_mutex_unlock(&dispatcher.mutex);
+		if(stop)
+			break;
+	}
+
+	if(close_on_exit) {
+		close(epoll_fd);
+		close(stop_fd);
+	}
+	return NULL;
+}
+
+
+/**
+ * Starts the event thread.
+ *
+ * The thread blocks all signals, so that it does not receive signals that the
+ * application handles synchronously (e.g. with sigwait() or a signalfd).
+ *
+ * Note: The dispatcher mutex must be locked and the epoll set must exist.
+ */
+static CResult start_event_thread (void)
+{
+	struct epoll_event ev;
+	sigset_t signals, old_signals;
+
+	dispatcher.stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(dispatcher.stop_fd < 0)
+		return C_SYNC_ERROR;
+	memset(&ev, 0, sizeof(ev));
+	ev.events	= EPOLLIN;
+	ev.data.u64	= STOP_SOURCE;
+	if(epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_ADD, dispatcher.stop_fd, &ev))
+		goto failed;
+
+	sigfillset(&signals);
+	pthread_sigmask(SIG_SETMASK, &signals, &old_signals);
+	int r = pthread_create(&dispatcher.thread, NULL, event_thread,
+			(void *)(intptr_t)dispatcher.stop_fd);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if(r) {
+		epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_DEL, dispatcher.stop_fd, NULL);
+		goto failed;
+	}
+	return C_SUCCESS;
+
+failed:
+	close(dispatcher.stop_fd);
+	dispatcher.stop_fd = -1;
+	return C_SYNC_ERROR;
+}
+
+
+/**
+ * Creates the epoll set and, unless the application dispatches the events itself,
+ * starts the event thread if it is not running yet.
+ *
+ * Note: The dispatcher mutex must be locked.
+ */
+static CResult start_event_dispatcher (void)
+{
+	if(dispatcher.epoll_fd < 0) {
+		dispatcher.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if(dispatcher.epoll_fd < 0)
+			return C_SYNC_ERROR;
+	}
+	if(dispatcher.external || dispatcher.stop_fd >= 0)
+		return C_SUCCESS;
+
+	CResult ret = start_event_thread();
+	if(ret && !dispatcher.sources && dispatcher.uevent_fd < 0) {
+		close(dispatcher.epoll_fd);
+		dispatcher.epoll_fd = -1;
+	}
+	return ret;
+}
+
+
+/**
+ * Removes all subscriptions, stops the event thread, and closes the epoll set.
+ *
+ * If a handler calls this function (through c_cleanup()), the thread exits after the
+ * handler returns and closes the descriptors itself.
+ */
+void stop_event_dispatcher (void)
+{
+	uint64_t value = 1;
+
+	pthread_mutex_lock(&dispatcher.mutex);
+	EventSubscription *elem, *next;
+	for(elem = dispatcher.subscriptions; elem; elem = next) {
+		next = elem->next;
+		if(!elem->removed)
+			remove_subscription(elem);
+	}
+	dispatcher.external = 0;
+	if(dispatcher.epoll_fd < 0) {
+		pthread_mutex_unlock(&dispatcher.mutex);
+		return;
+	}
+	wait_for_handlers();
+
+	int epoll_fd = dispatcher.epoll_fd, stop_fd = dispatcher.stop_fd;
+	pthread_t thread = dispatcher.thread;
+	dispatcher.epoll_fd = dispatcher.stop_fd = -1;
+	pthread_mutex_unlock(&dispatcher.mutex);
+
+	if(stop_fd < 0) {
+		// The application dispatched the events, there is no thread
+		close(epoll_fd);
+		return;
+	}
+	if(write(stop_fd, &value, sizeof(value)) < 0)
+		return;
+	if(pthread_equal(pthread_self(), thread)) {
+		// The thread still waits on the descriptors, it closes them when it exits
+		close_on_exit = 1;
+		pthread_detach(thread);
+		return;
+	}
+	pthread_join(thread, NULL);
+	close(epoll_fd);
+	close(stop_fd);
+}
+
+
+/**
+ * Removes all subscriptions of a device handle.
+ *
+ * This function is called when the handle is closed.
+ */
+void remove_event_subscriptions (CHandle hDevice)
+{
+	pthread_mutex_lock(&dispatcher.mutex);
+	EventSubscription *elem, *next;
+	for(elem = dispatcher.subscriptions; elem; elem = next) {
+		next = elem->next;
+		if(elem->hDevice == hDevice && !elem->removed)
+			remove_subscription(elem);
+	}
+	wait_for_handlers();
+	pthread_mutex_unlock(&dispatcher.mutex);
+}
+
+
+/**
+ * Subscribes to the events of the controls that were added to a device after its event
+ * source was opened, e.g. by a dynctrl import.
+ *
+ * This function is called after the control list of the device was updated.
+ */
+void update_event_source (Device *device)
+{
+	pthread_mutex_lock(&dispatcher.mutex);
+	EventSource *source = find_event_source(device->v4l2_name);
+	if(source)
+		add_event_controls(source, device);
+	pthread_mutex_unlock(&dispatcher.mutex);
+}
+
+
+
+/*
+ * Events
+ */
+
+/**
+ * Enumerates the events supported by the given device.
+ *
+ * A device supports the control events if at least one of its controls has the
+ * #CC_CAN_NOTIFY flag.
+ *
+ * If the buffer is not large enough, #C_BUFFER_TOO_SMALL is returned and
+ * the \a size parameter is modified to contain the required buffer size.
+ *
+ * @param hDevice	a device handle obtained from c_open_device()
+ * @param events	a pointer to a buffer that retrieves the list of supported events
+ * @param size		a pointer to an integer that contains or receives the size of
+ * 					the \a events buffer.
+ * @param count		a pointer to an integer that receives the number of events
+ * 					supported. Can be NULL. If this argument is not NULL, the event
+ * 					count is returned independent of whether or not the buffer is
+ * 					large enough.
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_NOT_EXIST if the device does not exist (anymore)
+ * 		- #C_SYNC_ERROR if the synchronization structures could not be initialized
+ * 		- #C_INVALID_ARG if no size pointer was given or if a size pointer was given
+ * 		  but no @a events buffer was given
+ * 		- #C_BUFFER_TOO_SMALL if the supplied buffer is not large enough
+ */
+CResult c_enum_events (CHandle hDevice, CEvent *events, unsigned int *size, unsigned int *count)
+{
+	unsigned int event_count = 0, names_length = 0, i;
+
+	// Check the given handle and arguments
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(!HANDLE_OPEN(hDevice))
+		return C_INVALID_HANDLE;
+	if(!HANDLE_VALID(hDevice))
+		return C_NOT_EXIST;
+	Device *device = GET_HANDLE(hDevice).device;
+	if(size == NULL)
+		return C_INVALID_ARG;
+
+	if(lock_control_list(device))
+		return C_SYNC_ERROR;
+	Control *elem;
+	for(elem = device->controls.first; elem; elem = elem->next) {
+		if(elem->control.flags & CC_CAN_NOTIFY)
+			break;
+	}
+	unlock_control_list(device);
+	if(elem) {
+		event_count = ARRAY_SIZE(supported_events);
+		for(i = 0; i < event_count; i++)
+			names_length += strlen(supported_events[i].name) + 1;
+	}
+
+	// Determine the buffer size needed to describe all events
+	if(count)
+		*count = event_count;
+	unsigned int req_size = event_count * sizeof(CEvent) + names_length;
+	if(req_size > *size) {
+		*size = req_size;
+		return C_BUFFER_TOO_SMALL;
+	}
+	if(event_count == 0)
+		return C_SUCCESS;
+	if(events == NULL)
+		return C_INVALID_ARG;
+
+	unsigned int names_offset = event_count * sizeof(CEvent);
+	for(i = 0; i < event_count; i++) {
+		events[i].id	= supported_events[i].id;
+		events[i].flags	= 0;
+		copy_string_to_buffer(&events[i].name, supported_events[i].name, events, &names_offset);
+	}
+	assert(names_offset == req_size);
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Subscribes the caller to receive the given event.
+ *
+ * The handler is called on the event thread of the library every time the event
+ * occurs, until c_unsubscribe_event() is called or the handle is closed. The events
+ * of all devices are delivered by the same thread, so handlers are never called
+ * concurrently. For control events, the handler receives the ID of the control that
+ * changed and, for #CE_CONTROL_VALUE_CHANGED, its new value. Value changes are
+ * reported independent of whether this or another application changed the control.
+ * No event is sent for the current values when subscribing.
+ *
+ * Hotplug events (#CE_DEVICE_ADDED and #CE_DEVICE_REMOVED) concern all devices and are
+ * subscribed to with a handle of 0. When they are delivered, the library's device list
+ * has already been updated: handles of a removed device return #C_NOT_EXIST and an
+ * added device can be opened. Devices that were added or removed before subscribing
+ * are not reported, so applications should call c_enum_devices() after subscribing.
+ *
+ * If the handle is already subscribed to the event, the handler and context are
+ * replaced.
+ *
+ * @param hDevice	a device handle obtained from c_open_device(), or 0 for hotplug
+ * 					events
+ * @param event_id	the event to subscribe to
+ * @param handler	the function that is called for each event
+ * @param context	a value that is passed to the handler
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_NOT_EXIST if the device does not exist (anymore)
+ * 		- #C_INVALID_ARG if no handler or an unknown event is given, or if a hotplug
+ * 		  event is given with a device handle
+ * 		- #C_INVALID_DEVICE if the device could not be opened
+ * 		- #C_NOT_FOUND if the device does not support the event
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SYNC_ERROR if the event thread could not be started or the uevent socket
+ * 		  could not be opened
+ */
+CResult c_subscribe_event (CHandle hDevice, CEventId event_id, CEventHandler handler, void *context)
+{
+	CResult ret = C_SUCCESS;
+	EventSubscription *elem;
+	unsigned int i;
+
+	// Check the given handle and arguments
+	if(!initialized)
+		return C_INIT_ERROR;
+	Device *device = NULL;
+	if(hDevice) {
+		if(!HANDLE_OPEN(hDevice))
+			return C_INVALID_HANDLE;
+		if(!HANDLE_VALID(hDevice))
+			return C_NOT_EXIST;
+		device = GET_HANDLE(hDevice).device;
+		for(i = 0; i < ARRAY_SIZE(supported_events) && supported_events[i].id != event_id; i++)
+			;
+		if(i == ARRAY_SIZE(supported_events))
+			return C_INVALID_ARG;
+	}
+	else if(!is_hotplug_event(event_id)) {
+		return C_INVALID_HANDLE;
+	}
+	if(handler == NULL)
+		return C_INVALID_ARG;
+
+	EventSubscription *subscription = (EventSubscription *)calloc(1, sizeof(*subscription));
+	if(!subscription)
+		return C_NO_MEMORY;
+	subscription->hDevice	= hDevice;
+	subscription->id		= event_id;
+	subscription->handler	= handler;
+	subscription->context	= context;
+
+	pthread_mutex_lock(&dispatcher.mutex);
+
+	// Replace the handler of an existing subscription
+	for(elem = dispatcher.subscriptions; elem; elem = elem->next) {
+		if(!elem->removed && elem->hDevice == hDevice && elem->id == event_id) {
+			elem->handler = handler;
+			elem->context = context;
+			goto done;
+		}
+	}
+
+	ret = start_event_dispatcher();
+	if(ret)
+		goto done;
+	if(!device) {
+		ret = open_uevent_socket();
+		if(ret)
+			goto done;
+		subscription->source = HOTPLUG_SOURCE;
+		goto add;
+	}
+	EventSource *source = find_event_source(device->v4l2_name);
+	if(!source) {
+		ret = open_event_source(device, &source);
+		if(ret)
+			goto done;
+	}
+
+	subscription->source = source->serial;
+
+add:
+	subscription->next = dispatcher.subscriptions;
+	dispatcher.subscriptions = subscription;
+	subscription = NULL;
+
+done:
+	pthread_mutex_unlock(&dispatcher.mutex);
+	free(subscription);
+	return ret;
+}
+
+
+/**
+ * Unsubscribes the caller from the given event.
+ *
+ * When the function returns, the handler is not running and will not be called
+ * again, unless the function is called by the handler itself.
+ *
+ * @param hDevice	a device handle obtained from c_open_device(), or 0 for hotplug
+ * 					events
+ * @param event_id	the event to unsubscribe from
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_NOT_FOUND if the handle is not subscribed to the event
+ */
+CResult c_unsubscribe_event (CHandle hDevice, CEventId event_id)
+{
+	CResult ret = C_NOT_FOUND;
+	EventSubscription *elem;
+
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(hDevice && !HANDLE_OPEN(hDevice))
+		return C_INVALID_HANDLE;
+
+	pthread_mutex_lock(&dispatcher.mutex);
+	for(elem = dispatcher.subscriptions; elem; elem = elem->next) {
+		if(!elem->removed && elem->hDevice == hDevice && elem->id == event_id) {
+			remove_subscription(elem);
+			wait_for_handlers();
+			ret = C_SUCCESS;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dispatcher.mutex);
+
+	return ret;
+}
+
+
+/**
+ * Returns a descriptor that lets the application deliver events on its own thread.
+ *
+ * The descriptor becomes readable when events of any subscription are pending. It can
+ * be added to the application's poll(), epoll, or event loop; when it is readable, the
+ * application calls c_dispatch_events(), which calls the handlers on the calling
+ * thread. From the first call of this function until c_cleanup(), the library does
+ * not use a thread for events. If the event thread is already running, it is stopped
+ * and its subscriptions are kept.
+ *
+ * The descriptor is owned by the library and stays the same until c_cleanup() closes
+ * it. The application must not read from it or close it.
+ *
+ * @param fd	receives the descriptor
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_ARG if no pointer is given
+ * 		- #C_SYNC_ERROR if a handler called the function on the event thread or the
+ * 		  descriptor could not be created
+ */
+CResult c_get_event_fd (int *fd)
+{
+	CResult ret = C_SUCCESS;
+	uint64_t value = 1;
+
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(fd == NULL)
+		return C_INVALID_ARG;
+
+	pthread_mutex_lock(&dispatcher.mutex);
+	dispatcher.external = 1;
+	if(dispatcher.stop_fd >= 0) {
+		// The thread cannot wait for itself
+		if(pthread_equal(pthread_self(), dispatcher.thread)) {
+			dispatcher.external = 0;
+			ret = C_SYNC_ERROR;
+			goto done;
+		}
+
+		// Stop the thread, but keep the epoll set
+		int stop_fd = dispatcher.stop_fd;
+		pthread_t thread = dispatcher.thread;
+		dispatcher.stop_fd = -1;
+		pthread_mutex_unlock(&dispatcher.mutex);
+		if(write(stop_fd, &value, sizeof(value)) == sizeof(value))
+			pthread_join(thread, NULL);
+		else
+			pthread_detach(thread);
+		pthread_mutex_lock(&dispatcher.mutex);
+		if(dispatcher.epoll_fd >= 0)
+			epoll_ctl(dispatcher.epoll_fd, EPOLL_CTL_DEL, stop_fd, NULL);
+		close(stop_fd);
+	}
+
+	ret = start_event_dispatcher();
+	if(!ret)
+		*fd = dispatcher.epoll_fd;
+
+done:
+	pthread_mutex_unlock(&dispatcher.mutex);
+	return ret;
+}
+
+
+/**
+ * Delivers the pending events on the calling thread.
+ *
+ * The function does not block. It handles the devices that have events pending when it
+ * is called and calls their handlers. If more events arrive meanwhile, the descriptor
+ * from c_get_event_fd() stays readable, so that the application's event loop calls the
+ * function again.
+ *
+ * @return
+ * 		- #C_SUCCESS on success, also if no events were pending
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_SYNC_ERROR if c_get_event_fd() has not been called, if a handler calls the
+ * 		  function, or if waiting for events failed
+ */
+CResult c_dispatch_events (void)
+{
+	CResult ret = C_SUCCESS;
+	struct epoll_event ready[EVENT_READY_SIZE];
+
+	if(!initialized)
+		return C_INIT_ERROR;
+
+	pthread_mutex_lock(&dispatcher.mutex);
+	if(!dispatcher.external || in_handler()) {
+		ret = C_SYNC_ERROR;
+		goto done;
+	}
+
+	int count = epoll_wait(dispatcher.epoll_fd, ready, ARRAY_SIZE(ready), 0);
+	if(count < 0) {
+		if(errno != EINTR)
+			ret = C_SYNC_ERROR;
+		goto done;
+	}
+	dispatch_ready_events(ready, count);
+
+done:
+	pthread_mutex_unlock(&dispatcher.mutex);
+	return ret;
+}
@@ -0,0 +1,1517 @@
+/**
+ * \file
+ * Fake device backend.
+ *
+ * \ingroup libwebcam
+ */
+
+/*
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of libwebcam.
+ *
+ * libwebcam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libwebcam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwebcam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The fake backend simulates V4L2 devices in memory, so that the library can be tested
+ * and benchmarked without cameras. It is enabled by setting the LIBWEBCAM_FAKE
+ * environment variable to the name of a script that describes the devices. Each line of
+ * the script contains one directive:
+ *
+ *   device <name>                          Starts a new device (e.g. 'video0')
+ *   driver <name>                          Driver name (default: 'uvcvideo')
+ *   card <name>                            Human-readable device name
+ *   usb <vendor>:<product> [<release>]     USB IDs in hex (default: no USB device)
+ *   control <id> <type> <name> <min> <max> <step> <default> [readonly] [noevents]
+ *                                          Control with a V4L2 ID and a type of
+ *                                          'integer', 'boolean', 'menu', or 'button'
+ *   menu <id> <index> <name>               Menu entry of a menu control
+ *   format <fourcc> <description>          Pixel format
+ *   size <width>x<height> [<fps> ...]      Frame size and frame rates of the last format
+ *   latency <request> <microseconds>       Delay of a request or of 'all' requests
+ *   fault <request> <error> [<skip> [<count>]]
+ *                                          Lets a request fail with the given error
+ *                                          (e.g. EIO, EPIPE) after <skip> successful
+ *                                          calls, <count> times (default: always)
+ *   uvc-map ok|<error>                     Result of UVCIOC_CTRL_MAP (default: 'ok' for
+ *                                          uvcvideo devices, ENOTTY for others)
+ *   hotplug <milliseconds>                 The device is unplugged after the given time
+ *                                          and plugged in again after the same time,
+ *                                          over and over
+ *
+ * All directives except 'device' apply to the last device. Requests are named like the
+ * ioctls (e.g. VIDIOC_S_CTRL, UVCIOC_CTRL_MAP) or 'open'. Arguments that contain spaces
+ * can be quoted and '#' starts a comment.
+ *
+ * The simulation is deterministic: the same script and the same sequence of requests
+ * always give the same results. Controls mapped with UVCIOC_CTRL_MAP appear in the
+ * control list like the ones of the UVC driver, and control events are delivered to the
+ * other open files of a device like the V4L2 core does.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <poll.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/videodev2.h>
+#include <linux/uvcvideo.h>
+
+#include "webcam.h"
+#include "libwebcam.h"
+
+
+/// Maximum number of fake devices
+#define FAKE_MAX_DEVICES		16
+/// Maximum number of controls per device, including mapped controls
+#define FAKE_MAX_CONTROLS		64
+/// Maximum number of menu entries per control
+#define FAKE_MAX_MENU_ENTRIES	32
+/// Maximum number of pixel formats per device
+#define FAKE_MAX_FORMATS		16
+/// Maximum number of frame sizes per pixel format
+#define FAKE_MAX_SIZES			16
+/// Maximum number of frame rates per frame size
+#define FAKE_MAX_RATES			8
+/// Maximum number of faults per device
+#define FAKE_MAX_FAULTS			16
+/// Maximum number of open files
+#define FAKE_MAX_FILES			256
+/// Number of events that can be queued per open file
+#define FAKE_MAX_EVENTS			64
+/// File descriptor of the first open file. Fake descriptors do not overlap real ones.
+#define FAKE_FD_BASE			0x100000
+/// Maximum number of arguments of a script directive
+#define FAKE_MAX_ARGS			10
+/// Subscription flag that marks a control as subscribed, even without other flags
+#define FAKE_SUBSCRIBED			0x80000000
+
+/// Directory that lists the video4linux devices in sysfs
+#define SYSFS_V4L2_DIR			"/sys/class/video4linux"
+
+
+/**
+ * Requests whose latency and faults can be configured.
+ */
+static const struct {
+	const char		* name;
+	unsigned long	request;
+} fake_requests[] = {
+	{ "open",						0 },
+	{ "VIDIOC_QUERYCAP",			VIDIOC_QUERYCAP },
+	{ "VIDIOC_QUERYCTRL",			VIDIOC_QUERYCTRL },
+	{ "VIDIOC_QUERYMENU",			VIDIOC_QUERYMENU },
+	{ "VIDIOC_G_CTRL",				VIDIOC_G_CTRL },
+	{ "VIDIOC_S_CTRL",				VIDIOC_S_CTRL },
+	{ "VIDIOC_G_EXT_CTRLS",			VIDIOC_G_EXT_CTRLS },
+	{ "VIDIOC_S_EXT_CTRLS",			VIDIOC_S_EXT_CTRLS },
+	{ "VIDIOC_ENUM_FMT",			VIDIOC_ENUM_FMT },
+	{ "VIDIOC_ENUM_FRAMESIZES",		VIDIOC_ENUM_FRAMESIZES },
+	{ "VIDIOC_ENUM_FRAMEINTERVALS",	VIDIOC_ENUM_FRAMEINTERVALS },
+#ifdef V4L2_EVENT_CTRL
+	{ "VIDIOC_SUBSCRIBE_EVENT",		VIDIOC_SUBSCRIBE_EVENT },
+	{ "VIDIOC_UNSUBSCRIBE_EVENT",	VIDIOC_UNSUBSCRIBE_EVENT },
+	{ "VIDIOC_DQEVENT",				VIDIOC_DQEVENT },
+#endif
+	{ "UVCIOC_CTRL_MAP",			UVCIOC_CTRL_MAP },
+};
+#define FAKE_REQUEST_COUNT		ARRAY_SIZE(fake_requests)
+
+/**
+ * Error names that can be used in scripts.
+ */
+static const struct {
+	const char		* name;
+	int				error;
+} fake_errors[] = {
+	{ "EIO",		EIO },
+	{ "EPIPE",		EPIPE },
+	{ "EBUSY",		EBUSY },
+	{ "EINVAL",		EINVAL },
+	{ "ENODEV",		ENODEV },
+	{ "ENOENT",		ENOENT },
+	{ "ENOTTY",		ENOTTY },
+	{ "EACCES",		EACCES },
+	{ "EPERM",		EPERM },
+	{ "EEXIST",		EEXIST },
+	{ "ERANGE",		ERANGE },
+	{ "ETIMEDOUT",	ETIMEDOUT },
+	{ "ENOMEM",		ENOMEM },
+	{ "ENOSPC",		ENOSPC },
+	{ "EPROTO",		EPROTO },
+};
+
+
+/**
+ * A simulated control.
+ */
+typedef struct _FakeControl {
+	/// Control description as returned by VIDIOC_QUERYCTRL
+	struct v4l2_queryctrl	info;
+	/// Current value
+	int						value;
+	/// Whether the control supports control events
+	int						events;
+	/// Names of the menu entries. Entries with an empty name do not exist.
+	char					menu[FAKE_MAX_MENU_ENTRIES][32];
+
+} FakeControl;
+
+/**
+ * A simulated frame size with its frame rates.
+ */
+typedef struct _FakeFrameSize {
+	unsigned int			width;
+	unsigned int			height;
+	/// Frame rates in frames per second
+	unsigned int			rates[FAKE_MAX_RATES];
+	unsigned int			rate_count;
+
+} FakeFrameSize;
+
+/**
+ * A simulated pixel format.
+ */
+typedef struct _FakeFormat {
+	unsigned int			fourcc;
+	char					description[32];
+	FakeFrameSize			sizes[FAKE_MAX_SIZES];
+	unsigned int			size_count;
+
+} FakeFormat;
+
+/**
+ * A fault that lets a request fail.
+ */
+typedef struct _FakeFault {
+	/// Index of the request in #fake_requests
+	unsigned int			request;
+	/// Error code returned in errno
+	int						error;
+	/// Number of successful calls before the request fails
+	unsigned int			skip;
+	/// Number of failing calls or 0 if the request fails for good
+	unsigned int			count;
+	/// Number of calls so far
+	unsigned int			calls;
+
+} FakeFault;
+
+/**
+ * A simulated device.
+ */
+typedef struct _FakeDevice {
+	char					name[32];
+	char					driver[16];
+	char					card[32];
+	unsigned short			vendor;
+	unsigned short			product;
+	unsigned short			release;
+	FakeControl				controls[FAKE_MAX_CONTROLS];
+	unsigned int			control_count;
+	FakeFormat				formats[FAKE_MAX_FORMATS];
+	unsigned int			format_count;
+	/// Latency of each request in #fake_requests in microseconds
+	unsigned int			latency[FAKE_REQUEST_COUNT];
+	FakeFault				faults[FAKE_MAX_FAULTS];
+	unsigned int			fault_count;
+	/// Error returned by UVCIOC_CTRL_MAP, 0 for success, or -1 to decide by driver
+	int						map_error;
+	/// Interval in milliseconds at which the device is unplugged and plugged in again,
+	/// 0 if it stays
+	unsigned int			hotplug_interval;
+	/// Boolean whether the device is currently unplugged
+	int						unplugged;
+	/// Time of the next hotplug event in milliseconds (CLOCK_MONOTONIC)
+	long long				next_hotplug;
+
+} FakeDevice;
+
+/**
+ * A queued control event.
+ */
+typedef struct _FakeEvent {
+	unsigned int			id;
+	int						value;
+	unsigned int			changes;
+
+} FakeEvent;
+
+/**
+ * An open file of a simulated device.
+ */
+typedef struct _FakeFile {
+	/// Index of the device or -1 if the file is not open
+	int						device;
+	/// Subscription flags for each control, 0 if the control is not subscribed
+	unsigned int			subscribed[FAKE_MAX_CONTROLS];
+	/// Ring buffer of queued events
+	FakeEvent				events[FAKE_MAX_EVENTS];
+	unsigned int			first_event;
+	unsigned int			event_count;
+	unsigned int			sequence;
+	/// Descriptor that is readable while events are queued, -1 if not created yet.
+	/// Fake descriptors cannot be added to an epoll set, so this one stands in for them.
+	int						event_fd;
+
+} FakeFile;
+
+/**
+ * State of the fake backend.
+ */
+static struct {
+	/// Serializes the access to the devices and files
+	pthread_mutex_t			mutex;
+	/// Signaled when events are queued
+	pthread_cond_t			event_cond;
+	FakeDevice				* devices;
+	unsigned int			device_count;
+	FakeFile				* files;
+	/// Socket pair that carries the hotplug uevents (see fake_uevent_socket())
+	int						uevent_fds[2];
+	/// Boolean whether the socket pair and the hotplug thread have been created
+	int						uevents_started;
+
+} fake = { PTHREAD_MUTEX_INITIALIZER };
+
+
+
+/*
+ * Script parsing
+ */
+
+/**
+ * Splits a script line into arguments.
+ *
+ * The line is modified in place and the arguments point into it.
+ *
+ * @return the number of arguments or -1 if there are too many or a quote is not closed
+ */
+static int split_line (char *line, char *args[FAKE_MAX_ARGS])
+{
+	int count = 0;
+	char *p = line;
+
+	for(;;) {
+		while(isspace((unsigned char)*p))
+			p++;
+		if(!*p || *p == '#')
+			break;
+		if(count == FAKE_MAX_ARGS)
+			return -1;
+
+		if(*p == '"' || *p == '\'') {
+			char quote = *p++;
+			args[count++] = p;
+			p = strchr(p, quote);
+			if(!p)
+				return -1;
+		}
+		else {
+			args[count++] = p;
+			while(*p && !isspace((unsigned char)*p))
+				p++;
+			if(!*p)
+				break;
+		}
+		*p++ = '\0';
+	}
+
+	return count;
+}
+
+
+static int parse_number (const char *string, long *value)
+{
+	char *end;
+	errno = 0;
+	*value = strtol(string, &end, 0);
+	return errno || !*string || *end;
+}
+
+
+static int parse_request (const char *name)
+{
+	unsigned int i;
+	for(i = 0; i < FAKE_REQUEST_COUNT; i++) {
+		if(strcmp(name, fake_requests[i].name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+static int parse_error (const char *name)
+{
+	unsigned int i;
+	for(i = 0; i < ARRAY_SIZE(fake_errors); i++) {
+		if(strcmp(name, fake_errors[i].name) == 0)
+			return fake_errors[i].error;
+	}
+	return 0;
+}
+
+
+static FakeControl *find_fake_control (FakeDevice *dev, unsigned int id)
+{
+	unsigned int i;
+	for(i = 0; i < dev->control_count; i++) {
+		if(dev->controls[i].info.id == id)
+			return &dev->controls[i];
+	}
+	return NULL;
+}
+
+
+static const char *parse_control (FakeDevice *dev, char *args[], int count)
+{
+	static const struct {
+		const char				* name;
+		enum v4l2_ctrl_type		type;
+	} types[] = {
+		{ "integer",	V4L2_CTRL_TYPE_INTEGER },
+		{ "boolean",	V4L2_CTRL_TYPE_BOOLEAN },
+		{ "menu",		V4L2_CTRL_TYPE_MENU },
+		{ "button",		V4L2_CTRL_TYPE_BUTTON },
+	};
+	long values[5];
+	int i;
+
+	if(count < 8)
+		return "Missing control arguments";
+	if(dev->control_count == FAKE_MAX_CONTROLS)
+		return "Too many controls";
+	if(parse_number(args[1], &values[0]))
+		return "Invalid control ID";
+	for(i = 1; i < 5; i++) {
+		if(parse_number(args[3 + i], &values[i]))
+			return "Invalid control range";
+	}
+	if(find_fake_control(dev, values[0]))
+		return "Duplicate control ID";
+
+	FakeControl *control = &dev->controls[dev->control_count];
+	memset(control, 0, sizeof(*control));
+	for(i = 0; i < ARRAY_SIZE(types); i++) {
+		if(strcmp(args[2], types[i].name) == 0)
+			break;
+	}
+	if(i == ARRAY_SIZE(types))
+		return "Unknown control type";
+	control->info.type			= types[i].type;
+	control->info.id			= values[0];
+	snprintf((char *)control->info.name, sizeof(control->info.name), "%s", args[3]);
+	control->info.minimum		= values[1];
+	control->info.maximum		= values[2];
+	control->info.step			= values[3];
+	control->info.default_value	= values[4];
+	control->value				= values[4];
+	control->events				= 1;
+	if(control->info.type == V4L2_CTRL_TYPE_BUTTON)
+		control->info.flags		|= V4L2_CTRL_FLAG_WRITE_ONLY;
+
+	for(i = 8; i < count; i++) {
+		if(strcmp(args[i], "readonly") == 0)
+			control->info.flags |= V4L2_CTRL_FLAG_READ_ONLY;
+		else if(strcmp(args[i], "noevents") == 0)
+			control->events = 0;
+		else
+			return "Unknown control flag";
+	}
+
+	dev->control_count++;
+	return NULL;
+}
+
+
+static const char *parse_size (FakeDevice *dev, char *args[], int count)
+{
+	unsigned int width, height;
+	char end;
+	int i;
+
+	if(!dev->format_count)
+		return "Frame size without a format";
+	FakeFormat *format = &dev->formats[dev->format_count - 1];
+	if(format->size_count == FAKE_MAX_SIZES || count - 2 > FAKE_MAX_RATES)
+		return "Too many frame sizes or rates";
+	if(count < 2 || sscanf(args[1], "%ux%u%c", &width, &height, &end) != 2)
+		return "Invalid frame size";
+
+	FakeFrameSize *size = &format->sizes[format->size_count];
+	size->width		= width;
+	size->height	= height;
+	size->rate_count = 0;
+	for(i = 2; i < count; i++) {
+		long rate;
+		if(parse_number(args[i], &rate) || rate <= 0)
+			return "Invalid frame rate";
+		size->rates[size->rate_count++] = rate;
+	}
+
+	format->size_count++;
+	return NULL;
+}
+
+
+/**
+ * Processes a single script directive.
+ *
+ * @return NULL on success or an error message
+ */
+static const char *parse_directive (char *args[], int count)
+{
+	FakeDevice *dev = fake.device_count ? &fake.devices[fake.device_count - 1] : NULL;
+	const char *directive = args[0];
+	long value;
+
+	if(strcmp(directive, "device") == 0) {
+		if(count != 2 || strncmp(args[1], "video", 5) != 0)
+			return "Invalid device name";
+		if(fake.device_count == FAKE_MAX_DEVICES)
+			return "Too many devices";
+		dev = &fake.devices[fake.device_count++];
+		memset(dev, 0, sizeof(*dev));
+		snprintf(dev->name, sizeof(dev->name), "%s", args[1]);
+		snprintf(dev->driver, sizeof(dev->driver), "uvcvideo");
+		snprintf(dev->card, sizeof(dev->card), "Fake Camera %s", args[1] + 5);
+		dev->map_error = -1;
+		return NULL;
+	}
+	if(!dev)
+		return "Directive before the first device";
+
+	if(strcmp(directive, "driver") == 0 && count == 2) {
+		snprintf(dev->driver, sizeof(dev->driver), "%s", args[1]);
+	}
+	else if(strcmp(directive, "card") == 0 && count == 2) {
+		snprintf(dev->card, sizeof(dev->card), "%s", args[1]);
+	}
+	else if(strcmp(directive, "usb") == 0 && (count == 2 || count == 3)) {
+		unsigned int vendor, product, release = 0;
+		if(sscanf(args[1], "%x:%x", &vendor, &product) != 2 ||
+		   (count == 3 && sscanf(args[2], "%x", &release) != 1))
+			return "Invalid USB IDs";
+		dev->vendor		= vendor;
+		dev->product	= product;
+		dev->release	= release;
+	}
+	else if(strcmp(directive, "control") == 0) {
+		return parse_control(dev, args, count);
+	}
+	else if(strcmp(directive, "menu") == 0 && count == 4) {
+		long index;
+		if(parse_number(args[1], &value) || parse_number(args[2], &index))
+			return "Invalid menu entry";
+		FakeControl *control = find_fake_control(dev, value);
+		if(!control || control->info.type != V4L2_CTRL_TYPE_MENU)
+			return "Menu entry for an unknown control";
+		if(index < 0 || index >= FAKE_MAX_MENU_ENTRIES)
+			return "Menu index out of range";
+		snprintf(control->menu[index], sizeof(control->menu[index]), "%s", args[3]);
+	}
+	else if(strcmp(directive, "format") == 0 && count == 3) {
+		if(dev->format_count == FAKE_MAX_FORMATS)
+			return "Too many formats";
+		if(strlen(args[1]) != 4)
+			return "Invalid FourCC code";
+		FakeFormat *format = &dev->formats[dev->format_count++];
+		memset(format, 0, sizeof(*format));
+		format->fourcc = v4l2_fourcc(args[1][0], args[1][1], args[1][2], args[1][3]);
+		snprintf(format->description, sizeof(format->description), "%s", args[2]);
+	}
+	else if(strcmp(directive, "size") == 0) {
+		return parse_size(dev, args, count);
+	}
+	else if(strcmp(directive, "latency") == 0 && count == 3) {
+		int request = parse_request(args[1]);
+		if((request < 0 && strcmp(args[1], "all") != 0) || parse_number(args[2], &value) || value < 0)
+			return "Invalid latency";
+		unsigned int i;
+		for(i = 0; i < FAKE_REQUEST_COUNT; i++) {
+			if(request < 0 || i == request)
+				dev->latency[i] = value;
+		}
+	}
+	else if(strcmp(directive, "fault") == 0 && count >= 3 && count <= 5) {
+		long skip = 0, fault_count = 0;
+		int request = parse_request(args[1]);
+		int error = parse_error(args[2]);
+		if(request < 0 || !error ||
+		   (count > 3 && (parse_number(args[3], &skip) || skip < 0)) ||
+		   (count > 4 && (parse_number(args[4], &fault_count) || fault_count < 0)))
+			return "Invalid fault";
+		if(dev->fault_count == FAKE_MAX_FAULTS)
+			return "Too many faults";
+		FakeFault *fault = &dev->faults[dev->fault_count++];
+		fault->request	= request;
+		fault->error	= error;
+		fault->skip		= skip;
+		fault->count	= fault_count;
+		fault->calls	= 0;
+	}
+	else if(strcmp(directive, "uvc-map") == 0 && count == 2) {
+		if(strcmp(args[1], "ok") == 0)
+			dev->map_error = 0;
+		else if(!(dev->map_error = parse_error(args[1])))
+			return "Unknown error name";
+	}
+	else if(strcmp(directive, "hotplug") == 0 && count == 2) {
+		long interval;
+		if(parse_number(args[1], &interval) || interval <= 0)
+			return "Invalid hotplug interval";
+		dev->hotplug_interval = interval;
+	}
+	else {
+		return "Unknown directive or wrong number of arguments";
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Loads the script that describes the fake devices.
+ *
+ * If the script cannot be loaded, the backend simulates a system without devices.
+ *
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_INVALID_ARG if the script could not be opened
+ * 		- #C_PARSE_ERROR if the script contains an error
+ */
+CResult fake_load (const char *file_name)
+{
+	CResult ret = C_SUCCESS;
+	char line[1024];
+	unsigned int line_number = 0, i;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&fake.event_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	fake.devices = (FakeDevice *)calloc(FAKE_MAX_DEVICES, sizeof(FakeDevice));
+	fake.files = (FakeFile *)calloc(FAKE_MAX_FILES, sizeof(FakeFile));
+	if(!fake.devices || !fake.files)
+		return C_NO_MEMORY;
+	for(i = 0; i < FAKE_MAX_FILES; i++)
+		fake.files[i].device = -1;
+
+	FILE *file = fopen(file_name, "r");
+	if(!file) {
+		print_libwebcam_error("Unable to open fake device script %s: %s", file_name, strerror(errno));
+		return C_INVALID_ARG;
+	}
+
+	while(fgets(line, sizeof(line), file)) {
+		char *args[FAKE_MAX_ARGS];
+		line_number++;
+
+		int count = split_line(line, args);
+		if(count == 0)
+			continue;
+		const char *error = count < 0 ? "Invalid line" : parse_directive(args, count);
+		if(error) {
+			print_libwebcam_error("%s:%u: %s.", file_name, line_number, error);
+			fake.device_count = 0;
+			ret = C_PARSE_ERROR;
+			break;
+		}
+	}
+
+	fclose(file);
+	return ret;
+}
+
+
+
+/*
+ * Request handling
+ */
+
+/**
+ * Returns the open file with the given descriptor or NULL if there is none.
+ */
+static FakeFile *get_fake_file (int fd)
+{
+	if(!fake.files || fd < FAKE_FD_BASE || fd >= FAKE_FD_BASE + FAKE_MAX_FILES)
+		return NULL;
+	FakeFile *file = &fake.files[fd - FAKE_FD_BASE];
+	return file->device < 0 ? NULL : file;
+}
+
+
+/**
+ * Simulates the latency and the faults of a request.
+ *
+ * Must be called without holding the mutex, so that requests to different devices run
+ * in parallel.
+ *
+ * @return 0 if the request should be handled or -1 with errno set if it fails
+ */
+static int simulate_request (FakeDevice *dev, unsigned int request)
+{
+	unsigned int i, latency;
+	int error = 0;
+
+	pthread_mutex_lock(&fake.mutex);
+	latency = dev->latency[request];
+	for(i = 0; i < dev->fault_count; i++) {
+		FakeFault *fault = &dev->faults[i];
+		if(fault->request != request)
+			continue;
+		fault->calls++;
+		if(fault->calls > fault->skip && (!fault->count || fault->calls <= fault->skip + fault->count))
+			error = fault->error;
+	}
+	pthread_mutex_unlock(&fake.mutex);
+
+	if(latency) {
+		struct timespec delay = { latency / 1000000, (latency % 1000000) * 1000 };
+		while(nanosleep(&delay, &delay) && errno == EINTR)
+			;
+	}
+	if(error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Makes the event descriptor of a file readable while events are queued.
+ */
+static void update_event_fd (FakeFile *file)
+{
+	uint64_t count = 1;
+	if(file->event_fd < 0)
+		return;
+	if(file->event_count)
+		write(file->event_fd, &count, sizeof(count));
+	else
+		read(file->event_fd, &count, sizeof(count));
+}
+
+
+/**
+ * Appends a control event to the queue of a file, dropping the oldest event if the
+ * queue is full.
+ */
+static void push_control_event (FakeFile *file, FakeControl *control, unsigned int changes)
+{
+	if(file->event_count == FAKE_MAX_EVENTS) {
+		file->first_event = (file->first_event + 1) % FAKE_MAX_EVENTS;
+		file->event_count--;
+	}
+	FakeEvent *event = &file->events[(file->first_event + file->event_count) % FAKE_MAX_EVENTS];
+	event->id		= control->info.id;
+	event->value	= control->value;
+	event->changes	= changes;
+	file->event_count++;
+	update_event_fd(file);
+	pthread_cond_broadcast(&fake.event_cond);
+}
+
+
+/**
+ * Queues a control event for all files that subscribed to the given control.
+ *
+ * The file that changed the control only gets the event if it asked for it.
+ */
+static void queue_control_event (FakeDevice *dev, FakeControl *control, FakeFile *sender,
+		unsigned int changes)
+{
+#ifdef V4L2_EVENT_CTRL
+	unsigned int c = control - dev->controls, i;
+	for(i = 0; i < FAKE_MAX_FILES; i++) {
+		FakeFile *file = &fake.files[i];
+		if(file->device != dev - fake.devices || !file->subscribed[c])
+			continue;
+		if(file == sender && !(file->subscribed[c] & V4L2_EVENT_SUB_FL_ALLOW_FEEDBACK))
+			continue;
+		push_control_event(file, control, changes);
+	}
+#endif
+}
+
+
+/**
+ * Checks a new control value and brings it into the valid range like the V4L2 core.
+ *
+ * @return 0 if the value is valid or an error code
+ */
+static int validate_control_value (FakeControl *control, int *value)
+{
+	struct v4l2_queryctrl *info = &control->info;
+
+	if(info->flags & V4L2_CTRL_FLAG_READ_ONLY)
+		return EACCES;
+	switch(info->type) {
+		case V4L2_CTRL_TYPE_BOOLEAN:
+			*value = !!*value;
+			break;
+		case V4L2_CTRL_TYPE_MENU:
+			if(*value < info->minimum || *value > info->maximum)
+				return ERANGE;
+			if(*value >= FAKE_MAX_MENU_ENTRIES || !control->menu[*value][0])
+				return EINVAL;
+			break;
+		case V4L2_CTRL_TYPE_BUTTON:
+			*value = 0;
+			break;
+		default:
+			if(*value < info->minimum)
+				*value = info->minimum;
+			else if(*value > info->maximum)
+				*value = info->maximum;
+			else if(info->step > 1)
+				*value = info->minimum + (*value - info->minimum + info->step / 2) / info->step * info->step;
+			break;
+	}
+	return 0;
+}
+
+
+static void set_control_value (FakeDevice *dev, FakeControl *control, FakeFile *sender, int value)
+{
+	if(control->info.type == V4L2_CTRL_TYPE_BUTTON || control->value == value)
+		return;
+	control->value = value;
+	if(control->events)
+		queue_control_event(dev, control, sender, V4L2_EVENT_CTRL_CH_VALUE);
+}
+
+
+static int get_control (FakeDevice *dev, unsigned int id, int *value)
+{
+	FakeControl *control = find_fake_control(dev, id);
+	if(!control)
+		return EINVAL;
+	if(control->info.flags & V4L2_CTRL_FLAG_WRITE_ONLY)
+		return EACCES;
+	*value = control->value;
+	return 0;
+}
+
+
+static int query_control (FakeDevice *dev, struct v4l2_queryctrl *query)
+{
+	FakeControl *found = NULL;
+	unsigned int i;
+
+	if(query->id & V4L2_CTRL_FLAG_NEXT_CTRL) {
+		// Return the control with the next higher ID
+		unsigned int id = query->id & ~V4L2_CTRL_FLAG_NEXT_CTRL;
+#ifdef V4L2_CTRL_FLAG_NEXT_COMPOUND
+		id &= ~V4L2_CTRL_FLAG_NEXT_COMPOUND;
+#endif
+		for(i = 0; i < dev->control_count; i++) {
+			FakeControl *control = &dev->controls[i];
+			if(control->info.id > id && (!found || control->info.id < found->info.id))
+				found = control;
+		}
+	}
+	else {
+		found = find_fake_control(dev, query->id);
+	}
+	if(!found)
+		return EINVAL;
+
+	*query = found->info;
+	return 0;
+}
+
+
+static int query_menu (FakeDevice *dev, struct v4l2_querymenu *query)
+{
+	FakeControl *control = find_fake_control(dev, query->id);
+	if(!control || control->info.type != V4L2_CTRL_TYPE_MENU)
+		return EINVAL;
+	if(query->index < control->info.minimum || query->index > control->info.maximum ||
+	   query->index >= FAKE_MAX_MENU_ENTRIES || !control->menu[query->index][0])
+		return EINVAL;
+
+	snprintf((char *)query->name, sizeof(query->name), "%s", control->menu[query->index]);
+	return 0;
+}
+
+
+static int transfer_ext_controls (FakeDevice *dev, FakeFile *file, struct v4l2_ext_controls *ctrls,
+		int write)
+{
+	unsigned int i;
+	int error;
+
+	// Validate all controls first, so that either all or no values are changed
+	for(i = 0; i < ctrls->count; i++) {
+		struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+		FakeControl *control = find_fake_control(dev, ctrl->id);
+		int value = ctrl->value;
+		if(!control)
+			error = EINVAL;
+		else if(write)
+			error = validate_control_value(control, &value);
+		else
+			error = get_control(dev, ctrl->id, &value);
+		ctrl->value = value;
+		if(error) {
+			ctrls->error_idx = write ? ctrls->count : i;
+			return error;
+		}
+	}
+	if(write) {
+		for(i = 0; i < ctrls->count; i++)
+			set_control_value(dev, find_fake_control(dev, ctrls->controls[i].id), file,
+					ctrls->controls[i].value);
+	}
+	return 0;
+}
+
+
+static FakeFormat *find_fake_format (FakeDevice *dev, unsigned int fourcc)
+{
+	unsigned int i;
+	for(i = 0; i < dev->format_count; i++) {
+		if(dev->formats[i].fourcc == fourcc)
+			return &dev->formats[i];
+	}
+	return NULL;
+}
+
+
+static int enum_frame_intervals (FakeDevice *dev, struct v4l2_frmivalenum *fival)
+{
+	FakeFormat *format = find_fake_format(dev, fival->pixel_format);
+	unsigned int i;
+	if(!format)
+		return EINVAL;
+	for(i = 0; i < format->size_count; i++) {
+		FakeFrameSize *size = &format->sizes[i];
+		if(size->width != fival->width || size->height != fival->height)
+			continue;
+		if(fival->index >= size->rate_count)
+			return EINVAL;
+		fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+		fival->discrete.numerator = 1;
+		fival->discrete.denominator = size->rates[fival->index];
+		return 0;
+	}
+	return EINVAL;
+}
+
+
+/**
+ * Adds a control mapping like the UVC driver.
+ *
+ * The mapped control becomes part of the control list. Mapping an ID that already
+ * exists fails with EEXIST, and so does redefining a control of the standard UVC units,
+ * which is what libwebcam uses to detect dynamic control support. Extension unit
+ * controls without a V4L2 ID are accepted but do not show up in the control list.
+ */
+static int map_control (FakeDevice *dev, struct uvc_xu_control_mapping *mapping)
+{
+	static const __u8 standard_unit[14] = { 0 };
+	int error = dev->map_error;
+	if(error < 0)
+		error = strcmp(dev->driver, "uvcvideo") == 0 ? 0 : ENOTTY;
+	if(error)
+		return error;
+	if(memcmp(mapping->entity, standard_unit, sizeof(standard_unit)) == 0 ||
+	   find_fake_control(dev, mapping->id))
+		return EEXIST;
+	if(mapping->id == 0)
+		return 0;
+	if(dev->control_count == FAKE_MAX_CONTROLS)
+		return ENOMEM;
+
+	FakeControl *control = &dev->controls[dev->control_count++];
+	memset(control, 0, sizeof(*control));
+	control->info.id		= mapping->id;
+	control->info.type		= mapping->v4l2_type;
+	snprintf((char *)control->info.name, sizeof(control->info.name), "%s", (char *)mapping->name);
+	control->info.minimum	= 0;
+	control->info.maximum	= mapping->size >= 31 || mapping->size == 0 ? INT_MAX : (1 << mapping->size) - 1;
+	control->info.step		= 1;
+	control->events			= 1;
+	if(mapping->v4l2_type == V4L2_CTRL_TYPE_MENU) {
+		unsigned int i;
+		control->info.maximum = mapping->menu_count ? mapping->menu_count - 1 : 0;
+		for(i = 0; i < mapping->menu_count && i < FAKE_MAX_MENU_ENTRIES; i++)
+			snprintf(control->menu[i], sizeof(control->menu[i]), "%s",
+					(char *)mapping->menu_info[i].name);
+	}
+	return 0;
+}
+
+
+#ifdef V4L2_EVENT_CTRL
+static int subscribe_event (FakeDevice *dev, FakeFile *file, struct v4l2_event_subscription *sub,
+		int subscribe)
+{
+	unsigned int i;
+
+	if(!subscribe && sub->type == V4L2_EVENT_ALL) {
+		memset(file->subscribed, 0, sizeof(file->subscribed));
+		file->event_count = 0;
+		update_event_fd(file);
+		return 0;
+	}
+	if(sub->type != V4L2_EVENT_CTRL)
+		return EINVAL;
+	FakeControl *control = find_fake_control(dev, sub->id);
+	if(!control || !control->events)
+		return EINVAL;
+	unsigned int c = control - dev->controls;
+
+	if(!subscribe) {
+		// Remove the subscription and its queued events
+		unsigned int kept = 0;
+		file->subscribed[c] = 0;
+		for(i = 0; i < file->event_count; i++) {
+			FakeEvent event = file->events[(file->first_event + i) % FAKE_MAX_EVENTS];
+			if(event.id != control->info.id)
+				file->events[(file->first_event + kept++) % FAKE_MAX_EVENTS] = event;
+		}
+		file->event_count = kept;
+		update_event_fd(file);
+		return 0;
+	}
+
+	file->subscribed[c] = sub->flags | FAKE_SUBSCRIBED;
+	if(sub->flags & V4L2_EVENT_SUB_FL_SEND_INITIAL)
+		push_control_event(file, control, V4L2_EVENT_CTRL_CH_VALUE | V4L2_EVENT_CTRL_CH_FLAGS);
+	return 0;
+}
+
+
+static int dequeue_event (FakeDevice *dev, FakeFile *file, struct v4l2_event *event)
+{
+	if(!file->event_count)
+		return ENOENT;
+
+	FakeEvent *queued = &file->events[file->first_event];
+	FakeControl *control = find_fake_control(dev, queued->id);
+	memset(event, 0, sizeof(*event));
+	event->type				= V4L2_EVENT_CTRL;
+	event->id				= queued->id;
+	event->u.ctrl.changes	= queued->changes;
+	event->u.ctrl.value		= queued->value;
+	if(control) {
+		event->u.ctrl.type		= control->info.type;
+		event->u.ctrl.flags		= control->info.flags;
+		event->u.ctrl.minimum	= control->info.minimum;
+		event->u.ctrl.maximum	= control->info.maximum;
+		event->u.ctrl.step		= control->info.step;
+		event->u.ctrl.default_value = control->info.default_value;
+	}
+	event->sequence = file->sequence++;
+	clock_gettime(CLOCK_MONOTONIC, &event->timestamp);
+
+	file->first_event = (file->first_event + 1) % FAKE_MAX_EVENTS;
+	file->event_count--;
+	event->pending = file->event_count;
+	if(!file->event_count)
+		update_event_fd(file);
+	return 0;
+}
+#endif
+
+
+/**
+ * Handles a request to an open file. The caller must hold the mutex.
+ *
+ * @return 0 on success or an error code
+ */
+static int handle_request (FakeDevice *dev, FakeFile *file, unsigned long request, void *arg)
+{
+	switch(request) {
+		case VIDIOC_QUERYCAP: {
+			struct v4l2_capability *cap = arg;
+			memset(cap, 0, sizeof(*cap));
+			snprintf((char *)cap->driver, sizeof(cap->driver), "%s", dev->driver);
+			snprintf((char *)cap->card, sizeof(cap->card), "%s", dev->card);
+			snprintf((char *)cap->bus_info, sizeof(cap->bus_info), "fake:%.26s", dev->name);
+			cap->version		= 0x030000;
+			cap->capabilities	= V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+			return 0;
+		}
+		case VIDIOC_QUERYCTRL:
+			return query_control(dev, arg);
+		case VIDIOC_QUERYMENU:
+			return query_menu(dev, arg);
+		case VIDIOC_G_CTRL: {
+			struct v4l2_control *ctrl = arg;
+			return get_control(dev, ctrl->id, &ctrl->value);
+		}
+		case VIDIOC_S_CTRL: {
+			struct v4l2_control *ctrl = arg;
+			FakeControl *control = find_fake_control(dev, ctrl->id);
+			if(!control)
+				return EINVAL;
+			int error = validate_control_value(control, &ctrl->value);
+			if(!error)
+				set_control_value(dev, control, file, ctrl->value);
+			return error;
+		}
+		case VIDIOC_G_EXT_CTRLS:
+			return transfer_ext_controls(dev, file, arg, 0);
+		case VIDIOC_S_EXT_CTRLS:
+			return transfer_ext_controls(dev, file, arg, 1);
+		case VIDIOC_ENUM_FMT: {
+			struct v4l2_fmtdesc *fmt = arg;
+			if(fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || fmt->index >= dev->format_count)
+				return EINVAL;
+			FakeFormat *format = &dev->formats[fmt->index];
+			fmt->flags			= 0;
+			fmt->pixelformat	= format->fourcc;
+			snprintf((char *)fmt->description, sizeof(fmt->description), "%s", format->description);
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMESIZES: {
+			struct v4l2_frmsizeenum *fsize = arg;
+			FakeFormat *format = find_fake_format(dev, fsize->pixel_format);
+			if(!format || fsize->index >= format->size_count)
+				return EINVAL;
+			fsize->type				= V4L2_FRMSIZE_TYPE_DISCRETE;
+			fsize->discrete.width	= format->sizes[fsize->index].width;
+			fsize->discrete.height	= format->sizes[fsize->index].height;
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			return enum_frame_intervals(dev, arg);
+#ifdef V4L2_EVENT_CTRL
+		case VIDIOC_SUBSCRIBE_EVENT:
+			return subscribe_event(dev, file, arg, 1);
+		case VIDIOC_UNSUBSCRIBE_EVENT:
+			return subscribe_event(dev, file, arg, 0);
+		case VIDIOC_DQEVENT:
+			return dequeue_event(dev, file, arg);
+#endif
+		case UVCIOC_CTRL_MAP:
+			return map_control(dev, arg);
+		default:
+			return ENOTTY;
+	}
+}
+
+
+
+/*
+ * Backend functions
+ */
+
+/**
+ * Opens a fake device node.
+ *
+ * @param path	path of the device node (e.g. '/dev/video0')
+ * @param flags	open flags, which are ignored
+ */
+int fake_open (const char *path, int flags)
+{
+	unsigned int d, i;
+
+	if(strncmp(path, "/dev/", 5) != 0)
+		goto not_found;
+	for(d = 0; d < fake.device_count; d++) {
+		if(strcmp(fake.devices[d].name, path + 5) == 0)
+			break;
+	}
+	if(d == fake.device_count || fake.devices[d].unplugged)
+		goto not_found;
+	if(simulate_request(&fake.devices[d], 0))
+		return -1;
+
+	pthread_mutex_lock(&fake.mutex);
+	for(i = 0; i < FAKE_MAX_FILES && fake.files[i].device >= 0; i++)
+		;
+	if(i == FAKE_MAX_FILES) {
+		pthread_mutex_unlock(&fake.mutex);
+		errno = EMFILE;
+		return -1;
+	}
+	FakeFile *file = &fake.files[i];
+	memset(file, 0, sizeof(*file));
+	file->device = d;
+	file->event_fd = -1;
+	pthread_mutex_unlock(&fake.mutex);
+	return FAKE_FD_BASE + i;
+
+not_found:
+	errno = ENOENT;
+	return -1;
+}
+
+
+/**
+ * Closes a file opened with fake_open().
+ */
+int fake_close (int fd)
+{
+	pthread_mutex_lock(&fake.mutex);
+	FakeFile *file = get_fake_file(fd);
+	if(file) {
+		file->device = -1;
+		if(file->event_fd >= 0)
+			close(file->event_fd);
+		file->event_fd = -1;
+	}
+	pthread_mutex_unlock(&fake.mutex);
+
+	if(!file) {
+		errno = EBADF;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Sends a request to a fake device.
+ *
+ * @return 0 on success or -1 with errno set like ioctl()
+ */
+int fake_ioctl (int fd, unsigned long request, void *arg)
+{
+	unsigned int r;
+
+	pthread_mutex_lock(&fake.mutex);
+	FakeFile *file = get_fake_file(fd);
+	FakeDevice *dev = file ? &fake.devices[file->device] : NULL;
+	pthread_mutex_unlock(&fake.mutex);
+	if(!file) {
+		errno = EBADF;
+		return -1;
+	}
+
+	for(r = 1; r < FAKE_REQUEST_COUNT && fake_requests[r].request != request; r++)
+		;
+	if(r < FAKE_REQUEST_COUNT && simulate_request(dev, r))
+		return -1;
+
+	pthread_mutex_lock(&fake.mutex);
+	int error = get_fake_file(fd) != file ? EBADF
+			  : dev->unplugged ? ENODEV
+			  : handle_request(dev, file, request, arg);
+	pthread_mutex_unlock(&fake.mutex);
+
+	if(error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Waits for events on fake device files.
+ *
+ * Only POLLPRI (pending events) is supported. Descriptors that do not belong to an open
+ * fake file get POLLNVAL.
+ */
+int fake_poll (struct pollfd *fds, nfds_t count, int timeout)
+{
+	struct timespec deadline;
+	int ready, r = 0;
+	nfds_t i;
+
+	if(timeout > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&fake.mutex);
+	for(;;) {
+		ready = 0;
+		for(i = 0; i < count; i++) {
+			FakeFile *file = get_fake_file(fds[i].fd);
+			fds[i].revents = 0;
+			if(!file)
+				fds[i].revents = POLLNVAL;
+			else if((fds[i].events & POLLPRI) && file->event_count)
+				fds[i].revents = POLLPRI;
+			if(fds[i].revents)
+				ready++;
+		}
+		if(ready || timeout == 0 || r == ETIMEDOUT)
+			break;
+		if(timeout < 0)
+			pthread_cond_wait(&fake.event_cond, &fake.mutex);
+		else
+			r = pthread_cond_timedwait(&fake.event_cond, &fake.mutex, &deadline);
+	}
+	pthread_mutex_unlock(&fake.mutex);
+
+	return ready;
+}
+
+
+/**
+ * Returns a real descriptor that is readable (POLLIN) while events are queued for a
+ * fake device file, so that the file can be waited on with epoll like a V4L2 device.
+ *
+ * The descriptor belongs to the file and is closed by fake_close().
+ *
+ * @return the descriptor or -1 with errno set
+ */
+int fake_event_fd (int fd)
+{
+	pthread_mutex_lock(&fake.mutex);
+	FakeFile *file = get_fake_file(fd);
+	if(file && file->event_fd < 0)
+		file->event_fd = eventfd(file->event_count ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC);
+	int event_fd = file ? file->event_fd : -1;
+	pthread_mutex_unlock(&fake.mutex);
+
+	if(!file)
+		errno = EBADF;
+	return event_fd;
+}
+
+
+static int compare_entries (const struct dirent **a, const struct dirent **b)
+{
+	return strverscmp((*a)->d_name, (*b)->d_name);
+}
+
+
+/**
+ * Lists the fake devices in the sysfs video4linux directory.
+ *
+ * Takes the same arguments as scandir(). Other directories do not exist.
+ */
+int fake_scandir (const char *dir_name, struct dirent ***entries,
+		int (*filter)(const struct dirent *),
+		int (*compare)(const struct dirent **, const struct dirent **))
+{
+	unsigned int d;
+	int count = 0;
+
+	if(strcmp(dir_name, SYSFS_V4L2_DIR) != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	*entries = (struct dirent **)malloc((fake.device_count + 1) * sizeof(struct dirent *));
+	if(!*entries) {
+		errno = ENOMEM;
+		return -1;
+	}
+	pthread_mutex_lock(&fake.mutex);
+	for(d = 0; d < fake.device_count; d++) {
+		if(fake.devices[d].unplugged)
+			continue;
+		struct dirent *entry = (struct dirent *)calloc(1, sizeof(struct dirent));
+		if(!entry) {
+			pthread_mutex_unlock(&fake.mutex);
+			while(count)
+				free((*entries)[--count]);
+			free(*entries);
+			errno = ENOMEM;
+			return -1;
+		}
+		snprintf(entry->d_name, sizeof(entry->d_name), "%s", fake.devices[d].name);
+		entry->d_type = DT_LNK;
+		if(filter && !filter(entry)) {
+			free(entry);
+			continue;
+		}
+		(*entries)[count++] = entry;
+	}
+	pthread_mutex_unlock(&fake.mutex);
+	if(compare)
+		qsort(*entries, count, sizeof(struct dirent *),
+				(int (*)(const void *, const void *))compare);
+	else
+		qsort(*entries, count, sizeof(struct dirent *),
+				(int (*)(const void *, const void *))compare_entries);
+	return count;
+}
+
+
+/**
+ * Opens a sysfs attribute of a fake device for reading.
+ *
+ * The USB attributes idVendor, idProduct, and bcdDevice exist for devices that have
+ * USB IDs. Other files do not exist.
+ */
+FILE *fake_fopen (const char *path, const char *mode)
+{
+	char name[32], attribute[32], end;
+	unsigned int d;
+
+	if(sscanf(path, SYSFS_V4L2_DIR "/%31[^/]/device/%31[^/]%c", name, attribute, &end) != 2)
+		goto not_found;
+	for(d = 0; d < fake.device_count && strcmp(fake.devices[d].name, name) != 0; d++)
+		;
+	if(d == fake.device_count || !fake.devices[d].vendor || fake.devices[d].unplugged)
+		goto not_found;
+
+	FakeDevice *dev = &fake.devices[d];
+	unsigned short value;
+	if(strcmp(attribute, "idVendor") == 0)
+		value = dev->vendor;
+	else if(strcmp(attribute, "idProduct") == 0)
+		value = dev->product;
+	else if(strcmp(attribute, "bcdDevice") == 0)
+		value = dev->release;
+	else
+		goto not_found;
+
+	FILE *file = fmemopen(NULL, 8, "w+");
+	if(file) {
+		fprintf(file, "%04x\n", value);
+		rewind(file);
+	}
+	return file;
+
+not_found:
+	errno = ENOENT;
+	return NULL;
+}
+
+
+/**
+ * Returns the current time of the monotonic clock in milliseconds.
+ */
+static long long get_fake_time (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/**
+ * Unplugs and plugs in the devices with a hotplug interval and sends the corresponding
+ * uevents, like the kernel does for real devices.
+ */
+static void *hotplug_thread (void *arg)
+{
+	char message[256];
+	unsigned int d, i;
+
+	for(;;) {
+		// Sleep until the next device is due
+		long long next = 0;
+		pthread_mutex_lock(&fake.mutex);
+		for(d = 0; d < fake.device_count; d++) {
+			FakeDevice *dev = &fake.devices[d];
+			if(dev->hotplug_interval && (!next || dev->next_hotplug < next))
+				next = dev->next_hotplug;
+		}
+		pthread_mutex_unlock(&fake.mutex);
+		long long delay = next - get_fake_time();
+		if(delay > 0) {
+			struct timespec wait = { delay / 1000, (delay % 1000) * 1000000 };
+			while(nanosleep(&wait, &wait) && errno == EINTR)
+				;
+		}
+
+		long long now = get_fake_time();
+		for(d = 0; d < fake.device_count; d++) {
+			FakeDevice *dev = &fake.devices[d];
+			if(!dev->hotplug_interval || dev->next_hotplug > now)
+				continue;
+
+			pthread_mutex_lock(&fake.mutex);
+			dev->unplugged = !dev->unplugged;
+			dev->next_hotplug += dev->hotplug_interval;
+			const char *action = dev->unplugged ? "remove" : "add";
+			if(dev->unplugged) {
+				// Like a real device, wake up the pollers of the open files. Their
+				// next VIDIOC_DQEVENT fails with ENODEV.
+				uint64_t count = 1;
+				for(i = 0; i < FAKE_MAX_FILES; i++) {
+					FakeFile *file = &fake.files[i];
+					if(file->device == (int)d && file->event_fd >= 0)
+						write(file->event_fd, &count, sizeof(count));
+				}
+			}
+			pthread_mutex_unlock(&fake.mutex);
+
+			// Kernel uevent: header followed by NUL-terminated KEY=VALUE pairs
+			int length = snprintf(message, sizeof(message),
+					"%s@/devices/virtual/video4linux/%s%cACTION=%s%cSUBSYSTEM=video4linux%c"
+					"DEVNAME=%s", action, dev->name, 0, action, 0, 0, dev->name);
+			send(fake.uevent_fds[1], message, length + 1, MSG_DONTWAIT);
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Returns a socket that receives the uevents of the fake devices in the format of the
+ * kernel's uevent netlink socket.
+ *
+ * The first call starts the thread that unplugs and plugs in the devices with a
+ * hotplug interval. The caller must close the returned socket.
+ *
+ * @return the socket or -1 with errno set
+ */
+int fake_uevent_socket (void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	unsigned int d;
+	int hotplug = 0;
+
+	pthread_mutex_lock(&fake.mutex);
+	if(!fake.uevents_started) {
+		if(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fake.uevent_fds)) {
+			pthread_mutex_unlock(&fake.mutex);
+			return -1;
+		}
+		fake.uevents_started = 1;
+
+		long long now = get_fake_time();
+		for(d = 0; d < fake.device_count; d++) {
+			FakeDevice *dev = &fake.devices[d];
+			dev->next_hotplug = now + dev->hotplug_interval;
+			if(dev->hotplug_interval)
+				hotplug = 1;
+		}
+		if(hotplug && pthread_attr_init(&attr) == 0) {
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			pthread_create(&thread, &attr, hotplug_thread, NULL);
+			pthread_attr_destroy(&attr);
+		}
+	}
+	int fd = fcntl(fake.uevent_fds[0], F_DUPFD_CLOEXEC, 0);
+	pthread_mutex_unlock(&fake.mutex);
+
+	return fd;
+}
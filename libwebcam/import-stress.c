@@ -0,0 +1,549 @@
+/*
+ * Concurrent dynamic controls import test for libwebcam.
+ *
+ *
+ * Copyright (c) 2006-2007 Logitech.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Imports dynamic controls files into simulated devices from several threads at once
+ * and checks that every device ends up with each mapped control exactly once. The
+ * program writes a fake device script and the dynamic controls files to a temporary
+ * directory and points LIBWEBCAM_FAKE to the script. Usage:
+ *
+ *   webcam-import-stress [-n devices] [-i iterations]
+ *
+ * Two threads per device import a new file into that device in each iteration, so
+ * that the control list of the device is updated by both threads at the same time.
+ * Two more threads import a file that applies to all devices, and one thread per
+ * device reads the control list while it changes. The program exits with 0 if all
+ * imports succeeded and all control lists are complete. It stops without importing
+ * anything if libwebcam sees other devices than the simulated ones.
+ *
+ * The test is most useful when libwebcam is built with -fsanitize=thread or
+ * -fsanitize=address.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <webcam.h>
+
+
+/// Default number of simulated devices
+#define DEFAULT_DEVICE_COUNT		4
+/// Default number of files that each device thread imports
+#define DEFAULT_ITERATIONS			12
+/// Maximum number of simulated devices
+#define MAX_DEVICE_COUNT			16
+/// Maximum number of iterations. The fake backend supports a limited number of
+/// controls per device, which the mapped controls must not exceed.
+#define MAX_ITERATIONS				24
+
+/// Number of threads per device that import files into this device
+#define DEVICE_THREADS				2
+/// Number of threads that import the shared file into all devices
+#define SHARED_THREADS				2
+/// Number of mappings in the shared file
+#define SHARED_MAPPINGS				4
+
+/// V4L2 ID of the first control mapped by the dynamic controls files
+#define XML_MAPPING_BASE_ID			0x0A046D00
+/// V4L2 ID of the first control mapped by the shared file
+#define XML_SHARED_BASE_ID			0x0A046E00
+
+
+/**
+ * State of a thread that imports files or reads control lists.
+ */
+typedef struct _StressThread {
+	/// Thread ID
+	pthread_t			thread;
+	/// Index of the device, or -1 for the threads that import the shared file
+	int					device;
+	/// Index of the thread among the threads of the same device
+	int					index;
+	/// Handle of the device (reader threads only)
+	CHandle				handle;
+	/// Number of failed library calls
+	unsigned int		errors;
+
+} StressThread;
+
+/// Number of simulated devices
+static int device_count = DEFAULT_DEVICE_COUNT;
+/// Number of files that each device thread imports
+static int iterations = DEFAULT_ITERATIONS;
+/// Set when the import threads are done, so that the readers stop
+static volatile int imports_done;
+/// Temporary directory that contains the generated files. Leaves room for the file names.
+static char temp_dir[PATH_MAX - 32];
+
+
+/*
+ * Test data
+ */
+
+/**
+ * Writes the fake device script with the given number of identical UVC devices.
+ */
+static int write_device_script (const char *file_name)
+{
+	int i;
+
+	FILE *file = fopen(file_name, "w");
+	if(!file)
+		return -1;
+	for(i = 0; i < device_count; i++)
+		fprintf(file,
+			"device video%d\n"
+			"card \"Stress Camera %d\"\n"
+			"usb 046d:0825 0010\n"
+			"control 0x00980900 integer Brightness 0 255 1 128\n"
+			"control 0x00980901 integer Contrast 0 255 1 32\n",
+			i, i);
+	return fclose(file);
+}
+
+
+/**
+ * Returns the name of a mapping. Device threads name their mappings after the device,
+ * thread, and iteration. The mappings of the shared file have a device of -1.
+ */
+static void get_mapping_name (char *name, size_t size, int device, int thread, int iteration)
+{
+	if(device < 0)
+		snprintf(name, size, "Shared %d", iteration);
+	else
+		snprintf(name, size, "Stress %d.%d.%d", device, thread, iteration);
+}
+
+
+/**
+ * Returns the V4L2 ID of a mapping. The IDs only need to be unique within a device.
+ */
+static unsigned int get_mapping_id (int device, int thread, int iteration)
+{
+	if(device < 0)
+		return XML_SHARED_BASE_ID + iteration;
+	return XML_MAPPING_BASE_ID + thread * MAX_ITERATIONS + iteration;
+}
+
+
+/**
+ * Returns the name of a dynamic controls file. The shared file has a device of -1.
+ */
+static void get_file_name (char *file_name, size_t size, int device, int thread, int iteration)
+{
+	if(device < 0)
+		snprintf(file_name, size, "%s/shared.xml", temp_dir);
+	else
+		snprintf(file_name, size, "%s/d%d-t%d-%d.xml", temp_dir, device, thread, iteration);
+}
+
+
+/**
+ * Writes a dynamic controls file that maps the given number of extension unit controls
+ * to V4L2 controls. The mappings are named and numbered by get_mapping_name() and
+ * get_mapping_id(), starting with the given iteration.
+ */
+static int write_dynctrl_file (int device, int thread, int iteration, int mapping_count)
+{
+	char file_name[PATH_MAX], name[32];
+	int i;
+
+	get_file_name(file_name, sizeof(file_name), device, thread, iteration);
+	FILE *file = fopen(file_name, "w");
+	if(!file)
+		return -1;
+
+	fprintf(file,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<config version=\"1.0\">\n"
+		"\t<meta>\n"
+		"\t\t<version>1.0</version>\n"
+		"\t\t<author>webcam-import-stress</author>\n"
+		"\t\t<contact>-</contact>\n"
+		"\t\t<revision>1.0</revision>\n"
+		"\t\t<copyright>-</copyright>\n"
+		"\t</meta>\n"
+		"\t<constants>\n"
+		"\t\t<constant type=\"guid\">\n"
+		"\t\t\t<id>UVC_GUID_STRESS</id>\n"
+		"\t\t\t<value>63610682-5070-49ab-b8cc-b3855e8d2256</value>\n"
+		"\t\t</constant>\n"
+		"\t</constants>\n"
+		"\t<devices>\n"
+		"\t\t<device>\n"
+		"\t\t\t<match>\n"
+		"\t\t\t\t<vendor_id>0x046d</vendor_id>\n"
+		"\t\t\t</match>\n"
+		"\t\t\t<controls>\n");
+	for(i = 0; i < mapping_count; i++)
+		fprintf(file,
+			"\t\t\t\t<control id=\"stress_control_%d\">\n"
+			"\t\t\t\t\t<entity>UVC_GUID_STRESS</entity>\n"
+			"\t\t\t\t\t<selector>%d</selector>\n"
+			"\t\t\t\t\t<size>4</size>\n"
+			"\t\t\t\t</control>\n",
+			i, i + 1);
+	fprintf(file,
+		"\t\t\t</controls>\n"
+		"\t\t</device>\n"
+		"\t</devices>\n"
+		"\t<mappings>\n");
+	for(i = 0; i < mapping_count; i++) {
+		get_mapping_name(name, sizeof(name), device, thread, iteration + i);
+		fprintf(file,
+			"\t\t<mapping>\n"
+			"\t\t\t<name>%s</name>\n"
+			"\t\t\t<uvc>\n"
+			"\t\t\t\t<control_ref idref=\"stress_control_%d\"/>\n"
+			"\t\t\t\t<size>16</size>\n"
+			"\t\t\t\t<offset>0</offset>\n"
+			"\t\t\t\t<uvc_type>UVC_CTRL_DATA_TYPE_UNSIGNED</uvc_type>\n"
+			"\t\t\t</uvc>\n"
+			"\t\t\t<v4l2>\n"
+			"\t\t\t\t<id>%u</id>\n"
+			"\t\t\t\t<v4l2_type>V4L2_CTRL_TYPE_INTEGER</v4l2_type>\n"
+			"\t\t\t</v4l2>\n"
+			"\t\t</mapping>\n",
+			name, i, get_mapping_id(device, thread, iteration + i));
+	}
+	fprintf(file,
+		"\t</mappings>\n"
+		"</config>\n");
+
+	return fclose(file);
+}
+
+
+/**
+ * Creates the temporary directory with the fake device script and the dynamic controls
+ * files and selects the fake backend.
+ */
+static int create_test_data (void)
+{
+	char script[PATH_MAX];
+	int d, t, i;
+
+	snprintf(temp_dir, sizeof(temp_dir), "%s/webcam-import-stress.XXXXXX",
+			getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if(!mkdtemp(temp_dir)) {
+		temp_dir[0] = '\0';
+		return -1;
+	}
+	snprintf(script, sizeof(script), "%s/devices.txt", temp_dir);
+	if(write_device_script(script) || write_dynctrl_file(-1, 0, 0, SHARED_MAPPINGS))
+		return -1;
+	for(d = 0; d < device_count; d++) {
+		for(t = 0; t < DEVICE_THREADS; t++) {
+			for(i = 0; i < iterations; i++) {
+				if(write_dynctrl_file(d, t, i, 1))
+					return -1;
+			}
+		}
+	}
+
+	return setenv("LIBWEBCAM_FAKE", script, 1);
+}
+
+
+static void remove_test_data (void)
+{
+	char file_name[PATH_MAX];
+	int d, t, i;
+	if(!temp_dir[0])
+		return;
+
+	for(d = 0; d < device_count; d++) {
+		for(t = 0; t < DEVICE_THREADS; t++) {
+			for(i = 0; i < iterations; i++) {
+				get_file_name(file_name, sizeof(file_name), d, t, i);
+				unlink(file_name);
+			}
+		}
+	}
+	get_file_name(file_name, sizeof(file_name), -1, 0, 0);
+	unlink(file_name);
+	snprintf(file_name, sizeof(file_name), "%s/devices.txt", temp_dir);
+	unlink(file_name);
+	rmdir(temp_dir);
+}
+
+
+
+/*
+ * Threads
+ */
+
+/**
+ * Imports the files of a device thread into its device, or the shared file into all
+ * devices.
+ */
+static void *import_thread (void *arg)
+{
+	StressThread *thread = (StressThread *)arg;
+	char file_name[PATH_MAX], device_name[16];
+	CDynctrlInfo info;
+	CResult res;
+	int i;
+
+	snprintf(device_name, sizeof(device_name), "video%d", thread->device);
+	for(i = 0; i < iterations; i++) {
+		memset(&info, 0, sizeof(info));
+		if(thread->device < 0) {
+			get_file_name(file_name, sizeof(file_name), -1, 0, 0);
+			res = c_add_control_mappings_from_file(file_name, &info);
+		}
+		else {
+			get_file_name(file_name, sizeof(file_name), thread->device, thread->index, i);
+			res = c_add_control_mappings_to_device(device_name, file_name, &info);
+			if(!res && info.stats.mappings.successful != 1)
+				res = C_PARSE_ERROR;
+		}
+		if(res) {
+			fprintf(stderr, "Import of %s failed (%d).\n", file_name, res);
+			thread->errors++;
+		}
+		free(info.messages);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Enumerates the controls of a device and reads one of them until the imports are done.
+ */
+static void *read_thread (void *arg)
+{
+	StressThread *thread = (StressThread *)arg;
+	CControlValue value;
+	CResult res;
+
+	while(!imports_done) {
+		// The list can grow between the two calls, so start over with the new size
+		unsigned int size, count;
+		CControl *controls = NULL;
+		do {
+			free(controls);
+			controls = NULL;
+			size = 0;
+			res = c_enum_controls(thread->handle, NULL, &size, &count);
+			if(res != C_BUFFER_TOO_SMALL)
+				break;
+			controls = (CControl *)malloc(size);
+			res = controls ? c_enum_controls(thread->handle, controls, &size, &count) : C_NO_MEMORY;
+		} while(res == C_BUFFER_TOO_SMALL);
+		free(controls);
+		if(!res)
+			res = c_get_control(thread->handle, CC_BRIGHTNESS, &value);
+		if(res) {
+			fprintf(stderr, "Reading the controls of video%d failed (%d).\n", thread->device, res);
+			thread->errors++;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Checks that the library sees exactly the simulated devices, so that the files are never
+ * imported into real cameras, e.g. if the library does not support LIBWEBCAM_FAKE.
+ */
+static int check_simulated_devices (void)
+{
+	CDevice *devices = NULL;
+	unsigned int size = 0, count = 0, simulated = 0, i;
+
+	CResult res = c_enum_devices(NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		devices = (CDevice *)malloc(size);
+		res = devices ? c_enum_devices(devices, &size, &count) : C_NO_MEMORY;
+	}
+	for(i = 0; !res && i < count; i++) {
+		if(strncmp(devices[i].name, "Stress Camera ", 14) == 0)
+			simulated++;
+	}
+	free(devices);
+
+	return !res && count == (unsigned int)device_count && simulated == count;
+}
+
+
+/**
+ * Checks that each mapped control appears exactly once in the control list of a device.
+ *
+ * @return the number of missing or duplicate controls
+ */
+static unsigned int check_device (CHandle handle, int device)
+{
+	unsigned int size = 0, count = 0, errors = 0, i;
+	char name[32];
+	int t, n;
+
+	CResult res = c_enum_controls(handle, NULL, &size, &count);
+	CControl *controls = res == C_BUFFER_TOO_SMALL ? (CControl *)malloc(size) : NULL;
+	if(!controls || c_enum_controls(handle, controls, &size, &count)) {
+		fprintf(stderr, "Unable to enumerate the controls of video%d.\n", device);
+		free(controls);
+		return 1;
+	}
+
+	for(t = -1; t < DEVICE_THREADS; t++) {
+		for(n = 0; n < (t < 0 ? SHARED_MAPPINGS : iterations); n++) {
+			unsigned int found = 0;
+			get_mapping_name(name, sizeof(name), t < 0 ? -1 : device, t, n);
+			for(i = 0; i < count; i++) {
+				if(strcmp(controls[i].name, name) == 0)
+					found++;
+			}
+			if(found != 1) {
+				fprintf(stderr, "video%d has control '%s' %u times.\n", device, name, found);
+				errors++;
+			}
+		}
+	}
+	printf("video%d\t%u controls\t%s\n", device, count, errors ? "FAILED" : "ok");
+
+	free(controls);
+	return errors;
+}
+
+
+
+static void print_usage (const char *program)
+{
+	fprintf(stderr, "Usage: %s [-n devices] [-i iterations]\n", program);
+}
+
+
+int main (int argc, char **argv)
+{
+	StressThread readers[MAX_DEVICE_COUNT];
+	StressThread importers[MAX_DEVICE_COUNT * DEVICE_THREADS + SHARED_THREADS];
+	unsigned int reader_count = 0, importer_count = 0, errors = 0, i;
+	int opt, d, t;
+
+	while((opt = getopt(argc, argv, "n:i:h")) != -1) {
+		switch(opt) {
+			case 'n':	device_count = atoi(optarg);	break;
+			case 'i':	iterations = atoi(optarg);		break;
+			default:
+				print_usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(device_count <= 0 || device_count > MAX_DEVICE_COUNT ||
+	   iterations <= 0 || iterations > MAX_ITERATIONS || optind < argc) {
+		print_usage(argv[0]);
+		fprintf(stderr, "The number of devices must be between 1 and %d and the number of "
+				"iterations between 1 and %d.\n", MAX_DEVICE_COUNT, MAX_ITERATIONS);
+		return 1;
+	}
+
+	if(create_test_data()) {
+		fprintf(stderr, "Unable to create the test data in %s.\n", temp_dir);
+		remove_test_data();
+		return 1;
+	}
+
+	printf("# libwebcam concurrent import: %d simulated devices, %d iterations\n",
+			device_count, iterations);
+
+	// The mapped controls have private IDs that libwebcam warns about
+	c_set_log_level(CL_ERROR);
+	CResult res = c_init();
+	if(res) {
+		fprintf(stderr, "Unable to initialize libwebcam (%d).\n", res);
+		remove_test_data();
+		return 1;
+	}
+
+	memset(readers, 0, sizeof(readers));
+	if(!check_simulated_devices()) {
+		fprintf(stderr, "libwebcam does not use the simulated devices.\n");
+		errors++;
+		goto done;
+	}
+
+	// Open the handles before the threads start, the test is about the imports
+	for(d = 0; d < device_count; d++) {
+		char device_name[16];
+		snprintf(device_name, sizeof(device_name), "video%d", d);
+		readers[d].device = d;
+		readers[d].handle = c_open_device(device_name);
+		if(!readers[d].handle) {
+			fprintf(stderr, "Unable to open the simulated device %s.\n", device_name);
+			errors++;
+			goto done;
+		}
+	}
+
+	memset(importers, 0, sizeof(importers));
+	for(d = -1; d < device_count; d++) {
+		for(t = 0; t < (d < 0 ? SHARED_THREADS : DEVICE_THREADS); t++) {
+			importers[importer_count].device	= d;
+			importers[importer_count].index		= t;
+			importer_count++;
+		}
+	}
+	for(; reader_count < (unsigned int)device_count; reader_count++) {
+		if(pthread_create(&readers[reader_count].thread, NULL, read_thread, &readers[reader_count]))
+			break;
+	}
+	for(i = 0; i < importer_count; i++) {
+		if(pthread_create(&importers[i].thread, NULL, import_thread, &importers[i])) {
+			fprintf(stderr, "Unable to start the import threads.\n");
+			importer_count = i;
+			errors++;
+			break;
+		}
+	}
+
+	for(i = 0; i < importer_count; i++) {
+		pthread_join(importers[i].thread, NULL);
+		errors += importers[i].errors;
+	}
+	imports_done = 1;
+	for(i = 0; i < reader_count; i++) {
+		pthread_join(readers[i].thread, NULL);
+		errors += readers[i].errors;
+	}
+	if(reader_count < (unsigned int)device_count) {
+		fprintf(stderr, "Unable to start the reader threads.\n");
+		errors++;
+	}
+
+	for(d = 0; d < device_count && !errors; d++)
+		errors += check_device(readers[d].handle, d);
+
+done:
+	for(d = 0; d < device_count; d++) {
+		if(readers[d].handle)
+			c_close_device(readers[d].handle);
+	}
+	c_cleanup();
+	remove_test_data();
+	printf("# %s\n", errors ? "FAILED" : "passed");
+	return errors ? 1 : 0;
+}
@@ -39,6 +39,8 @@
 #include <stdarg.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <linux/videodev2.h>
 #include <linux/uvcvideo.h>
 
@@ -56,6 +58,14 @@ int initialized = 0;
 static DeviceList device_list;
 /// The fixed size list of file handles.
 HandleList handle_list;
+/// The implementation used to access devices.
+BackendType backend_type = BACKEND_V4L2;
+/// Makes sure that the backend is selected only once.
+static pthread_once_t backend_init_once = PTHREAD_ONCE_INIT;
+/// Request statistics of all devices that requests were sent to.
+static DeviceStats *device_stats_list[MAX_STATS_DEVICES];
+/// Protects the device statistics list. The counters themselves are updated atomically.
+static pthread_mutex_t device_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 /*
@@ -67,13 +77,18 @@ static void print_libwebcam_c_error (CResult error, char *format, ...);
 
 static unsigned int get_control_dynamics_length(Device *device, unsigned int *names_length, unsigned int *choices_length);
 static Control *find_control_by_id (Device *dev, CControlId id);
+static void use_control_list (Device *dev);
+static void release_control_list (Device *dev);
 
+static CResult lock_device_list (void);
+static void unlock_device_list (void);
 static CResult refresh_device_list (void);
 static Device *find_device_by_name (const char *name);
 static int get_device_dynamics_length (CDevice *device);
 static int get_devices_dynamics_length (void);
 
 int open_v4l2_device(char *device_name);
+static DeviceStats *lookup_device_stats (const char *v4l2_name, int create);
 static CResult read_v4l2_control(Device *device, Control *control, CControlValue *value, CHandle hDevice);
 static CResult write_v4l2_control(Device *device, Control *control, const CControlValue *value, CHandle hDevice);
 static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev);
@@ -146,8 +161,10 @@ CHandle c_open_device (const char *device_name)
  */
 void c_close_device (CHandle hDevice)
 {
-	if(!initialized)
+	// Handle 0 carries the hotplug subscriptions, it must not remove them
+	if(!initialized || !HANDLE_OPEN(hDevice))
 		return;
+	remove_event_subscriptions(hDevice);
 	close_handle(hDevice);
 }
 
@@ -188,7 +205,7 @@ CResult c_enum_devices (CDevice *devices, unsigned int *size, unsigned int *coun
 	ret = refresh_device_list();
 	if(ret) return ret;
 
-	if(lock_mutex(&device_list.mutex))
+	if(lock_device_list())
 		return C_SYNC_ERROR;
 
 	// Return the required size if the given size is not large enough
@@ -228,7 +245,7 @@ CResult c_enum_devices (CDevice *devices, unsigned int *size, unsigned int *coun
 	assert(dynamics_offset == req_size);
 
 done:
-	unlock_mutex(&device_list.mutex);
+	unlock_device_list();
 	return ret;
 }
 
@@ -318,6 +335,109 @@ CResult c_get_device_info (CHandle hDevice, const char *device_name, CDevice *in
 }
 
 
+/**
+ * Returns the request statistics of a device.
+ *
+ * libwebcam counts the requests it sends to each device, including those sent by
+ * the dynctrl functions, and measures how long they take. The statistics cover
+ * the lifetime of the process and survive the device being closed or reconnected.
+ * The counters are updated while they are copied, so the result is not an exact
+ * snapshot if other threads access the device at the same time.
+ * The library does not need to be initialized to call this function.
+ *
+ * @param device_name	a device name as accepted by c_open_device()
+ * @param stats			a pointer to a structure to receive the statistics
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INVALID_ARG if no device name or no @a stats pointer was given
+ * 		- #C_NOT_FOUND if no requests have been sent to the given device
+ */
+CResult c_get_device_stats (const char *device_name, CDeviceStats *stats)
+{
+	if(device_name == NULL || stats == NULL)
+		return C_INVALID_ARG;
+	if(strncmp(device_name, "/dev/", 5) == 0)
+		device_name += 5;
+
+	DeviceStats *device_stats = lookup_device_stats(device_name, 0);
+	if(device_stats == NULL)
+		return C_NOT_FOUND;
+
+	memcpy(stats, &device_stats->stats, sizeof(*stats));
+	return C_SUCCESS;
+}
+
+
+/**
+ * Returns the most recent requests sent to a device.
+ *
+ * libwebcam keeps the last #C_TRACE_ENTRIES requests sent to each device in memory,
+ * so that the cause of a problem can be found after the fact. The entries are
+ * returned in the order in which the requests were sent. Requests that are being
+ * recorded while the trace is read are left out.
+ * The library does not need to be initialized to call this function.
+ *
+ * If the buffer is not large enough, #C_BUFFER_TOO_SMALL is returned and
+ * the \a size parameter is modified to contain the required buffer size.
+ *
+ * @param device_name	a device name as accepted by c_open_device()
+ * @param entries		a pointer to a buffer that receives the trace entries
+ * @param size			a pointer to an integer that contains or receives the size
+ * 						of the @a entries buffer
+ * @param count			a pointer to an integer that receives the number of entries.
+ * 						Can be NULL.
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INVALID_ARG if no device name or no size pointer was given or if a size
+ * 		  pointer was given but no @a entries buffer was given
+ * 		- #C_NOT_FOUND if no requests have been sent to the given device
+ * 		- #C_BUFFER_TOO_SMALL if the supplied buffer is not large enough
+ */
+CResult c_get_device_trace (const char *device_name, CTraceEntry *entries, unsigned int *size, unsigned int *count)
+{
+	unsigned int sequence, copied = 0;
+
+	if(device_name == NULL || size == NULL)
+		return C_INVALID_ARG;
+	if(strncmp(device_name, "/dev/", 5) == 0)
+		device_name += 5;
+
+	DeviceStats *device_stats = lookup_device_stats(device_name, 0);
+	if(device_stats == NULL)
+		return C_NOT_FOUND;
+	TraceRing *ring = &device_stats->trace;
+
+	// Return the required size if the given size is not large enough
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned int available = head < C_TRACE_ENTRIES ? head : C_TRACE_ENTRIES;
+	unsigned int req_size = available * sizeof(CTraceEntry);
+	if(count)
+		*count = available;
+	if(req_size > *size) {
+		*size = req_size;
+		return C_BUFFER_TOO_SMALL;
+	}
+	if(available && entries == NULL)
+		return C_INVALID_ARG;
+
+	// Copy the entries and skip the ones that are overwritten while we copy them
+	for(sequence = head - available; sequence != head; sequence++) {
+		TraceSlot *slot = &ring->slots[sequence % C_TRACE_ENTRIES];
+		if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence + 1)
+			continue;
+		entries[copied] = slot->entry;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence + 1)
+			continue;
+		entries[copied++].sequence = sequence;
+	}
+	if(count)
+		*count = copied;
+
+	return C_SUCCESS;
+}
+
+
 
 /*
  * Frame format enumeration
@@ -380,7 +500,7 @@ CResult c_enum_pixel_formats (CHandle hDevice, CPixelFormat *formats, unsigned i
 	memset(&fmt, 0, sizeof(fmt));
 	fmt.index = 0;
 	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	while(ioctl(v4l2_dev, VIDIOC_ENUM_FMT, &fmt) == 0) {
+	while(device_ioctl(device->stats, v4l2_dev, VIDIOC_ENUM_FMT, &fmt) == 0) {
 		PixelFormat *format = (PixelFormat *)malloc(sizeof(PixelFormat));
 		if(!format) {
 			ret = C_NO_MEMORY;
@@ -449,7 +569,7 @@ CResult c_enum_pixel_formats (CHandle hDevice, CPixelFormat *formats, unsigned i
 
 done:
 	// Free the list of pixel formats and close the V4L2 device
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 	elem = head;
 	while(elem) {
 		PixelFormat *next = elem->next;
@@ -528,7 +648,7 @@ CResult c_enum_frame_sizes (CHandle hDevice, const CPixelFormat *pixelformat, CF
 			(unsigned long)pixelformat->fourcc[2] << 16 |
 			(unsigned long)pixelformat->fourcc[3] << 24;
 	fsize.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	while(ioctl(v4l2_dev, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0) {
+	while(device_ioctl(device->stats, v4l2_dev, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0) {
 		FrameSize *framesize = (FrameSize *)malloc(sizeof(FrameSize));
 		if(!framesize) {
 			ret = C_NO_MEMORY;
@@ -601,7 +721,7 @@ CResult c_enum_frame_sizes (CHandle hDevice, const CPixelFormat *pixelformat, CF
 
 done:
 	// Free the list of frame sizes and close the V4L2 device
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 	elem = head;
 	while(elem) {
 		FrameSize *next = elem->next;
@@ -691,7 +811,7 @@ CResult c_enum_frame_intervals (CHandle hDevice, const CPixelFormat *pixelformat
 	fival.width = framesize->width;
 	fival.height = framesize->height;
 	fival.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	while(ioctl(v4l2_dev, VIDIOC_ENUM_FRAMEINTERVALS, &fival) == 0) {
+	while(device_ioctl(device->stats, v4l2_dev, VIDIOC_ENUM_FRAMEINTERVALS, &fival) == 0) {
 		FrameInterval *frameinterval = (FrameInterval *)malloc(sizeof(FrameInterval));
 		if(!frameinterval) {
 			ret = C_NO_MEMORY;
@@ -764,7 +884,7 @@ CResult c_enum_frame_intervals (CHandle hDevice, const CPixelFormat *pixelformat
 
 done:
 	// Free the list of frame sizes and close the V4L2 device
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 	elem = head;
 	while(elem) {
 		FrameInterval *next = elem->next;
@@ -820,7 +940,7 @@ CResult c_enum_controls (CHandle hDevice, CControl *controls, unsigned int *size
 	if(size == NULL)
 		return C_INVALID_ARG;
 
-	if(lock_mutex(&device->controls.mutex))
+	if(lock_control_list(device))
 		return C_SYNC_ERROR;
 
 	// Determine the buffer size needed to describe all controls
@@ -835,8 +955,10 @@ CResult c_enum_controls (CHandle hDevice, CControl *controls, unsigned int *size
 	}
 	if(device->controls.count == 0)
 		goto done;
-	if(controls == NULL)
-		return C_INVALID_ARG;
+	if(controls == NULL) {
+		ret = C_INVALID_ARG;
+		goto done;
+	}
 
 	// Loop through all the device's controls and return a list of CControl structs
 	CControl *current = controls;
@@ -878,7 +1000,7 @@ CResult c_enum_controls (CHandle hDevice, CControl *controls, unsigned int *size
 	assert(choices_offset == req_size);
 
 done:
-	unlock_mutex(&device->controls.mutex);
+	unlock_control_list(device);
 	return ret;
 }
 
@@ -915,13 +1037,20 @@ CResult c_set_control (CHandle hDevice, CControlId control_id, const CControlVal
 		return C_INVALID_ARG;
 
 	// Look for the requested control within the given device
+	if(lock_control_list(device))
+		return C_SYNC_ERROR;
 	Control *control = find_control_by_id(device, control_id);
+	if(control)
+		use_control_list(device);
+	unlock_control_list(device);
 	if(!control)
 		return C_NOT_FOUND;
 
 	// Check if the control is writable
-	if(!(control->control.flags & CC_CAN_WRITE))
-		return C_CANNOT_WRITE;
+	if(!(control->control.flags & CC_CAN_WRITE)) {
+		ret = C_CANNOT_WRITE;
+		goto done;
+	}
 
 	// Write the control in a way that depends on its source
 	if(control->v4l2_control) {		// V4L2
@@ -929,9 +1058,11 @@ CResult c_set_control (CHandle hDevice, CControlId control_id, const CControlVal
 	}
 	else {
 		assert(0);
-		return C_INVALID_ARG;
+		ret = C_INVALID_ARG;
 	}
 
+done:
+	release_control_list(device);
 	return ret;
 }
 
@@ -968,13 +1099,20 @@ CResult c_get_control (CHandle hDevice, CControlId control_id, CControlValue *va
 		return C_INVALID_ARG;
 
 	// Look for the requested control within the given device
+	if(lock_control_list(device))
+		return C_SYNC_ERROR;
 	Control *control = find_control_by_id(device, control_id);
+	if(control)
+		use_control_list(device);
+	unlock_control_list(device);
 	if(!control)
 		return C_NOT_FOUND;
 
 	// Check if the control is readable
-	if(!(control->control.flags & CC_CAN_READ))
-		return C_CANNOT_READ;
+	if(!(control->control.flags & CC_CAN_READ)) {
+		ret = C_CANNOT_READ;
+		goto done;
+	}
 
 	// Read the control in a way that depends on its source
 	if(control->v4l2_control) {			// V4L2
@@ -982,219 +1120,910 @@ CResult c_get_control (CHandle hDevice, CControlId control_id, CControlValue *va
 	}
 	else {
 		assert(0);
-		return C_INVALID_ARG;
+		ret = C_INVALID_ARG;
 	}
 
+done:
+	release_control_list(device);
 	return ret;
 }
 
 
 /*
- * Events
+ * Control profiles
+ */
+
+/**
+ * A control value stored in or restored from a profile.
  */
+typedef struct _ProfileEntry {
+	/// Control of the device the value belongs to
+	Control			* control;
+	/// Control value
+	int				value;
+	/// Application phase (see get_profile_phase())
+	int				phase;
+	/// Position of the entry in the profile (keeps the order stable when sorting)
+	unsigned int	index;
+	/// Whether the last transfer of the value failed
+	int				failed;
+
+} ProfileEntry;
 
 /**
- * Enumerates the events supported by the given device. @e [unimplemented]
+ * Automatic mode controls and the manual controls that depend on them.
  *
- * @return
- * 		- #C_INIT_ERROR if the library has not been initialized
- * 		- #C_NOT_IMPLEMENTED
+ * The manual controls can only be changed while the corresponding automatic mode is off,
+ * so restoring a profile must take them into account.
  */
-CResult c_enum_events (CHandle hDevice, CEvent *events, unsigned int *size, unsigned int *count)
-{
-	if(!initialized)
-		return C_INIT_ERROR;
-	return C_NOT_IMPLEMENTED;
-}
+static const struct {
+	/// V4L2 ID of the manual control
+	int				manual_id;
+	/// V4L2 ID of the automatic mode control
+	int				auto_id;
+
+} profile_dependencies[] = {
+	{ V4L2_CID_HUE,							V4L2_CID_HUE_AUTO },
+	{ V4L2_CID_GAIN,						V4L2_CID_AUTOGAIN },
+	{ V4L2_CID_RED_BALANCE,					V4L2_CID_AUTO_WHITE_BALANCE },
+	{ V4L2_CID_BLUE_BALANCE,				V4L2_CID_AUTO_WHITE_BALANCE },
+#ifdef V4L2_CID_WHITE_BALANCE_TEMPERATURE
+	{ V4L2_CID_WHITE_BALANCE_TEMPERATURE,	V4L2_CID_AUTO_WHITE_BALANCE },
+#endif
+#ifdef V4L2_CID_EXPOSURE_AUTO
+	{ V4L2_CID_EXPOSURE_ABSOLUTE,			V4L2_CID_EXPOSURE_AUTO },
+	{ V4L2_CID_EXPOSURE,					V4L2_CID_EXPOSURE_AUTO },
+#endif
+#ifdef V4L2_CID_FOCUS_AUTO
+	{ V4L2_CID_FOCUS_ABSOLUTE,				V4L2_CID_FOCUS_AUTO },
+#endif
+};
 
 
 /**
- * Subscribes the caller to receive the given event. @e [unimplemented]
- *
- * @return
- * 		- #C_INIT_ERROR if the library has not been initialized
- * 		- #C_NOT_IMPLEMENTED
+ * Returns true if the given automatic mode control value allows the manual controls
+ * that depend on it to be changed.
  */
-CResult c_subscribe_event (CHandle hDevice, CEventId event_id, CEventHandler handler, void *context)
+static int auto_mode_allows_manual (int auto_id, int value)
 {
-	if(!initialized)
-		return C_INIT_ERROR;
-	return C_NOT_IMPLEMENTED;
+#ifdef V4L2_CID_EXPOSURE_AUTO
+	// In shutter priority mode the exposure time is set manually
+	if(auto_id == V4L2_CID_EXPOSURE_AUTO)
+		return value == V4L2_EXPOSURE_MANUAL || value == V4L2_EXPOSURE_SHUTTER_PRIORITY;
+#endif
+	return value == 0;
 }
 
 
 /**
- * Unsubscribes the caller from the given event. @e [unimplemented]
- *
- * @return
- * 		- #C_INIT_ERROR if the library has not been initialized
- * 		- #C_NOT_IMPLEMENTED
+ * Returns true if the given V4L2 control is an automatic mode control.
  */
-CResult c_unsubscribe_event (CHandle hDevice, CEventId event_id)
+static int is_auto_mode_control (int v4l2_id)
 {
-	if(!initialized)
-		return C_INIT_ERROR;
-	return C_NOT_IMPLEMENTED;
+	int i;
+	for(i = 0; i < ARRAY_SIZE(profile_dependencies); i++) {
+		if(profile_dependencies[i].auto_id == v4l2_id)
+			return 1;
+	}
+	return 0;
 }
 
 
 /**
- * Returns the error message associated with a given error code.
- *
- * Note that the caller must free the buffer returned by this function.
- *
- * @param error		error code for which the message should be retrieved
- * @return
- * 		- a newly allocated string describing the given error code
- * 		- NULL if not enough memory was available or if the error code is
- * 		  unknown
+ * Returns true if the given control can be stored in a profile.
  */
-char *c_get_error_text (CResult error)
+static int is_profile_control (Control *control)
 {
-	return c_get_handle_error_text(0, error);
+	CControl *c = &control->control;
+	return control->v4l2_control
+		&& (c->flags & CC_CAN_READ) && (c->flags & CC_CAN_WRITE)
+		&& !(c->flags & (CC_IS_ACTION | CC_IS_RELATIVE))
+		&& c->type != CC_TYPE_RAW;
 }
 
 
 /**
- * Returns the error message associated with a given error code and device handle.
- *
- * Note that the caller must free the buffer returned by this function. Compared to the
- * #c_get_error_text() function, this function can take the handle's last system error
- * into account.
+ * Determines in which phase a profile entry is restored, or -1 if it must be skipped.
  *
- * @param hDevice	an open device handle. If this parameter is 0, the function behaves
- *					exactly like #c_get_error_text().
- * @param error		error code for which the message should be retrieved
- * @return
- * 		- a newly allocated string describing the given error code
- * 		- NULL if not enough memory was available or if the error code is
- * 		  unknown
+ * Automatic modes that are switched off come first (phase 0), so that the manual
+ * controls depending on them can be changed in phase 1. Automatic modes that are
+ * switched on come last (phase 2). Manual controls whose automatic mode is on in the
+ * profile are skipped because the device determines their values.
  */
-char *c_get_handle_error_text (CHandle hDevice, CResult error)
+static int get_profile_phase (ProfileEntry *entry, ProfileEntry *entries, unsigned int count)
 {
-	switch(error) {
-		case C_SUCCESS:				return strdup("Success");
-		case C_NOT_IMPLEMENTED:		return strdup("The function is not implemented");
-		case C_INIT_ERROR:			return strdup("Error during initialization or library not initialized");
-		case C_INVALID_ARG:			return strdup("Invalid argument");
-		case C_INVALID_HANDLE:		return strdup("Invalid handle");
-		case C_INVALID_DEVICE:		return strdup("Invalid device or device cannot be opened");
-		case C_NOT_FOUND:			return strdup("Object not found");
-		case C_BUFFER_TOO_SMALL:	return strdup("Buffer too small");
-		case C_SYNC_ERROR:			return strdup("Error during data synchronization");
-		case C_NO_MEMORY:			return strdup("Out of memory");
-		case C_NO_HANDLES:			return strdup("Out of handles");
-		case C_V4L2_ERROR:
-		{
-			char *text = NULL;
-			if(hDevice && HANDLE_OPEN(hDevice)) {
-				if(asprintf(&text, "A Video4Linux2 API call returned an unexpected error %d", GET_HANDLE(hDevice).last_system_error) == -1)
-					text = NULL;;
-			}
-			if(!text)
-				return strdup("A Video4Linux2 API call returned an unexpected error");
-			return text;
+	int id = entry->control->v4l2_control;
+	int i, j;
+
+	if(is_auto_mode_control(id))
+		return auto_mode_allows_manual(id, entry->value) ? 0 : 2;
+
+	for(i = 0; i < ARRAY_SIZE(profile_dependencies); i++) {
+		if(profile_dependencies[i].manual_id != id)
+			continue;
+		for(j = 0; j < count; j++) {
+			int auto_id = profile_dependencies[i].auto_id;
+			if(entries[j].control->v4l2_control == auto_id &&
+			   !auto_mode_allows_manual(auto_id, entries[j].value))
+				return -1;
 		}
-		case C_SYSFS_ERROR:			return strdup("A sysfs file access returned an error");
-		case C_PARSE_ERROR:			return strdup("A control could not be parsed");
-		case C_CANNOT_WRITE:		return strdup("Writing not possible (e.g. read-only control)");
-		case C_CANNOT_READ:			return strdup("Reading not possible (e.g. write-only control)");
-		default:					return NULL;
 	}
+	return 1;
 }
 
 
-
-/*
- * Helper functions
+/**
+ * Orders profile entries by phase and by control class, so that the controls of one
+ * class in one phase can be transferred with a single ioctl.
  */
+static int compare_profile_entries (const void *a, const void *b)
+{
+	const ProfileEntry *ea = (const ProfileEntry *)a;
+	const ProfileEntry *eb = (const ProfileEntry *)b;
+	unsigned int ca = V4L2_CTRL_ID2CLASS(ea->control->v4l2_control);
+	unsigned int cb = V4L2_CTRL_ID2CLASS(eb->control->v4l2_control);
+
+	if(ea->phase != eb->phase)
+		return ea->phase < eb->phase ? -1 : 1;
+	if(ca != cb)
+		return ca < cb ? -1 : 1;
+	return ea->index < eb->index ? -1 : (ea->index > eb->index);
+}
+
 
 /**
- * Prints a generic error message to stderr.
+ * Reads or writes the values of the given profile entries.
+ *
+ * Consecutive entries of the same phase and control class are transferred with a single
+ * VIDIOC_G_EXT_CTRLS or VIDIOC_S_EXT_CTRLS request. If the driver rejects such a request,
+ * the controls are transferred one by one, so that a single failing control does not
+ * affect the other ones. The @a failed field of each entry tells whether its transfer
+ * succeeded.
+ *
+ * @return the number of entries that could not be transferred
  */
-void print_libwebcam_error (char *format, ...)
+static unsigned int transfer_profile_entries (int v4l2_dev, ProfileEntry *entries,
+		unsigned int count, int write, CHandle hDevice)
 {
-	char *newformat;
-	va_list ap;
+	DeviceStats *stats = GET_HANDLE(hDevice).device->stats;
+	unsigned int failed = 0, first = 0, i;
+	struct v4l2_ext_control *ctrls = NULL;
+
+	if(count) {
+		ctrls = (struct v4l2_ext_control *)malloc(count * sizeof(*ctrls));
+		if(!ctrls)
+			return count;
+	}
 
-	if(asprintf(&newformat, "[libwebcam] %s\n", format) == -1)
-		newformat = format;
+	while(first < count) {
+		// Find the end of the run of entries with the same phase and class
+		unsigned int class = V4L2_CTRL_ID2CLASS(entries[first].control->v4l2_control);
+		unsigned int end = first + 1;
+		while(end < count && entries[end].phase == entries[first].phase &&
+			  V4L2_CTRL_ID2CLASS(entries[end].control->v4l2_control) == class)
+			end++;
+
+		memset(ctrls, 0, (end - first) * sizeof(*ctrls));
+		for(i = first; i < end; i++) {
+			ctrls[i - first].id = entries[i].control->v4l2_control;
+			ctrls[i - first].value = entries[i].value;
+		}
+		struct v4l2_ext_controls ext_ctrls = {
+			.ctrl_class	= class,
+			.count		= end - first,
+			.controls	= ctrls,
+		};
 
-	va_start(ap, format);
-	vfprintf(stderr, newformat, ap);
-	va_end(ap);
+		if(device_ioctl(stats, v4l2_dev, write ? VIDIOC_S_EXT_CTRLS : VIDIOC_G_EXT_CTRLS, &ext_ctrls) == 0) {
+			for(i = first; i < end; i++) {
+				if(!write)
+					entries[i].value = ctrls[i - first].value;
+				entries[i].failed = 0;
+			}
+		}
+		else {
+			// Fall back to transferring the controls one by one
+			for(i = first; i < end; i++) {
+				struct v4l2_control ctrl = {
+					.id		= entries[i].control->v4l2_control,
+					.value	= entries[i].value,
+				};
+				entries[i].failed = device_ioctl(stats, v4l2_dev, write ? VIDIOC_S_CTRL : VIDIOC_G_CTRL, &ctrl) != 0;
+				if(entries[i].failed) {
+					set_last_error(hDevice, errno);
+					failed++;
+				}
+				else if(!write) {
+					entries[i].value = ctrl.value;
+				}
+			}
+		}
 
-	if(newformat != format)
-		free(newformat);
-	else
-		fprintf(stderr, "\n");
+		first = end;
+	}
+
+	free(ctrls);
+	return failed;
 }
 
 
 /**
- * Prints a libwebcam error message to stderr.
+ * Saves the values of all controls of a device to a profile file.
  *
- * @param error		a #CResult error code whose error text is appended
- * @param format	a @a printf compatible format
+ * Only controls that can be both read and written are saved. Action controls, relative
+ * controls, and raw controls are left out. Each line of the file contains the V4L2
+ * control ID, the value, and the control name, so that the profile can be restored even
+ * if the control IDs change. All values are read with as few ioctls as possible.
+ *
+ * @param hDevice		a device handle obtained from c_open_device()
+ * @param file_name		name of the profile file to write
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_INVALID_ARG if no file name is given
+ * 		- #C_INVALID_DEVICE if the device could not be opened
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_CANNOT_WRITE if the file could not be written
  */
-static void print_libwebcam_c_error (CResult error, char *format, ...)
+CResult c_save_profile (CHandle hDevice, const char *file_name)
 {
-	char *unknown_text = "Unknown error";
-	char *text, *newformat;
-	va_list ap;
-
-	// Retrieve the libwebcam error text
-	text = c_get_error_text(error);
-	if(text == NULL)
-		text = unknown_text;
+	CResult ret = C_SUCCESS;
+	ProfileEntry *entries = NULL;
+	unsigned int count = 0, i;
+	FILE *file = NULL;
 
-	if(asprintf(&newformat, "[libwebcam] %s (error %d: %s)\n", format, error, text) == -1)
-		newformat = format;
+	// Check the given handle and arguments
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(!HANDLE_OPEN(hDevice))
+		return C_INVALID_HANDLE;
+	if(!HANDLE_VALID(hDevice))
+		return C_NOT_EXIST;
+	Device *device = GET_HANDLE(hDevice).device;
+	if(file_name == NULL)
+		return C_INVALID_ARG;
 
-	if(text != unknown_text)
-		free(text);
+	int v4l2_dev = open_v4l2_device(device->v4l2_name);
+	if(v4l2_dev <= 0)
+		return C_INVALID_DEVICE;
 
-	va_start(ap, format);
-	vfprintf(stderr, newformat, ap);
-	va_end(ap);
+	if(lock_control_list(device)) {
+		backend_close(v4l2_dev);
+		return C_SYNC_ERROR;
+	}
 
-	if(newformat != format)
-		free(newformat);
-	else
-		fprintf(stderr, "\n");
-}
+	// Collect the controls and read their values
+	if(device->controls.count) {
+		entries = (ProfileEntry *)malloc(device->controls.count * sizeof(ProfileEntry));
+		if(!entries) {
+			ret = C_NO_MEMORY;
+			goto done;
+		}
+	}
+	Control *elem;
+	for(elem = device->controls.first; elem; elem = elem->next) {
+		if(!is_profile_control(elem))
+			continue;
+		entries[count].control	= elem;
+		entries[count].value	= 0;
+		entries[count].phase	= 0;
+		entries[count].index	= count;
+		entries[count].failed	= 0;
+		count++;
+	}
+	qsort(entries, count, sizeof(ProfileEntry), compare_profile_entries);
+	transfer_profile_entries(v4l2_dev, entries, count, 0, hDevice);
 
+	// Write the profile
+	file = fopen(file_name, "w");
+	if(!file) {
+		set_last_error(hDevice, errno);
+		ret = C_CANNOT_WRITE;
+		goto done;
+	}
+	fprintf(file, "# libwebcam control profile for %s\n", device->device.name);
+	fprintf(file, "# <V4L2 control ID> <value> <control name>\n");
+	for(i = 0; i < count; i++) {
+		if(!entries[i].failed)
+			fprintf(file, "0x%08x %d %s\n", entries[i].control->v4l2_control,
+					entries[i].value, entries[i].control->control.name);
+	}
+	if(fclose(file))
+		ret = C_CANNOT_WRITE;
 
+done:
+	unlock_control_list(device);
+	backend_close(v4l2_dev);
+	free(entries);
+	return ret;
+}
 
-/*
- * Control management
- */
 
 /**
- * Queries the control choice values of the given V4L2 control and uses the results to
- * fill in the choice structures of a libwebcam control.
+ * Restores the control values saved with c_save_profile().
  *
- * @param ctrl		Internal control for which the choice data is requested.
- * @param v4l2_ctrl	Pointer to a structure obtained from VIDIOC_QUERYCTRL and containing
- * 					the V4L2 control data.
- * @param v4l2_dev	Open V4L2 device handle.
+ * The controls are looked up by their V4L2 control ID first and by their name if no
+ * control with that ID exists. Entries that do not match any control are ignored, so
+ * a profile can be applied to a different camera model.
+ *
+ * The values are applied in an order that respects the dependencies between automatic
+ * modes and the manual controls that depend on them: Automatic modes that are off in the
+ * profile are switched off first, then the manual values are set, and automatic modes
+ * that are on are switched on last. Manual values whose automatic mode is on are not
+ * applied. Within each of these steps all controls of a control class are set with a
+ * single ioctl, so restoring a profile usually takes only a few requests.
+ *
+ * @param hDevice		a device handle obtained from c_open_device()
+ * @param file_name		name of the profile file to read
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_INVALID_ARG if no file name is given
+ * 		- #C_INVALID_DEVICE if the device could not be opened
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_CANNOT_READ if the file could not be read
+ * 		- #C_PARSE_ERROR if the file contains invalid lines
+ * 		- #C_V4L2_ERROR if some of the values could not be set. The other values are
+ * 		  applied nevertheless.
  */
-static CResult create_control_choices (Control *ctrl, struct v4l2_queryctrl *v4l2_ctrl, int v4l2_dev)
+CResult c_load_profile (CHandle hDevice, const char *file_name)
 {
 	CResult ret = C_SUCCESS;
+	ProfileEntry *entries = NULL;
+	unsigned int count = 0, i;
+	char line[256];
 
-	int choices_count = v4l2_ctrl->maximum - v4l2_ctrl->minimum + 1;
-	ctrl->control.choices.count = choices_count;
+	// Check the given handle and arguments
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(!HANDLE_OPEN(hDevice))
+		return C_INVALID_HANDLE;
+	if(!HANDLE_VALID(hDevice))
+		return C_NOT_EXIST;
+	Device *device = GET_HANDLE(hDevice).device;
+	if(file_name == NULL)
+		return C_INVALID_ARG;
 
-	// Allocate memory for the choices.names and choices.list members
-	ctrl->control.choices.names = (char *)malloc(choices_count * V4L2_MENU_CTRL_MAX_NAME_SIZE);
-	if(ctrl->control.choices.names == NULL) {
-		ret = C_NO_MEMORY;
-		goto done;
+	FILE *file = fopen(file_name, "r");
+	if(!file) {
+		set_last_error(hDevice, errno);
+		return C_CANNOT_READ;
 	}
-	ctrl->control.choices.list = (CControlChoice *)malloc(choices_count * sizeof(CControlChoice));
-	if(ctrl->control.choices.list == NULL) {
-		ret = C_NO_MEMORY;
+
+	int v4l2_dev = open_v4l2_device(device->v4l2_name);
+	if(v4l2_dev <= 0) {
+		fclose(file);
+		return C_INVALID_DEVICE;
+	}
+
+	if(lock_control_list(device)) {
+		backend_close(v4l2_dev);
+		fclose(file);
+		return C_SYNC_ERROR;
+	}
+
+	// Each control can appear at most once, so there are never more entries than controls
+	if(device->controls.count) {
+		entries = (ProfileEntry *)malloc(device->controls.count * sizeof(ProfileEntry));
+		if(!entries) {
+			ret = C_NO_MEMORY;
+			goto done;
+		}
+	}
+
+	// Read the profile and match the entries with the device controls
+	while(fgets(line, sizeof(line), file)) {
+		unsigned int v4l2_id;
+		int value, name_start;
+
+		if(line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if(sscanf(line, "%x %d %n", &v4l2_id, &value, &name_start) < 2) {
+			ret = C_PARSE_ERROR;
+			continue;
+		}
+		char *name = &line[name_start];
+		name[strcspn(name, "\r\n")] = '\0';
+
+		Control *elem, *control = NULL;
+		for(elem = device->controls.first; elem && !control; elem = elem->next) {
+			if(elem->v4l2_control == v4l2_id)
+				control = elem;
+		}
+		for(elem = device->controls.first; elem && !control && *name; elem = elem->next) {
+			if(strcasecmp(elem->control.name, name) == 0)
+				control = elem;
+		}
+		if(!control || !is_profile_control(control))
+			continue;
+
+		// Later entries for the same control replace earlier ones
+		for(i = 0; i < count && entries[i].control != control; i++)
+			;
+		entries[i].control	= control;
+		entries[i].value	= value;
+		entries[i].index	= i;
+		if(i == count)
+			count++;
+	}
+
+	// Determine the order and apply the values
+	unsigned int applied = 0;
+	for(i = 0; i < count; i++) {
+		entries[i].phase = get_profile_phase(&entries[i], entries, count);
+		if(entries[i].phase >= 0)
+			applied++;
+	}
+	qsort(entries, count, sizeof(ProfileEntry), compare_profile_entries);
+	// Skipped entries have a negative phase and are sorted to the front
+	if(transfer_profile_entries(v4l2_dev, &entries[count - applied], applied, 1, hDevice))
+		ret = C_V4L2_ERROR;
+
+done:
+	unlock_control_list(device);
+	backend_close(v4l2_dev);
+	fclose(file);
+	free(entries);
+	return ret;
+}
+
+
+
+/*
+ * Control watching
+ */
+
+/// Initial interval at which controls without event support are polled, in milliseconds
+#define WATCH_POLL_MIN_INTERVAL		50
+/// Longest polling interval, reached if the polled controls do not change
+#define WATCH_POLL_MAX_INTERVAL		1000
+
+
+/**
+ * Returns true if the value of the given control can be watched.
+ */
+static int is_watch_control (Control *control)
+{
+	CControl *c = &control->control;
+	return control->v4l2_control
+		&& (c->flags & CC_CAN_READ)
+		&& !(c->flags & CC_IS_ACTION)
+		&& c->type != CC_TYPE_RAW;
+}
+
+
+/**
+ * Subscribes to or unsubscribes from the change events of a V4L2 control.
+ *
+ * @param send_initial	if non-zero, the driver sends an initial event with the current
+ * 						value when subscribing
+ * @return 0 on success or -1 with errno set
+ */
+int subscribe_control_event (DeviceStats *stats, int v4l2_dev, unsigned int v4l2_id,
+		int subscribe, int send_initial)
+{
+#ifdef V4L2_EVENT_CTRL
+	struct v4l2_event_subscription sub;
+	memset(&sub, 0, sizeof(sub));
+	sub.type	= V4L2_EVENT_CTRL;
+	sub.id		= v4l2_id;
+	if(send_initial)
+		sub.flags	= V4L2_EVENT_SUB_FL_SEND_INITIAL;
+	return device_ioctl(stats, v4l2_dev, subscribe ? VIDIOC_SUBSCRIBE_EVENT : VIDIOC_UNSUBSCRIBE_EVENT, &sub);
+#else
+	errno = ENOTTY;
+	return -1;
+#endif
+}
+
+
+/**
+ * Passes a new control value to the watch handler.
+ *
+ * @return the return value of the handler
+ */
+static int report_control_change (CHandle hDevice, Control *control, int value,
+		CControlChangeHandler handler, void *context)
+{
+	CControlValue control_value;
+	memset(&control_value, 0, sizeof(control_value));
+	control_value.type	= control->control.type;
+	control_value.value	= value;
+	return handler(hDevice, control->control.id, &control_value, context);
+}
+
+
+/**
+ * Dequeues all pending control events and passes the value changes to the handler.
+ *
+ * @return the return value of the last handler call, i.e. non-zero if watching should stop
+ */
+static int dispatch_control_events (CHandle hDevice, int v4l2_dev,
+		CControlChangeHandler handler, void *context)
+{
+#ifdef V4L2_EVENT_CTRL
+	Device *device = GET_HANDLE(hDevice).device;
+	struct v4l2_event event;
+	int stop = 0;
+
+	do {
+		if(device_ioctl(device->stats, v4l2_dev, VIDIOC_DQEVENT, &event))
+			break;
+		if(event.type != V4L2_EVENT_CTRL || !(event.u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE))
+			continue;
+
+		Control *elem;
+		if(lock_control_list(device))
+			break;
+		for(elem = device->controls.first; elem; elem = elem->next) {
+			if(elem->v4l2_control == event.id)
+				break;
+		}
+		unlock_control_list(device);
+		if(elem)
+			stop = report_control_change(hDevice, elem, event.u.ctrl.value, handler, context);
+	} while(event.pending && !stop);
+
+	return stop;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * Returns the current time of the monotonic clock in milliseconds.
+ */
+static long long get_monotonic_time (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/**
+ * Watches the given controls and reports their value changes as they happen.
+ *
+ * The function subscribes to the V4L2 control events of all given controls and waits for
+ * the driver to signal changes, so that no requests are sent to the device while the
+ * values do not change. Controls that do not support events are polled instead. Their
+ * polling interval starts short and grows while their values stay the same. Each watch
+ * opens the device again, so several watches can run on the same device at the same
+ * time and changes made through other handles are reported, too.
+ *
+ * The handler is called once with the current value of each control, and then every time
+ * a value changes. The function returns when the handler returns a non-zero value or when
+ * the wait is interrupted by a signal.
+ *
+ * @param hDevice		a handle obtained from a call to #c_open_device
+ * @param control_ids	an array with the IDs of the controls to watch or NULL to watch all
+ * 						readable controls of the device
+ * @param count			the number of elements in @a control_ids
+ * @param handler		the function that is called with the new control values
+ * @param context		a value that is passed to the handler
+ * @return
+ * 		- #C_SUCCESS if the handler or a signal stopped the watch
+ * 		- #C_INIT_ERROR if the library has not been initialized
+ * 		- #C_INVALID_HANDLE if the given device handle is invalid
+ * 		- #C_NOT_EXIST if the device does not exist (anymore)
+ * 		- #C_INVALID_ARG if no handler is given
+ * 		- #C_INVALID_DEVICE if the device could not be opened
+ * 		- #C_NOT_FOUND if a given control does not exist or no control can be watched
+ * 		- #C_CANNOT_READ if a given control cannot be watched
+ * 		- #C_NO_MEMORY if memory could not be allocated
+ * 		- #C_SYNC_ERROR if the wait for events failed
+ */
+CResult c_watch_controls (CHandle hDevice, const CControlId *control_ids, unsigned int count,
+		CControlChangeHandler handler, void *context)
+{
+	CResult ret = C_SUCCESS;
+	ProfileEntry *polled = NULL;		// Controls without event support
+	int *values = NULL;					// Last reported values of the polled controls
+	unsigned int *events = NULL;		// V4L2 IDs of the controls with event support
+	unsigned int polled_count = 0, event_count = 0, i;
+	int stop = 0, using_controls = 0;
+
+	// Check the given handle and arguments
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(!HANDLE_OPEN(hDevice))
+		return C_INVALID_HANDLE;
+	if(!HANDLE_VALID(hDevice))
+		return C_NOT_EXIST;
+	Device *device = GET_HANDLE(hDevice).device;
+	if(handler == NULL || (count && control_ids == NULL))
+		return C_INVALID_ARG;
+
+	// The events are subscribed on a file handle of their own. Other watches then cannot
+	// dequeue them, and the driver reports the changes made through the other handles of
+	// this process, too.
+	char path[5 + NAME_MAX + 1];
+	snprintf(path, sizeof(path), "/dev/%s", device->v4l2_name);
+	int v4l2_dev = backend_open(path, O_RDWR | O_NONBLOCK);
+	if(v4l2_dev < 0)
+		return C_INVALID_DEVICE;
+
+	if(lock_control_list(device)) {
+		ret = C_SYNC_ERROR;
+		goto done;
+	}
+
+	for(i = 0; i < count; i++) {
+		Control *control = find_control_by_id(device, control_ids[i]);
+		if(!control) {
+			ret = C_NOT_FOUND;
+			goto unlock;
+		}
+		if(!is_watch_control(control)) {
+			ret = C_CANNOT_READ;
+			goto unlock;
+		}
+	}
+
+	// Subscribe to the control events and collect the controls that need polling
+	if(device->controls.count) {
+		polled = (ProfileEntry *)malloc(device->controls.count * sizeof(ProfileEntry));
+		values = (int *)malloc(device->controls.count * sizeof(int));
+		events = (unsigned int *)malloc(device->controls.count * sizeof(unsigned int));
+		if(!polled || !values || !events) {
+			ret = C_NO_MEMORY;
+			goto unlock;
+		}
+	}
+	Control *elem;
+	for(elem = device->controls.first; elem; elem = elem->next) {
+		if(!is_watch_control(elem))
+			continue;
+		if(count) {
+			for(i = 0; i < count && control_ids[i] != elem->control.id; i++)
+				;
+			if(i == count)
+				continue;
+		}
+
+		if((elem->control.flags & CC_CAN_NOTIFY) &&
+		   subscribe_control_event(device->stats, v4l2_dev, elem->v4l2_control, 1, 1) == 0) {
+			events[event_count++] = elem->v4l2_control;
+			continue;
+		}
+		polled[polled_count].control	= elem;
+		polled[polled_count].value		= 0;
+		polled[polled_count].phase		= 0;
+		polled[polled_count].index		= polled_count;
+		polled[polled_count].failed		= 0;
+		polled_count++;
+	}
+	qsort(polled, polled_count, sizeof(ProfileEntry), compare_profile_entries);
+
+unlock:
+	// The polled entries and the event dispatching use the controls outside the lock
+	if(!ret) {
+		use_control_list(device);
+		using_controls = 1;
+	}
+	unlock_control_list(device);
+	if(ret)
+		goto done;
+	if(!event_count && !polled_count) {
+		ret = C_NOT_FOUND;
+		goto done;
+	}
+
+	// Report the initial values of the polled controls. The initial values of the other
+	// controls arrive as events.
+	transfer_profile_entries(v4l2_dev, polled, polled_count, 0, hDevice);
+	for(i = 0; i < polled_count && !stop; i++) {
+		values[i] = polled[i].value;
+		if(!polled[i].failed)
+			stop = report_control_change(hDevice, polled[i].control, polled[i].value,
+					handler, context);
+	}
+
+	int interval = WATCH_POLL_MIN_INTERVAL;
+	long long next_poll = get_monotonic_time() + interval;
+	while(!stop) {
+		struct pollfd fd = { .fd = v4l2_dev, .events = POLLPRI };
+		int timeout = -1;
+		if(polled_count) {
+			long long remaining = next_poll - get_monotonic_time();
+			timeout = remaining > 0 ? (int)remaining : 0;
+		}
+
+		int r = backend_poll(&fd, event_count ? 1 : 0, timeout);
+		if(r < 0) {
+			if(errno != EINTR) {
+				set_last_error(hDevice, errno);
+				ret = C_SYNC_ERROR;
+			}
+			break;
+		}
+		if(fd.revents & POLLPRI) {
+			stop = dispatch_control_events(hDevice, v4l2_dev, handler, context);
+		}
+		else if(fd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			// The device is gone
+			ret = C_NOT_EXIST;
+			break;
+		}
+
+		if(!polled_count || stop || get_monotonic_time() < next_poll)
+			continue;
+
+		// Poll the controls without event support and adapt the interval to the changes
+		int changed = 0;
+		transfer_profile_entries(v4l2_dev, polled, polled_count, 0, hDevice);
+		for(i = 0; i < polled_count && !stop; i++) {
+			if(polled[i].failed || polled[i].value == values[i])
+				continue;
+			values[i] = polled[i].value;
+			changed = 1;
+			stop = report_control_change(hDevice, polled[i].control, polled[i].value,
+					handler, context);
+		}
+		if(changed)
+			interval = WATCH_POLL_MIN_INTERVAL;
+		else if(interval * 2 < WATCH_POLL_MAX_INTERVAL)
+			interval *= 2;
+		else
+			interval = WATCH_POLL_MAX_INTERVAL;
+		next_poll = get_monotonic_time() + interval;
+	}
+
+done:
+	for(i = 0; i < event_count; i++)
+		subscribe_control_event(device->stats, v4l2_dev, events[i], 0, 0);
+	backend_close(v4l2_dev);
+	if(using_controls)
+		release_control_list(device);
+	free(polled);
+	free(values);
+	free(events);
+	return ret;
+}
+
+
+
+/**
+ * Returns the error message associated with a given error code.
+ *
+ * Note that the caller must free the buffer returned by this function.
+ *
+ * @param error		error code for which the message should be retrieved
+ * @return
+ * 		- a newly allocated string describing the given error code
+ * 		- NULL if not enough memory was available or if the error code is
+ * 		  unknown
+ */
+char *c_get_error_text (CResult error)
+{
+	return c_get_handle_error_text(0, error);
+}
+
+
+/**
+ * Returns the error message associated with a given error code and device handle.
+ *
+ * Note that the caller must free the buffer returned by this function. Compared to the
+ * #c_get_error_text() function, this function can take the handle's last system error
+ * into account.
+ *
+ * @param hDevice	an open device handle. If this parameter is 0, the function behaves
+ *					exactly like #c_get_error_text().
+ * @param error		error code for which the message should be retrieved
+ * @return
+ * 		- a newly allocated string describing the given error code
+ * 		- NULL if not enough memory was available or if the error code is
+ * 		  unknown
+ */
+char *c_get_handle_error_text (CHandle hDevice, CResult error)
+{
+	switch(error) {
+		case C_SUCCESS:				return strdup("Success");
+		case C_NOT_IMPLEMENTED:		return strdup("The function is not implemented");
+		case C_INIT_ERROR:			return strdup("Error during initialization or library not initialized");
+		case C_INVALID_ARG:			return strdup("Invalid argument");
+		case C_INVALID_HANDLE:		return strdup("Invalid handle");
+		case C_INVALID_DEVICE:		return strdup("Invalid device or device cannot be opened");
+		case C_NOT_FOUND:			return strdup("Object not found");
+		case C_BUFFER_TOO_SMALL:	return strdup("Buffer too small");
+		case C_SYNC_ERROR:			return strdup("Error during data synchronization");
+		case C_NO_MEMORY:			return strdup("Out of memory");
+		case C_NO_HANDLES:			return strdup("Out of handles");
+		case C_V4L2_ERROR:
+		{
+			char *text = NULL;
+			if(hDevice && HANDLE_OPEN(hDevice)) {
+				if(asprintf(&text, "A Video4Linux2 API call returned an unexpected error %d", GET_HANDLE(hDevice).last_system_error) == -1)
+					text = NULL;;
+			}
+			if(!text)
+				return strdup("A Video4Linux2 API call returned an unexpected error");
+			return text;
+		}
+		case C_SYSFS_ERROR:			return strdup("A sysfs file access returned an error");
+		case C_PARSE_ERROR:			return strdup("A control could not be parsed");
+		case C_CANNOT_WRITE:		return strdup("Writing not possible (e.g. read-only control)");
+		case C_CANNOT_READ:			return strdup("Reading not possible (e.g. write-only control)");
+		default:					return NULL;
+	}
+}
+
+
+
+/*
+ * Helper functions
+ */
+
+/**
+ * Logs a generic error message.
+ */
+void print_libwebcam_error (char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	log_vmessage(CL_ERROR, NULL, format, NULL, ap);
+	va_end(ap);
+}
+
+
+/**
+ * Logs a libwebcam error message.
+ *
+ * @param error		a #CResult error code whose error text is appended
+ * @param format	a @a printf compatible format
+ */
+static void print_libwebcam_c_error (CResult error, char *format, ...)
+{
+	char suffix[128];
+	char *text;
+	va_list ap;
+
+	// Retrieve the libwebcam error text
+	text = c_get_error_text(error);
+	snprintf(suffix, sizeof(suffix), " (error %d: %s)", error, text ? text : "Unknown error");
+	free(text);
+
+	va_start(ap, format);
+	log_vmessage(CL_ERROR, NULL, format, suffix, ap);
+	va_end(ap);
+}
+
+
+
+/*
+ * Control management
+ */
+
+/**
+ * Queries the control choice values of the given V4L2 control and uses the results to
+ * fill in the choice structures of a libwebcam control.
+ *
+ * @param ctrl		Internal control for which the choice data is requested.
+ * @param v4l2_ctrl	Pointer to a structure obtained from VIDIOC_QUERYCTRL and containing
+ * 					the V4L2 control data.
+ * @param v4l2_dev	Open V4L2 device handle.
+ * @param stats		Request statistics of the device (may be NULL).
+ */
+static CResult create_control_choices (Control *ctrl, struct v4l2_queryctrl *v4l2_ctrl, int v4l2_dev, DeviceStats *stats)
+{
+	CResult ret = C_SUCCESS;
+
+	int choices_count = v4l2_ctrl->maximum - v4l2_ctrl->minimum + 1;
+	ctrl->control.choices.count = choices_count;
+
+	// Allocate memory for the choices.names and choices.list members
+	ctrl->control.choices.names = (char *)malloc(choices_count * V4L2_MENU_CTRL_MAX_NAME_SIZE);
+	if(ctrl->control.choices.names == NULL) {
+		ret = C_NO_MEMORY;
+		goto done;
+	}
+	ctrl->control.choices.list = (CControlChoice *)malloc(choices_count * sizeof(CControlChoice));
+	if(ctrl->control.choices.list == NULL) {
+		ret = C_NO_MEMORY;
 		goto done;
 	}
 
@@ -1203,7 +2032,7 @@ static CResult create_control_choices (Control *ctrl, struct v4l2_queryctrl *v4l
 	struct v4l2_querymenu v4l2_menu = { .id = v4l2_ctrl->id };
 	for(v4l2_menu.index = v4l2_ctrl->minimum; v4l2_menu.index <= v4l2_ctrl->maximum; v4l2_menu.index++) {
 		int choice_index = v4l2_menu.index - v4l2_ctrl->minimum;
-		if(ioctl(v4l2_dev, VIDIOC_QUERYMENU, &v4l2_menu)) {
+		if(device_ioctl(stats, v4l2_dev, VIDIOC_QUERYMENU, &v4l2_menu)) {
 			if(errno == EINVAL) {
 #ifdef V4L2_CID_EXPOSURE_AUTO
 				// Some newer versions of the UVC driver implement an 'Exposure, Auto'
@@ -1211,14 +2040,14 @@ static CResult create_control_choices (Control *ctrl, struct v4l2_queryctrl *v4l
 				// but { 1, 2, 4, 8 } instead.
 				if(v4l2_ctrl->id == V4L2_CID_EXPOSURE_AUTO && errno == EINVAL &&
 						v4l2_menu.index == 0) {
-					print_libwebcam_error(
+					log_message(CL_WARNING, NULL,
 						"Unsupported V4L2_CID_EXPOSURE_AUTO control with a non-contiguous \n"
 						"  range of choice IDs found");
 				}
 				else
 #endif
 				{
-					print_libwebcam_error(
+					log_message(CL_WARNING, NULL,
 						"Invalid menu control choice range encountered.\n"
 						"  Indicated range is [ %d .. %d ] but querying choice %d failed.",
 						v4l2_ctrl->minimum, v4l2_ctrl->maximum, v4l2_menu.index
@@ -1250,6 +2079,21 @@ done:
 }
 
 
+/**
+ * Extracts the parts of a V4L2 control description that update_control() compares.
+ */
+static void get_v4l2_control_info (const struct v4l2_queryctrl *v4l2_ctrl, V4L2ControlInfo *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->type			= v4l2_ctrl->type;
+	info->minimum		= v4l2_ctrl->minimum;
+	info->maximum		= v4l2_ctrl->maximum;
+	info->step			= v4l2_ctrl->step;
+	info->default_value	= v4l2_ctrl->default_value;
+	info->flags			= v4l2_ctrl->flags & ~V4L2_CTRL_STATE_FLAGS;
+}
+
+
 /**
  * Create a libwebcam control from a V4L2 control.
  *
@@ -1284,13 +2128,15 @@ static Control *create_v4l2_control (Device *device, struct v4l2_queryctrl *v4l2
 		case V4L2_CTRL_TYPE_BUTTON:		// TODO implement
 		case V4L2_CTRL_TYPE_INTEGER64:	// TODO implement
 			ret = C_NOT_IMPLEMENTED;
-			print_libwebcam_error("Warning: Unsupported V4L2 control type encountered: ctrl_id = 0x%08X, "
+			log_message(CL_WARNING, device->v4l2_name,
+					"Unsupported V4L2 control type encountered: ctrl_id = 0x%08X, "
 					"name = '%s', type = %d",
 					v4l2_ctrl->id, v4l2_ctrl->name, v4l2_ctrl->type);
 			goto done;
 		default:
 			ret = C_PARSE_ERROR;
-			print_libwebcam_error("Invalid V4L2 control type encountered: ctrl_id = 0x%08X, "
+			log_message(CL_WARNING, device->v4l2_name,
+					"Invalid V4L2 control type encountered: ctrl_id = 0x%08X, "
 					"name = '%s', type = %d",
 					v4l2_ctrl->id, v4l2_ctrl->name, v4l2_ctrl->type);
 			goto done;
@@ -1310,6 +2156,7 @@ static Control *create_v4l2_control (Device *device, struct v4l2_queryctrl *v4l2
 		memset(ctrl, 0, sizeof(*ctrl));
 		ctrl->control.id		= ctrl_id;
 		ctrl->v4l2_control		= v4l2_ctrl->id;
+		get_v4l2_control_info(v4l2_ctrl, &ctrl->v4l2_info);
 		if(strlen((char *)v4l2_ctrl->name))
 			ctrl->control.name		= strdup((char *)v4l2_ctrl->name);
 		else
@@ -1320,16 +2167,21 @@ static Control *create_v4l2_control (Device *device, struct v4l2_queryctrl *v4l2
 			ctrl->control.flags	|= CC_CAN_WRITE;
 		if(v4l2_ctrl->id >= V4L2_CID_PRIVATE_BASE)
 			ctrl->control.flags |= CC_IS_CUSTOM;
+		// The subscription only tests for event support. It ends when the enumeration
+		// closes the device.
+		if(subscribe_control_event(device->stats, v4l2_dev, v4l2_ctrl->id, 1, 0) == 0)
+			ctrl->control.flags |= CC_CAN_NOTIFY;
 		ctrl->control.def.value	= v4l2_ctrl->default_value;
 
 		// Process V4L2 menu-style and raw controls
 		if(type == CC_TYPE_CHOICE) {
-			ret = create_control_choices(ctrl, v4l2_ctrl, v4l2_dev);
+			ret = create_control_choices(ctrl, v4l2_ctrl, v4l2_dev, device->stats);
 			if(ret) goto done;
 		}
 		else if(type == CC_TYPE_RAW) {
 			if(v4l2_ctrl->minimum != v4l2_ctrl->maximum || v4l2_ctrl->step != 1) {
-				print_libwebcam_error("Unsupported V4L2 string control encountered: ctrl_id = 0x%08X, "
+				log_message(CL_WARNING, device->v4l2_name,
+					"Unsupported V4L2 string control encountered: ctrl_id = 0x%08X, "
 					"name = '%s', min = %u, max = %u, step = %u",
 					v4l2_ctrl->id, v4l2_ctrl->name,
 					v4l2_ctrl->minimum, v4l2_ctrl->maximum, v4l2_ctrl->step);
@@ -1371,6 +2223,65 @@ done:
 }
 
 
+/**
+ * Brings a control up to date with a new description of the same V4L2 control.
+ *
+ * If the driver describes the control the same way as when it was created, nothing
+ * happens. Otherwise the control is updated in place, so that pointers to it stay
+ * valid. Only the numbers and flags are updated: the name and the menu choices may be
+ * in use by other threads, so a control whose name or menu range changed has to be
+ * created again.
+ *
+ * @param ctrl		Control to update.
+ * @param v4l2_ctrl	Pointer to a structure obtained from VIDIOC_QUERYCTRL and containing
+ * 					the V4L2 control data.
+ *
+ * Note: The control list must be locked.
+ *
+ * @return
+ * 		- #C_SUCCESS if the control is up to date
+ * 		- #C_PARSE_ERROR if the control has to be created again (e.g. its type changed)
+ */
+static CResult update_control (Control *ctrl, struct v4l2_queryctrl *v4l2_ctrl)
+{
+	V4L2ControlInfo info;
+
+	get_v4l2_control_info(v4l2_ctrl, &info);
+	const char *name = strlen((char *)v4l2_ctrl->name) ? (char *)v4l2_ctrl->name : UNKNOWN_CONTROL_NAME;
+	int same_name = ctrl->control.name && strcmp(ctrl->control.name, name) == 0;
+	if(same_name && memcmp(&info, &ctrl->v4l2_info, sizeof(info)) == 0)
+		return C_SUCCESS;
+
+	if(!same_name || info.type != ctrl->v4l2_info.type)
+		return C_PARSE_ERROR;
+	if(ctrl->control.type == CC_TYPE_RAW && (info.minimum != info.maximum || info.step != 1))
+		return C_PARSE_ERROR;
+	if(ctrl->control.type == CC_TYPE_CHOICE &&
+	   (info.minimum != ctrl->v4l2_info.minimum || info.maximum != ctrl->v4l2_info.maximum))
+		return C_PARSE_ERROR;
+
+	ctrl->control.def.value = v4l2_ctrl->default_value;
+	if(ctrl->control.type == CC_TYPE_RAW) {
+		ctrl->control.value.raw.size =
+		ctrl->control.min.raw.size =
+		ctrl->control.max.raw.size =
+		ctrl->control.def.raw.size = v4l2_ctrl->maximum;
+	}
+	else {
+		ctrl->control.min.value		= v4l2_ctrl->minimum;
+		ctrl->control.max.value		= v4l2_ctrl->maximum;
+		ctrl->control.step.value	= v4l2_ctrl->step;
+	}
+	if(v4l2_ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY)
+		ctrl->control.flags &= ~CC_CAN_WRITE;
+	else
+		ctrl->control.flags |= CC_CAN_WRITE;
+	ctrl->v4l2_info = info;
+
+	return C_SUCCESS;
+}
+
+
 /**
  * Frees all resources associated with the given control, including choice data.
  *
@@ -1393,6 +2304,9 @@ static void delete_control (Control *ctrl)
 /**
  * Looks up the control with the given ID for the given device.
  *
+ * Note: The control list must be locked. The control stays valid after the list is
+ * unlocked, because controls are only freed together with their device.
+ *
  * @return
  * 		- NULL if no corresponding control was found for the given device.
  * 		- Pointer to the control if it was found.
@@ -1410,11 +2324,14 @@ static Control *find_control_by_id (Device *dev, CControlId id)
 
 
 /**
- * Clears the control list of the given device and frees all associated resources.
+ * Clears the control list of the given device and frees all associated resources,
+ * including the retired controls.
+ *
+ * This function is only called when the device is deleted.
  */
 static void clear_control_list (Device *dev)
 {
-	lock_mutex(&dev->controls.mutex);
+	lock_control_list(dev);
 
 	Control *elem = dev->controls.first;
 	while(elem) {
@@ -1425,14 +2342,87 @@ static void clear_control_list (Device *dev)
 	dev->controls.first = NULL;
 	dev->controls.count = 0;
 
-	unlock_mutex(&dev->controls.mutex);
+	elem = dev->controls.retired;
+	while(elem) {
+		Control *next = elem->next;
+		delete_control(elem);
+		elem = next;
+	}
+	dev->controls.retired = NULL;
+
+	unlock_control_list(dev);
+}
+
+
+/**
+ * Disposes of a control that was taken out of the control list.
+ *
+ * If other threads use the controls of the device without holding the lock, the control
+ * is moved to the retired controls of the device, which release_control_list() frees
+ * once the last of them is done. Otherwise it is freed right away.
+ *
+ * Note: The control list must be locked.
+ */
+static void retire_control (Device *dev, Control *ctrl)
+{
+	if(!dev->controls.users) {
+		delete_control(ctrl);
+		return;
+	}
+	ctrl->next = dev->controls.retired;
+	dev->controls.retired = ctrl;
+}
+
+
+/**
+ * Marks the controls of a device as used outside the control list lock, so that
+ * controls taken out of the list in the meantime are not freed.
+ *
+ * Note: The control list must be locked.
+ */
+static void use_control_list (Device *dev)
+{
+	dev->controls.users++;
+}
+
+
+/**
+ * Ends a use that was started with use_control_list() and frees the retired controls
+ * if no other thread uses the controls anymore.
+ */
+static void release_control_list (Device *dev)
+{
+	lock_control_list(dev);
+	if(--dev->controls.users == 0) {
+		Control *elem = dev->controls.retired;
+		while(elem) {
+			Control *next = elem->next;
+			delete_control(elem);
+			elem = next;
+		}
+		dev->controls.retired = NULL;
+	}
+	unlock_control_list(dev);
+}
+
+
+#ifdef CONTROL_IO_ERROR_RETRIES
+/**
+ * Counts a control query that had to be retried because of an I/O error.
+ */
+static void count_control_retry (Device *dev)
+{
+	if(dev->stats)
+		__sync_fetch_and_add(&dev->stats->stats.retries, 1);
 }
+#endif
 
 
 /**
  * Scans the given device for supported controls and adds them to the internal list.
  *
- * Note that this function clears all existing controls prior to reenumerating them.
+ * Note that this function removes all existing controls prior to reenumerating them.
+ * They are retired, because other threads may still use them.
  */
 static CResult refresh_control_list (Device *dev)
 {
@@ -1441,14 +2431,25 @@ static CResult refresh_control_list (Device *dev)
 	struct v4l2_queryctrl v4l2_ctrl = { 0 };
 
 	// Clear control list first
-	clear_control_list(dev);
+	if(lock_control_list(dev))
+		return C_SYNC_ERROR;
+	while(dev->controls.first) {
+		Control *next = dev->controls.first->next;
+		retire_control(dev, dev->controls.first);
+		dev->controls.first = next;
+	}
+	dev->controls.count = 0;
+	unlock_control_list(dev);
+	PROBE1(controls__start, dev->v4l2_name);
 
 	// Open the corresponding V4L2 device
 	v4l2_dev = open_v4l2_device(dev->v4l2_name);
-	if(!v4l2_dev)
+	if(!v4l2_dev) {
+		PROBE3(controls__done, dev->v4l2_name, 0, C_INVALID_DEVICE);
 		return C_INVALID_DEVICE;
+	}
 
-	if(lock_mutex(&dev->controls.mutex)) {
+	if(lock_control_list(dev)) {
 		ret = C_SYNC_ERROR;
 		goto done;
 	}
@@ -1456,7 +2457,7 @@ static CResult refresh_control_list (Device *dev)
 	// Test if the driver supports the V4L2_CTRL_FLAG_NEXT_CTRL flag
 #ifdef ENABLE_V4L2_ADVANCED_CONTROL_ENUMERATION
 	v4l2_ctrl.id = 0 | V4L2_CTRL_FLAG_NEXT_CTRL;
-	if(ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl) == 0) {
+	if(device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl) == 0) {
 		// The driver supports the V4L2_CTRL_FLAG_NEXT_CTRL flag, so go ahead with
 		// the advanced enumeration way.
 
@@ -1465,7 +2466,7 @@ static CResult refresh_control_list (Device *dev)
 		int current_ctrl = v4l2_ctrl.id;
 		v4l2_ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
 		// Loop as long as ioctl does not return EINVAL
-		while((r = ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)), r ? errno != EINVAL : 1) {
+		while((r = device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)), r ? errno != EINVAL : 1) {
 #ifdef CONTROL_IO_ERROR_RETRIES
 			if(r && (errno == EIO || errno == EPIPE || errno == ETIMEDOUT)) {
 				// An I/O error occurred, so retry the query a few times.
@@ -1477,9 +2478,10 @@ static CResult refresh_control_list (Device *dev)
 				// Keep in mind that with the NEXT_CTRL flag VIDIO_QUERYCTRL returns the
 				// first control with a *higher* ID than the specified one.
 				int tries = CONTROL_IO_ERROR_RETRIES;
+				count_control_retry(dev);
 				v4l2_ctrl.id = current_ctrl | V4L2_CTRL_FLAG_NEXT_CTRL;
 				while(tries-- &&
-					  (r = ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
+					  (r = device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
 					  (errno == EIO || errno == EPIPE || errno == ETIMEDOUT)) {
 					v4l2_ctrl.id = current_ctrl | V4L2_CTRL_FLAG_NEXT_CTRL;
 				}
@@ -1491,8 +2493,8 @@ static CResult refresh_control_list (Device *dev)
 				// of the next control, we have to manually increase the control ID,
 				// otherwise we risk getting stuck querying the erroneous control.
 				current_ctrl++;
-				print_libwebcam_error(
-						"Warning: The driver behind device %s has a slightly buggy implementation\n"
+				log_message(CL_WARNING, dev->v4l2_name,
+						"The driver behind device %s has a slightly buggy implementation\n"
 						"  of the V4L2_CTRL_FLAG_NEXT_CTRL flag. It does not return the next higher\n"
 						"  control ID if a control query fails. A workaround has been enabled.",
 						dev->v4l2_name);
@@ -1501,8 +2503,8 @@ static CResult refresh_control_list (Device *dev)
 			else if(!r && v4l2_ctrl.id == current_ctrl) {
 				// If there was no error but the driver did not increase the control ID
 				// we simply cancel the enumeration.
-				print_libwebcam_error(
-						"Error: The driver %s behind device %s has a buggy\n"
+				log_message(CL_ERROR, dev->v4l2_name,
+						"The driver %s behind device %s has a buggy\n"
 						"  implementation of the V4L2_CTRL_FLAG_NEXT_CTRL flag. It does not raise an\n"
 						"  error or return the next control. Canceling control enumeration.",
 						dev->device.driver, dev->v4l2_name);
@@ -1518,7 +2520,7 @@ static CResult refresh_control_list (Device *dev)
 			Control *ctrl = create_v4l2_control(dev, &v4l2_ctrl, v4l2_dev, &ret);
 			if(ctrl == NULL) {
 				if(ret == C_PARSE_ERROR || ret == C_NOT_IMPLEMENTED) {
-					print_libwebcam_error("Invalid or unsupported V4L2 control encountered: "
+					log_message(CL_WARNING, dev->v4l2_name, "Invalid or unsupported V4L2 control encountered: "
 							"ctrl_id = 0x%08X, name = '%s'", v4l2_ctrl.id, v4l2_ctrl.name);
 					ret = C_SUCCESS;
 				}
@@ -1549,14 +2551,16 @@ next_control:
 		for(current_ctrl = V4L2_CID_BASE; current_ctrl < V4L2_CID_LASTP1; current_ctrl++) {
 			v4l2_ctrl.id = current_ctrl;
 #ifndef CONTROL_IO_ERROR_RETRIES
-			if(ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl) ||
+			if(device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl) ||
 			   v4l2_ctrl.flags & V4L2_CTRL_FLAG_DISABLED)
 				continue;
 #else
 			int r = 0, tries = 1 + CONTROL_IO_ERROR_RETRIES;
 			while(tries-- &&
-				  (r = ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
+				  (r = device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
 				  (errno == EIO || errno == EPIPE || errno == ETIMEDOUT));
+			if(tries < CONTROL_IO_ERROR_RETRIES)
+				count_control_retry(dev);
 			if(r || v4l2_ctrl.flags & V4L2_CTRL_FLAG_DISABLED)
 				continue;
 #endif
@@ -1564,7 +2568,7 @@ next_control:
 			Control *ctrl = create_v4l2_control(dev, &v4l2_ctrl, v4l2_dev, &ret);
 			if(ctrl == NULL) {
 				if(ret == C_PARSE_ERROR || ret == C_NOT_IMPLEMENTED) {
-					print_libwebcam_error("Invalid or unsupported V4L2 control encountered: "
+					log_message(CL_WARNING, dev->v4l2_name, "Invalid or unsupported V4L2 control encountered: "
 							"ctrl_id = 0x%08X, name = '%s'", v4l2_ctrl.id, v4l2_ctrl.name);
 					ret = C_SUCCESS;
 					continue;
@@ -1576,36 +2580,132 @@ next_control:
 		// Enumerate custom controls
 		for(v4l2_ctrl.id = V4L2_CID_PRIVATE_BASE;; v4l2_ctrl.id++) {
 #ifndef CONTROL_IO_ERROR_RETRIES
-			if(ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl))
+			if(device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl))
 				break;
 #else
 			int r = 0, tries = 1 + CONTROL_IO_ERROR_RETRIES;
 			while(tries-- &&
-				  (r = ioctl(v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
+				  (r = device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) &&
 				  (errno == EIO || errno == EPIPE || errno == ETIMEDOUT));
+			if(tries < CONTROL_IO_ERROR_RETRIES)
+				count_control_retry(dev);
 			if(r)
 				break;
 #endif
 			if(v4l2_ctrl.flags & V4L2_CTRL_FLAG_DISABLED)
 				continue;
 
-			Control *ctrl = create_v4l2_control(dev, &v4l2_ctrl, v4l2_dev, &ret);
-			if(ctrl == NULL) {
-				if(ret == C_PARSE_ERROR || ret == C_NOT_IMPLEMENTED) {
-					print_libwebcam_error("Invalid or unsupported custom V4L2 control encountered: "
-							"ctrl_id = 0x%08X, name = '%s'", v4l2_ctrl.id, v4l2_ctrl.name);
-					ret = C_SUCCESS;
-					continue;
-				}
-				goto done;
-			}
+			Control *ctrl = create_v4l2_control(dev, &v4l2_ctrl, v4l2_dev, &ret);
+			if(ctrl == NULL) {
+				if(ret == C_PARSE_ERROR || ret == C_NOT_IMPLEMENTED) {
+					log_message(CL_WARNING, dev->v4l2_name, "Invalid or unsupported custom V4L2 control encountered: "
+							"ctrl_id = 0x%08X, name = '%s'", v4l2_ctrl.id, v4l2_ctrl.name);
+					ret = C_SUCCESS;
+					continue;
+				}
+				goto done;
+			}
+		}
+	}
+
+done:
+	unlock_control_list(dev);
+	backend_close(v4l2_dev);
+	PROBE3(controls__done, dev->v4l2_name, dev->controls.count, ret);
+
+	return ret;
+}
+
+
+/**
+ * Brings the control list of the given device up to date without rebuilding it.
+ *
+ * The controls are enumerated with the V4L2_CTRL_FLAG_NEXT_CTRL flag and compared to
+ * the existing ones: New controls are created, controls that the driver no longer
+ * reports are retired, and controls whose description changed are updated by
+ * update_control() or, if that is not possible, created again. Unchanged controls are
+ * kept as they are, so that no menus are queried and no event support is probed for
+ * them. The resulting list has the same order as after refresh_control_list().
+ *
+ * The control list stays locked during the update, so concurrent updates of the same
+ * device are serialized. Controls are retired rather than freed, so pointers that other
+ * threads use outside the lock stay valid.
+ *
+ * If the driver does not support the V4L2_CTRL_FLAG_NEXT_CTRL flag or the enumeration
+ * fails, the function falls back to refresh_control_list(), which knows how to work
+ * around broken drivers.
+ *
+ * @param dev		Device whose control list should be updated.
+ * @param v4l2_dev	Open V4L2 device handle.
+ */
+static CResult update_control_list (Device *dev, int v4l2_dev)
+{
+	CResult ret = C_SUCCESS;
+#ifdef ENABLE_V4L2_ADVANCED_CONTROL_ENUMERATION
+	struct v4l2_queryctrl v4l2_ctrl = { 0 };
+	unsigned int last_id = 0;
+	int r;
+
+	if(lock_control_list(dev))
+		return C_SYNC_ERROR;
+
+	// Take the existing controls out of the list. Controls that are still present are
+	// moved back in the order of the enumeration, the remaining ones are retired.
+	Control *old = dev->controls.first;
+	dev->controls.first = NULL;
+	dev->controls.count = 0;
+
+	v4l2_ctrl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+	while((r = device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl)) == 0) {
+		if(v4l2_ctrl.id <= last_id) {
+			// Buggy NEXT_CTRL implementation, see refresh_control_list()
+			ret = C_V4L2_ERROR;
+			break;
+		}
+		last_id = v4l2_ctrl.id;
+		if(v4l2_ctrl.flags & V4L2_CTRL_FLAG_DISABLED)
+			goto next_control;
+
+		Control **link = &old;
+		while(*link && (*link)->v4l2_control != v4l2_ctrl.id)
+			link = &(*link)->next;
+		if(*link && update_control(*link, &v4l2_ctrl) == C_SUCCESS) {
+			Control *ctrl = *link;
+			*link = ctrl->next;
+			ctrl->next = dev->controls.first;
+			dev->controls.first = ctrl;
+			dev->controls.count++;
+			goto next_control;
 		}
+
+		// The control is new or cannot be updated, so create it from scratch
+		if(create_v4l2_control(dev, &v4l2_ctrl, v4l2_dev, &ret) == NULL) {
+			if(ret != C_PARSE_ERROR && ret != C_NOT_IMPLEMENTED)
+				break;
+			log_message(CL_WARNING, dev->v4l2_name, "Invalid or unsupported V4L2 control encountered: "
+					"ctrl_id = 0x%08X, name = '%s'", v4l2_ctrl.id, v4l2_ctrl.name);
+			ret = C_SUCCESS;
+		}
+
+next_control:
+		v4l2_ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
 	}
+	// The enumeration ends with EINVAL. If the first query fails, the driver may not
+	// support the flag.
+	if(r && (errno != EINVAL || last_id == 0))
+		ret = C_V4L2_ERROR;
 
-done:
-	unlock_mutex(&dev->controls.mutex);
-	close(v4l2_dev);
+	while(old) {
+		Control *next = old->next;
+		retire_control(dev, old);
+		old = next;
+	}
+	unlock_control_list(dev);
+	if(!ret)
+		return C_SUCCESS;
+#endif
 
+	ret = refresh_control_list(dev);
 	return ret;
 }
 
@@ -1625,7 +2725,7 @@ static CResult refresh_device_details (Device *dev)
 		return C_INVALID_DEVICE;
 
 	// Query the device
-	if(!ioctl(v4l2_dev, VIDIOC_QUERYCAP, &v4l2_cap)) {
+	if(!device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCAP, &v4l2_cap)) {
 		if(v4l2_cap.card[0])
 			dev->device.name = strdup((char *)v4l2_cap.card);
 		else
@@ -1640,7 +2740,7 @@ static CResult refresh_device_details (Device *dev)
 		ret = C_V4L2_ERROR;
 	}
 
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 
 	return ret;
 }
@@ -1861,7 +2961,7 @@ static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev)
 	// after libwebcam compilation time.
 	if(V4L2_CTRL_ID2CLASS(v4l2_id) == V4L2_CTRL_CLASS_USER) {
 		// Unknown user control
-		print_libwebcam_error(
+		log_message(CL_WARNING, dev->v4l2_name,
 			"Unknown V4L2 user control ID encountered: 0x%08X (V4L2_CID_USER_BASE + %d)",
 			v4l2_id, v4l2_id - V4L2_CID_USER_BASE
 		);
@@ -1869,7 +2969,7 @@ static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev)
 	}
 	else if(V4L2_CTRL_ID2CLASS(v4l2_id) == V4L2_CTRL_CLASS_MPEG) {
 		// Unknown MPEG control
-		print_libwebcam_error(
+		log_message(CL_WARNING, dev->v4l2_name,
 			"Unknown V4L2 MPEG control ID encountered: 0x%08X (V4L2_CID_MPEG_BASE + %d)",
 			v4l2_id, v4l2_id - V4L2_CID_MPEG_BASE
 		);
@@ -1877,7 +2977,7 @@ static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev)
 	}
 	else if(V4L2_CTRL_ID2CLASS(v4l2_id) == V4L2_CTRL_CLASS_CAMERA) {
 		// Unknown camera class (UVC) control
-		print_libwebcam_error(
+		log_message(CL_WARNING, dev->v4l2_name,
 			"Unknown V4L2 camera class (UVC) control ID encountered: 0x%08X (V4L2_CID_CAMERA_CLASS_BASE + %d)",
 			v4l2_id, v4l2_id - V4L2_CID_CAMERA_CLASS_BASE
 		);
@@ -1885,14 +2985,14 @@ static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev)
 	}
 	else if(v4l2_id >= V4L2_CID_PRIVATE_BASE) {
 		// Unknown private control
-		print_libwebcam_error(
+		log_message(CL_WARNING, dev->v4l2_name,
 			"Unknown V4L2 private control ID encountered: 0x%08X (V4L2_CID_PRIVATE_BASE + %d)",
 			v4l2_id, v4l2_id - V4L2_CID_PRIVATE_BASE
 		);
 		return CC_V4L2_CUSTOM_BASE + (v4l2_id - V4L2_CID_PRIVATE_BASE);
 	}
 
-	print_libwebcam_error("Unknown V4L2 control ID encountered: 0x%08X", v4l2_id);
+	log_message(CL_WARNING, dev->v4l2_name, "Unknown V4L2 control ID encountered: 0x%08X", v4l2_id);
 	return 0;
 }
 
@@ -1902,7 +3002,30 @@ static CControlId get_control_id_from_v4l2 (int v4l2_id, Device *dev)
  */
 
 /**
- * Allocate a new device with the given name and add it to the global device list.
+ * Locks the device list.
+ *
+ * The event thread adds devices while application threads look at the list, so this
+ * lock is taken even if #DISABLE_LOCKING is set.
+ */
+static CResult lock_device_list (void)
+{
+	return pthread_mutex_lock(&device_list.mutex) ? C_SYNC_ERROR : C_SUCCESS;
+}
+
+
+/**
+ * Unlocks the device list.
+ */
+static void unlock_device_list (void)
+{
+	pthread_mutex_unlock(&device_list.mutex);
+}
+
+
+/**
+ * Allocate a new device with the given name.
+ *
+ * The device is not visible to other threads until it is passed to add_device().
  */
 static Device *create_device (char *name)
 {
@@ -1913,18 +3036,33 @@ static Device *create_device (char *name)
 		memset(dev, 0, sizeof(*dev));
 		strcpy(dev->v4l2_name, name);
 		dev->device.shortName = strdup(name);
+		dev->stats = get_device_stats(name);
 		dev->valid = 1;
-
-		// Add the new device to the global device list
-		dev->next = device_list.first;
-		device_list.first = dev;
-		device_list.count++;
+		pthread_mutex_init(&dev->controls.mutex, NULL);
+		PROBE1(device__add, dev->v4l2_name);
 	}
 
 	return dev;
 }
 
 
+/**
+ * Add a device to the global device list.
+ *
+ * Threads that walk the list without holding the lock see either the complete
+ * device or none at all.
+ *
+ * Note: The device list must be locked before calling this function.
+ */
+static void add_device (Device *dev)
+{
+	dev->next = device_list.first;
+	__sync_synchronize();
+	device_list.first = dev;
+	device_list.count++;
+}
+
+
 /**
  * Free up the given device.
  *
@@ -1932,6 +3070,8 @@ static Device *create_device (char *name)
  */
 static void delete_device (Device *dev)
 {
+	PROBE1(device__remove, dev->v4l2_name);
+
 	// Free all the handles that point to this device
 	lock_mutex(&handle_list.mutex);
 	if(dev->handles > 0) {
@@ -1948,6 +3088,7 @@ static void delete_device (Device *dev)
 
 	// Free all controls of this device
 	clear_control_list(dev);
+	pthread_mutex_destroy(&dev->controls.mutex);
 
 	if(dev->device.shortName)
 		free(dev->device.shortName);
@@ -2006,12 +3147,15 @@ static void cleanup_device_list (void)
 
 /**
  * Searches the device list for the device with the given name.
+ *
+ * Devices that were removed from the system are skipped, so a device that was
+ * plugged in again is found under its new entry.
  */
 static Device *find_device_by_name (const char *name)
 {
 	Device *elem = device_list.first;
 	while(elem) {
-		if(strcmp(name, elem->v4l2_name) == 0)
+		if(!elem->removed && strcmp(name, elem->v4l2_name) == 0)
 			return elem;
 		elem = elem->next;
 	}
@@ -2019,6 +3163,93 @@ static Device *find_device_by_name (const char *name)
 }
 
 
+/**
+ * Updates the control list of a device after its controls changed, e.g. because
+ * dynamic controls were added to the driver.
+ *
+ * Only new and changed controls are queried, see update_control_list(). If the device
+ * has event subscribers, they receive the events of the new controls, too.
+ *
+ * @param v4l2_name	Short V4L2 device name (e.g. 'video0')
+ * @param v4l2_dev	Open V4L2 device handle.
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_NOT_FOUND if the device is not in the device list (yet)
+ * 		- the error of update_control_list() otherwise
+ */
+CResult update_device_controls (const char *v4l2_name, int v4l2_dev)
+{
+	CResult ret = C_NOT_FOUND;
+
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(lock_device_list())
+		return C_SYNC_ERROR;
+	Device *dev = find_device_by_name(v4l2_name);
+	if(dev)
+		ret = update_control_list(dev, v4l2_dev);
+	unlock_device_list();
+
+	// Deliver the events of new controls to the existing subscribers
+	if(dev)
+		update_event_source(dev);
+	return ret;
+}
+
+
+/**
+ * Queries a single control of a device again, e.g. after the driver reported that
+ * its range or flags changed.
+ *
+ * If the control cannot be updated in place, e.g. because its menu range changed, the
+ * control list is brought up to date with update_control_list().
+ *
+ * @param v4l2_name	Short V4L2 device name (e.g. 'video0')
+ * @param v4l2_dev	Open V4L2 device handle.
+ * @param v4l2_id	V4L2 ID of the control
+ * @return
+ * 		- #C_SUCCESS on success
+ * 		- #C_NOT_FOUND if the device or the control is not known
+ * 		- #C_V4L2_ERROR if the control could not be queried
+ * 		- the error of update_control_list() otherwise
+ */
+CResult update_device_control (const char *v4l2_name, int v4l2_dev, unsigned int v4l2_id)
+{
+	CResult ret = C_NOT_FOUND;
+	struct v4l2_queryctrl v4l2_ctrl = { .id = v4l2_id };
+
+	if(!initialized)
+		return C_INIT_ERROR;
+	if(lock_device_list())
+		return C_SYNC_ERROR;
+	Device *dev = find_device_by_name(v4l2_name);
+	if(!dev)
+		goto done;
+	if(lock_control_list(dev)) {
+		ret = C_SYNC_ERROR;
+		goto done;
+	}
+	Control *elem;
+	for(elem = dev->controls.first; elem; elem = elem->next) {
+		if(elem->v4l2_control == v4l2_id)
+			break;
+	}
+	if(elem) {
+		if(device_ioctl(dev->stats, v4l2_dev, VIDIOC_QUERYCTRL, &v4l2_ctrl))
+			ret = C_V4L2_ERROR;
+		else
+			ret = update_control(elem, &v4l2_ctrl);
+	}
+	unlock_control_list(dev);
+	if(ret == C_PARSE_ERROR)
+		ret = update_control_list(dev, v4l2_dev);
+
+done:
+	unlock_device_list();
+	return ret;
+}
+
+
 /**
  * Returns the length required to store all the (null-terminated) strings of the
  * given device in a buffer.
@@ -2056,10 +3287,10 @@ static int get_devices_dynamics_length (void)
 static CResult refresh_device_list (void)
 {
 	CResult ret = C_SUCCESS;
-	DIR *v4l_dir = NULL;
-	struct dirent *dir_entry;
+	struct dirent **entries = NULL;
+	int entry_count, i;
 
-	if(lock_mutex(&device_list.mutex))
+	if(lock_device_list())
 		return C_SYNC_ERROR;
 
 	// Invalidate all list entries
@@ -2067,9 +3298,11 @@ static CResult refresh_device_list (void)
 
 	// Go through all devices in sysfs and validate the list entries that have
 	// correspondences in sysfs.
-	v4l_dir = opendir("/sys/class/video4linux");
-	if(v4l_dir) {
-		while((dir_entry = readdir(v4l_dir))) {
+	entry_count = backend_scandir("/sys/class/video4linux", &entries, NULL, NULL);
+	if(entry_count > 0) {
+		for(i = 0; i < entry_count; i++) {
+			struct dirent *dir_entry = entries[i];
+
 			// Ignore non-video devices
 			if(strstr(dir_entry->d_name, "video") != dir_entry->d_name)
 				continue;
@@ -2084,6 +3317,7 @@ static CResult refresh_device_list (void)
 					ret = C_NO_MEMORY;
 					goto done;
 				}
+				add_device(dev);
 
 				// Read detail information about the device
 				ret = refresh_device_details(dev);
@@ -2096,8 +3330,8 @@ static CResult refresh_device_list (void)
 					// continues. This is necessary because V4L1 devices will let
 					// refresh_device_details fail as they don't understand VIDIOC_QUERYCAP.
 					if(ret == C_V4L2_ERROR) {
-						print_libwebcam_error(
-								"Warning: The driver behind device %s does not seem to support V4L2.",
+						log_message(CL_WARNING, dev->v4l2_name,
+								"The driver behind device %s does not seem to support V4L2.",
 								dev->v4l2_name);
 						ret = C_SUCCESS;
 						continue;
@@ -2117,15 +3351,92 @@ static CResult refresh_device_list (void)
 	cleanup_device_list();
 
 done:
-	if(v4l_dir)
-		closedir(v4l_dir);
-	unlock_mutex(&device_list.mutex);
+	if(entry_count > 0) {
+		for(i = 0; i < entry_count; i++)
+			free(entries[i]);
+		free(entries);
+	}
+	unlock_device_list();
 	if(ret)
 		print_libwebcam_c_error(ret, "Unable to refresh device list.");
 	return ret;
 }
 
 
+/**
+ * Checks whether sysfs lists a video device with the given name.
+ */
+static int is_device_present (const char *v4l2_name)
+{
+	struct dirent **entries = NULL;
+	int entry_count, i, present = 0;
+
+	entry_count = backend_scandir("/sys/class/video4linux", &entries, NULL, NULL);
+	for(i = 0; i < entry_count; i++) {
+		if(strcmp(entries[i]->d_name, v4l2_name) == 0)
+			present = 1;
+		free(entries[i]);
+	}
+	if(entry_count > 0)
+		free(entries);
+	return present;
+}
+
+
+/**
+ * Brings a single entry of the device list up to date after a device was added to or
+ * removed from the system.
+ *
+ * Unlike refresh_device_list(), this function only looks at the given device. If the
+ * device is gone, its handles become invalid right away.
+ *
+ * This function runs on the event thread. A new device is only added to the list
+ * once it is complete. A device that is gone is only marked as removed, because
+ * application threads may still be using it. The next refresh_device_list() frees it.
+ *
+ * @param v4l2_name	Short V4L2 device name (e.g. 'video0')
+ * @return
+ * 		- 1 if the device was added to the list
+ * 		- -1 if the device was removed from the list
+ * 		- 0 if the list did not change
+ */
+int update_device (const char *v4l2_name)
+{
+	int change = 0;
+
+	if(!initialized || strstr(v4l2_name, "video") != v4l2_name || strlen(v4l2_name) >= NAME_MAX)
+		return 0;
+	if(lock_device_list())
+		return 0;
+
+	int present = is_device_present(v4l2_name);
+	Device *dev = find_device_by_name(v4l2_name);
+	if(present && !dev) {
+		dev = create_device((char *)v4l2_name);
+		if(dev == NULL)
+			goto done;
+		if(refresh_device_details(dev) == C_SUCCESS) {
+			get_device_usb_info(dev, &dev->device.usb);
+			if(refresh_control_list(dev) == C_SUCCESS)
+				change = 1;
+		}
+		if(change)
+			add_device(dev);
+		else
+			delete_device(dev);
+	}
+	else if(!present && dev) {
+		dev->valid = 0;
+		dev->removed = 1;
+		change = -1;
+	}
+
+done:
+	unlock_device_list();
+	return change;
+}
+
+
 /**
  * Open the V4L2 device node with the given name.
  *
@@ -2147,12 +3458,246 @@ int open_v4l2_device(char *device_name)
 	if(!dev_node)
 		return 0;
 	sprintf(dev_node, "/dev/%s", device_name);
-	v4l2_dev = open(dev_node, 0);
+	v4l2_dev = backend_open(dev_node, 0);
 	free(dev_node);
 	return v4l2_dev;
 }
 
 
+/**
+ * Looks up the request statistics of a device.
+ *
+ * @param v4l2_name	Short V4L2 device name (e.g. 'video0')
+ * @param create	If non-zero, a new entry is created if the device has none yet.
+ *
+ * @return
+ * 		- NULL if the device has no statistics and none could be created
+ * 		- a pointer to the statistics of the device otherwise
+ */
+static DeviceStats *lookup_device_stats (const char *v4l2_name, int create)
+{
+	DeviceStats *stats = NULL;
+	int i;
+
+	if(v4l2_name == NULL || !*v4l2_name)
+		return NULL;
+
+	pthread_mutex_lock(&device_stats_mutex);
+	for(i = 0; i < MAX_STATS_DEVICES && device_stats_list[i]; i++) {
+		if(strcmp(device_stats_list[i]->v4l2_name, v4l2_name) == 0) {
+			stats = device_stats_list[i];
+			goto done;
+		}
+	}
+	if(!create || i == MAX_STATS_DEVICES)
+		goto done;
+
+	stats = (DeviceStats *)calloc(1, sizeof(*stats));
+	if(stats) {
+		strncpy(stats->v4l2_name, v4l2_name, NAME_MAX - 1);
+		device_stats_list[i] = stats;
+	}
+
+done:
+	pthread_mutex_unlock(&device_stats_mutex);
+	return stats;
+}
+
+
+/**
+ * Returns the request statistics of a device and creates them if necessary.
+ *
+ * The returned pointer stays valid for the lifetime of the process.
+ *
+ * @param v4l2_name	Short V4L2 device name (e.g. 'video0')
+ *
+ * @return
+ * 		- NULL if the statistics table is full or out of memory
+ * 		- a pointer to the statistics of the device otherwise
+ */
+DeviceStats *get_device_stats (const char *v4l2_name)
+{
+	return lookup_device_stats(v4l2_name, 1);
+}
+
+
+/**
+ * Maps an ioctl request code to the request type under which it is counted.
+ */
+static CRequestType get_request_type (unsigned long request)
+{
+	switch(request) {
+		case VIDIOC_QUERYCAP:			return CR_QUERYCAP;
+		case VIDIOC_QUERYCTRL:			return CR_QUERYCTRL;
+		case VIDIOC_QUERYMENU:			return CR_QUERYMENU;
+		case VIDIOC_G_CTRL:				return CR_G_CTRL;
+		case VIDIOC_S_CTRL:				return CR_S_CTRL;
+		case VIDIOC_G_EXT_CTRLS:		return CR_G_EXT_CTRLS;
+		case VIDIOC_S_EXT_CTRLS:		return CR_S_EXT_CTRLS;
+		case VIDIOC_ENUM_FMT:			return CR_ENUM_FMT;
+		case VIDIOC_ENUM_FRAMESIZES:	return CR_ENUM_FRAMESIZES;
+		case VIDIOC_ENUM_FRAMEINTERVALS:return CR_ENUM_FRAMEINTERVALS;
+#ifdef V4L2_EVENT_CTRL
+		case VIDIOC_SUBSCRIBE_EVENT:	return CR_SUBSCRIBE_EVENT;
+		case VIDIOC_UNSUBSCRIBE_EVENT:	return CR_UNSUBSCRIBE_EVENT;
+		case VIDIOC_DQEVENT:			return CR_DQEVENT;
+#endif
+#ifdef UVCIOC_CTRL_MAP
+		case UVCIOC_CTRL_MAP:			return CR_CTRL_MAP;
+#endif
+		default:						return CR_OTHER;
+	}
+}
+
+
+/**
+ * Extracts the control ID and value from the argument of a control request.
+ */
+static void get_request_control (CRequestType type, void *arg, unsigned int *id, int *value)
+{
+	switch(type) {
+		case CR_QUERYCTRL:
+			*id		= ((struct v4l2_queryctrl *)arg)->id;
+			break;
+		case CR_QUERYMENU:
+			*id		= ((struct v4l2_querymenu *)arg)->id;
+			*value	= ((struct v4l2_querymenu *)arg)->index;
+			break;
+		case CR_G_CTRL:
+		case CR_S_CTRL:
+			*id		= ((struct v4l2_control *)arg)->id;
+			*value	= ((struct v4l2_control *)arg)->value;
+			break;
+		case CR_G_EXT_CTRLS:
+		case CR_S_EXT_CTRLS: {
+			// Only the first control of the request is recorded
+			struct v4l2_ext_controls *ctrls = (struct v4l2_ext_controls *)arg;
+			if(ctrls->count && ctrls->controls) {
+				*id		= ctrls->controls[0].id;
+				*value	= ctrls->controls[0].value;
+			}
+			break;
+		}
+#ifdef V4L2_EVENT_CTRL
+		case CR_SUBSCRIBE_EVENT:
+		case CR_UNSUBSCRIBE_EVENT:
+			*id		= ((struct v4l2_event_subscription *)arg)->id;
+			break;
+		case CR_DQEVENT: {
+			struct v4l2_event *event = (struct v4l2_event *)arg;
+			if(event->type == V4L2_EVENT_CTRL) {
+				*id		= event->id;
+				*value	= event->u.ctrl.value;
+			}
+			break;
+		}
+#endif
+#ifdef UVCIOC_CTRL_MAP
+		case CR_CTRL_MAP:
+			*id		= ((struct uvc_xu_control_mapping *)arg)->id;
+			break;
+#endif
+		default:
+			break;
+	}
+}
+
+
+/**
+ * Records a request in the trace ring of a device.
+ *
+ * The slot is reserved with a single atomic increment. Readers skip slots whose
+ * sequence number changes while they copy them, so no lock is needed.
+ */
+static void record_trace (TraceRing *ring, CRequestType type, unsigned long request,
+		void *arg, int error, const struct timespec *start, unsigned long long duration)
+{
+	unsigned int sequence = __sync_fetch_and_add(&ring->head, 1);
+	TraceSlot *slot = &ring->slots[sequence % C_TRACE_ENTRIES];
+
+	__atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->entry.type		= type;
+	slot->entry.request		= request;
+	slot->entry.control_id	= 0;
+	slot->entry.value		= 0;
+	slot->entry.error		= error;
+	slot->entry.timestamp	= (unsigned long long)start->tv_sec * 1000000000ULL + start->tv_nsec;
+	slot->entry.duration	= duration;
+	if(type != CR_OTHER && arg)
+		get_request_control(type, arg, &slot->entry.control_id, &slot->entry.value);
+
+	__atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Sends a request to a device and records its duration and result.
+ *
+ * The request is counted in the statistics and added to the trace of the device.
+ * This is a drop-in replacement for ioctl() on device file descriptors. errno is
+ * preserved, so the caller can evaluate it as usual. The ioctl__start and ioctl__done
+ * probes fire around the request.
+ *
+ * @param stats		Statistics to update. If NULL, the request is only sent.
+ * @param fd		Device file descriptor
+ * @param request	ioctl request code
+ * @param arg		ioctl argument
+ *
+ * @return
+ * 		- the return value of the ioctl
+ */
+int device_ioctl (DeviceStats *stats, int fd, unsigned long request, void *arg)
+{
+	struct timespec start, end;
+	int ret, error;
+
+	if(stats == NULL) {
+		PROBE3(ioctl__start, NULL, fd, request);
+		ret = backend_ioctl(fd, request, arg);
+		PROBE5(ioctl__done, NULL, fd, request, ret, ret ? errno : 0);
+		return ret;
+	}
+
+	PROBE3(ioctl__start, stats->v4l2_name, fd, request);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = backend_ioctl(fd, request, arg);
+	error = errno;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	PROBE5(ioctl__done, stats->v4l2_name, fd, request, ret, ret ? error : 0);
+
+	CRequestType type = get_request_type(request);
+	CRequestStats *rs = &stats->stats.requests[type];
+	unsigned long long ns = (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL
+			+ end.tv_nsec - start.tv_nsec;
+	unsigned long long us = ns / 1000;
+	unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+	if(bucket >= C_STATS_LATENCY_BUCKETS)
+		bucket = C_STATS_LATENCY_BUCKETS - 1;
+
+	__sync_fetch_and_add(&rs->count, 1);
+	__sync_fetch_and_add(&rs->total_time, ns);
+	__sync_fetch_and_add(&rs->latency[bucket], 1);
+	unsigned long long max = rs->max_time;
+	while(ns > max) {
+		unsigned long long prev = __sync_val_compare_and_swap(&rs->max_time, max, ns);
+		if(prev == max)
+			break;
+		max = prev;
+	}
+	if(ret) {
+		__sync_fetch_and_add(&rs->errors, 1);
+		__sync_fetch_and_add(&rs->error_codes[
+				error >= 0 && error < C_STATS_ERROR_CODES ? error : C_STATS_ERROR_CODES - 1], 1);
+	}
+	record_trace(&stats->trace, type, request, arg, ret ? error : 0, &start, ns);
+
+	errno = error;
+	return ret;
+}
+
+
 /**
  * Retrieves the value of a given V4L2 control.
  */
@@ -2163,19 +3708,20 @@ static CResult read_v4l2_control(Device *device, Control *control, CControlValue
 	if(device == NULL || control == NULL || value == NULL)
 		return C_INVALID_ARG;
 
+#ifdef ENABLE_RAW_CONTROLS
+	if(control->control.type == CC_TYPE_RAW &&
+	   (value->raw.data == NULL || value->raw.size < control->control.max.raw.size))
+		return C_INVALID_ARG;
+#endif
+
 	int v4l2_dev = open_v4l2_device(device->v4l2_name);
-	if(!v4l2_dev)
+	if(v4l2_dev <= 0)
 		return C_INVALID_DEVICE;
 
 #ifdef ENABLE_RAW_CONTROLS
 	if(control->control.type == CC_TYPE_RAW) {
 		unsigned int ctrl_size = control->control.max.raw.size;
 
-		if(value->raw.data == NULL)
-			return C_INVALID_ARG;
-		if(value->raw.size < ctrl_size)
-			return C_INVALID_ARG;
-
 		struct v4l2_ext_control v4l2_ext_ctrl = {
 			.id		= control->v4l2_control,
 			.size	= ctrl_size,
@@ -2186,7 +3732,7 @@ static CResult read_v4l2_control(Device *device, Control *control, CControlValue
 			.count		= 1,
 			.controls	= &v4l2_ext_ctrl
 		};
-		if(ioctl(v4l2_dev, VIDIOC_G_EXT_CTRLS, &v4l2_ext_ctrls)) {
+		if(device_ioctl(device->stats, v4l2_dev, VIDIOC_G_EXT_CTRLS, &v4l2_ext_ctrls)) {
 			ret = C_V4L2_ERROR;
 			set_last_error(hDevice, errno);
 			goto done;
@@ -2199,7 +3745,7 @@ static CResult read_v4l2_control(Device *device, Control *control, CControlValue
 #endif
 	{
 		struct v4l2_control v4l2_ctrl = { .id = control->v4l2_control };
-		if(ioctl(v4l2_dev, VIDIOC_G_CTRL, &v4l2_ctrl)) {
+		if(device_ioctl(device->stats, v4l2_dev, VIDIOC_G_CTRL, &v4l2_ctrl)) {
 			ret = C_V4L2_ERROR;
 			set_last_error(hDevice, errno);
 			goto done;
@@ -2210,7 +3756,7 @@ static CResult read_v4l2_control(Device *device, Control *control, CControlValue
 	value->type		= control->control.type;
 
 done:
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 	return ret;
 }
 
@@ -2225,19 +3771,20 @@ static CResult write_v4l2_control(Device *device, Control *control, const CContr
 	if(device == NULL || control == NULL || value == NULL)
 		return C_INVALID_ARG;
 
+#ifdef ENABLE_RAW_CONTROLS
+	if(control->control.type == CC_TYPE_RAW &&
+	   (value->raw.data == NULL || value->raw.size < control->control.max.raw.size))
+		return C_INVALID_ARG;
+#endif
+
 	int v4l2_dev = open_v4l2_device(device->v4l2_name);
-	if(!v4l2_dev)
+	if(v4l2_dev <= 0)
 		return C_INVALID_DEVICE;
 
 #ifdef ENABLE_RAW_CONTROLS
 	if(control->control.type == CC_TYPE_RAW) {
 		unsigned int ctrl_size = control->control.max.raw.size;
 
-		if(value->raw.data == NULL)
-			return C_INVALID_ARG;
-		if(value->raw.size < ctrl_size)
-			return C_INVALID_ARG;
-
 		struct v4l2_ext_control v4l2_ext_ctrl = {
 			.id		= control->v4l2_control,
 			.size	= ctrl_size,
@@ -2248,7 +3795,7 @@ static CResult write_v4l2_control(Device *device, Control *control, const CContr
 			.count		= 1,
 			.controls	= &v4l2_ext_ctrl
 		};
-		if(ioctl(v4l2_dev, VIDIOC_S_EXT_CTRLS, &v4l2_ext_ctrls)) {
+		if(device_ioctl(device->stats, v4l2_dev, VIDIOC_S_EXT_CTRLS, &v4l2_ext_ctrls)) {
 			ret = C_V4L2_ERROR;
 			set_last_error(hDevice, errno);
 			goto done;
@@ -2261,7 +3808,7 @@ static CResult write_v4l2_control(Device *device, Control *control, const CContr
 			.id		= control->v4l2_control,
 			.value	= value->value
 		};
-		if(ioctl(v4l2_dev, VIDIOC_S_CTRL, &v4l2_ctrl)) {
+		if(device_ioctl(device->stats, v4l2_dev, VIDIOC_S_CTRL, &v4l2_ctrl)) {
 			ret = C_V4L2_ERROR;
 			set_last_error(hDevice, errno);
 		}
@@ -2270,7 +3817,7 @@ static CResult write_v4l2_control(Device *device, Control *control, const CContr
 #ifdef ENABLE_RAW_CONTROLS
 done:
 #endif
-	close(v4l2_dev);
+	backend_close(v4l2_dev);
 	return ret;
 }
 
@@ -2280,7 +3827,23 @@ done:
  */
 static CResult get_device_usb_info (Device *device, CUSBInfo *usbinfo)
 {
-	if(device == NULL || usbinfo == NULL)
+	if(device == NULL)
+		return C_INVALID_ARG;
+
+	return get_v4l2_device_usb_info(device->v4l2_name, usbinfo);
+}
+
+
+/**
+ * Reads the USB information for the V4L2 device with the given short name (e.g. 'video0')
+ * into the given #CUSBInfo structure.
+ *
+ * The information is read from sysfs, so this works for devices that are not part of
+ * the device list as well. Fields that cannot be read are set to 0.
+ */
+CResult get_v4l2_device_usb_info (const char *v4l2_name, CUSBInfo *usbinfo)
+{
+	if(v4l2_name == NULL || usbinfo == NULL)
 		return C_INVALID_ARG;
 
 	// File names in the /sys/class/video4linux/video?/device directory and
@@ -2296,22 +3859,30 @@ static CResult get_device_usb_info (Device *device, CUSBInfo *usbinfo)
 		&usbinfo->release
 	};
 
-	// Read USB information
-	int i;
+	// Read USB information. Depending on the kernel version the device link points to
+	// the USB device or to the video interface, in which case the files can be found in
+	// the parent directory.
+	char *paths[] = {
+		"/sys/class/video4linux/%s/device/%s",
+		"/sys/class/video4linux/%s/device/../%s"
+	};
+	int i, p;
 	for(i = 0; i < 3; i++) {
-		char *filename = NULL;
-		if(asprintf(&filename, "/sys/class/video4linux/%s/device/%s",
-					device->v4l2_name, files[i]) < 0)
-			return C_NO_MEMORY;
-
-		FILE *input = fopen(filename, "r");
-		if(input) {
-			if(fscanf(input, "%hx", fields[i]) != 1)
-				*fields[i] = 0;
-			fclose(input);
+		*fields[i] = 0;
+		for(p = 0; p < 2; p++) {
+			char *filename = NULL;
+			if(asprintf(&filename, paths[p], v4l2_name, files[i]) < 0)
+				return C_NO_MEMORY;
+
+			FILE *input = backend_fopen(filename, "r");
+			free(filename);
+			if(input) {
+				if(fscanf(input, "%hx", fields[i]) != 1)
+					*fields[i] = 0;
+				fclose(input);
+				break;
+			}
 		}
-
-		free(filename);
 	}
 
 	return C_SUCCESS;
@@ -2395,6 +3966,7 @@ static CHandle create_handle(Device *device)
 		handle_list.first_free = 0;		// No free handles left
 
 	unlock_mutex(&handle_list.mutex);
+	PROBE2(handle__open, handle, device->v4l2_name);
 	return handle;
 }
 
@@ -2407,15 +3979,19 @@ static void close_handle(CHandle hDevice)
 	if(!HANDLE_OPEN(hDevice))
 		return;
 
-	// If the handle is open, close it. If it is also valid, remove the device reference.
-	if(HANDLE_VALID(hDevice)) {
+	// If the handle is open, close it. If it still points to a device (which may have
+	// been removed from the system), remove the device reference.
+	if(GET_HANDLE(hDevice).device) {
 		lock_mutex(&handle_list.mutex);
-		GET_HANDLE(hDevice).device->handles--;
+		Device *device = GET_HANDLE(hDevice).device;
+		PROBE2(handle__close, hDevice, device->v4l2_name);
+		device->handles--;
 		GET_HANDLE(hDevice).device = NULL;
 		GET_HANDLE(hDevice).open = 0;
 		unlock_mutex(&handle_list.mutex);
 	}
 	else {
+		PROBE2(handle__close, hDevice, NULL);
 		GET_HANDLE(hDevice).open = 0;
 	}
 	GET_HANDLE(hDevice).last_system_error = 0;
@@ -2437,6 +4013,37 @@ static void set_last_error(CHandle hDevice, int error)
  * Initialization and cleanup
  */
 
+/**
+ * Selects the fake backend if the LIBWEBCAM_FAKE environment variable names a device
+ * script. If the script cannot be loaded, the fake backend simulates a system without
+ * devices, so that a broken script never lets the library touch real devices.
+ * The variable is ignored in setuid and setgid programs, so that it cannot make them
+ * read files on behalf of the user.
+ */
+static void select_backend (void)
+{
+	const char *script = secure_getenv("LIBWEBCAM_FAKE");
+	if(!script || !*script)
+		return;
+
+	if(fake_load(script))
+		print_libwebcam_error("Unable to load fake devices from '%s'. No devices will be available.",
+				script);
+	backend_type = BACKEND_FAKE;
+}
+
+
+/**
+ * Selects the implementation used to access devices.
+ * This function is called before the first device is accessed and can be called any
+ * number of times.
+ */
+void init_backend (void)
+{
+	pthread_once(&backend_init_once, select_backend);
+}
+
+
 /**
  * Initializes libwebcam.
  * This method must be called prior to using most of the other methods.
@@ -2451,6 +4058,9 @@ CResult c_init(void)
 	if(initialized)
 		return C_SUCCESS;
 
+	init_backend();
+	init_log();
+
 	// Initialize the handle list
 	memset(&handle_list, 0, sizeof(handle_list));
 	handle_list.first_free = 1;
@@ -2476,18 +4086,27 @@ CResult c_init(void)
  */
 void c_cleanup(void)
 {
-	if(!initialized)
+	if(!initialized) {
+		// The dynctrl functions can log without c_init()
+		flush_log();
 		return;
+	}
 	initialized = 0;
 
+	// Stop the event delivery before the devices go away
+	stop_event_dispatcher();
+
 	// Clear the device list
-	lock_mutex(&device_list.mutex);
+	lock_device_list();
 	invalidate_device_list();
 	cleanup_device_list();
-	unlock_mutex(&device_list.mutex);
+	unlock_device_list();
 
 	pthread_mutex_destroy(&device_list.mutex);
 	pthread_mutex_destroy(&handle_list.mutex);
+
+	// Write out the messages that are still queued
+	flush_log();
 }
 
 
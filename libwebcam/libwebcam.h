@@ -29,6 +29,13 @@
 
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 
 
 /*
@@ -70,9 +77,32 @@
 /// instead of per-device controls.
 #define DYNCTRL_IGNORE_EEXIST_AFTER_PASS1
 
+/// The maximum number of threads used to add dynamic controls to multiple devices
+/// in parallel
+#define DYNCTRL_MAX_WORKERS				8
+
 /// The maximum number (plus 1) of handles libwebcam supports
 #define	MAX_HANDLES						32
 
+/// The maximum number of devices for which request statistics are kept
+#define	MAX_STATS_DEVICES				64
+
+/// The maximum length of a log message (longer messages are truncated)
+#define	LOG_MESSAGE_MAX					512
+/// The number of log messages that the default log sink buffers
+#define	LOG_QUEUE_SIZE					64
+/// The number of messages logged from the same place before rate limiting starts
+#define	LOG_RATE_BURST					5
+/// The interval in seconds after which rate limiting starts over
+#define	LOG_RATE_INTERVAL				60
+
+/// The maximum number of events that are taken from a device at once
+#define	EVENT_BATCH_SIZE				32
+/// The maximum number of ready descriptors that are handled per epoll_wait() call
+#define	EVENT_READY_SIZE				16
+/// Size of the buffer used to receive uevents
+#define	UEVENT_BUFFER_SIZE				4096
+
 /// Debug option to disable locking
 #define	DISABLE_LOCKING					1
 /// Debug option to add verbosity to locking and unlocking
@@ -80,6 +110,9 @@
 
 /// The name used for controls whose name could not be retrieved.
 #define	UNKNOWN_CONTROL_NAME			"Unknown control"
+/// V4L2 control flags that reflect the device state rather than the control
+/// description and are therefore ignored when looking for changed controls
+#define	V4L2_CTRL_STATE_FLAGS			(V4L2_CTRL_FLAG_GRABBED | V4L2_CTRL_FLAG_INACTIVE)
 /// Number of retries for failed V4L2 ioctl requests.
 /// This is a workaround for faulty devices.
 #define	CONTROL_IO_ERROR_RETRIES		2
@@ -93,12 +126,16 @@
  * Macros
  */
 
+/// Returns the number of elements in a static array
+#define ARRAY_SIZE(a)			(sizeof(a) / sizeof((a)[0]))
+
 /// Returns the given handle structure
 #define GET_HANDLE(handle)		(handle_list.handles[(handle)])
 /// Returns true if the given handle is open (valid or invalid)
 #define HANDLE_OPEN(handle)		((handle) < MAX_HANDLES && GET_HANDLE(handle).open)
 /// Returns true if the given handle is open and valid
-#define HANDLE_VALID(handle)	(HANDLE_OPEN(handle) && GET_HANDLE(handle).device)
+#define HANDLE_VALID(handle)	(HANDLE_OPEN(handle) && GET_HANDLE(handle).device && \
+								 !GET_HANDLE(handle).device->removed)
 
 /// Returns the maximum number of characters that a menu-type control choice
 /// can have in V4L2.
@@ -125,6 +162,21 @@
  * Structures
  */
 
+/**
+ * The parts of a V4L2 control description (struct v4l2_queryctrl) that are compared
+ * to find out whether a control changed.
+ */
+typedef struct _V4L2ControlInfo {
+	unsigned int	type;
+	int				minimum;
+	int				maximum;
+	int				step;
+	int				default_value;
+	/// V4L2 control flags without the ones that change with the device state
+	unsigned int	flags;
+
+} V4L2ControlInfo;
+
 /**
  * An internal control description associated with a device.
  */
@@ -133,6 +185,8 @@ typedef struct _Control {
 	CControl		control;
 	/// V4L2 ioctl mapping (non-0 for V4L2 controls)
 	int				v4l2_control;
+	/// V4L2 control description that the control was created from
+	V4L2ControlInfo	v4l2_info;
 	/// Pointer to the next control in the list
 	struct _Control	* next;
 
@@ -144,13 +198,59 @@ typedef struct _Control {
 typedef struct _ControlList {
 	/// The first control in the list
 	Control			* first;
-	/// The mutex used to serialize access to the control list
+	/// The mutex used to serialize access to the control list. Unlike the other
+	/// mutexes, it is always used because the list is updated by other threads.
 	pthread_mutex_t mutex;
 	/// The number of controls contained in the list
 	int				count;
+	/// Number of threads that use controls of the list without holding the lock
+	int				users;
+	/// Controls that were taken out of the list while other threads used it. They are
+	/// freed as soon as @a users drops to 0.
+	Control			* retired;
 
 } ControlList;
 
+/**
+ * Slot in the trace ring of a device.
+ */
+typedef struct _TraceSlot {
+	/// Sequence number of the entry plus 1, or 0 while the entry is being written
+	unsigned int	sequence;
+	/// Recorded request (the @a sequence field is only set when the entry is read)
+	CTraceEntry		entry;
+
+} TraceSlot;
+
+/**
+ * Ring buffer of the most recent requests sent to a device.
+ * Writers reserve a slot by incrementing @a head atomically and mark the slot as
+ * incomplete while they fill it in, so that neither writers nor readers need a lock.
+ */
+typedef struct _TraceRing {
+	/// Number of requests recorded so far
+	unsigned int	head;
+	/// Recorded requests, the one with sequence number n is in slot n % #C_TRACE_ENTRIES
+	TraceSlot		slots[C_TRACE_ENTRIES];
+
+} TraceRing;
+
+/**
+ * Request statistics and trace of a device.
+ * The statistics are kept by device name for the lifetime of the process, so that they
+ * survive device list refreshes and include the requests sent by the dynctrl functions.
+ * The counters are updated with atomic operations.
+ */
+typedef struct _DeviceStats {
+	/// Short V4L2 device name (e.g. 'video0')
+	char			v4l2_name[NAME_MAX];
+	/// Counters
+	CDeviceStats	stats;
+	/// Most recent requests
+	TraceRing		trace;
+
+} DeviceStats;
+
 /**
  * Internal device information.
  */
@@ -163,9 +263,15 @@ typedef struct _Device {
 	int				handles;
 	/// List of controls supported by this device
 	ControlList		controls;
+	/// Request statistics of this device (NULL if they are not kept)
+	DeviceStats		* stats;
 	/// Boolean whether the device is still valid, i.e. exists in the system.
 	/// Devices marked as invalid will be cleared out by cleanup_device_list().
 	int				valid;
+	/// Boolean whether the event thread saw the device disappear. Its handles are
+	/// invalid, but the structure is only freed by the next refresh_device_list(),
+	/// because application threads may still be using it.
+	int				removed;
 	/// Next device in the global device list
 	struct _Device	* next;
 
@@ -177,7 +283,8 @@ typedef struct _Device {
 typedef struct _DeviceList {
 	/// The first device in the list
 	Device			* first;
-	/// The mutex used to serialize access to the device list
+	/// The mutex used to serialize changes to the device list. Unlike the other
+	/// mutexes, it is always used because the event thread adds devices.
 	pthread_mutex_t mutex;
 	/// The number of devices contained in the list
 	int				count;
@@ -229,7 +336,161 @@ extern int initialized;
 extern HandleList handle_list;
 
 extern void print_error (char *format, ...);
+extern void print_libwebcam_error (char *format, ...);
 extern int open_v4l2_device(char *device_name);
+extern DeviceStats *get_device_stats (const char *v4l2_name);
+extern int device_ioctl (DeviceStats *stats, int fd, unsigned long request, void *arg);
+extern int subscribe_control_event (DeviceStats *stats, int v4l2_dev, unsigned int v4l2_id,
+		int subscribe, int send_initial);
+extern CResult get_v4l2_device_usb_info (const char *v4l2_name, CUSBInfo *usbinfo);
+extern int update_device (const char *v4l2_name);
+extern CResult update_device_controls (const char *v4l2_name, int v4l2_dev);
+extern CResult update_device_control (const char *v4l2_name, int v4l2_dev, unsigned int v4l2_id);
+
+
+
+/*
+ * Device backend
+ *
+ * All access to devices and to their sysfs entries goes through the backend_* functions.
+ * The backend is selected once by init_backend(), so that the V4L2 path only costs a
+ * well-predicted branch instead of an indirect call per request.
+ */
+
+/// Implementation used to access devices
+typedef enum _BackendType {
+	/// Real V4L2 devices (default)
+	BACKEND_V4L2		= 0,
+	/// Simulated devices described by the script in the LIBWEBCAM_FAKE variable
+	BACKEND_FAKE,
+
+} BackendType;
+
+extern BackendType backend_type;
+extern void init_backend (void);
+
+extern CResult fake_load (const char *file_name);
+extern int fake_open (const char *path, int flags);
+extern int fake_close (int fd);
+extern int fake_ioctl (int fd, unsigned long request, void *arg);
+extern int fake_poll (struct pollfd *fds, nfds_t count, int timeout);
+extern int fake_event_fd (int fd);
+extern int fake_uevent_socket (void);
+extern int fake_scandir (const char *dir_name, struct dirent ***entries,
+		int (*filter)(const struct dirent *),
+		int (*compare)(const struct dirent **, const struct dirent **));
+extern FILE *fake_fopen (const char *path, const char *mode);
+
+#define USE_FAKE_BACKEND		__builtin_expect(backend_type == BACKEND_FAKE, 0)
+
+static inline int backend_open (const char *path, int flags)
+{
+	return USE_FAKE_BACKEND ? fake_open(path, flags) : open(path, flags);
+}
+
+static inline int backend_close (int fd)
+{
+	return USE_FAKE_BACKEND ? fake_close(fd) : close(fd);
+}
+
+static inline int backend_ioctl (int fd, unsigned long request, void *arg)
+{
+	return USE_FAKE_BACKEND ? fake_ioctl(fd, request, arg) : ioctl(fd, request, arg);
+}
+
+static inline int backend_poll (struct pollfd *fds, nfds_t count, int timeout)
+{
+	return USE_FAKE_BACKEND ? fake_poll(fds, count, timeout) : poll(fds, count, timeout);
+}
+
+/**
+ * Returns the descriptor that signals the pending events of an open device and the
+ * poll events to wait for. For V4L2 devices this is the device itself with POLLPRI.
+ */
+static inline int backend_event_fd (int fd, short *events)
+{
+	if(USE_FAKE_BACKEND) {
+		*events = POLLIN;
+		return fake_event_fd(fd);
+	}
+	*events = POLLPRI;
+	return fd;
+}
+
+static inline int backend_scandir (const char *dir_name, struct dirent ***entries,
+		int (*filter)(const struct dirent *),
+		int (*compare)(const struct dirent **, const struct dirent **))
+{
+	return USE_FAKE_BACKEND
+		? fake_scandir(dir_name, entries, filter, compare)
+		: scandir(dir_name, entries, filter, compare);
+}
+
+static inline FILE *backend_fopen (const char *path, const char *mode)
+{
+	return USE_FAKE_BACKEND ? fake_fopen(path, mode) : fopen(path, mode);
+}
+
+
+
+/*
+ * Logging
+ *
+ * All messages go through log_message(), which drops messages above the log level and
+ * limits how often the same message (i.e. the same format string) is logged. Messages
+ * are passed to the handler set with c_set_log_handler(). Without a handler, they are
+ * queued and written to stderr by a background thread, so that logging never blocks
+ * the caller.
+ */
+
+extern void log_message (CLogLevel level, const char *device, const char *format, ...)
+		__attribute__ ((format (printf, 3, 4)));
+extern void log_vmessage (CLogLevel level, const char *device, const char *format,
+		const char *suffix, va_list ap);
+extern void init_log (void);
+extern void flush_log (void);
+
+
+
+/*
+ * Events
+ *
+ * Control and hotplug events of all devices are delivered by a single thread of the
+ * library that is started with the first subscription (see events.c).
+ */
+
+extern void remove_event_subscriptions (CHandle hDevice);
+extern void update_event_source (Device *device);
+extern void stop_event_dispatcher (void);
+
+
+
+/*
+ * Tracing
+ *
+ * If the library is built with the ENABLE_USDT CMake option, the PROBEn macros define
+ * USDT probes of the 'libwebcam' provider that tools like bpftrace, perf, and SystemTap
+ * can attach to. A probe is a single nop instruction as long as no tracer is attached.
+ * Without the option, the macros expand to nothing.
+ */
+
+#ifdef ENABLE_USDT_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)					DTRACE_PROBE1(libwebcam, name, a)
+#define PROBE2(name, a, b)				DTRACE_PROBE2(libwebcam, name, a, b)
+#define PROBE3(name, a, b, c)			DTRACE_PROBE3(libwebcam, name, a, b, c)
+#define PROBE5(name, a, b, c, d, e)		DTRACE_PROBE5(libwebcam, name, a, b, c, d, e)
+
+#else
+
+#define PROBE1(name, a)					do { } while(0)
+#define PROBE2(name, a, b)				do { } while(0)
+#define PROBE3(name, a, b, c)			do { } while(0)
+#define PROBE5(name, a, b, c, d, e)		do { } while(0)
+
+#endif
 
 
 
@@ -292,6 +553,31 @@ static inline void unlock_mutex (pthread_mutex_t *mutex)
 }
 
 
+/**
+ * Locks the control list of a device.
+ *
+ * The event thread and the dynctrl functions update control lists while application
+ * threads read them, so this lock is taken even if #DISABLE_LOCKING is set.
+ *
+ * @return
+ * 		C_SUCCESS if the mutex was successfully acquired
+ * 		C_SYNC_ERROR if an error occured while trying to acquire the mutex
+ */
+static inline CResult lock_control_list (Device *device)
+{
+	return pthread_mutex_lock(&device->controls.mutex) ? C_SYNC_ERROR : C_SUCCESS;
+}
+
+
+/**
+ * Unlocks the control list of a device.
+ */
+static inline void unlock_control_list (Device *device)
+{
+	pthread_mutex_unlock(&device->controls.mutex);
+}
+
+
 /**
  * Copies a variable-length string to the part of an enumeration buffer that is
  * reserved for dynamic data.
@@ -0,0 +1,492 @@
+/**
+ * \file
+ * Logging.
+ *
+ * \ingroup libwebcam
+ */
+
+/*
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of libwebcam.
+ *
+ * libwebcam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libwebcam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwebcam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Messages are often logged while a device or the device list is locked, e.g. during
+ * control enumeration, so logging must neither block nor take long. log_message() only
+ * formats the message into a buffer on the stack and hands it to the sink:
+ *
+ * - If the application has set a handler with c_set_log_handler(), the handler is
+ *   called directly.
+ * - Otherwise the message is copied to a fixed-size queue and a background thread
+ *   writes it to stderr. If the queue is full, the message is dropped and counted.
+ *   Errors are written directly once the queue is empty, so that they are not lost
+ *   if the process exits without calling c_cleanup().
+ *
+ * Drivers with bugs can trigger the same message for every control or request. Each
+ * format string is therefore logged at most LOG_RATE_BURST times per LOG_RATE_INTERVAL
+ * seconds. The next message that gets through reports how many were suppressed. The
+ * default sink reports the remaining ones as a total when c_cleanup() flushes it. The
+ * dynctrl functions that work without c_init() flush it before they return.
+ *
+ * A forked child process writes its messages directly instead of starting a writer
+ * thread, because children often leave with _exit() and would lose the queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include "webcam.h"
+#include "libwebcam.h"
+
+
+/// The number of different messages whose rate is limited
+#define LOG_LIMIT_SLOTS		128
+
+
+/**
+ * Rate limiting state of a message.
+ */
+typedef struct _LogLimit {
+	/// Format string that identifies the message (NULL if the slot is free)
+	const char		* format;
+	/// Start of the current interval in seconds (CLOCK_MONOTONIC)
+	time_t			interval_start;
+	/// Number of messages logged in the current interval
+	unsigned int	count;
+	/// Number of messages suppressed since the last one was logged
+	unsigned int	suppressed;
+
+} LogLimit;
+
+/**
+ * Message in the queue of the default log sink.
+ */
+typedef struct _LogEntry {
+	/// Severity level
+	CLogLevel		level;
+	/// Number of similar messages that were suppressed before this one
+	unsigned int	suppressed;
+	/// Message text
+	char			text[LOG_MESSAGE_MAX];
+
+} LogEntry;
+
+/// State of the thread that writes the queued messages
+typedef enum _LogWriterState {
+	LOG_WRITER_STOPPED	= 0,
+	LOG_WRITER_RUNNING,
+	LOG_WRITER_FAILED,
+	/// The process is a forked child, messages are written directly
+	LOG_WRITER_DIRECT,
+
+} LogWriterState;
+
+
+/// Protects all of the logging state below except @a log_level.
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+/// Signaled when messages are added to the queue.
+static pthread_cond_t log_queued = PTHREAD_COND_INITIALIZER;
+/// Signaled when the queue has been written out.
+static pthread_cond_t log_flushed = PTHREAD_COND_INITIALIZER;
+
+/// Messages above this level are dropped.
+static volatile CLogLevel log_level = CL_WARNING;
+/// Application supplied log handler (NULL to use the default sink)
+static CLogHandler log_handler;
+/// Context passed to @a log_handler
+static void *log_context;
+
+/// Rate limiting state, indexed by a hash of the format string
+static LogLimit log_limits[LOG_LIMIT_SLOTS];
+
+/// Queue of the default sink. Message n is in element n % #LOG_QUEUE_SIZE.
+static LogEntry log_queue[LOG_QUEUE_SIZE];
+/// Number of messages written out of the queue
+static unsigned int log_head;
+/// Number of messages added to the queue
+static unsigned int log_tail;
+/// Number of messages dropped because the queue was full
+static unsigned int log_dropped;
+/// Boolean whether the writer thread is writing a message that it took from the queue
+static int log_writing;
+/// State of the writer thread
+static LogWriterState log_writer_state = LOG_WRITER_STOPPED;
+/// Makes sure that the fork handlers are registered only once.
+static pthread_once_t log_atfork_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Checks whether a message may be logged or exceeds its rate limit.
+ *
+ * Note: The log mutex must be locked before calling this function.
+ *
+ * @param format		format string of the message
+ * @param suppressed	receives the number of similar messages that were suppressed
+ * 						since the last one was logged
+ *
+ * @return
+ * 		- 1 if the message should be logged
+ * 		- 0 if the message should be suppressed
+ */
+static int check_rate_limit (const char *format, unsigned int *suppressed)
+{
+	LogLimit *limit = NULL;
+	struct timespec now;
+	unsigned int slot = ((unsigned long)format >> 3) % LOG_LIMIT_SLOTS, i;
+
+	*suppressed = 0;
+	for(i = 0; i < LOG_LIMIT_SLOTS; i++) {
+		LogLimit *elem = &log_limits[(slot + i) % LOG_LIMIT_SLOTS];
+		if(elem->format == format || elem->format == NULL) {
+			limit = elem;
+			break;
+		}
+	}
+	if(limit == NULL)			// Too many different messages, don't limit this one
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(limit->format == NULL || now.tv_sec - limit->interval_start >= LOG_RATE_INTERVAL) {
+		limit->format			= format;
+		limit->interval_start	= now.tv_sec;
+		limit->count			= 0;
+	}
+	if(limit->count >= LOG_RATE_BURST) {
+		limit->suppressed++;
+		return 0;
+	}
+	limit->count++;
+	*suppressed = limit->suppressed;
+	limit->suppressed = 0;
+	return 1;
+}
+
+
+/**
+ * Writes a message of the default sink to stderr.
+ */
+static void write_log_entry (CLogLevel level, const char *text, unsigned int suppressed)
+{
+	const char *prefix = "";
+	switch(level) {
+		case CL_WARNING:	prefix = "Warning: ";	break;
+		case CL_INFO:		prefix = "Info: ";		break;
+		case CL_DEBUG:		prefix = "Debug: ";		break;
+		default:									break;
+	}
+
+	if(suppressed)
+		fprintf(stderr, "[libwebcam] %s%s (%u similar messages were suppressed)\n",
+				prefix, text, suppressed);
+	else
+		fprintf(stderr, "[libwebcam] %s%s\n", prefix, text);
+}
+
+
+/**
+ * Writes the queued messages to stderr until the process exits.
+ */
+static void *log_writer (void *arg)
+{
+	LogEntry entry;
+
+	pthread_mutex_lock(&log_mutex);
+	for(;;) {
+		while(log_head == log_tail && !log_dropped)
+			pthread_cond_wait(&log_queued, &log_mutex);
+
+		unsigned int dropped = log_dropped;
+		int have_entry = log_head != log_tail;
+		log_dropped = 0;
+		if(have_entry)
+			memcpy(&entry, &log_queue[log_head++ % LOG_QUEUE_SIZE], sizeof(entry));
+		log_writing = 1;
+		pthread_mutex_unlock(&log_mutex);
+
+		// Write without holding the lock, so that stderr cannot block the callers
+		if(dropped)
+			fprintf(stderr, "[libwebcam] %u messages were dropped because they were logged "
+					"too quickly\n", dropped);
+		if(have_entry)
+			write_log_entry(entry.level, entry.text, entry.suppressed);
+
+		pthread_mutex_lock(&log_mutex);
+		log_writing = 0;
+		if(log_head == log_tail && !log_dropped)
+			pthread_cond_broadcast(&log_flushed);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Fork handlers. The child process does not inherit the writer thread, so it starts
+ * over with an empty queue. The parent still writes the messages queued before the fork.
+ */
+static void log_prepare_fork (void)
+{
+	pthread_mutex_lock(&log_mutex);
+}
+
+static void log_parent_fork (void)
+{
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static void log_child_fork (void)
+{
+	log_head = log_tail = 0;
+	log_dropped = 0;
+	log_writing = 0;
+	log_writer_state = LOG_WRITER_DIRECT;
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static void register_fork_handlers (void)
+{
+	pthread_atfork(log_prepare_fork, log_parent_fork, log_child_fork);
+}
+
+
+/**
+ * Prepares the default sink. Called by c_init().
+ *
+ * The fork handlers are registered before any message is logged, so that a child
+ * writes directly even if the parent has not started the writer thread yet.
+ */
+void init_log (void)
+{
+	pthread_once(&log_atfork_once, register_fork_handlers);
+}
+
+
+/**
+ * Starts the writer thread of the default sink.
+ *
+ * The thread blocks all signals, so that it does not receive signals that the
+ * application handles synchronously (e.g. with sigwait() or a signalfd).
+ *
+ * Note: The log mutex must be locked before calling this function.
+ */
+static void start_log_writer (void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t signals, old_signals;
+
+	log_writer_state = LOG_WRITER_FAILED;
+	if(pthread_attr_init(&attr))
+		return;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	sigfillset(&signals);
+	pthread_sigmask(SIG_SETMASK, &signals, &old_signals);
+	if(pthread_create(&thread, &attr, log_writer, NULL) == 0)
+		log_writer_state = LOG_WRITER_RUNNING;
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+
+/**
+ * Waits until the writer thread has written all queued messages.
+ *
+ * The caller must hold @a log_mutex.
+ */
+static void wait_for_log_writer (void)
+{
+	while(log_writer_state == LOG_WRITER_RUNNING &&
+		  (log_head != log_tail || log_dropped || log_writing))
+		pthread_cond_wait(&log_flushed, &log_mutex);
+}
+
+
+/**
+ * Passes a message to the default sink.
+ *
+ * The message is queued for the writer thread. Errors are written directly after the
+ * queued messages, and so are all messages if the thread cannot be started or the
+ * process is a forked child.
+ */
+static void queue_log_message (const CLogMessage *message)
+{
+	pthread_mutex_lock(&log_mutex);
+	if(log_writer_state == LOG_WRITER_STOPPED)
+		start_log_writer();
+	if(log_writer_state != LOG_WRITER_RUNNING || message->level <= CL_ERROR) {
+		wait_for_log_writer();
+		pthread_mutex_unlock(&log_mutex);
+		write_log_entry(message->level, message->text, message->suppressed);
+		return;
+	}
+
+	if(log_tail - log_head < LOG_QUEUE_SIZE) {
+		LogEntry *entry = &log_queue[log_tail++ % LOG_QUEUE_SIZE];
+		entry->level		= message->level;
+		entry->suppressed	= message->suppressed;
+		strcpy(entry->text, message->text);
+	}
+	else {
+		log_dropped++;
+	}
+	pthread_cond_signal(&log_queued);
+	pthread_mutex_unlock(&log_mutex);
+}
+
+
+/**
+ * Logs a message.
+ *
+ * @param level		severity level
+ * @param device	short name of the device that the message concerns or NULL
+ * @param format	a @a printf compatible format. It also identifies the message for
+ * 					rate limiting, so it must not be built at runtime.
+ * @param suffix	text that is appended to the formatted message or NULL
+ * @param ap		arguments for @a format
+ */
+void log_vmessage (CLogLevel level, const char *device, const char *format,
+		const char *suffix, va_list ap)
+{
+	char text[LOG_MESSAGE_MAX];
+	CLogMessage message;
+	CLogHandler handler;
+	void *context;
+	struct timespec now;
+
+	if(level > log_level)
+		return;
+
+	pthread_mutex_lock(&log_mutex);
+	int log = check_rate_limit(format, &message.suppressed);
+	handler = log_handler;
+	context = log_context;
+	pthread_mutex_unlock(&log_mutex);
+	if(!log)
+		return;
+
+	// Format the message and remove trailing newlines
+	int length = vsnprintf(text, sizeof(text), format, ap);
+	if(length < 0)
+		return;
+	if(length >= sizeof(text))
+		length = sizeof(text) - 1;
+	if(suffix)
+		length += snprintf(text + length, sizeof(text) - length, "%s", suffix);
+	if(length >= sizeof(text))
+		length = sizeof(text) - 1;
+	while(length > 0 && text[length - 1] == '\n')
+		text[--length] = '\0';
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	message.level		= level;
+	message.timestamp	= (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	message.device		= device;
+	message.text		= text;
+
+	if(handler)
+		handler(&message, context);
+	else
+		queue_log_message(&message);
+}
+
+
+/**
+ * Logs a message.
+ *
+ * See log_vmessage() for the arguments.
+ */
+void log_message (CLogLevel level, const char *device, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	log_vmessage(level, device, format, NULL, ap);
+	va_end(ap);
+}
+
+
+/**
+ * Waits until the default sink has written all queued messages.
+ *
+ * Messages that were suppressed after the last message that got through are reported
+ * as a total.
+ */
+void flush_log (void)
+{
+	unsigned int suppressed = 0, i;
+
+	pthread_mutex_lock(&log_mutex);
+	if(log_handler == NULL) {
+		for(i = 0; i < LOG_LIMIT_SLOTS; i++) {
+			suppressed += log_limits[i].suppressed;
+			log_limits[i].suppressed = 0;
+		}
+	}
+	pthread_mutex_unlock(&log_mutex);
+	if(suppressed) {
+		char text[64];
+		snprintf(text, sizeof(text), "%u more messages were suppressed", suppressed);
+		CLogMessage message = { .level = CL_WARNING, .text = text };
+		queue_log_message(&message);
+	}
+
+	pthread_mutex_lock(&log_mutex);
+	wait_for_log_writer();
+	pthread_mutex_unlock(&log_mutex);
+}
+
+
+/**
+ * Sets the function that receives the messages logged by libwebcam.
+ *
+ * By default, libwebcam writes its messages to stderr. To avoid blocking the library,
+ * the messages are written by a background thread. When an application sets a
+ * handler, the handler receives all messages instead. Messages that were logged
+ * before are written to stderr first.
+ * The library does not need to be initialized to call this function.
+ *
+ * @param handler	function that is called for each message or NULL to restore the
+ * 					default behavior
+ * @param context	value that is passed to the handler
+ */
+void c_set_log_handler (CLogHandler handler, void *context)
+{
+	flush_log();
+
+	pthread_mutex_lock(&log_mutex);
+	log_handler = handler;
+	log_context = context;
+	pthread_mutex_unlock(&log_mutex);
+}
+
+
+/**
+ * Sets the most verbose level of the messages that are logged.
+ *
+ * Messages above the given level are dropped. The default level is #CL_WARNING.
+ * The library does not need to be initialized to call this function.
+ *
+ * @param level		severity level
+ */
+void c_set_log_level (CLogLevel level)
+{
+	log_level = level;
+}
@@ -0,0 +1,359 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Batch mode
+ *
+ * Runs a list of commands in a single library session. Devices are opened on first use
+ * and their control lists are retrieved only once, so that scripts that get and set many
+ * controls do not pay for the library initialization and the control enumeration every
+ * time. Each line contains one command:
+ *
+ *   list                              List available cameras
+ *   clist <device>                    List available controls
+ *   get <device> <control>            Retrieve the current control value
+ *   set <device> <control> <value>    Set a new control value
+ *
+ * Arguments that contain spaces can be enclosed in single or double quotes. Empty lines
+ * and lines starting with '#' are ignored.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "batch.h"
+#include "controls.h"
+
+
+/// Maximum number of arguments of a command including the command name
+#define MAX_ARGS		5
+
+
+/**
+ * A device used by the batch commands.
+ */
+typedef struct _BatchDevice {
+	/// Device name as given in the command
+	char				name[NAME_MAX];
+	/// Handle of the open device
+	CHandle				handle;
+	/// Controls of the device
+	CControl			* controls;
+	/// Number of elements in @a controls
+	unsigned int		control_count;
+	/// Pointer to the next device in the list
+	struct _BatchDevice	* next;
+
+} BatchDevice;
+
+/**
+ * State of a batch session.
+ */
+typedef struct _BatchSession {
+	/// Name of the batch file used in messages
+	const char			* file_name;
+	/// Number of the line that is being processed
+	unsigned int		line;
+	/// Devices opened so far
+	BatchDevice			* devices;
+
+} BatchSession;
+
+
+static void
+print_command_error (BatchSession *session, CHandle handle, const char *error, CResult res)
+{
+	char *text = (int)res < 0 ? NULL : c_get_handle_error_text(handle, res);
+	if(text) {
+		printf("ERROR: %s:%u: %s: %s. (Code: %d)\n", session->file_name, session->line,
+				error, text, res);
+		free(text);
+	}
+	else {
+		printf("ERROR: %s:%u: %s.\n", session->file_name, session->line, error);
+	}
+}
+
+
+/**
+ * Splits a command line into arguments.
+ *
+ * The line is modified in place and the arguments point into it.
+ *
+ * @return the number of arguments or -1 if there are too many or a quote is not closed
+ */
+static int
+split_command (char *line, char *args[MAX_ARGS])
+{
+	int count = 0;
+	char *p = line;
+
+	for(;;) {
+		while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+			p++;
+		if(!*p || (*p == '#' && count == 0))
+			break;
+		if(count == MAX_ARGS)
+			return -1;
+
+		if(*p == '"' || *p == '\'') {
+			char quote = *p++;
+			args[count++] = p;
+			p = strchr(p, quote);
+			if(!p)
+				return -1;
+		}
+		else {
+			args[count++] = p;
+			p += strcspn(p, " \t\r\n");
+			if(!*p)
+				break;
+		}
+		*p++ = '\0';
+	}
+
+	return count;
+}
+
+
+/**
+ * Returns the device with the given name, opening it and retrieving its controls if
+ * it is used for the first time.
+ */
+static BatchDevice *
+get_device (BatchSession *session, const char *name)
+{
+	BatchDevice *dev;
+	for(dev = session->devices; dev; dev = dev->next) {
+		if(strcmp(dev->name, name) == 0)
+			return dev;
+	}
+
+	dev = (BatchDevice *)malloc(sizeof(BatchDevice));
+	if(!dev) {
+		print_command_error(session, 0, "Out of memory", -1);
+		return NULL;
+	}
+	memset(dev, 0, sizeof(*dev));
+	snprintf(dev->name, sizeof(dev->name), "%s", name);
+
+	dev->handle = c_open_device(name);
+	if(!dev->handle) {
+		print_command_error(session, 0, "Unable to open device", -1);
+		free(dev);
+		return NULL;
+	}
+	CResult res = get_control_list(dev->handle, &dev->controls, &dev->control_count);
+	if(res) {
+		print_command_error(session, dev->handle, "Unable to retrieve control list", res);
+		c_close_device(dev->handle);
+		free(dev);
+		return NULL;
+	}
+
+	dev->next = session->devices;
+	session->devices = dev;
+	return dev;
+}
+
+
+static CControl *
+find_control (BatchDevice *dev, const char *name)
+{
+	unsigned int i;
+	for(i = 0; i < dev->control_count; i++) {
+		if(strcasecmp(name, dev->controls[i].name) == 0)
+			return &dev->controls[i];
+	}
+	return NULL;
+}
+
+
+static CResult
+list_devices (BatchSession *session)
+{
+	CResult res;
+	CDevice *devices = NULL;
+	unsigned int size = 0, count = 0;
+
+	res = c_enum_devices(NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		devices = (CDevice *)malloc(size);
+		res = devices ? c_enum_devices(devices, &size, &count) : C_NO_MEMORY;
+	}
+	if(res) {
+		print_command_error(session, 0, "Unable to retrieve device list", res);
+		goto done;
+	}
+
+	unsigned int i;
+	for(i = 0; i < count; i++)
+		printf("%s   %s\n", devices[i].shortName, devices[i].name);
+
+done:
+	free(devices);
+	return res;
+}
+
+
+static CResult
+run_command (BatchSession *session, char *args[], int count)
+{
+	CResult res;
+	BatchDevice *dev = NULL;
+	CControl *control = NULL;
+	CControlValue value;
+
+	// Check the number of arguments
+	static const struct {
+		const char		* name;
+		int				count;
+	} commands[] = {
+		{ "list",	1 },
+		{ "clist",	2 },
+		{ "get",	3 },
+		{ "set",	4 },
+	};
+	int i;
+	for(i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+		if(strcmp(args[0], commands[i].name) == 0)
+			break;
+	}
+	if(i == sizeof(commands) / sizeof(commands[0])) {
+		print_command_error(session, 0, "Unknown command", -1);
+		return C_INVALID_ARG;
+	}
+	if(count != commands[i].count) {
+		print_command_error(session, 0, "Wrong number of arguments", -1);
+		return C_INVALID_ARG;
+	}
+
+	if(strcmp(args[0], "list") == 0)
+		return list_devices(session);
+
+	// Resolve the device and the control
+	dev = get_device(session, args[1]);
+	if(!dev)
+		return C_INVALID_DEVICE;
+
+	if(strcmp(args[0], "clist") == 0) {
+		unsigned int j;
+		for(j = 0; j < dev->control_count; j++)
+			printf("%s\n", dev->controls[j].name);
+		return C_SUCCESS;
+	}
+
+	control = find_control(dev, args[2]);
+	if(!control) {
+		print_command_error(session, 0, "Unknown control specified", -1);
+		return C_NOT_FOUND;
+	}
+
+	if(strcmp(args[0], "get") == 0) {
+		res = c_get_control(dev->handle, control->id, &value);
+		if(res) {
+			print_command_error(session, dev->handle, "Unable to retrieve control value", res);
+			return res;
+		}
+		printf("%d\n", value.value);
+	}
+	else {
+		if(parse_control_value(args[3], &value)) {
+			print_command_error(session, 0, "Invalid control value specified", -1);
+			return C_INVALID_ARG;
+		}
+		res = c_set_control(dev->handle, control->id, &value);
+		if(res) {
+			print_command_error(session, dev->handle, "Unable to set new control value", res);
+			return res;
+		}
+	}
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Runs the commands in a batch file.
+ *
+ * All commands are run even if some of them fail.
+ *
+ * @param file_name	name of the file to read the commands from or '-' for stdin
+ *
+ * @return
+ * 		- the result of the first command that failed
+ * 		- #C_SUCCESS if all commands succeeded
+ */
+CResult
+run_batch (const char *file_name)
+{
+	CResult res = C_SUCCESS;
+	BatchSession session = { file_name, 0, NULL };
+	char line[1024];
+
+	FILE *file = stdin;
+	if(strcmp(file_name, "-") == 0) {
+		session.file_name = "stdin";
+	}
+	else {
+		file = fopen(file_name, "r");
+		if(!file) {
+			printf("ERROR: Unable to open batch file %s.\n", file_name);
+			return C_INVALID_ARG;
+		}
+	}
+
+	while(fgets(line, sizeof(line), file)) {
+		char *args[MAX_ARGS];
+		session.line++;
+
+		int count = split_command(line, args);
+		if(count == 0)
+			continue;
+
+		CResult cmd_res;
+		if(count < 0) {
+			print_command_error(&session, 0, "Invalid command", -1);
+			cmd_res = C_INVALID_ARG;
+		}
+		else {
+			cmd_res = run_command(&session, args, count);
+		}
+		if(cmd_res && !res)
+			res = cmd_res;
+	}
+
+	// Clean up
+	while(session.devices) {
+		BatchDevice *next = session.devices->next;
+		c_close_device(session.devices->handle);
+		free(session.devices->controls);
+		free(session.devices);
+		session.devices = next;
+	}
+	if(file != stdin)
+		fclose(file);
+
+	return res;
+}
@@ -0,0 +1,32 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LV_BATCH_H
+#define LV_BATCH_H
+
+#include <webcam.h>
+
+
+extern CResult run_batch (const char *file_name);
+
+
+#endif /* LV_BATCH_H */
@@ -0,0 +1,366 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Benchmark
+ *
+ * Measures the latency of the library operations on a device and prints the distribution
+ * for each operation as tab-separated values:
+ *
+ *   # operation	samples	errors	p50_us	p99_us	max_us
+ *   init	100	0	412.5	603.1	750.0
+ *   rescan	100	0	41.2	60.3	75.0
+ *   get:Brightness	100	0	3.1	5.0	9.8
+ *   ...
+ *
+ * 'init' is a fresh c_init() that discovers all devices, 'rescan' is a c_enum_devices()
+ * call that revalidates the devices the library already knows. The getters and setters
+ * are measured for every control. The setters write back the current value, so the
+ * benchmark does not change the device settings. 'import_first' is the first import of
+ * the dynamic controls, which adds the mappings that the device does not have yet, and
+ * 'import_again' are the following imports, which find the mappings present and skip
+ * them. Failed operations are counted as errors and not included in the distribution.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "controls.h"
+
+
+/**
+ * Latency samples of a single operation.
+ */
+typedef struct _BenchResult {
+	/// Durations of the successful operations in microseconds
+	double				* samples;
+	/// Number of elements in @a samples
+	unsigned int		count;
+	/// Number of failed operations
+	unsigned int		errors;
+
+} BenchResult;
+
+
+static double
+get_time_us (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+
+static CResult
+init_result (BenchResult *result, int iterations)
+{
+	result->samples = (double *)malloc(iterations * sizeof(double));
+	result->count = 0;
+	result->errors = 0;
+	return result->samples ? C_SUCCESS : C_NO_MEMORY;
+}
+
+
+static void
+add_sample (BenchResult *result, double start, CResult res)
+{
+	if(res)
+		result->errors++;
+	else
+		result->samples[result->count++] = get_time_us() - start;
+}
+
+
+static int
+compare_samples (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Returns the given percentile of the sorted samples using the nearest rank method.
+ */
+static double
+get_percentile (BenchResult *result, unsigned int percent)
+{
+	unsigned int rank = (result->count * percent + 99) / 100;
+	return result->samples[rank ? rank - 1 : 0];
+}
+
+
+/**
+ * Prints the distribution of an operation and frees its samples.
+ */
+static void
+print_result (const char *operation, const char *control_name, BenchResult *result)
+{
+	printf("%s%s%s\t%u\t%u", operation, control_name ? ":" : "", control_name ? control_name : "",
+			result->count + result->errors, result->errors);
+	if(result->count) {
+		qsort(result->samples, result->count, sizeof(double), compare_samples);
+		printf("\t%.1f\t%.1f\t%.1f\n", get_percentile(result, 50), get_percentile(result, 99),
+				result->samples[result->count - 1]);
+	}
+	else {
+		printf("\t-\t-\t-\n");
+	}
+	free(result->samples);
+	result->samples = NULL;
+}
+
+
+static CResult
+enum_devices (void)
+{
+	CDevice *devices = NULL;
+	unsigned int size = 0, count = 0;
+	CResult res = c_enum_devices(NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		devices = (CDevice *)malloc(size);
+		res = devices ? c_enum_devices(devices, &size, &count) : C_NO_MEMORY;
+	}
+	free(devices);
+	return res;
+}
+
+
+static CResult
+enum_controls (CHandle handle)
+{
+	CControl *controls = NULL;
+	unsigned int count = 0;
+	CResult res = get_control_list(handle, &controls, &count);
+	free(controls);
+	return res;
+}
+
+
+/**
+ * Enumerates the pixel formats, frame sizes, and frame intervals of the device.
+ */
+static CResult
+enum_formats (CHandle handle)
+{
+	CResult res;
+	CPixelFormat *formats = NULL;
+	CFrameSize *sizes = NULL;
+	CFrameInterval *intervals = NULL;
+	unsigned int size = 0, count = 0, i, j;
+
+	res = c_enum_pixel_formats(handle, NULL, &size, &count);
+	if(res != C_BUFFER_TOO_SMALL)
+		return res;
+	formats = (CPixelFormat *)malloc(size);
+	res = formats ? c_enum_pixel_formats(handle, formats, &size, &count) : C_NO_MEMORY;
+	unsigned int format_count = count;
+
+	for(i = 0; i < format_count && !res; i++) {
+		size = 0;
+		res = c_enum_frame_sizes(handle, &formats[i], NULL, &size, &count);
+		if(res != C_BUFFER_TOO_SMALL) {
+			res = C_SUCCESS;
+			continue;
+		}
+		sizes = (CFrameSize *)malloc(size);
+		res = sizes ? c_enum_frame_sizes(handle, &formats[i], sizes, &size, &count) : C_NO_MEMORY;
+		unsigned int size_count = count;
+
+		for(j = 0; j < size_count && !res; j++) {
+			if(sizes[j].type != CF_SIZE_DISCRETE)
+				continue;
+			size = 0;
+			res = c_enum_frame_intervals(handle, &formats[i], &sizes[j], NULL, &size, &count);
+			if(res != C_BUFFER_TOO_SMALL) {
+				res = C_SUCCESS;
+				continue;
+			}
+			intervals = (CFrameInterval *)malloc(size);
+			res = intervals ? c_enum_frame_intervals(handle, &formats[i], &sizes[j], intervals,
+					&size, &count) : C_NO_MEMORY;
+			free(intervals);
+			intervals = NULL;
+		}
+		free(sizes);
+		sizes = NULL;
+	}
+
+	free(formats);
+	return res;
+}
+
+
+static CResult
+import_mappings (const char *device_name, const char *file_name, const char *dir_name)
+{
+	CDynctrlInfo info = { 0 };
+	CResult res;
+	if(dir_name)
+		res = c_add_control_mappings_from_dir(device_name, dir_name, &info);
+	else
+		res = c_add_control_mappings_to_device(device_name, file_name, &info);
+	free(info.messages);
+	return res;
+}
+
+
+/**
+ * Measures the latency of the library operations on a device.
+ *
+ * @param device_name	name of the device to measure
+ * @param iterations	number of times each operation is run
+ * @param file_name		name of a dynamic controls file to import or NULL
+ * @param dir_name		name of a dynamic controls directory to import or NULL. The import
+ * 						is only measured if a file or a directory is given.
+ */
+CResult
+run_benchmark (const char *device_name, int iterations, const char *file_name,
+		const char *dir_name)
+{
+	CResult res;
+	CHandle handle = 0;
+	CControl *controls = NULL;
+	unsigned int control_count = 0, j;
+	int i;
+	BenchResult result;
+	double start;
+
+	if(iterations <= 0) {
+		printf("ERROR: The number of iterations must be positive.\n");
+		return C_INVALID_ARG;
+	}
+
+	printf("# operation\tsamples\terrors\tp50_us\tp99_us\tmax_us\n");
+
+	// Device discovery by a freshly initialized library, which leaves the library
+	// initialized for the remaining operations
+	if((res = init_result(&result, iterations))) goto done;
+	for(i = 0; i < iterations; i++) {
+		c_cleanup();
+		start = get_time_us();
+		add_sample(&result, start, c_init());
+	}
+	print_result("init", NULL, &result);
+
+	// Revalidation of the known devices
+	if((res = init_result(&result, iterations))) goto done;
+	for(i = 0; i < iterations; i++) {
+		start = get_time_us();
+		add_sample(&result, start, enum_devices());
+	}
+	print_result("rescan", NULL, &result);
+
+	// Opening the device
+	if((res = init_result(&result, iterations))) goto done;
+	for(i = 0; i < iterations; i++) {
+		start = get_time_us();
+		handle = c_open_device(device_name);
+		add_sample(&result, start, handle ? C_SUCCESS : C_INVALID_DEVICE);
+		if(handle)
+			c_close_device(handle);
+	}
+	print_result("open", NULL, &result);
+
+	handle = c_open_device(device_name);
+	if(!handle) {
+		printf("ERROR: Unable to open device.\n");
+		res = C_INVALID_DEVICE;
+		goto done;
+	}
+
+	// Control and format enumeration
+	if((res = init_result(&result, iterations))) goto done;
+	for(i = 0; i < iterations; i++) {
+		start = get_time_us();
+		add_sample(&result, start, enum_controls(handle));
+	}
+	print_result("enum_controls", NULL, &result);
+
+	if((res = init_result(&result, iterations))) goto done;
+	for(i = 0; i < iterations; i++) {
+		start = get_time_us();
+		add_sample(&result, start, enum_formats(handle));
+	}
+	print_result("enum_formats", NULL, &result);
+
+	// Getting and setting each control
+	res = get_control_list(handle, &controls, &control_count);
+	if(res) {
+		printf("ERROR: Unable to retrieve control list.\n");
+		goto done;
+	}
+	for(j = 0; j < control_count; j++) {
+		CControl *control = &controls[j];
+		CControlValue value;
+		if(!(control->flags & CC_CAN_READ) || control->type == CC_TYPE_RAW)
+			continue;
+
+		if((res = init_result(&result, iterations))) goto done;
+		for(i = 0; i < iterations; i++) {
+			start = get_time_us();
+			add_sample(&result, start, c_get_control(handle, control->id, &value));
+		}
+		print_result("get", control->name, &result);
+
+		if(!(control->flags & CC_CAN_WRITE) || (control->flags & (CC_IS_ACTION | CC_IS_RELATIVE)))
+			continue;
+		if(c_get_control(handle, control->id, &value))
+			continue;
+		if((res = init_result(&result, iterations))) goto done;
+		for(i = 0; i < iterations; i++) {
+			start = get_time_us();
+			add_sample(&result, start, c_set_control(handle, control->id, &value));
+		}
+		print_result("set", control->name, &result);
+	}
+
+	// Dynamic controls import. Only the first import adds mappings, the following ones
+	// find them present on the device.
+	if(file_name || dir_name) {
+		if((res = init_result(&result, 1))) goto done;
+		start = get_time_us();
+		add_sample(&result, start, import_mappings(device_name, file_name, dir_name));
+		print_result("import_first", NULL, &result);
+
+		if(iterations > 1) {
+			if((res = init_result(&result, iterations - 1))) goto done;
+			for(i = 1; i < iterations; i++) {
+				start = get_time_us();
+				add_sample(&result, start, import_mappings(device_name, file_name, dir_name));
+			}
+			print_result("import_again", NULL, &result);
+		}
+	}
+
+done:
+	if(res == C_NO_MEMORY)
+		printf("ERROR: Out of memory.\n");
+	free(controls);
+	if(handle)
+		c_close_device(handle);
+	return res;
+}
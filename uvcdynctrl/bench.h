@@ -0,0 +1,33 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LV_BENCH_H
+#define LV_BENCH_H
+
+#include <webcam.h>
+
+
+extern CResult run_benchmark (const char *device_name, int iterations,
+		const char *file_name, const char *dir_name);
+
+
+#endif /* LV_BENCH_H */
@@ -32,18 +32,28 @@ const char *gengetopt_args_info_help[] = {
   "  -V, --version            Print version and exit",
   "  -l, --list               List available cameras",
   "  -i, --import=filename    Import dynamic controls from an XML file",
+  "  -I, --import-dir=dirname Import dynamic controls from the XML files for the\n                             device in a directory\n                             (Reads the .xml files in dirname/VID/PID and\n                             dirname/VID)",
+  "  -D, --daemon             Keep running and import dynamic controls from the\n                             --import-dir directory whenever a UVC device is\n                             added",
+  "  -b, --batch=filename     Run the get, set, list, and clist commands in a file\n                             ('-' for stdin) in a single session",
   "  -v, --verbose            Enable verbose output  (default=off)",
-  "  -d, --device=devicename  Specify the device to use  (default=`video0')",
+  "  -d, --device=devicename  Specify the device to use\n                             ('all', a glob like 'video[0-3]', or a USB ID\n                             like '046d:08*' select several devices)\n                             (default=`video0')",
   "  -c, --clist              List available controls",
   "  -g, --get=control        Retrieve the current control value",
   "  -s, --set=control        Set a new control value\n                             (For negative values: -s 'My Control' -- -42)",
   "  -f, --formats            List available frame formats",
+  "  -p, --save-profile=filename\n                             Save the values of all controls to a file",
+  "  -P, --load-profile=filename\n                             Restore the control values saved in a file",
+  "  -w, --watch              Print control value changes as they happen\n                             (Watches the controls given as arguments or all\n                             controls)",
+  "  -B, --bench=count        Measure the latency of library operations on the\n                             device\n                             (Runs each operation count times and prints p50,\n                             p99, and max in microseconds)",
+  "  -S, --stats              Print the request statistics of the device when\n                             done\n                             (Number, latency, and errors of the requests sent\n                             to the driver)",
+  "  -T, --dump-trace         Print the most recent requests sent to the device\n                             when done",
     0
 };
 
 typedef enum {ARG_NO
   , ARG_FLAG
   , ARG_STRING
+  , ARG_INT
 } cmdline_parser_arg_type;
 
 static
@@ -66,12 +76,21 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->version_given = 0 ;
   args_info->list_given = 0 ;
   args_info->import_given = 0 ;
+  args_info->import_dir_given = 0 ;
+  args_info->daemon_given = 0 ;
+  args_info->batch_given = 0 ;
   args_info->verbose_given = 0 ;
   args_info->device_given = 0 ;
   args_info->clist_given = 0 ;
   args_info->get_given = 0 ;
   args_info->set_given = 0 ;
   args_info->formats_given = 0 ;
+  args_info->save_profile_given = 0 ;
+  args_info->load_profile_given = 0 ;
+  args_info->watch_given = 0 ;
+  args_info->bench_given = 0 ;
+  args_info->stats_given = 0 ;
+  args_info->dump_trace_given = 0 ;
 }
 
 static
@@ -79,6 +98,10 @@ void clear_args (struct gengetopt_args_info *args_info)
 {
   args_info->import_arg = NULL;
   args_info->import_orig = NULL;
+  args_info->import_dir_arg = NULL;
+  args_info->import_dir_orig = NULL;
+  args_info->batch_arg = NULL;
+  args_info->batch_orig = NULL;
   args_info->verbose_flag = 0;
   args_info->device_arg = gengetopt_strdup ("video0");
   args_info->device_orig = NULL;
@@ -86,6 +109,11 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->get_orig = NULL;
   args_info->set_arg = NULL;
   args_info->set_orig = NULL;
+  args_info->save_profile_arg = NULL;
+  args_info->save_profile_orig = NULL;
+  args_info->load_profile_arg = NULL;
+  args_info->load_profile_orig = NULL;
+  args_info->bench_orig = NULL;
   
 }
 
@@ -98,12 +126,21 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->version_help = gengetopt_args_info_help[1] ;
   args_info->list_help = gengetopt_args_info_help[2] ;
   args_info->import_help = gengetopt_args_info_help[3] ;
-  args_info->verbose_help = gengetopt_args_info_help[4] ;
-  args_info->device_help = gengetopt_args_info_help[5] ;
-  args_info->clist_help = gengetopt_args_info_help[6] ;
-  args_info->get_help = gengetopt_args_info_help[7] ;
-  args_info->set_help = gengetopt_args_info_help[8] ;
-  args_info->formats_help = gengetopt_args_info_help[9] ;
+  args_info->import_dir_help = gengetopt_args_info_help[4] ;
+  args_info->daemon_help = gengetopt_args_info_help[5] ;
+  args_info->batch_help = gengetopt_args_info_help[6] ;
+  args_info->verbose_help = gengetopt_args_info_help[7] ;
+  args_info->device_help = gengetopt_args_info_help[8] ;
+  args_info->clist_help = gengetopt_args_info_help[9] ;
+  args_info->get_help = gengetopt_args_info_help[10] ;
+  args_info->set_help = gengetopt_args_info_help[11] ;
+  args_info->formats_help = gengetopt_args_info_help[12] ;
+  args_info->save_profile_help = gengetopt_args_info_help[13] ;
+  args_info->load_profile_help = gengetopt_args_info_help[14] ;
+  args_info->watch_help = gengetopt_args_info_help[15] ;
+  args_info->bench_help = gengetopt_args_info_help[16] ;
+  args_info->stats_help = gengetopt_args_info_help[17] ;
+  args_info->dump_trace_help = gengetopt_args_info_help[18] ;
   
 }
 
@@ -187,12 +224,21 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   unsigned int i;
   free_string_field (&(args_info->import_arg));
   free_string_field (&(args_info->import_orig));
+  free_string_field (&(args_info->import_dir_arg));
+  free_string_field (&(args_info->import_dir_orig));
+  free_string_field (&(args_info->batch_arg));
+  free_string_field (&(args_info->batch_orig));
   free_string_field (&(args_info->device_arg));
   free_string_field (&(args_info->device_orig));
   free_string_field (&(args_info->get_arg));
   free_string_field (&(args_info->get_orig));
   free_string_field (&(args_info->set_arg));
   free_string_field (&(args_info->set_orig));
+  free_string_field (&(args_info->save_profile_arg));
+  free_string_field (&(args_info->save_profile_orig));
+  free_string_field (&(args_info->load_profile_arg));
+  free_string_field (&(args_info->load_profile_orig));
+  free_string_field (&(args_info->bench_orig));
   
   
   for (i = 0; i < args_info->inputs_num; ++i)
@@ -235,6 +281,12 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "list", 0, 0 );
   if (args_info->import_given)
     write_into_file(outfile, "import", args_info->import_orig, 0);
+  if (args_info->import_dir_given)
+    write_into_file(outfile, "import-dir", args_info->import_dir_orig, 0);
+  if (args_info->daemon_given)
+    write_into_file(outfile, "daemon", 0, 0 );
+  if (args_info->batch_given)
+    write_into_file(outfile, "batch", args_info->batch_orig, 0);
   if (args_info->verbose_given)
     write_into_file(outfile, "verbose", 0, 0 );
   if (args_info->device_given)
@@ -247,6 +299,18 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "set", args_info->set_orig, 0);
   if (args_info->formats_given)
     write_into_file(outfile, "formats", 0, 0 );
+  if (args_info->save_profile_given)
+    write_into_file(outfile, "save-profile", args_info->save_profile_orig, 0);
+  if (args_info->load_profile_given)
+    write_into_file(outfile, "load-profile", args_info->load_profile_orig, 0);
+  if (args_info->watch_given)
+    write_into_file(outfile, "watch", 0, 0 );
+  if (args_info->bench_given)
+    write_into_file(outfile, "bench", args_info->bench_orig, 0);
+  if (args_info->stats_given)
+    write_into_file(outfile, "stats", 0, 0 );
+  if (args_info->dump_trace_given)
+    write_into_file(outfile, "dump-trace", 0, 0 );
   
 
   i = EXIT_SUCCESS;
@@ -411,6 +475,9 @@ int update_arg(void *field, char **orig_field,
   case ARG_FLAG:
     *((int *)field) = !*((int *)field);
     break;
+  case ARG_INT:
+    if (val) *((int *)field) = strtol (val, &stop_char, 0);
+    break;
   case ARG_STRING:
     if (val) {
       string_field = (char **)field;
@@ -423,6 +490,18 @@ int update_arg(void *field, char **orig_field,
     break;
   };
 
+  /* check numeric conversion */
+  switch(arg_type) {
+  case ARG_INT:
+    if (val && !(stop_char && *stop_char == '\0')) {
+      fprintf(stderr, "%s: invalid numeric value: %s\n", package_name, val);
+      return 1; /* failure */
+    }
+    break;
+  default:
+    ;
+  };
+
 
   /* store the original value */
   switch(arg_type) {
@@ -485,16 +564,25 @@ cmdline_parser_internal (int argc, char * const *argv, struct gengetopt_args_inf
         { "version",	0, NULL, 'V' },
         { "list",	0, NULL, 'l' },
         { "import",	1, NULL, 'i' },
+        { "import-dir",	1, NULL, 'I' },
+        { "daemon",	0, NULL, 'D' },
+        { "batch",	1, NULL, 'b' },
         { "verbose",	0, NULL, 'v' },
         { "device",	1, NULL, 'd' },
         { "clist",	0, NULL, 'c' },
         { "get",	1, NULL, 'g' },
         { "set",	1, NULL, 's' },
         { "formats",	0, NULL, 'f' },
+        { "save-profile",	1, NULL, 'p' },
+        { "load-profile",	1, NULL, 'P' },
+        { "watch",	0, NULL, 'w' },
+        { "bench",	1, NULL, 'B' },
+        { "stats",	0, NULL, 'S' },
+        { "dump-trace",	0, NULL, 'T' },
         { NULL,	0, NULL, 0 }
       };
 
-      c = getopt_long (argc, argv, "hVli:vd:cg:s:f", long_options, &option_index);
+      c = getopt_long (argc, argv, "hVli:I:Db:vd:cg:s:fp:P:wB:ST", long_options, &option_index);
 
       if (c == -1) break;	/* Exit from `while (1)' loop.  */
 
@@ -533,6 +621,42 @@ cmdline_parser_internal (int argc, char * const *argv, struct gengetopt_args_inf
               additional_error))
             goto failure;
         
+          break;
+        case 'I':	/* Import dynamic controls from the XML files for the device in a directory\n(Reads the .xml files in dirname/VID/PID and dirname/VID).  */
+        
+        
+          if (update_arg( (void *)&(args_info->import_dir_arg), 
+               &(args_info->import_dir_orig), &(args_info->import_dir_given),
+              &(local_args_info.import_dir_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "import-dir", 'I',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'D':	/* Keep running and import dynamic controls from the --import-dir directory whenever a UVC device is added.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->daemon_given),
+              &(local_args_info.daemon_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "daemon", 'D',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'b':	/* Run the get, set, list, and clist commands in a file ('-' for stdin) in a single session.  */
+        
+        
+          if (update_arg( (void *)&(args_info->batch_arg), 
+               &(args_info->batch_orig), &(args_info->batch_given),
+              &(local_args_info.batch_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "batch", 'b',
+              additional_error))
+            goto failure;
+        
           break;
         case 'v':	/* Enable verbose output.  */
         
@@ -604,6 +728,78 @@ cmdline_parser_internal (int argc, char * const *argv, struct gengetopt_args_inf
             goto failure;
         
           break;
+        case 'p':	/* Save the values of all controls to a file.  */
+        
+        
+          if (update_arg( (void *)&(args_info->save_profile_arg), 
+               &(args_info->save_profile_orig), &(args_info->save_profile_given),
+              &(local_args_info.save_profile_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "save-profile", 'p',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'P':	/* Restore the control values saved in a file.  */
+        
+        
+          if (update_arg( (void *)&(args_info->load_profile_arg), 
+               &(args_info->load_profile_orig), &(args_info->load_profile_given),
+              &(local_args_info.load_profile_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "load-profile", 'P',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'w':	/* Print control value changes as they happen\n(Watches the controls given as arguments or all controls).  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->watch_given),
+              &(local_args_info.watch_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "watch", 'w',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'B':	/* Measure the latency of library operations on the device\n(Runs each operation count times and prints p50, p99, and max in microseconds).  */
+        
+        
+          if (update_arg( (void *)&(args_info->bench_arg), 
+               &(args_info->bench_orig), &(args_info->bench_given),
+              &(local_args_info.bench_given), optarg, 0, 0, ARG_INT,
+              check_ambiguity, override, 0, 0,
+              "bench", 'B',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'S':	/* Print the request statistics of the device when done\n(Number, latency, and errors of the requests sent to the driver).  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->stats_given),
+              &(local_args_info.stats_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "stats", 'S',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'T':	/* Print the most recent requests sent to the device when done.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->dump_trace_given),
+              &(local_args_info.dump_trace_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "dump-trace", 'T',
+              additional_error))
+            goto failure;
+        
+          break;
 
         case 0:	/* Long option with no short option */
         case '?':	/* Invalid option.  */
@@ -38,11 +38,18 @@ struct gengetopt_args_info
   char * import_arg;	/**< @brief Import dynamic controls from an XML file.  */
   char * import_orig;	/**< @brief Import dynamic controls from an XML file original value given at command line.  */
   const char *import_help; /**< @brief Import dynamic controls from an XML file help description.  */
+  char * import_dir_arg;	/**< @brief Import dynamic controls from the XML files for the device in a directory\n(Reads the .xml files in dirname/VID/PID and dirname/VID).  */
+  char * import_dir_orig;	/**< @brief Import dynamic controls from the XML files for the device in a directory\n(Reads the .xml files in dirname/VID/PID and dirname/VID) original value given at command line.  */
+  const char *import_dir_help; /**< @brief Import dynamic controls from the XML files for the device in a directory\n(Reads the .xml files in dirname/VID/PID and dirname/VID) help description.  */
+  const char *daemon_help; /**< @brief Keep running and import dynamic controls from the --import-dir directory whenever a UVC device is added help description.  */
+  char * batch_arg;	/**< @brief Run the get, set, list, and clist commands in a file ('-' for stdin) in a single session.  */
+  char * batch_orig;	/**< @brief Run the get, set, list, and clist commands in a file ('-' for stdin) in a single session original value given at command line.  */
+  const char *batch_help; /**< @brief Run the get, set, list, and clist commands in a file ('-' for stdin) in a single session help description.  */
   int verbose_flag;	/**< @brief Enable verbose output (default=off).  */
   const char *verbose_help; /**< @brief Enable verbose output help description.  */
-  char * device_arg;	/**< @brief Specify the device to use (default='video0').  */
-  char * device_orig;	/**< @brief Specify the device to use original value given at command line.  */
-  const char *device_help; /**< @brief Specify the device to use help description.  */
+  char * device_arg;	/**< @brief Specify the device to use\n('all', a glob like 'video[0-3]', or a USB ID like '046d:08*' select several devices) (default='video0').  */
+  char * device_orig;	/**< @brief Specify the device to use\n('all', a glob like 'video[0-3]', or a USB ID like '046d:08*' select several devices) original value given at command line.  */
+  const char *device_help; /**< @brief Specify the device to use\n('all', a glob like 'video[0-3]', or a USB ID like '046d:08*' select several devices) help description.  */
   const char *clist_help; /**< @brief List available controls help description.  */
   char * get_arg;	/**< @brief Retrieve the current control value.  */
   char * get_orig;	/**< @brief Retrieve the current control value original value given at command line.  */
@@ -51,17 +58,38 @@ struct gengetopt_args_info
   char * set_orig;	/**< @brief Set a new control value\n(For negative values: -s 'My Control' -- -42) original value given at command line.  */
   const char *set_help; /**< @brief Set a new control value\n(For negative values: -s 'My Control' -- -42) help description.  */
   const char *formats_help; /**< @brief List available frame formats help description.  */
+  char * save_profile_arg;	/**< @brief Save the values of all controls to a file.  */
+  char * save_profile_orig;	/**< @brief Save the values of all controls to a file original value given at command line.  */
+  const char *save_profile_help; /**< @brief Save the values of all controls to a file help description.  */
+  char * load_profile_arg;	/**< @brief Restore the control values saved in a file.  */
+  char * load_profile_orig;	/**< @brief Restore the control values saved in a file original value given at command line.  */
+  const char *load_profile_help; /**< @brief Restore the control values saved in a file help description.  */
+  const char *watch_help; /**< @brief Print control value changes as they happen\n(Watches the controls given as arguments or all controls) help description.  */
+  int bench_arg;	/**< @brief Measure the latency of library operations on the device\n(Runs each operation count times and prints p50, p99, and max in microseconds).  */
+  char * bench_orig;	/**< @brief Measure the latency of library operations on the device\n(Runs each operation count times and prints p50, p99, and max in microseconds) original value given at command line.  */
+  const char *bench_help; /**< @brief Measure the latency of library operations on the device\n(Runs each operation count times and prints p50, p99, and max in microseconds) help description.  */
+  const char *stats_help; /**< @brief Print the request statistics of the device when done\n(Number, latency, and errors of the requests sent to the driver) help description.  */
+  const char *dump_trace_help; /**< @brief Print the most recent requests sent to the device when done help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
   unsigned int list_given ;	/**< @brief Whether list was given.  */
   unsigned int import_given ;	/**< @brief Whether import was given.  */
+  unsigned int import_dir_given ;	/**< @brief Whether import-dir was given.  */
+  unsigned int daemon_given ;	/**< @brief Whether daemon was given.  */
+  unsigned int batch_given ;	/**< @brief Whether batch was given.  */
   unsigned int verbose_given ;	/**< @brief Whether verbose was given.  */
   unsigned int device_given ;	/**< @brief Whether device was given.  */
   unsigned int clist_given ;	/**< @brief Whether clist was given.  */
   unsigned int get_given ;	/**< @brief Whether get was given.  */
   unsigned int set_given ;	/**< @brief Whether set was given.  */
   unsigned int formats_given ;	/**< @brief Whether formats was given.  */
+  unsigned int save_profile_given ;	/**< @brief Whether save-profile was given.  */
+  unsigned int load_profile_given ;	/**< @brief Whether load-profile was given.  */
+  unsigned int watch_given ;	/**< @brief Whether watch was given.  */
+  unsigned int bench_given ;	/**< @brief Whether bench was given.  */
+  unsigned int stats_given ;	/**< @brief Whether stats was given.  */
+  unsigned int dump_trace_given ;	/**< @brief Whether dump-trace was given.  */
 
   char **inputs ; /**< @brief unamed options (options without names) */
   unsigned inputs_num ; /**< @brief unamed options number */
@@ -0,0 +1,332 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Daemon mode
+ *
+ * Instead of starting one uvcdynctrl process per device from the udev rule, the daemon
+ * keeps the parsed configuration files in memory and listens for kernel uevents on a
+ * netlink socket. When a video4linux device is added, the dynamic controls for it are
+ * imported right away, so that applications see the controls as soon as possible.
+ *
+ * SIGHUP reloads the configuration files, SIGINT and SIGTERM terminate the daemon.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "daemon.h"
+
+
+/// Size of the buffer used to receive uevents
+#define UEVENT_BUFFER_SIZE		8192
+
+/// Directory that lists the video4linux devices in the system
+#define SYSFS_V4L2_DIR			"/sys/class/video4linux"
+
+
+/**
+ * A device known to the daemon.
+ */
+typedef struct _KnownDevice {
+	/// Short V4L2 device name (e.g. 'video0')
+	char				name[NAME_MAX];
+	/// Pointer to the next device in the list
+	struct _KnownDevice	* next;
+
+} KnownDevice;
+
+/**
+ * State of the daemon.
+ */
+typedef struct _Daemon {
+	/// Directory that contains the configuration files
+	const char			* dir_name;
+	/// Function that imports the dynamic controls for a device
+	DeviceAddedHandler	handler;
+	/// Cache of the parsed configuration files
+	CDynctrlCache		* cache;
+	/// List of the devices that are currently present
+	KnownDevice			* devices;
+
+} Daemon;
+
+
+static KnownDevice **
+find_device (Daemon *daemon, const char *name)
+{
+	KnownDevice **pdev;
+	for(pdev = &daemon->devices; *pdev; pdev = &(*pdev)->next) {
+		if(strcmp((*pdev)->name, name) == 0)
+			break;
+	}
+	return pdev;
+}
+
+
+static void
+device_added (Daemon *daemon, const char *name)
+{
+	KnownDevice **pdev = find_device(daemon, name);
+	if(*pdev)
+		return;
+
+	// Remember the device even if the import fails, so that it is not retried for every
+	// duplicate event. The device is retried after a reload.
+	KnownDevice *dev = (KnownDevice *)malloc(sizeof(KnownDevice));
+	if(!dev) {
+		printf("ERROR: Out of memory.\n");
+		return;
+	}
+	snprintf(dev->name, sizeof(dev->name), "%s", name);
+	dev->next = NULL;
+	*pdev = dev;
+
+	daemon->handler(daemon->cache, name);
+}
+
+
+static void
+device_removed (Daemon *daemon, const char *name)
+{
+	KnownDevice **pdev = find_device(daemon, name);
+	if(!*pdev)
+		return;
+
+	KnownDevice *dev = *pdev;
+	*pdev = dev->next;
+	free(dev);
+}
+
+
+static int
+is_video_device (const char *name)
+{
+	return strncmp(name, "video", 5) == 0;
+}
+
+
+/**
+ * Adds all video4linux devices that are already present.
+ */
+static void
+coldplug_devices (Daemon *daemon)
+{
+	DIR *dir = opendir(SYSFS_V4L2_DIR);
+	if(!dir) {
+		printf("ERROR: Unable to open %s: %s\n", SYSFS_V4L2_DIR, strerror(errno));
+		return;
+	}
+
+	struct dirent *entry;
+	while((entry = readdir(dir))) {
+		if(is_video_device(entry->d_name))
+			device_added(daemon, entry->d_name);
+	}
+	closedir(dir);
+}
+
+
+/**
+ * Parses the configuration files again and imports the new configuration into all
+ * devices that are present.
+ */
+static CResult
+reload_config (Daemon *daemon)
+{
+	CDynctrlCache *cache;
+	CResult res = c_create_dynctrl_cache(daemon->dir_name, &cache);
+	if(res)
+		return res;
+	c_destroy_dynctrl_cache(daemon->cache);
+	daemon->cache = cache;
+
+	printf("Reloaded dynamic controls from directory %s.\n", daemon->dir_name);
+	KnownDevice *dev;
+	for(dev = daemon->devices; dev; dev = dev->next)
+		daemon->handler(daemon->cache, dev->name);
+
+	return C_SUCCESS;
+}
+
+
+static int
+open_uevent_socket (void)
+{
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;		// Kernel uevents
+
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if(fd < 0)
+		return -1;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * Receives a kernel uevent and updates the device list if a video4linux device was
+ * added or removed.
+ */
+static void
+handle_uevent (Daemon *daemon, int fd)
+{
+	char buffer[UEVENT_BUFFER_SIZE];
+	struct sockaddr_nl addr;
+	struct iovec iov = { buffer, sizeof(buffer) - 1 };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	ssize_t length = recvmsg(fd, &msg, 0);
+	if(length <= 0)
+		return;
+	// Only trust messages that come from the kernel
+	if(addr.nl_pid != 0)
+		return;
+	buffer[length] = '\0';
+
+	// The message consists of a header followed by NUL-terminated KEY=VALUE pairs
+	const char *action = NULL, *subsystem = NULL, *devname = NULL;
+	char *p = buffer + strlen(buffer) + 1;
+	while(p < buffer + length) {
+		if(strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if(strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if(strncmp(p, "DEVNAME=", 8) == 0)
+			devname = p + 8;
+		p += strlen(p) + 1;
+	}
+	if(!action || !subsystem || !devname || strcmp(subsystem, "video4linux") != 0)
+		return;
+
+	// DEVNAME is relative to /dev
+	const char *name = strrchr(devname, '/');
+	name = name ? name + 1 : devname;
+	if(!is_video_device(name))
+		return;
+
+	if(strcmp(action, "add") == 0)
+		device_added(daemon, name);
+	else if(strcmp(action, "remove") == 0)
+		device_removed(daemon, name);
+}
+
+
+/**
+ * Runs the daemon until it receives SIGINT or SIGTERM.
+ *
+ * @param dir_name	directory that contains the configuration files
+ * @param handler	function that imports the dynamic controls for a device
+ */
+CResult
+run_daemon (const char *dir_name, DeviceAddedHandler handler)
+{
+	CResult res = C_SUCCESS;
+	Daemon daemon = { dir_name, handler, NULL, NULL };
+	int uevent_fd = -1, signal_fd = -1;
+
+	// Handle signals synchronously in the event loop
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	if(sigprocmask(SIG_BLOCK, &signals, NULL) < 0 ||
+	   (signal_fd = signalfd(-1, &signals, SFD_CLOEXEC)) < 0) {
+		printf("ERROR: Unable to set up signal handling: %s\n", strerror(errno));
+		res = C_INIT_ERROR;
+		goto done;
+	}
+
+	// Open the uevent socket before scanning the devices, so that no device gets lost
+	uevent_fd = open_uevent_socket();
+	if(uevent_fd < 0) {
+		printf("ERROR: Unable to listen for device events: %s\n", strerror(errno));
+		res = C_INIT_ERROR;
+		goto done;
+	}
+
+	res = c_create_dynctrl_cache(dir_name, &daemon.cache);
+	if(res) goto done;
+
+	printf("Importing dynamic controls from directory %s for all devices.\n", dir_name);
+	coldplug_devices(&daemon);
+	fflush(stdout);
+
+	for(;;) {
+		struct pollfd fds[2] = {
+			{ .fd = uevent_fd, .events = POLLIN },
+			{ .fd = signal_fd, .events = POLLIN },
+		};
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			printf("ERROR: Unable to wait for device events: %s\n", strerror(errno));
+			res = C_SYNC_ERROR;
+			goto done;
+		}
+
+		if(fds[0].revents & POLLIN)
+			handle_uevent(&daemon, uevent_fd);
+
+		if(fds[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			if(read(signal_fd, &info, sizeof(info)) != sizeof(info))
+				continue;
+			if(info.ssi_signo != SIGHUP)
+				break;
+			if(reload_config(&daemon))
+				printf("ERROR: Unable to reload dynamic controls.\n");
+		}
+		fflush(stdout);
+	}
+
+done:
+	while(daemon.devices)
+		device_removed(&daemon, daemon.devices->name);
+	c_destroy_dynctrl_cache(daemon.cache);
+	if(uevent_fd >= 0)
+		close(uevent_fd);
+	if(signal_fd >= 0)
+		close(signal_fd);
+	return res;
+}
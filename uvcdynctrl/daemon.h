@@ -0,0 +1,35 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LV_DAEMON_H
+#define LV_DAEMON_H
+
+#include <webcam.h>
+
+
+/// Function that the daemon calls to import the dynamic controls for a new device
+typedef CResult (*DeviceAddedHandler) (CDynctrlCache *cache, const char *device_name);
+
+extern CResult run_daemon (const char *dir_name, DeviceAddedHandler handler);
+
+
+#endif /* LV_DAEMON_H */
@@ -0,0 +1,246 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Multiple devices
+ *
+ * The --device option accepts selectors that match several devices: 'all', a glob for the
+ * device names (e.g. 'video[0-3]'), or a USB vendor and product ID that may contain glob
+ * characters (e.g. '046d:08*'). The action is run on all matching devices at the same
+ * time, one child process per device, so that an operation on many cameras takes about
+ * as long as on the slowest one. The library is initialized only once before the
+ * processes are forked. The output of each device is collected and printed in the order
+ * of the device names, with the device name in front of each line.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "fleet.h"
+
+
+/**
+ * A device on which the action runs.
+ */
+typedef struct _FleetDevice {
+	/// Short device name (e.g. 'video0')
+	const char			* name;
+	/// ID of the child process that runs the action
+	pid_t				pid;
+	/// Temporary file that receives the output of the child process
+	FILE				* output;
+	/// Result of the action
+	CResult				res;
+
+} FleetDevice;
+
+
+/**
+ * Returns true if the given device name is a selector that can match several devices.
+ */
+int
+is_device_selector (const char *name)
+{
+	return strcmp(name, "all") == 0 || strpbrk(name, "*?[:") != NULL;
+}
+
+
+static int
+matches_selector (const char *selector, CDevice *device)
+{
+	if(strcmp(selector, "all") == 0)
+		return 1;
+
+	// USB vendor and product ID, e.g. '046d:0825' or '046d:*'
+	if(strchr(selector, ':')) {
+		if(!device->usb.vendor)
+			return 0;
+		char id[16], pattern[64];
+		unsigned int i;
+		snprintf(id, sizeof(id), "%04x:%04x", device->usb.vendor, device->usb.product);
+		for(i = 0; selector[i] && i < sizeof(pattern) - 1; i++)
+			pattern[i] = tolower((unsigned char)selector[i]);
+		pattern[i] = '\0';
+		return fnmatch(pattern, id, 0) == 0;
+	}
+
+	if(strncmp(selector, "/dev/", 5) == 0)
+		selector += 5;
+	return fnmatch(selector, device->shortName, 0) == 0;
+}
+
+
+static int
+compare_devices (const void *a, const void *b)
+{
+	return strverscmp(((const FleetDevice *)a)->name, ((const FleetDevice *)b)->name);
+}
+
+
+/**
+ * Prints the output of a device with the device name in front of each line.
+ */
+static void
+print_device_output (FleetDevice *dev)
+{
+	char line[1024];
+	int line_start = 1;
+
+	rewind(dev->output);
+	while(fgets(line, sizeof(line), dev->output)) {
+		if(line_start)
+			printf("%s: ", dev->name);
+		fputs(line, stdout);
+		line_start = line[strlen(line) - 1] == '\n';
+	}
+	if(!line_start)
+		putchar('\n');
+}
+
+
+/**
+ * Runs an action on all devices that match the given selector at the same time.
+ *
+ * @param selector	a device selector for which #is_device_selector returns true
+ * @param action	function that runs the action on a single device
+ * @param capture	if non-zero the output of the devices is collected and printed in
+ * 					device order after all actions have finished. Otherwise the devices
+ * 					write to stdout directly, which is required for actions that do not
+ * 					end by themselves.
+ *
+ * @return
+ * 		- the result of the action on the first device (in device order) where it failed
+ * 		- #C_NOT_FOUND if no device matches the selector
+ * 		- #C_SUCCESS if the action succeeded on all devices
+ */
+CResult
+run_on_devices (const char *selector, DeviceAction action, int capture)
+{
+	CResult res;
+	CDevice *devices = NULL;
+	FleetDevice *fleet = NULL;
+	unsigned int size = 0, count = 0, fleet_count = 0, i;
+
+	res = c_enum_devices(NULL, &size, &count);
+	if(res == C_BUFFER_TOO_SMALL) {
+		devices = (CDevice *)malloc(size);
+		res = devices ? c_enum_devices(devices, &size, &count) : C_NO_MEMORY;
+	}
+	if(res) {
+		printf("ERROR: Unable to retrieve device list.\n");
+		goto done;
+	}
+
+	// Collect the matching devices
+	if(count) {
+		fleet = (FleetDevice *)malloc(count * sizeof(FleetDevice));
+		if(!fleet) {
+			res = C_NO_MEMORY;
+			printf("ERROR: Out of memory.\n");
+			goto done;
+		}
+	}
+	for(i = 0; i < count; i++) {
+		if(!matches_selector(selector, &devices[i]))
+			continue;
+		fleet[fleet_count].name		= devices[i].shortName;
+		fleet[fleet_count].pid		= -1;
+		fleet[fleet_count].output	= NULL;
+		fleet[fleet_count].res		= C_SUCCESS;
+		fleet_count++;
+	}
+	if(!fleet_count) {
+		res = C_NOT_FOUND;
+		printf("ERROR: No device matches '%s'.\n", selector);
+		goto done;
+	}
+	qsort(fleet, fleet_count, sizeof(FleetDevice), compare_devices);
+
+	// Start one process per device. Flush first so that the children do not inherit and
+	// repeat buffered output.
+	fflush(stdout);
+	fflush(stderr);
+	for(i = 0; i < fleet_count; i++) {
+		FleetDevice *dev = &fleet[i];
+		if(capture) {
+			dev->output = tmpfile();
+			if(!dev->output) {
+				dev->res = C_CANNOT_WRITE;
+				printf("ERROR: %s: Unable to create output file: %s\n", dev->name, strerror(errno));
+				continue;
+			}
+		}
+
+		dev->pid = fork();
+		if(dev->pid == 0) {
+			if(dev->output) {
+				dup2(fileno(dev->output), STDOUT_FILENO);
+				dup2(fileno(dev->output), STDERR_FILENO);
+			}
+			CResult child_res = action(dev->name);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(child_res);
+		}
+		if(dev->pid < 0) {
+			dev->res = C_SYNC_ERROR;
+			printf("ERROR: %s: Unable to start process: %s\n", dev->name, strerror(errno));
+		}
+	}
+
+	// Wait for all devices and print their output in order
+	for(i = 0; i < fleet_count; i++) {
+		FleetDevice *dev = &fleet[i];
+		int status;
+		if(dev->pid > 0) {
+			while(waitpid(dev->pid, &status, 0) < 0 && errno == EINTR)
+				;
+			dev->res = WIFEXITED(status) ? WEXITSTATUS(status) : C_SYNC_ERROR;
+		}
+	}
+	for(i = 0; i < fleet_count; i++) {
+		FleetDevice *dev = &fleet[i];
+		if(dev->output) {
+			print_device_output(dev);
+			fclose(dev->output);
+		}
+		if(dev->res && !res)
+			res = dev->res;
+	}
+
+done:
+	free(fleet);
+	free(devices);
+	return res;
+}
@@ -0,0 +1,37 @@
+/*
+ * uvcdynctrl - Manage dynamic controls in uvcvideo
+ *
+ *
+ * Copyright (c) 2006-2008 Logitech.
+ *
+ * This file is part of uvcdynctrl.
+ *
+ * uvcdynctrl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * uvcdynctrl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with uvcdynctrl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LV_FLEET_H
+#define LV_FLEET_H
+
+#include <webcam.h>
+
+
+/// Function that runs an action on a single device
+typedef CResult (*DeviceAction) (const char *device_name);
+
+extern int is_device_selector (const char *name);
+
+extern CResult run_on_devices (const char *selector, DeviceAction action, int capture);
+
+
+#endif /* LV_FLEET_H */
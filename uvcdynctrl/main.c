@@ -23,9 +23,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "cmdline.h"
 #include "controls.h"
+#include "daemon.h"
+#include "batch.h"
+#include "fleet.h"
+#include "bench.h"
 
 
 static struct gengetopt_args_info args_info;
@@ -217,6 +223,93 @@ done:
 }
 
 
+/**
+ * Controls of the device that is watched, used to print the control names.
+ */
+typedef struct _WatchContext {
+	/// Name of the watched device
+	const char		* device_name;
+	/// Controls of the device
+	CControl		* controls;
+	/// Number of elements in @a controls
+	unsigned int	count;
+
+} WatchContext;
+
+
+static int
+print_control_change (CHandle hDevice, CControlId control_id, const CControlValue *value, void *context)
+{
+	WatchContext *watch = (WatchContext *)context;
+	const char *name = "(unknown)";
+	for(unsigned int i = 0; i < watch->count; i++) {
+		if(watch->controls[i].id == control_id) {
+			name = watch->controls[i].name;
+			break;
+		}
+	}
+
+	// One line per change: <time> <device> <control>: <value>
+	struct timeval now;
+	struct tm local;
+	char time_string[16];
+	gettimeofday(&now, NULL);
+	localtime_r(&now.tv_sec, &local);
+	strftime(time_string, sizeof(time_string), "%H:%M:%S", &local);
+	printf("%s.%03ld %s %s: %d\n", time_string, (long)now.tv_usec / 1000,
+			watch->device_name, name, value->value);
+	fflush(stdout);
+
+	return 0;
+}
+
+
+/**
+ * Prints the value changes of the controls given as arguments, or of all controls, until
+ * the program is interrupted.
+ */
+static CResult
+watch_controls (CHandle hDevice, const char *device_name)
+{
+	CResult ret;
+	WatchContext watch = { device_name, NULL, 0 };
+	CControlId *ids = NULL;
+
+	ret = get_control_list(hDevice, &watch.controls, &watch.count);
+	if(ret) {
+		print_handle_error(hDevice, "Unable to retrieve control list", ret);
+		goto done;
+	}
+
+	// Resolve the control names given as arguments
+	if(args_info.inputs_num) {
+		ids = (CControlId *)malloc(args_info.inputs_num * sizeof(CControlId));
+		if(!ids) {
+			ret = C_NO_MEMORY;
+			print_error("Out of memory", -1);
+			goto done;
+		}
+	}
+	for(unsigned int i = 0; i < args_info.inputs_num; i++) {
+		ids[i] = get_control_id(hDevice, args_info.inputs[i]);
+		if(!ids[i]) {
+			ret = C_NOT_FOUND;
+			print_handle_error(hDevice, "Unknown control specified", -1);
+			goto done;
+		}
+	}
+
+	ret = c_watch_controls(hDevice, ids, args_info.inputs_num, print_control_change, &watch);
+	if(ret)
+		print_handle_error(hDevice, "Unable to watch controls", ret);
+
+done:
+	free(ids);
+	free(watch.controls);
+	return ret;
+}
+
+
 static CResult
 list_frame_intervals (CHandle hDevice, CPixelFormat *pixelformat, CFrameSize *framesize)
 {
@@ -463,16 +556,9 @@ done:
 }
 
 
-static CResult
-add_control_mappings(const char *filename)
+static void
+print_dynctrl_info(CDynctrlInfo *info, CResult res, const char *source_name)
 {
-	CDynctrlInfo info = { 0 };
-	info.flags = CD_REPORT_ERRORS;
-	if(HAS_VERBOSE())
-		info.flags |= CD_RETRIEVE_META_INFO;
-
-	printf("Importing dynamic controls from file %s.\n", filename);
-	CResult res = c_add_control_mappings_from_file(filename, &info);
 	if(res)
 		print_error("Unable to import dynamic controls", res);
 
@@ -485,32 +571,34 @@ add_control_mappings(const char *filename)
 			"  Contact:     %s\n"
 			"  Copyright:   %s\n"
 			"  Revision:    %d.%d\n",
-			info.meta.version.major, info.meta.version.minor,
-			info.meta.author    ? info.meta.author    : "(unknown)",
-			info.meta.contact   ? info.meta.contact   : "(unknown)",
-			info.meta.copyright ? info.meta.copyright : "(unknown)",
-			info.meta.revision.major, info.meta.revision.minor
+			info->meta.version.major, info->meta.version.minor,
+			info->meta.author    ? info->meta.author    : "(unknown)",
+			info->meta.contact   ? info->meta.contact   : "(unknown)",
+			info->meta.copyright ? info->meta.copyright : "(unknown)",
+			info->meta.revision.major, info->meta.revision.minor
 		);
 	}
 
 	// Print errors
-	if(info.message_count) {
-		for(int i = 0; i < info.message_count; i++) {
-			CDynctrlMessage *msg = &info.messages[i];
+	if(info->message_count) {
+		for(int i = 0; i < info->message_count; i++) {
+			CDynctrlMessage *msg = &info->messages[i];
 			const char *severity = "message";
 			switch(msg->severity) {
 				case CD_SEVERITY_ERROR:		severity = "error";		break;
 				case CD_SEVERITY_WARNING:	severity = "warning";	break;
 				case CD_SEVERITY_INFO:		severity = "info";		break;
 			}
+			const char *source = info->message_files && info->message_files[i] ?
+					info->message_files[i] : source_name;
 			if(msg->line && msg->col) {
-				printf("%s:%d:%d: %s: %s\n", filename, msg->line, msg->col, severity, msg->text);
+				printf("%s:%d:%d: %s: %s\n", source, msg->line, msg->col, severity, msg->text);
 			}
 			else if(msg->line) {
-				printf("%s:%d: %s: %s\n", filename, msg->line, severity, msg->text);
+				printf("%s:%d: %s: %s\n", source, msg->line, severity, msg->text);
 			}
 			else {
-				printf("%s: %s: %s\n", filename, severity, msg->text);
+				printf("%s: %s: %s\n", source, severity, msg->text);
 			}
 		}
 	}
@@ -522,59 +610,235 @@ add_control_mappings(const char *filename)
 			"  %u constants processed (%u failed, %u successful)\n"
 			"  %u controls processed (%u failed, %u successful)\n"
 			"  %u mappings processed (%u failed, %u successful)\n",
-			info.stats.constants.successful + info.stats.constants.failed,
-			info.stats.constants.successful, info.stats.constants.failed,
-			info.stats.controls.successful + info.stats.controls.failed,
-			info.stats.controls.successful, info.stats.controls.failed,
-			info.stats.mappings.successful + info.stats.mappings.failed,
-			info.stats.mappings.successful, info.stats.mappings.failed
+			info->stats.constants.successful + info->stats.constants.failed,
+			info->stats.constants.successful, info->stats.constants.failed,
+			info->stats.controls.successful + info->stats.controls.failed,
+			info->stats.controls.successful, info->stats.controls.failed,
+			info->stats.mappings.successful + info->stats.mappings.failed,
+			info->stats.mappings.successful, info->stats.mappings.failed
 		);
 	}
 
-	if(info.messages)
-		free(info.messages);
-	if(info.meta.author)
-		free(info.meta.author);
-	if(info.meta.contact)
-		free(info.meta.contact);
-	if(info.meta.author)
-		free(info.meta.copyright);
+	if(info->messages)
+		free(info->messages);
+	if(info->meta.author)
+		free(info->meta.author);
+	if(info->meta.contact)
+		free(info->meta.contact);
+	if(info->meta.author)
+		free(info->meta.copyright);
+}
+
+
+static CResult
+add_control_mappings(const char *device_name, const char *filename, const char *dirname)
+{
+	CDynctrlInfo info = { 0 };
+	info.flags = CD_REPORT_ERRORS | CD_REPORT_FILE_NAMES;
+	if(HAS_VERBOSE())
+		info.flags |= CD_RETRIEVE_META_INFO;
+
+	CResult res;
+	if(dirname) {
+		printf("Importing dynamic controls for device %s from directory %s.\n", device_name, dirname);
+		res = c_add_control_mappings_from_dir(device_name, dirname, &info);
+	}
+	else if(device_name) {
+		printf("Importing dynamic controls from file %s to device %s.\n", filename, device_name);
+		res = c_add_control_mappings_to_device(device_name, filename, &info);
+	}
+	else {
+		printf("Importing dynamic controls from file %s.\n", filename);
+		res = c_add_control_mappings_from_file(filename, &info);
+	}
+	print_dynctrl_info(&info, res, filename ? filename : dirname);
+
 	return res;
 }
 
 
-int
-main (int argc, char **argv)
+static CResult
+add_control_mappings_from_cache(CDynctrlCache *cache, const char *device_name)
 {
-	CHandle handle = 0;
-	CResult res = C_SUCCESS;
+	CDynctrlInfo info = { 0 };
+	info.flags = CD_REPORT_ERRORS | CD_REPORT_FILE_NAMES;
+	if(HAS_VERBOSE())
+		info.flags |= CD_RETRIEVE_META_INFO;
 
-	// Parse the command line
-	if(cmdline_parser(argc, argv, &args_info) != 0)
-		exit(1);
-	
-	// Display help if no arguments were specified
-	if(argc == 1) {
-		cmdline_parser_print_help();
-		exit(0);
+	printf("Importing dynamic controls for device %s.\n", device_name);
+	CResult res = c_add_control_mappings_from_cache(cache, device_name, &info);
+	print_dynctrl_info(&info, res, args_info.import_dir_arg);
+
+	return res;
+}
+
+
+static const char *
+get_request_name (CRequestType type)
+{
+	static const char *names[CR_COUNT] = {
+		[CR_QUERYCAP]				= "VIDIOC_QUERYCAP",
+		[CR_QUERYCTRL]				= "VIDIOC_QUERYCTRL",
+		[CR_QUERYMENU]				= "VIDIOC_QUERYMENU",
+		[CR_G_CTRL]					= "VIDIOC_G_CTRL",
+		[CR_S_CTRL]					= "VIDIOC_S_CTRL",
+		[CR_G_EXT_CTRLS]			= "VIDIOC_G_EXT_CTRLS",
+		[CR_S_EXT_CTRLS]			= "VIDIOC_S_EXT_CTRLS",
+		[CR_ENUM_FMT]				= "VIDIOC_ENUM_FMT",
+		[CR_ENUM_FRAMESIZES]		= "VIDIOC_ENUM_FRAMESIZES",
+		[CR_ENUM_FRAMEINTERVALS]	= "VIDIOC_ENUM_FRAMEINTERVALS",
+		[CR_SUBSCRIBE_EVENT]		= "VIDIOC_SUBSCRIBE_EVENT",
+		[CR_UNSUBSCRIBE_EVENT]		= "VIDIOC_UNSUBSCRIBE_EVENT",
+		[CR_DQEVENT]				= "VIDIOC_DQEVENT",
+		[CR_CTRL_MAP]				= "UVCIOC_CTRL_MAP",
+		[CR_OTHER]					= "other",
+	};
+	return names[type];
+}
+
+
+/**
+ * Prints the number, latency, and errors of the requests sent to a device.
+ */
+static CResult
+print_device_stats (const char *device_name)
+{
+	CDeviceStats stats;
+	unsigned int type, i;
+
+	CResult res = c_get_device_stats(device_name, &stats);
+	if(res == C_NOT_FOUND) {
+		printf("No requests were sent to device %s.\n", device_name);
+		return C_SUCCESS;
+	}
+	if(res) {
+		print_error("Unable to retrieve request statistics", res);
+		return res;
 	}
 
-	res = c_init();
-	if(res) goto done;
+	printf("Request statistics for device %s (%u control queries retried):\n",
+			device_name, stats.retries);
+	printf("  %-28s %8s %8s %10s %10s\n", "request", "count", "errors", "mean_us", "max_us");
+	for(type = 0; type < CR_COUNT; type++) {
+		CRequestStats *rs = &stats.requests[type];
+		if(!rs->count)
+			continue;
+		printf("  %-28s %8u %8u %10.1f %10.1f\n", get_request_name(type), rs->count, rs->errors,
+				rs->total_time / 1000.0 / rs->count, rs->max_time / 1000.0);
+
+		// Latency histogram, labeled with the lower bound of each bucket in microseconds
+		printf("    latency:");
+		for(i = 0; i < C_STATS_LATENCY_BUCKETS; i++) {
+			if(!rs->latency[i])
+				continue;
+			if(i == 0)
+				printf(" <1:%u", rs->latency[i]);
+			else
+				printf(" %s%u:%u", i == C_STATS_LATENCY_BUCKETS - 1 ? ">=" : "",
+						1u << (i - 1), rs->latency[i]);
+		}
+		printf("\n");
 
-	// List devices
-	if(args_info.list_given) {
-		res = list_devices();
-		goto done;
+		if(rs->errors) {
+			printf("    errors:");
+			for(i = 0; i < C_STATS_ERROR_CODES; i++) {
+				if(rs->error_codes[i])
+					printf(" %s:%u", strerror(i), rs->error_codes[i]);
+			}
+			printf("\n");
+		}
 	}
-	// Import dynamic controls from XML file
-	else if(args_info.import_given) {
-		res = add_control_mappings(args_info.import_arg);
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Prints the most recent requests sent to a device.
+ *
+ * The timestamps are seconds of the monotonic clock, like those of the kernel log,
+ * so that they can be matched with driver messages.
+ */
+static CResult
+print_device_trace (const char *device_name)
+{
+	CTraceEntry entries[C_TRACE_ENTRIES];
+	unsigned int size = sizeof(entries), count = 0, i;
+
+	CResult res = c_get_device_trace(device_name, entries, &size, &count);
+	if(res == C_NOT_FOUND || (!res && !count)) {
+		printf("No requests were sent to device %s.\n", device_name);
+		return C_SUCCESS;
+	}
+	if(res) {
+		print_error("Unable to retrieve request trace", res);
+		return res;
+	}
+
+	printf("Most recent requests sent to device %s:\n", device_name);
+	for(i = 0; i < count; i++) {
+		CTraceEntry *entry = &entries[i];
+		printf("  [%6llu.%06llu] #%-6u ", entry->timestamp / 1000000000ULL,
+				entry->timestamp % 1000000000ULL / 1000, entry->sequence);
+		int has_value = entry->type == CR_G_CTRL || entry->type == CR_S_CTRL ||
+				entry->type == CR_G_EXT_CTRLS || entry->type == CR_S_EXT_CTRLS ||
+				entry->type == CR_QUERYMENU || entry->type == CR_DQEVENT;
+		if(entry->type == CR_OTHER)
+			printf("%-26s 0x%08x %10s", "ioctl", entry->request, "");
+		else if(entry->control_id && has_value)
+			printf("%-26s 0x%08x = %-8d", get_request_name(entry->type), entry->control_id, entry->value);
+		else if(entry->control_id)
+			printf("%-26s 0x%08x %10s", get_request_name(entry->type), entry->control_id, "");
+		else
+			printf("%-26s %21s", get_request_name(entry->type), "");
+		printf(" %10.1f us", entry->duration / 1000.0);
+		if(entry->error)
+			printf("  error %d: %s", entry->error, strerror(entry->error));
+		printf("\n");
+	}
+
+	return C_SUCCESS;
+}
+
+
+/**
+ * Prints the request statistics and trace of a device if requested on the command line.
+ */
+static CResult
+print_device_reports (const char *device_name)
+{
+	CResult res = C_SUCCESS, ret;
+
+	if(args_info.stats_given) {
+		ret = print_device_stats(device_name);
+		if(!res) res = ret;
+	}
+	if(args_info.dump_trace_given) {
+		ret = print_device_trace(device_name);
+		if(!res) res = ret;
+	}
+	return res;
+}
+
+
+/**
+ * Runs the device dependent actions given on the command line on a single device.
+ */
+static CResult
+run_device_actions (const char *device_name)
+{
+	CHandle handle = 0;
+	CResult res = C_SUCCESS;
+
+	// Measure the latency of the library operations
+	if(args_info.bench_given) {
+		res = run_benchmark(device_name, args_info.bench_arg, args_info.import_arg,
+				args_info.import_dir_arg);
 		goto done;
 	}
 
 	// Open the device
-	handle = c_open_device(args_info.device_arg);
+	handle = c_open_device(device_name);
 	if(!handle) {
 		print_error("Unable to open device", -1);
 		res = C_INVALID_DEVICE;
@@ -583,12 +847,12 @@ main (int argc, char **argv)
 
 	// List frame formats
 	if(args_info.formats_given) {
-		printf("Listing available frame formats for device %s:\n", args_info.device_arg);
+		printf("Listing available frame formats for device %s:\n", device_name);
 		res = list_frame_formats(handle);
 	}
 	// List controls
 	else if(args_info.clist_given) {
-		printf("Listing available controls for device %s:\n", args_info.device_arg);
+		printf("Listing available controls for device %s:\n", device_name);
 		res = list_controls(handle);
 	}
 	// Retrieve control value
@@ -611,6 +875,23 @@ main (int argc, char **argv)
 		}
 		printf("%d\n", value.value);
 	}
+	// Save or restore the control values
+	else if(args_info.save_profile_given) {
+		res = c_save_profile(handle, args_info.save_profile_arg);
+		if(res)
+			print_handle_error(handle, "Unable to save control profile", res);
+	}
+	else if(args_info.load_profile_given) {
+		res = c_load_profile(handle, args_info.load_profile_arg);
+		if(res)
+			print_handle_error(handle, "Unable to restore control profile", res);
+	}
+	// Print control value changes until interrupted
+	else if(args_info.watch_given) {
+		printf("Watching controls of device %s (press Ctrl+C to stop):\n", device_name);
+		fflush(stdout);
+		res = watch_controls(handle, device_name);
+	}
 	else if(args_info.set_given) {
 		CControlValue value;
 
@@ -642,9 +923,109 @@ main (int argc, char **argv)
 		}
 	}
 
-	// Clean up
 done:
 	if(handle) c_close_device(handle);
+
+	// Print the request statistics and trace, which include the requests of the actions above
+	CResult report_res = print_device_reports(device_name);
+	if(!res)
+		res = report_res;
+	return res;
+}
+
+
+/**
+ * Imports the dynamic controls given on the command line into a single device.
+ */
+static CResult
+import_device_mappings (const char *device_name)
+{
+	CResult res = add_control_mappings(device_name, args_info.import_arg, args_info.import_dir_arg);
+	print_device_reports(device_name);
+	return res;
+}
+
+
+int
+main (int argc, char **argv)
+{
+	CResult res = C_SUCCESS;
+
+	// Parse the command line
+	if(cmdline_parser(argc, argv, &args_info) != 0)
+		exit(1);
+	
+	// Display help if no arguments were specified
+	if(argc == 1) {
+		cmdline_parser_print_help();
+		exit(0);
+	}
+
+	// Run as a daemon that imports dynamic controls whenever a device is added
+	if(args_info.daemon_given) {
+		if(!args_info.import_dir_given) {
+			res = C_INVALID_ARG;
+			print_error("The --daemon option requires --import-dir", -1);
+			goto done;
+		}
+		res = run_daemon(args_info.import_dir_arg, add_control_mappings_from_cache);
+		goto done;
+	}
+
+	// Import dynamic controls from an XML file or a directory into a single device. This
+	// only touches the given device, so there is no need to initialize the library and
+	// scan all devices. With --bench the import is measured instead.
+	int multiple_devices = is_device_selector(args_info.device_arg);
+	int import_only = !args_info.list_given && !args_info.bench_given;
+	if(args_info.import_dir_given && import_only && !multiple_devices) {
+		res = import_device_mappings(args_info.device_arg);
+		goto done;
+	}
+	if(args_info.import_given && args_info.device_given && import_only && !multiple_devices) {
+		res = import_device_mappings(args_info.device_arg);
+		goto done;
+	}
+
+	res = c_init();
+	if(res) goto done;
+
+	// List devices
+	if(args_info.list_given) {
+		res = list_devices();
+		goto done;
+	}
+	// Run the commands of a batch file in a single session
+	else if(args_info.batch_given) {
+		res = run_batch(args_info.batch_arg);
+		goto done;
+	}
+	// Import dynamic controls into the devices that match the selector
+	else if((args_info.import_given || args_info.import_dir_given) && import_only && multiple_devices) {
+		res = run_on_devices(args_info.device_arg, import_device_mappings, 1);
+		goto done;
+	}
+	// Import dynamic controls from XML file
+	else if(args_info.import_given && import_only) {
+		res = add_control_mappings(NULL, args_info.import_arg, NULL);
+		goto done;
+	}
+
+	// Run the device dependent actions. Selectors that match several devices run them
+	// on all matching devices at the same time.
+	if(multiple_devices) {
+		if(args_info.save_profile_given) {
+			res = C_INVALID_ARG;
+			print_error("The --save-profile option requires a single device", -1);
+			goto done;
+		}
+		res = run_on_devices(args_info.device_arg, run_device_actions, !args_info.watch_given);
+	}
+	else {
+		res = run_device_actions(args_info.device_arg);
+	}
+
+	// Clean up
+done:
 	c_cleanup();
 	cmdline_parser_free(&args_info);
 